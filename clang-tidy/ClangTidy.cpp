@@ -18,10 +18,13 @@
 #include "ClangTidy.h"
 #include "ClangTidyDiagnosticConsumer.h"
 #include "ClangTidyModuleRegistry.h"
+#include "ClangTidyResultCache.h"
+#include "NamedCallMatcher.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Decl.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "clang/Basic/FileSystemStatCache.h"
 #include "clang/Format/Format.h"
 #include "clang/Frontend/ASTConsumers.h"
 #include "clang/Frontend/CompilerInstance.h"
@@ -39,9 +42,17 @@
 #include "clang/Tooling/Refactoring.h"
 #include "clang/Tooling/ReplacementsYaml.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/Process.h"
 #include "llvm/Support/Signals.h"
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <utility>
 
 using namespace clang::ast_matchers;
@@ -263,17 +274,88 @@ private:
   unsigned WarningsAsErrors;
 };
 
+/// \brief Measures consecutive phases and adds the time spent in each of them
+/// to \c Phases, keyed by the name of the phase.
+class PhaseTimer {
+public:
+  PhaseTimer(llvm::StringMap<TimeRecord> &Phases) : Phases(Phases) {}
+  ~PhaseTimer() { startPhase(""); }
+
+  /// \brief Ends the current phase and starts the phase \p Name, if it's not
+  /// empty.
+  void startPhase(StringRef Name) {
+    if (!CurrentPhase.empty()) {
+      TimeRecord Time = TimeRecord::getCurrentTime(/*Start=*/false);
+      Time -= Start;
+      Phases[CurrentPhase] += Time;
+    }
+    CurrentPhase = Name;
+    if (!CurrentPhase.empty())
+      Start = TimeRecord::getCurrentTime(/*Start=*/true);
+  }
+
+private:
+  llvm::StringMap<TimeRecord> &Phases;
+  std::string CurrentPhase;
+  TimeRecord Start;
+};
+
+/// \brief Measures the phases of a translation unit and adds them to a
+/// \c ProfileData, when it's destroyed.
+class TranslationUnitProfiler {
+public:
+  TranslationUnitProfiler(ProfileData &Profile, StringRef File)
+      : Profile(Profile), Timer(Unit.Phases) {
+    Unit.File = File;
+  }
+
+  ~TranslationUnitProfiler() {
+    Timer.startPhase("");
+    for (const auto &Phase : Unit.Phases)
+      Profile.Phases[Phase.getKey()] += Phase.getValue();
+    Profile.TranslationUnits.push_back(std::move(Unit));
+  }
+
+  PhaseTimer &getTimer() { return Timer; }
+
+private:
+  ProfileData &Profile;
+  TranslationUnitProfile Unit;
+  PhaseTimer Timer;
+};
+
+/// \brief Starts a phase, when the consumers before it in a
+/// \c MultiplexConsumer have handled the translation unit.
+class PhaseStartingConsumer : public ASTConsumer {
+public:
+  PhaseStartingConsumer(PhaseTimer &Timer, StringRef Phase)
+      : Timer(Timer), Phase(Phase) {}
+
+  void HandleTranslationUnit(ASTContext &Context) override {
+    Timer.startPhase(Phase);
+  }
+
+private:
+  PhaseTimer &Timer;
+  StringRef Phase;
+};
+
 class ClangTidyASTConsumer : public MultiplexConsumer {
 public:
   ClangTidyASTConsumer(std::vector<std::unique_ptr<ASTConsumer>> Consumers,
                        std::unique_ptr<ast_matchers::MatchFinder> Finder,
-                       std::vector<std::unique_ptr<ClangTidyCheck>> Checks)
+                       std::unique_ptr<NamedCallMatcher> Calls,
+                       std::vector<std::unique_ptr<ClangTidyCheck>> Checks,
+                       std::unique_ptr<TranslationUnitProfiler> Profiler)
       : MultiplexConsumer(std::move(Consumers)), Finder(std::move(Finder)),
-        Checks(std::move(Checks)) {}
+        Calls(std::move(Calls)), Checks(std::move(Checks)),
+        Profiler(std::move(Profiler)) {}
 
 private:
   std::unique_ptr<ast_matchers::MatchFinder> Finder;
+  std::unique_ptr<NamedCallMatcher> Calls;
   std::vector<std::unique_ptr<ClangTidyCheck>> Checks;
+  std::unique_ptr<TranslationUnitProfiler> Profiler;
 };
 
 } // namespace
@@ -348,6 +430,12 @@ ClangTidyASTConsumerFactory::CreateASTConsumer(
   if (WorkingDir)
     Context.setCurrentBuildDirectory(WorkingDir.get());
 
+  std::unique_ptr<TranslationUnitProfiler> Profiler;
+  if (auto *P = Context.getCheckProfileData()) {
+    Profiler = llvm::make_unique<TranslationUnitProfiler>(*P, File);
+    Profiler->getTimer().startPhase("setup");
+  }
+
   std::vector<std::unique_ptr<ClangTidyCheck>> Checks;
   CheckFactories->createChecks(&Context, Checks);
 
@@ -358,12 +446,23 @@ ClangTidyASTConsumerFactory::CreateASTConsumer(
   std::unique_ptr<ast_matchers::MatchFinder> Finder(
       new ast_matchers::MatchFinder(std::move(FinderOptions)));
 
+  auto Calls = llvm::make_unique<NamedCallMatcher>();
   for (auto &Check : Checks) {
     Check->registerMatchers(&*Finder);
+    Check->registerNamedCallMatchers(*Calls);
     Check->registerPPCallbacks(Compiler);
   }
+  Calls->registerMatchers(*Finder);
 
+  // When profiling, the consumers are interleaved with consumers, that start
+  // the next phase after the previous consumers handled the translation unit.
   std::vector<std::unique_ptr<ASTConsumer>> Consumers;
+  auto StartPhase = [&](StringRef Phase) {
+    if (Profiler)
+      Consumers.push_back(llvm::make_unique<PhaseStartingConsumer>(
+          Profiler->getTimer(), Phase));
+  };
+  StartPhase("matching");
   if (!Checks.empty())
     Consumers.push_back(Finder->newASTConsumer());
 
@@ -384,10 +483,18 @@ ClangTidyASTConsumerFactory::CreateASTConsumer(
         ento::CreateAnalysisConsumer(Compiler);
     AnalysisConsumer->AddDiagnosticConsumer(
         new AnalyzerDiagnosticConsumer(Context));
+    StartPhase("analyzer");
     Consumers.push_back(std::move(AnalysisConsumer));
   }
+  StartPhase("");
+
+  // Preprocessing, parsing and semantic analysis are interleaved, they are
+  // measured as a single phase.
+  if (Profiler)
+    Profiler->getTimer().startPhase("parse");
   return llvm::make_unique<ClangTidyASTConsumer>(
-      std::move(Consumers), std::move(Finder), std::move(Checks));
+      std::move(Consumers), std::move(Finder), std::move(Calls),
+      std::move(Checks), std::move(Profiler));
 }
 
 std::vector<std::string> ClangTidyASTConsumerFactory::getCheckNames() {
@@ -419,6 +526,8 @@ DiagnosticBuilder ClangTidyCheck::diag(SourceLocation Loc, StringRef Message,
 }
 
 void ClangTidyCheck::run(const ast_matchers::MatchFinder::MatchResult &Result) {
+  if (ProfileData *Profile = Context->getCheckProfileData())
+    ++Profile->MatchCounts[CheckName];
   Context->setSourceManager(Result.SourceManager);
   check(Result);
 }
@@ -472,9 +581,118 @@ ClangTidyOptions::OptionMap getCheckOptions(const ClangTidyOptions &Options) {
   return Factory.getCheckOptions();
 }
 
-void runClangTidy(clang::tidy::ClangTidyContext &Context,
-                  const CompilationDatabase &Compilations,
-                  ArrayRef<std::string> InputFiles, ProfileData *Profile) {
+namespace {
+
+/// \brief Records the paths, that were looked up but don't exist, e.g. the
+/// directories of the include search path that don't contain a header.
+class MissingFilesRecorder : public FileSystemStatCache {
+public:
+  LookupResult getStat(const char *Path, FileData &Data, bool isFile,
+                       std::unique_ptr<vfs::File> *F,
+                       vfs::FileSystem &FS) override {
+    LookupResult Result = statChained(Path, Data, isFile, F, FS);
+    if (Result == CacheMissing)
+      MissingFiles.push_back(Path);
+    return Result;
+  }
+
+  /// \brief The paths, as they were looked up.
+  std::vector<std::string> MissingFiles;
+};
+
+class ClangTidyActionFactory : public FrontendActionFactory {
+public:
+  /// \brief If \p RecordDependencies is true, the files, that the actions
+  /// read or looked up, are recorded.
+  ClangTidyActionFactory(ClangTidyContext &Context,
+                         bool RecordDependencies = false)
+      : ConsumerFactory(Context), RecordDependencies(RecordDependencies) {}
+  FrontendAction *create() override {
+    if (!RecordDependencies)
+      return new Action(&ConsumerFactory, nullptr, nullptr);
+    return new Action(&ConsumerFactory, &Dependencies, &MissingFiles);
+  }
+
+  /// \brief Returns the absolute paths of the files, that were read by the
+  /// actions since the last call.
+  std::vector<std::string> takeDependencies() {
+    std::vector<std::string> Result;
+    Result.swap(Dependencies);
+    return Result;
+  }
+
+  /// \brief Returns the absolute paths of the files, that were looked up by
+  /// the actions since the last call, but didn't exist.
+  std::vector<std::string> takeMissingFiles() {
+    std::vector<std::string> Result;
+    Result.swap(MissingFiles);
+    return Result;
+  }
+
+private:
+  class Action : public ASTFrontendAction {
+  public:
+    Action(ClangTidyASTConsumerFactory *Factory,
+           std::vector<std::string> *Dependencies,
+           std::vector<std::string> *MissingFiles)
+        : Factory(Factory), Dependencies(Dependencies),
+          MissingFiles(MissingFiles) {}
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &Compiler,
+                                                   StringRef File) override {
+      return Factory->CreateASTConsumer(Compiler, File);
+    }
+
+    bool BeginSourceFileAction(CompilerInstance &Compiler) override {
+      if (MissingFiles) {
+        auto Recorder = llvm::make_unique<MissingFilesRecorder>();
+        this->Recorder = Recorder.get();
+        Compiler.getFileManager().addStatCache(std::move(Recorder));
+      }
+      return ASTFrontendAction::BeginSourceFileAction(Compiler);
+    }
+
+    void EndSourceFileAction() override {
+      CompilerInstance &Compiler = getCompilerInstance();
+      if (Recorder) {
+        for (const std::string &File : Recorder->MissingFiles) {
+          SmallString<256> Path(File);
+          Compiler.getFileManager().makeAbsolutePath(Path);
+          MissingFiles->push_back(Path.str().str());
+        }
+        Compiler.getFileManager().removeStatCache(Recorder);
+        Recorder = nullptr;
+      }
+      if (!Dependencies || !Compiler.hasSourceManager())
+        return;
+      const SourceManager &SM = Compiler.getSourceManager();
+      for (auto I = SM.fileinfo_begin(), E = SM.fileinfo_end(); I != E; ++I) {
+        SmallString<256> Path(I->first->getName());
+        Compiler.getFileManager().makeAbsolutePath(Path);
+        Dependencies->push_back(Path.str().str());
+      }
+    }
+
+  private:
+    ClangTidyASTConsumerFactory *Factory;
+    std::vector<std::string> *Dependencies;
+    std::vector<std::string> *MissingFiles;
+    /// \brief Owned by the \c FileManager while the file is processed.
+    MissingFilesRecorder *Recorder = nullptr;
+  };
+
+  ClangTidyASTConsumerFactory ConsumerFactory;
+  bool RecordDependencies;
+  std::vector<std::string> Dependencies;
+  std::vector<std::string> MissingFiles;
+};
+
+/// \brief Runs the checks of \p Factory on \p InputFiles on the current
+/// thread. Returns the result of \c ClangTool::run().
+int runClangTidyOnFiles(ClangTidyContext &Context,
+                         const CompilationDatabase &Compilations,
+                         ArrayRef<std::string> InputFiles,
+                         ClangTidyDiagnosticConsumer &DiagConsumer,
+                         ClangTidyActionFactory &Factory) {
   ClangTool Tool(Compilations, InputFiles);
 
   // Add extra arguments passed by the clang-tidy command-line.
@@ -513,40 +731,193 @@ void runClangTidy(clang::tidy::ClangTidyContext &Context,
 
   Tool.appendArgumentsAdjuster(PerFileExtraArgumentsInserter);
   Tool.appendArgumentsAdjuster(PluginArgumentsRemover);
-  if (Profile)
-    Context.setCheckProfileData(Profile);
+  Tool.setDiagnosticConsumer(&DiagConsumer);
+  return Tool.run(&Factory);
+}
 
-  ClangTidyDiagnosticConsumer DiagConsumer(Context);
+/// \brief Returns the options of a \c ClangTidyContext, that is shared between
+/// threads.
+class SharedOptionsProvider : public ClangTidyOptionsProvider {
+public:
+  SharedOptionsProvider(const ClangTidyContext &Context, std::mutex &Mutex)
+      : Context(Context), Mutex(Mutex) {}
 
-  Tool.setDiagnosticConsumer(&DiagConsumer);
+  const ClangTidyGlobalOptions &getGlobalOptions() override {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Context.getGlobalOptions();
+  }
 
-  class ActionFactory : public FrontendActionFactory {
-  public:
-    ActionFactory(ClangTidyContext &Context) : ConsumerFactory(Context) {}
-    FrontendAction *create() override { return new Action(&ConsumerFactory); }
+  std::vector<OptionsSource> getRawOptions(StringRef FileName) override {
+    // The shared provider caches the options of directories, it's not
+    // thread-safe.
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::vector<OptionsSource> Result;
+    Result.emplace_back(Context.getOptionsForFile(FileName),
+                        OptionsSourceTypeDefaultBinary);
+    return Result;
+  }
 
-  private:
-    class Action : public ASTFrontendAction {
-    public:
-      Action(ClangTidyASTConsumerFactory *Factory) : Factory(Factory) {}
-      std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &Compiler,
-                                                     StringRef File) override {
-        return Factory->CreateASTConsumer(Compiler, File);
+private:
+  const ClangTidyContext &Context;
+  std::mutex &Mutex;
+};
+
+void addProfileData(ProfileData &Profile, ProfileData &&Other) {
+  for (const auto &Record : Other.Records)
+    Profile.Records[Record.getKey()] += Record.getValue();
+  for (const auto &Count : Other.MatchCounts)
+    Profile.MatchCounts[Count.getKey()] += Count.getValue();
+  for (const auto &Phase : Other.Phases)
+    Profile.Phases[Phase.getKey()] += Phase.getValue();
+  std::move(Other.TranslationUnits.begin(), Other.TranslationUnits.end(),
+            std::back_inserter(Profile.TranslationUnits));
+}
+
+/// \brief Runs the checks on each of \p InputFiles separately, on
+/// \p JobsCount threads. Each thread has its own \c ClangTidyContext, the
+/// results are added to \p Context in the order of \p InputFiles. The results
+/// of files, that are up-to-date in \p Cache, are taken from it.
+void runClangTidyOnEachFile(ClangTidyContext &Context,
+                            const CompilationDatabase &Compilations,
+                            ArrayRef<std::string> InputFiles,
+                            ProfileData *Profile, unsigned JobsCount,
+                            const ClangTidyResultCache *Cache) {
+  SmallString<128> InitialDirectory;
+  if (std::error_code EC = llvm::sys::fs::current_path(InitialDirectory))
+    llvm::report_fatal_error("Cannot get current working path: " +
+                             EC.message());
+  // The working directory is changed below, so relative input files have to
+  // be resolved against the initial one first.
+  std::vector<std::string> AbsoluteInputFiles;
+  AbsoluteInputFiles.reserve(InputFiles.size());
+  for (const std::string &File : InputFiles)
+    AbsoluteInputFiles.push_back(tooling::getAbsolutePath(File));
+
+  // ClangTool changes the working directory of the process to the directory of
+  // each compile command and back. This is only safe on multiple threads if
+  // all of them use the same directory, so the files are processed in groups
+  // of files with the same directory, after changing to it. Files with
+  // commands in different directories are processed on a single thread.
+  std::map<std::string, std::vector<size_t>> FilesByDirectory;
+  std::vector<size_t> FilesInMultipleDirectories;
+  for (size_t I = 0; I < AbsoluteInputFiles.size(); ++I) {
+    std::vector<CompileCommand> Commands =
+        Compilations.getCompileCommands(AbsoluteInputFiles[I]);
+    std::string Directory = Commands.empty() ? "" : Commands[0].Directory;
+    if (std::all_of(Commands.begin(), Commands.end(),
+                    [&](const CompileCommand &Command) {
+                      return Command.Directory == Directory;
+                    }))
+      FilesByDirectory[Directory].push_back(I);
+    else
+      FilesInMultipleDirectories.push_back(I);
+  }
+
+  // Protects Context and Profile.
+  std::mutex ContextMutex;
+  std::vector<std::vector<ClangTidyError>> Errors(AbsoluteInputFiles.size());
+  std::vector<ClangTidyStats> Stats(AbsoluteInputFiles.size());
+  auto RunFiles = [&](ArrayRef<size_t> Files, unsigned ThreadsCount) {
+    if (Files.empty())
+      return;
+    std::atomic<size_t> NextFile(0);
+    auto RunThread = [&]() {
+      ClangTidyContext ThreadContext(
+          llvm::make_unique<SharedOptionsProvider>(Context, ContextMutex));
+      ProfileData ThreadProfile;
+      if (Profile)
+        ThreadContext.setCheckProfileData(&ThreadProfile);
+      ClangTidyDiagnosticConsumer DiagConsumer(ThreadContext);
+      ClangTidyActionFactory Factory(ThreadContext,
+                                     /*RecordDependencies=*/Cache != nullptr);
+
+      for (size_t I = NextFile++; I < Files.size(); I = NextFile++) {
+        size_t Index = Files[I];
+        const std::string &File = AbsoluteInputFiles[Index];
+        std::string Key;
+        if (Cache) {
+          Key = Cache->getKey(File, Compilations.getCompileCommands(File),
+                              ThreadContext.getOptionsForFile(File),
+                              ThreadContext.getGlobalOptions());
+          if (Cache->lookup(Key, Errors[Index], Stats[Index]))
+            continue;
+        }
+
+        bool Succeeded = runClangTidyOnFiles(ThreadContext, Compilations, File,
+                                             DiagConsumer, Factory) == 0;
+        Errors[Index] = ThreadContext.getErrors();
+        Stats[Index] = ThreadContext.getStats();
+        ThreadContext.clearErrors();
+        ThreadContext.clearStats();
+        // Files, that failed to compile, are analyzed again in the next run.
+        std::vector<std::string> Dependencies = Factory.takeDependencies();
+        std::vector<std::string> MissingFiles = Factory.takeMissingFiles();
+        if (Cache && Succeeded)
+          Cache->store(Key, Dependencies, MissingFiles, Errors[Index],
+                       Stats[Index]);
       }
 
-    private:
-      ClangTidyASTConsumerFactory *Factory;
+      std::lock_guard<std::mutex> Lock(ContextMutex);
+      if (Profile)
+        addProfileData(*Profile, std::move(ThreadProfile));
     };
 
-    ClangTidyASTConsumerFactory ConsumerFactory;
+    std::vector<std::thread> Threads;
+    for (unsigned I = 1; I < std::min<size_t>(ThreadsCount, Files.size()); ++I)
+      Threads.emplace_back(RunThread);
+    RunThread();
+    for (std::thread &Thread : Threads)
+      Thread.join();
   };
 
-  ActionFactory Factory(Context);
-  Tool.run(&Factory);
+  for (const auto &Group : FilesByDirectory) {
+    if (!Group.first.empty()) {
+      if (std::error_code EC = llvm::sys::fs::set_current_path(Group.first))
+        llvm::report_fatal_error("Cannot chdir into \"" + Group.first +
+                                 "\": " + EC.message());
+    }
+    RunFiles(Group.second, JobsCount);
+  }
+  RunFiles(FilesInMultipleDirectories, 1);
+  if (std::error_code EC = llvm::sys::fs::set_current_path(InitialDirectory))
+    llvm::report_fatal_error("Cannot chdir into \"" + InitialDirectory.str() +
+                             "\": " + EC.message());
+
+  for (size_t I = 0; I < AbsoluteInputFiles.size(); ++I) {
+    Context.addErrors(Errors[I]);
+    Context.addStats(Stats[I]);
+  }
+}
+
+} // namespace
+
+void runClangTidy(clang::tidy::ClangTidyContext &Context,
+                  const CompilationDatabase &Compilations,
+                  ArrayRef<std::string> InputFiles, ProfileData *Profile,
+                  unsigned JobsCount, const ClangTidyResultCache *Cache) {
+  // handleErrors() adds the phases of the whole run to the profile.
+  if (Profile)
+    Context.setCheckProfileData(Profile);
+
+  if (Cache || (JobsCount > 1 && InputFiles.size() > 1)) {
+    runClangTidyOnEachFile(Context, Compilations, InputFiles, Profile,
+                           std::max(JobsCount, 1u), Cache);
+    return;
+  }
+
+  ClangTidyDiagnosticConsumer DiagConsumer(Context);
+  ClangTidyActionFactory Factory(Context);
+  runClangTidyOnFiles(Context, Compilations, InputFiles, DiagConsumer, Factory);
 }
 
 void handleErrors(ClangTidyContext &Context, bool Fix,
                   unsigned &WarningsAsErrorsCount) {
+  llvm::Optional<PhaseTimer> Timer;
+  if (ProfileData *Profile = Context.getCheckProfileData()) {
+    Timer.emplace(Profile->Phases);
+    Timer->startPhase("report");
+  }
+
   ErrorReporter Reporter(Context, Fix);
   vfs::FileSystem &FileSystem =
       *Reporter.getSourceManager().getFileManager().getVirtualFileSystem();
@@ -566,6 +937,8 @@ void handleErrors(ClangTidyContext &Context, bool Fix,
     // Return to the initial directory to correctly resolve next Error.
     FileSystem.setCurrentWorkingDirectory(InitialWorkingDir.get());
   }
+  if (Timer)
+    Timer->startPhase("fixes");
   Reporter.Finish();
   WarningsAsErrorsCount += Reporter.getWarningsAsErrorsCount();
 }
@@ -584,5 +957,99 @@ void exportReplacements(const llvm::StringRef MainFilePath,
   YAML << TUD;
 }
 
+namespace {
+
+void writeJSONString(StringRef Str, raw_ostream &OS) {
+  OS << '"';
+  for (char C : Str) {
+    if (C == '"' || C == '\\')
+      OS << '\\' << C;
+    else if (static_cast<unsigned char>(C) < 0x20)
+      OS << format("\\u%04x", C);
+    else
+      OS << C;
+  }
+  OS << '"';
+}
+
+/// \brief Writes the members of a JSON object with the times of \p Time, in
+/// seconds.
+void writeTimeMembers(const TimeRecord &Time, raw_ostream &OS) {
+  OS << "\"wall\": " << format("%.6f", Time.getWallTime())
+     << ", \"user\": " << format("%.6f", Time.getUserTime())
+     << ", \"system\": " << format("%.6f", Time.getSystemTime());
+}
+
+/// \brief Writes a JSON object, that maps the names of \p Phases to their
+/// times.
+void writePhases(const llvm::StringMap<TimeRecord> &Phases, raw_ostream &OS,
+                 StringRef Indent) {
+  std::map<std::string, TimeRecord> SortedPhases;
+  for (const auto &Phase : Phases)
+    SortedPhases[Phase.getKey()] = Phase.getValue();
+  OS << "{";
+  StringRef Separator = "\n";
+  for (const auto &Phase : SortedPhases) {
+    OS << Separator << Indent << "  ";
+    writeJSONString(Phase.first, OS);
+    OS << ": {";
+    writeTimeMembers(Phase.second, OS);
+    OS << "}";
+    Separator = ",\n";
+  }
+  OS << "\n" << Indent << "}";
+}
+
+} // namespace
+
+void exportProfile(const ProfileData &Profile, raw_ostream &OS) {
+  OS << "{\n  \"phases\": ";
+  writePhases(Profile.Phases, OS, "  ");
+
+  std::map<std::string, std::pair<TimeRecord, unsigned>> Checks;
+  for (const auto &Record : Profile.Records)
+    Checks[Record.getKey()].first = Record.getValue();
+  for (const auto &Count : Profile.MatchCounts)
+    Checks[Count.getKey()].second = Count.getValue();
+  OS << ",\n  \"checks\": {";
+  StringRef Separator = "\n";
+  for (const auto &Check : Checks) {
+    OS << Separator << "    ";
+    writeJSONString(Check.first, OS);
+    OS << ": {";
+    writeTimeMembers(Check.second.first, OS);
+    OS << ", \"matches\": " << Check.second.second << "}";
+    Separator = ",\n";
+  }
+  OS << "\n  }";
+
+  // The most expensive translation units are listed first.
+  typedef std::pair<TimeRecord, const TranslationUnitProfile *> UnitWithTotal;
+  std::vector<UnitWithTotal> Units;
+  for (const TranslationUnitProfile &Unit : Profile.TranslationUnits) {
+    TimeRecord Total;
+    for (const auto &Phase : Unit.Phases)
+      Total += Phase.getValue();
+    Units.emplace_back(Total, &Unit);
+  }
+  std::stable_sort(Units.begin(), Units.end(),
+                   [](const UnitWithTotal &LHS, const UnitWithTotal &RHS) {
+                     return RHS.first < LHS.first;
+                   });
+  OS << ",\n  \"translation-units\": [";
+  Separator = "\n";
+  for (const auto &Unit : Units) {
+    OS << Separator << "    {\"file\": ";
+    writeJSONString(Unit.second->File, OS);
+    OS << ", \"total\": {";
+    writeTimeMembers(Unit.first, OS);
+    OS << "},\n     \"phases\": ";
+    writePhases(Unit.second->Phases, OS, "     ");
+    OS << "}";
+    Separator = ",\n";
+  }
+  OS << "\n  ]\n}\n";
+}
+
 } // namespace tidy
 } // namespace clang
@@ -31,6 +31,8 @@ class CompilationDatabase;
 
 namespace tidy {
 
+class NamedCallMatcher;
+
 /// \brief Provides access to the ``ClangTidyCheck`` options via check-local
 /// names.
 ///
@@ -158,6 +160,15 @@ public:
   /// matches occur in the order of the AST traversal.
   virtual void registerMatchers(ast_matchers::MatchFinder *Finder) {}
 
+  /// \brief Override this to register matchers for calls to functions with
+  /// known names with \p Calls.
+  ///
+  /// These matchers are only tried on calls to the named functions. The names
+  /// of the callees are looked up once per call for all checks, which is
+  /// cheaper than testing them with ``hasName()`` in each check's matcher.
+  /// The callbacks are not notified of the start and end of translation units.
+  virtual void registerNamedCallMatchers(NamedCallMatcher &Calls) {}
+
   /// \brief ``ClangTidyChecks`` that register ASTMatchers should do the actual
   /// work in here.
   virtual void check(const ast_matchers::MatchFinder::MatchResult &Result) {}
@@ -188,6 +199,7 @@ protected:
 };
 
 class ClangTidyCheckFactories;
+class ClangTidyResultCache;
 
 class ClangTidyASTConsumerFactory {
 public:
@@ -223,11 +235,19 @@ ClangTidyOptions::OptionMap getCheckOptions(const ClangTidyOptions &Options);
 /// \brief Run a set of clang-tidy checks on a set of files.
 ///
 /// \param Profile if provided, it enables check profile collection in
-/// MatchFinder, and will contain the result of the profile.
+/// MatchFinder and the timing of the phases of each translation unit, and will
+/// contain the result of the profile. It's also set as the profile of
+/// \p Context, so that \c handleErrors() adds its phases to it.
+/// \param JobsCount the number of translation units, that are processed in
+/// parallel. Each thread uses its own \c ClangTidyContext, the errors are
+/// added to \p Context in the order of \p InputFiles.
+/// \param Cache if provided, the results of translation units are taken from
+/// it if they are up-to-date, and stored in it otherwise.
 void runClangTidy(clang::tidy::ClangTidyContext &Context,
                   const tooling::CompilationDatabase &Compilations,
                   ArrayRef<std::string> InputFiles,
-                  ProfileData *Profile = nullptr);
+                  ProfileData *Profile = nullptr, unsigned JobsCount = 1,
+                  const ClangTidyResultCache *Cache = nullptr);
 
 // FIXME: This interface will need to be significantly extended to be useful.
 // FIXME: Implement confidence levels for displaying/fixing errors.
@@ -244,6 +264,14 @@ void exportReplacements(StringRef MainFilePath,
                         const std::vector<ClangTidyError> &Errors,
                         raw_ostream &OS);
 
+/// \brief Serializes \p Profile into JSON and writes it to \p OS.
+///
+/// The profile has the time spent in each phase and in the match callbacks of
+/// each check, the number of matches of each check and the phases of each
+/// translation unit. Profiles of separate runs can be merged by adding up the
+/// times and match counts and by joining the lists of translation units.
+void exportProfile(const ProfileData &Profile, raw_ostream &OS);
+
 } // end namespace tidy
 } // end namespace clang
 
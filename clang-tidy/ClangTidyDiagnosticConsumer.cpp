@@ -156,7 +156,10 @@ bool GlobList::contains(StringRef S, bool Contains) {
 
 class ClangTidyContext::CachedGlobList {
 public:
-  CachedGlobList(StringRef Globs) : Globs(Globs) {}
+  CachedGlobList(StringRef Globs) : Text(Globs), Globs(Globs) {}
+
+  /// \brief Returns the globs, this list was created from.
+  StringRef getText() const { return Text; }
 
   bool contains(StringRef S) {
     switch (auto &Result = Cache[S]) {
@@ -170,6 +173,7 @@ public:
   }
 
 private:
+  std::string Text;
   GlobList Globs;
   enum Tristate { None, Yes, No };
   llvm::StringMap<Tristate> Cache;
@@ -207,9 +211,14 @@ void ClangTidyContext::setSourceManager(SourceManager *SourceMgr) {
 void ClangTidyContext::setCurrentFile(StringRef File) {
   CurrentFile = File;
   CurrentOptions = getOptionsForFile(CurrentFile);
-  CheckFilter = llvm::make_unique<CachedGlobList>(*getOptions().Checks);
-  WarningAsErrorFilter =
-      llvm::make_unique<CachedGlobList>(*getOptions().WarningsAsErrors);
+  // Most files share their configuration. Keep the filters and the results
+  // they cached, unless the globs changed.
+  if (!CheckFilter || CheckFilter->getText() != *getOptions().Checks)
+    CheckFilter = llvm::make_unique<CachedGlobList>(*getOptions().Checks);
+  if (!WarningAsErrorFilter ||
+      WarningAsErrorFilter->getText() != *getOptions().WarningsAsErrors)
+    WarningAsErrorFilter =
+        llvm::make_unique<CachedGlobList>(*getOptions().WarningsAsErrors);
 }
 
 void ClangTidyContext::setASTContext(ASTContext *Context) {
@@ -249,6 +258,14 @@ void ClangTidyContext::storeError(const ClangTidyError &Error) {
   Errors.push_back(Error);
 }
 
+void ClangTidyContext::addStats(const ClangTidyStats &OtherStats) {
+  Stats.ErrorsDisplayed += OtherStats.ErrorsDisplayed;
+  Stats.ErrorsIgnoredCheckFilter += OtherStats.ErrorsIgnoredCheckFilter;
+  Stats.ErrorsIgnoredNOLINT += OtherStats.ErrorsIgnoredNOLINT;
+  Stats.ErrorsIgnoredNonUserCode += OtherStats.ErrorsIgnoredNonUserCode;
+  Stats.ErrorsIgnoredLineFilter += OtherStats.ErrorsIgnoredLineFilter;
+}
+
 StringRef ClangTidyContext::getCheckName(unsigned DiagnosticID) const {
   llvm::DenseMap<unsigned, std::string>::const_iterator I =
       CheckNamesByDiagnosticID.find(DiagnosticID);
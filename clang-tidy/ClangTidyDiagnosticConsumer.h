@@ -87,9 +87,24 @@ struct ClangTidyStats {
   }
 };
 
+/// \brief Time spent in the phases of analyzing a single translation unit.
+struct TranslationUnitProfile {
+  std::string File;
+  /// \brief Maps the names of the phases ("setup", "parse", "matching",
+  /// "analyzer") to the time spent in them.
+  llvm::StringMap<llvm::TimeRecord> Phases;
+};
+
 /// \brief Container for clang-tidy profiling data.
 struct ProfileData {
+  /// \brief Time spent in the match callbacks of each check.
   llvm::StringMap<llvm::TimeRecord> Records;
+  /// \brief Number of matches, that were passed to each check.
+  llvm::StringMap<unsigned> MatchCounts;
+  /// \brief Time spent in each phase, summed over all translation units, and
+  /// in the phases of the whole run ("report", "fixes").
+  llvm::StringMap<llvm::TimeRecord> Phases;
+  std::vector<TranslationUnitProfile> TranslationUnits;
 };
 
 /// \brief Every \c ClangTidyCheck reports errors through a \c DiagnosticsEngine
@@ -163,12 +178,25 @@ public:
   /// counters.
   const ClangTidyStats &getStats() const { return Stats; }
 
+  /// \brief Resets the issued and ignored diagnostic counters.
+  void clearStats() { Stats = ClangTidyStats(); }
+
   /// \brief Returns all collected errors.
   ArrayRef<ClangTidyError> getErrors() const { return Errors; }
 
   /// \brief Clears collected errors.
   void clearErrors() { Errors.clear(); }
 
+  /// \brief Appends \p NewErrors, that were collected by another context, e.g.
+  /// on another thread.
+  void addErrors(ArrayRef<ClangTidyError> NewErrors) {
+    Errors.insert(Errors.end(), NewErrors.begin(), NewErrors.end());
+  }
+
+  /// \brief Adds the counters of \p OtherStats, that were collected by another
+  /// context, to the counters of this context.
+  void addStats(const ClangTidyStats &OtherStats);
+
   /// \brief Set the output struct for profile data.
   ///
   /// Setting a non-null pointer here will enable profile collection in
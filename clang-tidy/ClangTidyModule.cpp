@@ -19,15 +19,25 @@ namespace tidy {
 void ClangTidyCheckFactories::registerCheckFactory(StringRef Name,
                                                    CheckFactory Factory) {
   Factories[Name] = std::move(Factory);
+  EnabledFactories.clear();
 }
 
 void ClangTidyCheckFactories::createChecks(
     ClangTidyContext *Context,
     std::vector<std::unique_ptr<ClangTidyCheck>> &Checks) {
-  for (const auto &Factory : Factories) {
-    if (Context->isCheckEnabled(Factory.first))
-      Checks.emplace_back(Factory.second(Factory.first, Context));
+  const std::string &CheckGlobs = *Context->getOptions().Checks;
+  auto Enabled = EnabledFactories.find(CheckGlobs);
+  if (Enabled == EnabledFactories.end()) {
+    std::vector<const FactoryMap::value_type *> EnabledForGlobs;
+    for (const auto &Factory : Factories) {
+      if (Context->isCheckEnabled(Factory.first))
+        EnabledForGlobs.push_back(&Factory);
+    }
+    Enabled =
+        EnabledFactories.emplace(CheckGlobs, std::move(EnabledForGlobs)).first;
   }
+  for (const FactoryMap::value_type *Factory : Enabled->second)
+    Checks.emplace_back(Factory->second(Factory->first, Context));
 }
 
 ClangTidyOptions ClangTidyModule::getModuleOptions() {
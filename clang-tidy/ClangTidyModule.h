@@ -16,6 +16,7 @@
 #include <map>
 #include <string>
 #include <utility>
+#include <vector>
 
 namespace clang {
 namespace tidy {
@@ -63,8 +64,12 @@ public:
                          });
   }
 
-  /// \brief Create instances of all checks matching \p CheckRegexString and
-  /// store them in \p Checks.
+  /// \brief Create instances of all checks, that are enabled in the current
+  /// options of \p Context, and store them in \p Checks.
+  ///
+  /// The factories of the enabled checks are remembered for each value of the
+  /// \c Checks option, so translation units with the same configuration don't
+  /// match all check names against it again.
   ///
   /// The caller takes ownership of the return \c ClangTidyChecks.
   void createChecks(ClangTidyContext *Context,
@@ -77,6 +82,9 @@ public:
 
 private:
   FactoryMap Factories;
+  /// \brief The enabled factories for each value of the \c Checks option.
+  std::map<std::string, std::vector<const FactoryMap::value_type *>>
+      EnabledFactories;
 };
 
 /// \brief A clang-tidy module groups a number of \c ClangTidyChecks and gives
@@ -0,0 +1,309 @@
+//===--- ClangTidyResultCache.cpp - clang-tidy ------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ClangTidyResultCache.h"
+#include "clang/Basic/Version.h"
+#include "clang/Tooling/ReplacementsYaml.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/YAMLTraits.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace clang;
+using namespace clang::tidy;
+
+namespace {
+
+/// \brief Changed when the meaning of the entries changes, so that old
+/// entries aren't used.
+const char CacheFormatVersion[] = "2";
+
+/// \brief A file, that was read by a cached translation unit, or that was
+/// looked up, but didn't exist.
+struct CachedDependency {
+  std::string Path;
+  /// \brief The result of hashFile().
+  std::string Hash;
+};
+
+/// \brief A \c tooling::DiagnosticMessage, as it's stored in the cache.
+struct CachedMessage {
+  std::string Message;
+  std::string FilePath;
+  unsigned FileOffset = 0;
+};
+
+/// \brief A \c ClangTidyError, as it's stored in the cache.
+struct CachedError {
+  std::string DiagnosticName;
+  int DiagLevel = 0;
+  std::string BuildDirectory;
+  bool IsWarningAsError = false;
+  CachedMessage Message;
+  std::vector<CachedMessage> Notes;
+  std::vector<tooling::Replacement> Replacements;
+};
+
+struct CacheEntry {
+  std::vector<CachedDependency> Dependencies;
+  ClangTidyStats Stats;
+  std::vector<CachedError> Errors;
+};
+
+} // namespace
+
+LLVM_YAML_IS_SEQUENCE_VECTOR(CachedDependency)
+LLVM_YAML_IS_SEQUENCE_VECTOR(CachedMessage)
+LLVM_YAML_IS_SEQUENCE_VECTOR(CachedError)
+
+namespace llvm {
+namespace yaml {
+
+template <> struct MappingTraits<CachedDependency> {
+  static void mapping(IO &IO, CachedDependency &Dependency) {
+    IO.mapRequired("Path", Dependency.Path);
+    IO.mapRequired("Hash", Dependency.Hash);
+  }
+};
+
+template <> struct MappingTraits<CachedMessage> {
+  static void mapping(IO &IO, CachedMessage &Message) {
+    IO.mapRequired("Message", Message.Message);
+    IO.mapRequired("FilePath", Message.FilePath);
+    IO.mapRequired("FileOffset", Message.FileOffset);
+  }
+};
+
+template <> struct MappingTraits<CachedError> {
+  static void mapping(IO &IO, CachedError &Error) {
+    IO.mapRequired("DiagnosticName", Error.DiagnosticName);
+    IO.mapRequired("DiagLevel", Error.DiagLevel);
+    IO.mapRequired("BuildDirectory", Error.BuildDirectory);
+    IO.mapRequired("IsWarningAsError", Error.IsWarningAsError);
+    IO.mapRequired("Message", Error.Message);
+    IO.mapOptional("Notes", Error.Notes);
+    IO.mapOptional("Replacements", Error.Replacements);
+  }
+};
+
+template <> struct MappingTraits<ClangTidyStats> {
+  static void mapping(IO &IO, ClangTidyStats &Stats) {
+    IO.mapRequired("ErrorsDisplayed", Stats.ErrorsDisplayed);
+    IO.mapRequired("ErrorsIgnoredCheckFilter", Stats.ErrorsIgnoredCheckFilter);
+    IO.mapRequired("ErrorsIgnoredNOLINT", Stats.ErrorsIgnoredNOLINT);
+    IO.mapRequired("ErrorsIgnoredNonUserCode", Stats.ErrorsIgnoredNonUserCode);
+    IO.mapRequired("ErrorsIgnoredLineFilter", Stats.ErrorsIgnoredLineFilter);
+  }
+};
+
+template <> struct MappingTraits<CacheEntry> {
+  static void mapping(IO &IO, CacheEntry &Entry) {
+    IO.mapRequired("Dependencies", Entry.Dependencies);
+    IO.mapRequired("Stats", Entry.Stats);
+    IO.mapOptional("Errors", Entry.Errors);
+  }
+};
+
+} // namespace yaml
+} // namespace llvm
+
+namespace {
+
+std::string toHex(llvm::MD5 &Hash) {
+  llvm::MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Hex;
+  llvm::MD5::stringifyResult(Result, Hex);
+  return Hex.str().str();
+}
+
+/// \brief Returns the hash of the contents of \p Path, or an empty string if
+/// it doesn't exist. Directories and files, that can't be read, get fixed
+/// strings, which aren't valid hashes.
+std::string hashFile(StringRef Path) {
+  llvm::sys::fs::file_status Status;
+  if (llvm::sys::fs::status(Path, Status))
+    return "";
+  if (llvm::sys::fs::is_directory(Status))
+    return "directory";
+  auto Buffer = llvm::MemoryBuffer::getFile(Path);
+  if (!Buffer)
+    return "unreadable";
+  llvm::MD5 Hash;
+  Hash.update((*Buffer)->getBuffer());
+  return toHex(Hash);
+}
+
+/// \brief Adds \p Data to \p Hash, followed by a separator, so that
+/// consecutive strings can't be confused.
+void addString(llvm::MD5 &Hash, StringRef Data) {
+  Hash.update(Data);
+  Hash.update(StringRef("\0", 1));
+}
+
+CachedMessage toCachedMessage(const tooling::DiagnosticMessage &Message) {
+  CachedMessage Result;
+  Result.Message = Message.Message;
+  Result.FilePath = Message.FilePath;
+  Result.FileOffset = Message.FileOffset;
+  return Result;
+}
+
+tooling::DiagnosticMessage fromCachedMessage(const CachedMessage &Message) {
+  tooling::DiagnosticMessage Result(Message.Message);
+  Result.FilePath = Message.FilePath;
+  Result.FileOffset = Message.FileOffset;
+  return Result;
+}
+
+} // namespace
+
+ClangTidyResultCache::ClangTidyResultCache(StringRef Directory)
+    : Directory(Directory) {}
+
+std::string ClangTidyResultCache::getFileHash(StringRef Path) const {
+  {
+    std::lock_guard<std::mutex> Lock(FileHashesMutex);
+    auto It = FileHashes.find(Path);
+    if (It != FileHashes.end())
+      return It->second;
+  } // unlock FileHashesMutex
+  // Other threads may hash the same file meanwhile, they get the same result.
+  std::string Hash = hashFile(Path);
+  std::lock_guard<std::mutex> Lock(FileHashesMutex);
+  FileHashes[Path] = Hash;
+  return Hash;
+}
+
+std::string ClangTidyResultCache::getKey(
+    StringRef File, ArrayRef<tooling::CompileCommand> Commands,
+    const ClangTidyOptions &Options,
+    const ClangTidyGlobalOptions &GlobalOptions) const {
+  llvm::MD5 Hash;
+  addString(Hash, CacheFormatVersion);
+  addString(Hash, getClangFullVersion());
+  addString(Hash, File);
+  for (const tooling::CompileCommand &Command : Commands) {
+    addString(Hash, Command.Directory);
+    addString(Hash, Command.Filename);
+    for (const std::string &Arg : Command.CommandLine)
+      addString(Hash, Arg);
+  }
+  addString(Hash, configurationAsText(Options));
+  // Not part of the configuration text, but affects the results.
+  addString(Hash, Options.SystemHeaders && *Options.SystemHeaders ? "1" : "0");
+  for (const FileFilter &Filter : GlobalOptions.LineFilter) {
+    addString(Hash, Filter.Name);
+    for (const FileFilter::LineRange &Range : Filter.LineRanges) {
+      addString(Hash, std::to_string(Range.first));
+      addString(Hash, std::to_string(Range.second));
+    }
+  }
+  return toHex(Hash);
+}
+
+bool ClangTidyResultCache::lookup(StringRef Key,
+                                  std::vector<ClangTidyError> &Errors,
+                                  ClangTidyStats &Stats) const {
+  SmallString<256> Path(Directory);
+  llvm::sys::path::append(Path, Key + ".yaml");
+  auto Buffer = llvm::MemoryBuffer::getFile(Path);
+  if (!Buffer)
+    return false;
+
+  CacheEntry Entry;
+  llvm::yaml::Input Input((*Buffer)->getBuffer());
+  Input >> Entry;
+  if (Input.error())
+    return false;
+
+  for (const CachedDependency &Dependency : Entry.Dependencies)
+    if (getFileHash(Dependency.Path) != Dependency.Hash)
+      return false;
+
+  Errors.clear();
+  for (const CachedError &Cached : Entry.Errors) {
+    ClangTidyError Error(Cached.DiagnosticName,
+                         ClangTidyError::Level(Cached.DiagLevel),
+                         Cached.BuildDirectory, Cached.IsWarningAsError);
+    Error.Message = fromCachedMessage(Cached.Message);
+    for (const CachedMessage &Note : Cached.Notes)
+      Error.Notes.push_back(fromCachedMessage(Note));
+    for (const tooling::Replacement &Replacement : Cached.Replacements) {
+      llvm::Error Err = Error.Fix[Replacement.getFilePath()].add(Replacement);
+      if (Err) {
+        // The stored replacements didn't conflict, the entry is corrupt.
+        llvm::consumeError(std::move(Err));
+        return false;
+      }
+    }
+    Errors.push_back(std::move(Error));
+  }
+  Stats = Entry.Stats;
+  return true;
+}
+
+void ClangTidyResultCache::store(StringRef Key,
+                                 ArrayRef<std::string> Dependencies,
+                                 ArrayRef<std::string> MissingFiles,
+                                 ArrayRef<ClangTidyError> Errors,
+                                 const ClangTidyStats &Stats) const {
+  CacheEntry Entry;
+  for (const std::string &Path : Dependencies) {
+    std::string Hash = getFileHash(Path);
+    if (Hash.empty())
+      return; // The entry could never be used.
+    Entry.Dependencies.push_back({Path, Hash});
+  }
+  // A file, that is created in the include search path, may shadow one of the
+  // dependencies.
+  std::vector<std::string> Missing(MissingFiles.begin(), MissingFiles.end());
+  std::sort(Missing.begin(), Missing.end());
+  Missing.erase(std::unique(Missing.begin(), Missing.end()), Missing.end());
+  for (const std::string &Path : Missing)
+    Entry.Dependencies.push_back({Path, getFileHash(Path)});
+  Entry.Stats = Stats;
+  for (const ClangTidyError &Error : Errors) {
+    CachedError Cached;
+    Cached.DiagnosticName = Error.DiagnosticName;
+    Cached.DiagLevel = Error.DiagLevel;
+    Cached.BuildDirectory = Error.BuildDirectory;
+    Cached.IsWarningAsError = Error.IsWarningAsError;
+    Cached.Message = toCachedMessage(Error.Message);
+    for (const tooling::DiagnosticMessage &Note : Error.Notes)
+      Cached.Notes.push_back(toCachedMessage(Note));
+    for (const auto &FileAndReplacements : Error.Fix)
+      for (const tooling::Replacement &Replacement :
+           FileAndReplacements.second)
+        Cached.Replacements.push_back(Replacement);
+    Entry.Errors.push_back(std::move(Cached));
+  }
+
+  // Write to a temporary file first, so that other processes never read a
+  // partial entry.
+  SmallString<256> TempModel(Directory);
+  llvm::sys::path::append(TempModel, Key + "-%%%%%%.tmp");
+  SmallString<256> TempPath;
+  int FD;
+  if (llvm::sys::fs::createUniqueFile(TempModel, FD, TempPath))
+    return;
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    llvm::yaml::Output Output(OS);
+    Output << Entry;
+  }
+  SmallString<256> Path(Directory);
+  llvm::sys::path::append(Path, Key + ".yaml");
+  if (llvm::sys::fs::rename(TempPath, Path))
+    llvm::sys::fs::remove(TempPath);
+}
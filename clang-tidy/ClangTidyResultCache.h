@@ -0,0 +1,78 @@
+//===--- ClangTidyResultCache.h - clang-tidy --------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANG_TIDY_CLANGTIDYRESULTCACHE_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANG_TIDY_CLANGTIDYRESULTCACHE_H
+
+#include "ClangTidyDiagnosticConsumer.h"
+#include "ClangTidyOptions.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/StringMap.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clang {
+namespace tidy {
+
+/// \brief An on-disk cache of the errors and statistics of translation units.
+///
+/// An entry is keyed by the main file, its compile commands, the effective
+/// options and the version of clang-tidy. It is only used if none of the files,
+/// that were read while the translation unit was analyzed (the main file and
+/// all headers), changed since then, which is checked by comparing hashes of
+/// their contents, and none of the files, that were looked up but didn't
+/// exist, e.g. in the include search path, was created since then.
+///
+/// The hash of each file is computed once per \c ClangTidyResultCache, so
+/// files must not change while it is used.
+///
+/// Entries are stored in separate files in the cache directory and are written
+/// atomically, so a cache can be shared by threads and processes. Nothing is
+/// ever removed from the cache.
+class ClangTidyResultCache {
+public:
+  /// \brief Uses the existing directory \p Directory to store the entries.
+  explicit ClangTidyResultCache(StringRef Directory);
+
+  /// \brief Returns the key of the entry for \p File, compiled with
+  /// \p Commands and analyzed with \p Options and \p GlobalOptions.
+  std::string getKey(StringRef File,
+                     ArrayRef<tooling::CompileCommand> Commands,
+                     const ClangTidyOptions &Options,
+                     const ClangTidyGlobalOptions &GlobalOptions) const;
+
+  /// \brief Returns true and fills \p Errors and \p Stats, if there's an
+  /// up-to-date entry for \p Key.
+  bool lookup(StringRef Key, std::vector<ClangTidyError> &Errors,
+              ClangTidyStats &Stats) const;
+
+  /// \brief Stores the results of a translation unit, which read the files
+  /// \p Dependencies and looked up the files \p MissingFiles, which didn't
+  /// exist.
+  void store(StringRef Key, ArrayRef<std::string> Dependencies,
+             ArrayRef<std::string> MissingFiles,
+             ArrayRef<ClangTidyError> Errors,
+             const ClangTidyStats &Stats) const;
+
+private:
+  /// \brief Returns the hash of the contents of \p Path, see hashFile().
+  std::string getFileHash(StringRef Path) const;
+
+  std::string Directory;
+  /// \brief Guards FileHashes.
+  mutable std::mutex FileHashesMutex;
+  /// \brief The hashes of the files, that were looked up or stored so far.
+  mutable llvm::StringMap<std::string> FileHashes;
+};
+
+} // end namespace tidy
+} // end namespace clang
+
+#endif // LLVM_CLANG_TOOLS_EXTRA_CLANG_TIDY_CLANGTIDYRESULTCACHE_H
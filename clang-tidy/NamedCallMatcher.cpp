@@ -0,0 +1,99 @@
+//===--- NamedCallMatcher.cpp - clang-tidy ----------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "NamedCallMatcher.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+using namespace clang::ast_matchers;
+using namespace clang::tidy;
+
+namespace {
+
+/// \brief Returns the unqualified part of a \c hasName() pattern.
+StringRef getUnqualifiedName(StringRef Pattern) {
+  size_t Separator = Pattern.rfind("::");
+  return Separator == StringRef::npos ? Pattern
+                                      : Pattern.drop_front(Separator + 2);
+}
+
+/// \brief Tests \p QualifiedName like \c hasName(Pattern).
+bool matchesQualifiedName(StringRef Pattern, StringRef QualifiedName) {
+  if (Pattern.consume_front("::"))
+    return QualifiedName == Pattern;
+  return QualifiedName == Pattern ||
+         (QualifiedName.endswith(Pattern) &&
+          QualifiedName.drop_back(Pattern.size()).endswith("::"));
+}
+
+} // namespace
+
+void NamedCallMatcher::addMatcher(ArrayRef<StringRef> CalleeNames,
+                                  const StatementMatcher &Matcher,
+                                  MatchFinder::MatchCallback *Action) {
+  Registrations.push_back(llvm::make_unique<Registration>());
+  Registration *Added = Registrations.back().get();
+  Added->Finder.addMatcher(Matcher, Action);
+  for (StringRef Name : CalleeNames)
+    RegistrationsByName[getUnqualifiedName(Name)].push_back(
+        NamedRegistration{Name.str(), Added});
+}
+
+void NamedCallMatcher::registerMatchers(MatchFinder &Finder) {
+  if (Registrations.empty())
+    return;
+  Finder.addMatcher(
+      callExpr(callee(functionDecl().bind("callee"))).bind("call"), this);
+}
+
+void NamedCallMatcher::run(const MatchFinder::MatchResult &Result) {
+  const auto *Call = Result.Nodes.getNodeAs<CallExpr>("call");
+  const auto *Callee = Result.Nodes.getNodeAs<FunctionDecl>("callee");
+
+  std::string NameStorage;
+  StringRef Name;
+  if (const IdentifierInfo *Identifier = Callee->getIdentifier()) {
+    Name = Identifier->getName();
+  } else {
+    NameStorage = Callee->getNameAsString();
+    Name = NameStorage;
+  }
+  auto It = RegistrationsByName.find(Name);
+  if (It == RegistrationsByName.end())
+    return;
+
+  // The qualified name is only built if a pattern needs it, and only once.
+  std::string QualifiedName;
+  bool HasQualifiedName = false;
+  // A registration with several patterns for the same name runs only once.
+  llvm::SmallPtrSet<Registration *, 4> Matched;
+  for (const NamedRegistration &Named : It->second) {
+    if (Matched.count(Named.Matcher))
+      continue;
+    if (Named.Pattern != Name) {
+      if (!HasQualifiedName) {
+        // Like hasName(), ignore inline and anonymous namespaces, that aren't
+        // written in the names.
+        PrintingPolicy Policy = Result.Context->getPrintingPolicy();
+        Policy.SuppressUnwrittenScope = true;
+        llvm::raw_string_ostream OS(QualifiedName);
+        Callee->printQualifiedName(OS, Policy);
+        OS.flush();
+        HasQualifiedName = true;
+      }
+      if (!matchesQualifiedName(Named.Pattern, QualifiedName))
+        continue;
+    }
+    Matched.insert(Named.Matcher);
+    Named.Matcher->Finder.match(*Call, *Result.Context);
+  }
+}
@@ -0,0 +1,75 @@
+//===--- NamedCallMatcher.h - clang-tidy ------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANG_TIDY_NAMEDCALLMATCHER_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANG_TIDY_NAMEDCALLMATCHER_H
+
+#include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "llvm/ADT/StringMap.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clang {
+namespace tidy {
+
+/// \brief Matches calls to functions with known names for all checks at once.
+///
+/// Many checks look for calls to specific functions, e.g. with
+/// ``callExpr(callee(functionDecl(hasName("::memset"))), ...)``. Registered
+/// with a \c MatchFinder, each of these matchers is tried on every call and
+/// compares the name of the callee on its own. Checks register them here
+/// instead, split into the names of the callees and the rest of the matcher.
+///
+/// A single matcher for all calls is then registered with the \c MatchFinder.
+/// It looks up the name of the callee once per call in a map from the names
+/// to the registered matchers, so identical name tests of all checks are
+/// shared. Only the matchers registered for that name are tried on the call.
+class NamedCallMatcher : public ast_matchers::MatchFinder::MatchCallback {
+public:
+  /// \brief Calls \p Action for each match of \p Matcher on calls to a function
+  /// named one of \p CalleeNames.
+  ///
+  /// The names have the syntax of ``hasName()``: a name starting with ``::``
+  /// is fully qualified, other names match the end of the qualified name.
+  /// \p Matcher must match a ``CallExpr``, it doesn't need to test the name
+  /// of the callee again.
+  void addMatcher(ArrayRef<StringRef> CalleeNames,
+                  const ast_matchers::StatementMatcher &Matcher,
+                  ast_matchers::MatchFinder::MatchCallback *Action);
+
+  /// \brief Registers the shared matcher with \p Finder, if any matchers were
+  /// added.
+  void registerMatchers(ast_matchers::MatchFinder &Finder);
+
+  void run(const ast_matchers::MatchFinder::MatchResult &Result) override;
+  StringRef getID() const override { return "named-call-dispatch"; }
+
+private:
+  /// A matcher, added by a check. It has its own \c MatchFinder, which is run
+  /// on the calls with a matching callee name.
+  struct Registration {
+    ast_matchers::MatchFinder Finder;
+  };
+  /// A name of a callee that a registration is interested in.
+  struct NamedRegistration {
+    /// The name, as passed to addMatcher().
+    std::string Pattern;
+    Registration *Matcher;
+  };
+
+  std::vector<std::unique_ptr<Registration>> Registrations;
+  /// The registrations by the unqualified names of their callees.
+  llvm::StringMap<std::vector<NamedRegistration>> RegistrationsByName;
+};
+
+} // namespace tidy
+} // namespace clang
+
+#endif // LLVM_CLANG_TOOLS_EXTRA_CLANG_TIDY_NAMEDCALLMATCHER_H
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "SuspiciousMemsetUsageCheck.h"
+#include "../NamedCallMatcher.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
@@ -20,12 +21,13 @@ namespace clang {
 namespace tidy {
 namespace bugprone {
 
-void SuspiciousMemsetUsageCheck::registerMatchers(MatchFinder *Finder) {
+void SuspiciousMemsetUsageCheck::registerNamedCallMatchers(
+    NamedCallMatcher &Calls) {
   // Note: void *memset(void *buffer, int fill_char, size_t byte_count);
   // Look for memset(x, '0', z). Probably memset(x, 0, z) was intended.
-  Finder->addMatcher(
+  Calls.addMatcher(
+      {"::memset"},
       callExpr(
-          callee(functionDecl(hasName("::memset"))),
           hasArgument(1, characterLiteral(equals(static_cast<unsigned>('0')))
                              .bind("char-zero-fill")),
           unless(
@@ -37,17 +39,18 @@ void SuspiciousMemsetUsageCheck::registerMatchers(MatchFinder *Finder) {
 
   // Look for memset with an integer literal in its fill_char argument.
   // Will check if it gets truncated.
-  Finder->addMatcher(callExpr(callee(functionDecl(hasName("::memset"))),
-                              hasArgument(1, integerLiteral().bind("num-fill")),
-                              unless(isInTemplateInstantiation())),
-                     this);
+  Calls.addMatcher({"::memset"},
+                   callExpr(hasArgument(1, integerLiteral().bind("num-fill")),
+                            unless(isInTemplateInstantiation())),
+                   this);
 
   // Look for memset(x, y, 0) as that is most likely an argument swap.
-  Finder->addMatcher(
-      callExpr(callee(functionDecl(hasName("::memset"))),
-               unless(hasArgument(1, anyOf(characterLiteral(equals(
-                                               static_cast<unsigned>('0'))),
-                                           integerLiteral()))),
+  Calls.addMatcher(
+      {"::memset"},
+      callExpr(unless(hasArgument(
+                   1, anyOf(characterLiteral(
+                                equals(static_cast<unsigned>('0'))),
+                            integerLiteral()))),
                unless(isInTemplateInstantiation()))
           .bind("call"),
       this);
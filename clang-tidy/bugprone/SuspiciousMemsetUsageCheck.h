@@ -24,7 +24,7 @@ class SuspiciousMemsetUsageCheck : public ClangTidyCheck {
 public:
   SuspiciousMemsetUsageCheck(StringRef Name, ClangTidyContext *Context)
       : ClangTidyCheck(Name, Context) {}
-  void registerMatchers(ast_matchers::MatchFinder *Finder) override;
+  void registerNamedCallMatchers(NamedCallMatcher &Calls) override;
   void check(const ast_matchers::MatchFinder::MatchResult &Result) override;
 };
 
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "UndefinedMemoryManipulationCheck.h"
+#include "../NamedCallMatcher.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 
@@ -24,26 +25,23 @@ AST_MATCHER(CXXRecordDecl, isNotTriviallyCopyable) {
 }
 } // namespace
 
-void UndefinedMemoryManipulationCheck::registerMatchers(MatchFinder *Finder) {
+void UndefinedMemoryManipulationCheck::registerNamedCallMatchers(
+    NamedCallMatcher &Calls) {
   const auto NotTriviallyCopyableObject =
       hasType(ast_matchers::hasCanonicalType(
           pointsTo(cxxRecordDecl(isNotTriviallyCopyable()))));
 
   // Check whether destination object is not TriviallyCopyable.
   // Applicable to all three memory manipulation functions.
-  Finder->addMatcher(callExpr(callee(functionDecl(hasAnyName(
-                                  "::memset", "::memcpy", "::memmove"))),
-                              hasArgument(0, NotTriviallyCopyableObject))
-                         .bind("dest"),
-                     this);
+  Calls.addMatcher(
+      {"::memset", "::memcpy", "::memmove"},
+      callExpr(hasArgument(0, NotTriviallyCopyableObject)).bind("dest"), this);
 
   // Check whether source object is not TriviallyCopyable.
   // Only applicable to memcpy() and memmove().
-  Finder->addMatcher(
-      callExpr(callee(functionDecl(hasAnyName("::memcpy", "::memmove"))),
-               hasArgument(1, NotTriviallyCopyableObject))
-          .bind("src"),
-      this);
+  Calls.addMatcher(
+      {"::memcpy", "::memmove"},
+      callExpr(hasArgument(1, NotTriviallyCopyableObject)).bind("src"), this);
 }
 
 void UndefinedMemoryManipulationCheck::check(
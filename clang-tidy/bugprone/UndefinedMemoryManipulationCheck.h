@@ -26,7 +26,7 @@ class UndefinedMemoryManipulationCheck : public ClangTidyCheck {
 public:
   UndefinedMemoryManipulationCheck(StringRef Name, ClangTidyContext *Context)
       : ClangTidyCheck(Name, Context) {}
-  void registerMatchers(ast_matchers::MatchFinder *Finder) override;
+  void registerNamedCallMatchers(NamedCallMatcher &Calls) override;
   void check(const ast_matchers::MatchFinder::MatchResult &Result) override;
 };
 
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "CommandProcessorCheck.h"
+#include "../NamedCallMatcher.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 
@@ -17,12 +18,12 @@ namespace clang {
 namespace tidy {
 namespace cert {
 
-void CommandProcessorCheck::registerMatchers(MatchFinder *Finder) {
-  Finder->addMatcher(
+void CommandProcessorCheck::registerNamedCallMatchers(
+    NamedCallMatcher &Calls) {
+  Calls.addMatcher(
+      {"::system", "::popen", "::_popen"},
       callExpr(
-          callee(functionDecl(anyOf(hasName("::system"), hasName("::popen"),
-                                    hasName("::_popen")))
-                     .bind("func")),
+          callee(functionDecl().bind("func")),
           // Do not diagnose when the call expression passes a null pointer
           // constant to system(); that only checks for the presence of a
           // command processor, which is not a security risk by itself.
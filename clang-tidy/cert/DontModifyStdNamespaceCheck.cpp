@@ -23,7 +23,7 @@ void DontModifyStdNamespaceCheck::registerMatchers(MatchFinder *Finder) {
 
   Finder->addMatcher(
       namespaceDecl(unless(isExpansionInSystemHeader()),
-                    anyOf(hasName("std"), hasName("posix")),
+                    hasAnyName("std", "posix"),
                     has(decl(unless(anyOf(
                         functionDecl(isExplicitTemplateSpecialization()),
                         cxxRecordDecl(isExplicitTemplateSpecialization()))))))
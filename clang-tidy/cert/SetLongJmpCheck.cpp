@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "SetLongJmpCheck.h"
+#include "../NamedCallMatcher.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/Frontend/CompilerInstance.h"
@@ -54,7 +55,7 @@ void SetLongJmpCheck::registerPPCallbacks(CompilerInstance &Compiler) {
       llvm::make_unique<SetJmpMacroCallbacks>(*this));
 }
 
-void SetLongJmpCheck::registerMatchers(MatchFinder *Finder) {
+void SetLongJmpCheck::registerNamedCallMatchers(NamedCallMatcher &Calls) {
   // This checker only applies to C++, where exception handling is a superior
   // solution to setjmp/longjmp calls.
   if (!getLangOpts().CPlusPlus)
@@ -63,10 +64,7 @@ void SetLongJmpCheck::registerMatchers(MatchFinder *Finder) {
   // In case there is an implementation that happens to define setjmp as a
   // function instead of a macro, this will also catch use of it. However, we
   // are primarily searching for uses of longjmp.
-  Finder->addMatcher(callExpr(callee(functionDecl(anyOf(hasName("setjmp"),
-                                                        hasName("longjmp")))))
-                         .bind("expr"),
-                     this);
+  Calls.addMatcher({"setjmp", "longjmp"}, callExpr().bind("expr"), this);
 }
 
 void SetLongJmpCheck::check(const MatchFinder::MatchResult &Result) {
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "NoMallocCheck.h"
+#include "../NamedCallMatcher.h"
 #include "../utils/Matchers.h"
 #include "../utils/OptionsUtils.h"
 #include "clang/AST/ASTContext.h"
@@ -24,10 +25,14 @@ namespace tidy {
 namespace cppcoreguidelines {
 
 namespace {
-Matcher<FunctionDecl> hasAnyListedName(const std::string &FunctionNames) {
+void addListedCalleesMatcher(NamedCallMatcher &Calls,
+                             const std::string &FunctionNames,
+                             const StatementMatcher &Matcher,
+                             MatchFinder::MatchCallback *Action) {
   const std::vector<std::string> NameList =
       utils::options::parseStringList(FunctionNames);
-  return hasAnyName(std::vector<StringRef>(NameList.begin(), NameList.end()));
+  Calls.addMatcher(std::vector<StringRef>(NameList.begin(), NameList.end()),
+                   Matcher, Action);
 }
 } // namespace
 
@@ -37,27 +42,20 @@ void NoMallocCheck::storeOptions(ClangTidyOptions::OptionMap &Opts) {
   Options.store(Opts, "Deallocations", DeallocList);
 }
 
-void NoMallocCheck::registerMatchers(MatchFinder *Finder) {
+void NoMallocCheck::registerNamedCallMatchers(NamedCallMatcher &Calls) {
   // C-style memory management is only problematic in C++.
   if (!getLangOpts().CPlusPlus)
     return;
 
   // Registering malloc, will suggest RAII.
-  Finder->addMatcher(callExpr(callee(functionDecl(hasAnyListedName(AllocList))))
-                         .bind("allocation"),
-                     this);
+  addListedCalleesMatcher(Calls, AllocList, callExpr().bind("allocation"),
+                          this);
 
   // Registering realloc calls, suggest std::vector or std::string.
-  Finder->addMatcher(
-      callExpr(callee(functionDecl(hasAnyListedName(ReallocList))))
-          .bind("realloc"),
-      this);
+  addListedCalleesMatcher(Calls, ReallocList, callExpr().bind("realloc"), this);
 
   // Registering free calls, will suggest RAII instead.
-  Finder->addMatcher(
-      callExpr(callee(functionDecl(hasAnyListedName(DeallocList))))
-          .bind("free"),
-      this);
+  addListedCalleesMatcher(Calls, DeallocList, callExpr().bind("free"), this);
 }
 
 void NoMallocCheck::check(const MatchFinder::MatchResult &Result) {
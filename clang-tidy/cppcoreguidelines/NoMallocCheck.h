@@ -38,7 +38,7 @@ public:
   void storeOptions(ClangTidyOptions::OptionMap &Opts) override;
 
   /// Registering for malloc, calloc, realloc and free calls.
-  void registerMatchers(ast_matchers::MatchFinder *Finder) override;
+  void registerNamedCallMatchers(NamedCallMatcher &Calls) override;
 
   /// Checks matched function calls and gives suggestion to modernize the code.
   void check(const ast_matchers::MatchFinder::MatchResult &Result) override;
@@ -27,8 +27,7 @@ void StringReferenceMemberCheck::registerMatchers(
     return;
 
   // Look for const references to std::string or ::string.
-  auto String = anyOf(namedDecl(hasName("::std::string")),
-                      namedDecl(hasName("::string")));
+  auto String = namedDecl(hasAnyName("::std::string", "::string"));
   auto ConstString = qualType(isConstQualified(), hasDeclaration(String));
 
   // Ignore members in template instantiations.
@@ -125,7 +125,7 @@ StatementMatcher makeIteratorLoopMatcher() {
   StatementMatcher BeginCallMatcher =
       cxxMemberCallExpr(
           argumentCountIs(0),
-          callee(cxxMethodDecl(anyOf(hasName("begin"), hasName("cbegin")))))
+          callee(cxxMethodDecl(hasAnyName("begin", "cbegin"))))
           .bind(BeginCallName);
 
   DeclarationMatcher InitDeclMatcher =
@@ -140,7 +140,7 @@ StatementMatcher makeIteratorLoopMatcher() {
 
   StatementMatcher EndCallMatcher = cxxMemberCallExpr(
       argumentCountIs(0),
-      callee(cxxMethodDecl(anyOf(hasName("end"), hasName("cend")))));
+      callee(cxxMethodDecl(hasAnyName("end", "cend"))));
 
   StatementMatcher IteratorBoundMatcher =
       expr(anyOf(ignoringParenImpCasts(
@@ -258,7 +258,7 @@ StatementMatcher makePseudoArrayLoopMatcher() {
 
   StatementMatcher SizeCallMatcher = cxxMemberCallExpr(
       argumentCountIs(0),
-      callee(cxxMethodDecl(anyOf(hasName("size"), hasName("length")))),
+      callee(cxxMethodDecl(hasAnyName("size", "length"))),
       on(anyOf(hasType(pointsTo(RecordWithBeginEnd)),
                hasType(RecordWithBeginEnd))));
 
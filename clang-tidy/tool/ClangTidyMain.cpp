@@ -16,8 +16,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "../ClangTidy.h"
+#include "../ClangTidyResultCache.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "llvm/Support/Process.h"
+#include "llvm/Support/Threading.h"
 
 using namespace clang::ast_matchers;
 using namespace clang::driver;
@@ -181,6 +183,24 @@ report to stderr.
                                         cl::init(false),
                                         cl::cat(ClangTidyCategory));
 
+static cl::opt<unsigned> JobsCount("j", cl::desc(R"(
+Number of translation units to process in
+parallel. 0 means the number of hardware
+threads. The diagnostics are reported in the
+order of the input files.
+)"),
+                                   cl::init(1), cl::cat(ClangTidyCategory));
+
+static cl::opt<std::string> CacheDir("cache-dir", cl::desc(R"(
+Directory for a cache of the results of
+translation units. Translation units are not
+analyzed again, if neither their sources and
+headers nor their compile commands and options
+changed since their results were cached.
+)"),
+                                     cl::value_desc("directory"),
+                                     cl::cat(ClangTidyCategory));
+
 static cl::opt<bool> AnalyzeTemporaryDtors("analyze-temporary-dtors",
                                            cl::desc(R"(
 Enable temporary destructor-aware analysis in
@@ -199,6 +219,18 @@ code with clang-apply-replacements.
                                         cl::value_desc("filename"),
                                         cl::cat(ClangTidyCategory));
 
+static cl::opt<std::string> ExportProfile("export-profile", cl::desc(R"(
+JSON file to store a timing profile in. It has
+the time spent in each phase (setup, parse,
+matching, analyzer, report, fixes) and check,
+the number of matches of each check, and the
+phases of each translation unit. Profiles of
+separate runs can be merged by adding up the
+times and joining the translation units.
+)"),
+                                          cl::value_desc("filename"),
+                                          cl::cat(ClangTidyCategory));
+
 static cl::opt<bool> Quiet("quiet", cl::desc(R"(
 Run clang-tidy in quiet mode. This suppresses
 printing statistics about ignored warnings and
@@ -403,9 +435,23 @@ static int clangTidyMain(int argc, const char **argv) {
 
   ProfileData Profile;
 
+  std::unique_ptr<ClangTidyResultCache> Cache;
+  if (!CacheDir.empty()) {
+    if (std::error_code EC = llvm::sys::fs::create_directories(CacheDir)) {
+      llvm::errs() << "Error creating cache directory: " << EC.message()
+                   << '\n';
+      return 1;
+    }
+    Cache = llvm::make_unique<ClangTidyResultCache>(CacheDir);
+  }
+
   ClangTidyContext Context(std::move(OwningOptionsProvider));
   runClangTidy(Context, OptionsParser.getCompilations(), PathList,
-               EnableCheckProfile ? &Profile : nullptr);
+               EnableCheckProfile || !ExportProfile.empty() ? &Profile
+                                                            : nullptr,
+               JobsCount == 0 ? llvm::thread::hardware_concurrency()
+                              : unsigned(JobsCount),
+               Cache.get());
   ArrayRef<ClangTidyError> Errors = Context.getErrors();
   bool FoundErrors =
       std::find_if(Errors.begin(), Errors.end(), [](const ClangTidyError &E) {
@@ -429,6 +475,16 @@ static int clangTidyMain(int argc, const char **argv) {
     exportReplacements(FilePath.str(), Errors, OS);
   }
 
+  if (!ExportProfile.empty()) {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(ExportProfile, EC, llvm::sys::fs::F_None);
+    if (EC) {
+      llvm::errs() << "Error opening output file: " << EC.message() << '\n';
+      return 1;
+    }
+    exportProfile(Profile, OS);
+  }
+
   if (!Quiet) {
     printStats(Context.getStats());
     if (DisableFixes)
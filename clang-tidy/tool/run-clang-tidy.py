@@ -69,7 +69,8 @@ def find_compilation_database(path):
 
 
 def get_tidy_invocation(f, clang_tidy_binary, checks, tmpdir, build_path,
-                        header_filter, extra_arg, extra_arg_before, quiet):
+                        header_filter, extra_arg, extra_arg_before, quiet,
+                        profile_dir):
   """Gets a command line for clang-tidy."""
   start = [clang_tidy_binary]
   if header_filter is not None:
@@ -86,6 +87,10 @@ def get_tidy_invocation(f, clang_tidy_binary, checks, tmpdir, build_path,
     (handle, name) = tempfile.mkstemp(suffix='.yaml', dir=tmpdir)
     os.close(handle)
     start.append(name)
+  if profile_dir is not None:
+    (handle, name) = tempfile.mkstemp(suffix='.json', dir=profile_dir)
+    os.close(handle)
+    start.append('-export-profile=' + name)
   for arg in extra_arg:
       start.append('-extra-arg=%s' % arg)
   for arg in extra_arg_before:
@@ -122,6 +127,34 @@ def merge_replacement_files(tmpdir, mergefile):
     open(mergefile, 'w').close()
 
 
+def merge_profile_files(profile_dir, mergefile):
+  """Merge all profile files in a directory into a single file"""
+  def add_times(merged, times):
+    for name, values in times.items():
+      merged_values = merged.setdefault(name, {})
+      for key, value in values.items():
+        merged_values[key] = merged_values.get(key, 0) + value
+
+  phases = {}
+  checks = {}
+  translation_units = []
+  for profilefile in glob.iglob(os.path.join(profile_dir, '*.json')):
+    content = open(profilefile, 'r').read()
+    if not content:
+      continue # Skip the files of crashed clang-tidy runs.
+    profile = json.loads(content)
+    add_times(phases, profile['phases'])
+    add_times(checks, profile['checks'])
+    translation_units.extend(profile['translation-units'])
+
+  # The most expensive translation units are listed first.
+  translation_units.sort(key=lambda unit: unit['total']['wall'], reverse=True)
+  output = { 'phases': phases, 'checks': checks,
+             'translation-units': translation_units }
+  with open(mergefile, 'w') as out:
+    json.dump(output, out, indent=2, sort_keys=True)
+
+
 def check_clang_apply_replacements_binary(args):
   """Checks if invoking supplied clang-apply-replacements binary works."""
   try:
@@ -144,14 +177,14 @@ def apply_fixes(args, tmpdir):
   subprocess.call(invocation)
 
 
-def run_tidy(args, tmpdir, build_path, queue):
+def run_tidy(args, tmpdir, profile_dir, build_path, queue):
   """Takes filenames out of queue and runs clang-tidy on them."""
   while True:
     name = queue.get()
     invocation = get_tidy_invocation(name, args.clang_tidy_binary, args.checks,
                                      tmpdir, build_path, args.header_filter,
                                      args.extra_arg, args.extra_arg_before,
-                                     args.quiet)
+                                     args.quiet, profile_dir)
     sys.stdout.write(' '.join(invocation) + '\n')
     subprocess.call(invocation)
     queue.task_done()
@@ -179,6 +212,10 @@ def main():
   parser.add_argument('-export-fixes', metavar='filename', dest='export_fixes',
                       help='Create a yaml file to store suggested fixes in, '
                       'which can be applied with clang-apply-replacements.')
+  parser.add_argument('-export-profile', metavar='filename',
+                      dest='export_profile',
+                      help='Create a json file with the timing profiles of '
+                      'all clang-tidy runs, merged.')
   parser.add_argument('-j', type=int, default=0,
                       help='number of tidy instances to be run in parallel.')
   parser.add_argument('files', nargs='*', default=['.*'],
@@ -234,6 +271,10 @@ def main():
     check_clang_apply_replacements_binary(args)
     tmpdir = tempfile.mkdtemp()
 
+  profile_dir = None
+  if args.export_profile:
+    profile_dir = tempfile.mkdtemp()
+
   # Build up a big regexy filter from all command line arguments.
   file_name_re = re.compile('|'.join(args.files))
 
@@ -242,7 +283,8 @@ def main():
     task_queue = queue.Queue(max_task)
     for _ in range(max_task):
       t = threading.Thread(target=run_tidy,
-                           args=(args, tmpdir, build_path, task_queue))
+                           args=(args, tmpdir, profile_dir, build_path,
+                                 task_queue))
       t.daemon = True
       t.start()
 
@@ -260,6 +302,8 @@ def main():
     print('\nCtrl-C detected, goodbye.')
     if tmpdir:
       shutil.rmtree(tmpdir)
+    if profile_dir:
+      shutil.rmtree(profile_dir)
     os.kill(0, 9)
 
   return_code = 0
@@ -272,6 +316,16 @@ def main():
       traceback.print_exc()
       return_code=1
 
+  if args.export_profile:
+    print('Writing profile to ' + args.export_profile + ' ...')
+    try:
+      merge_profile_files(profile_dir, args.export_profile)
+    except:
+      print('Error exporting profile.\n', file=sys.stderr)
+      traceback.print_exc()
+      return_code=1
+    shutil.rmtree(profile_dir)
+
   if args.fix:
     print('Applying fixes ...')
     try:
@@ -0,0 +1,40 @@
+//===--- Cancellation.h - Cancelling requests in flight ---------*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_CANCELLATION_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANGD_CANCELLATION_H
+
+#include <atomic>
+#include <memory>
+
+namespace clang {
+namespace clangd {
+
+/// A flag, shared between the issuer of a request and the code processing it,
+/// that allows the issuer to ask the processing to stop early. Copies of
+/// CancellationToken share the same flag and can be passed to other threads.
+/// Cancellation is cooperative: the code processing the request checks
+/// isCancelled() at the points where it can stop.
+class CancellationToken {
+public:
+  CancellationToken() : Cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+  /// Requests cancellation. Can be called from any thread.
+  void cancel() { Cancelled->store(true); }
+  /// Returns true if cancel() was called on this token or any of its copies.
+  bool isCancelled() const { return Cancelled->load(); }
+
+private:
+  std::shared_ptr<std::atomic<bool>> Cancelled;
+};
+
+} // namespace clangd
+} // namespace clang
+
+#endif
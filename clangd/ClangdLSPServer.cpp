@@ -10,30 +10,26 @@
 #include "ClangdLSPServer.h"
 #include "JSONRPCDispatcher.h"
 #include "ProtocolHandlers.h"
+#include "Trace.h"
 
 using namespace clang::clangd;
 using namespace clang;
 
 namespace {
 
-std::string
-replacementsToEdits(StringRef Code,
-                    const std::vector<tooling::Replacement> &Replacements) {
+void writeEdits(json::Writer &W, const PieceTable &Code,
+                const std::vector<tooling::Replacement> &Replacements) {
   // Turn the replacements into the format specified by the Language Server
-  // Protocol. Fuse them into one big JSON array.
-  std::string Edits;
+  // Protocol, a JSON array of TextEdits.
+  W.arrayBegin();
   for (auto &R : Replacements) {
     Range ReplacementRange = {
-        offsetToPosition(Code, R.getOffset()),
-        offsetToPosition(Code, R.getOffset() + R.getLength())};
+        Code.offsetToPosition(R.getOffset()),
+        Code.offsetToPosition(R.getOffset() + R.getLength())};
     TextEdit TE = {ReplacementRange, R.getReplacementText()};
-    Edits += TextEdit::unparse(TE);
-    Edits += ',';
+    TextEdit::unparse(W, TE);
   }
-  if (!Edits.empty())
-    Edits.pop_back();
-
-  return Edits;
+  W.arrayEnd();
 }
 
 } // namespace
@@ -59,6 +55,8 @@ public:
                            JSONOutput &Out) override;
   void onDocumentDidClose(DidCloseTextDocumentParams Params,
                           JSONOutput &Out) override;
+  void onFileEvent(DidChangeWatchedFilesParams Params,
+                   JSONOutput &Out) override;
   void onDocumentOnTypeFormatting(DocumentOnTypeFormattingParams Params,
                                   StringRef ID, JSONOutput &Out) override;
   void onDocumentRangeFormatting(DocumentRangeFormattingParams Params,
@@ -71,6 +69,10 @@ public:
                     JSONOutput &Out) override;
   void onGoToDefinition(TextDocumentPositionParams Params, StringRef ID,
                         JSONOutput &Out) override;
+  void onMemoryUsage(MemoryUsageParams Params, StringRef ID,
+                     JSONOutput &Out) override;
+  void onLatencyHistograms(StringRef ID, JSONOutput &Out) override;
+  void onCancelRequest(CancelParams Params, JSONOutput &Out) override;
 
 private:
   ClangdLSPServer &LangServer;
@@ -78,17 +80,18 @@ private:
 
 void ClangdLSPServer::LSPProtocolCallbacks::onInitialize(StringRef ID,
                                                          JSONOutput &Out) {
-  Out.writeMessage(
-      R"({"jsonrpc":"2.0","id":)" + ID +
-      R"(,"result":{"capabilities":{
-          "textDocumentSync": 1,
+  // Written with writeResult, so that the latency of initialize is recorded.
+  Out.writeResult(ID, [](json::Writer &W) {
+    W.raw(R"({"capabilities":{
+          "textDocumentSync": 2,
           "documentFormattingProvider": true,
           "documentRangeFormattingProvider": true,
           "documentOnTypeFormattingProvider": {"firstTriggerCharacter":"}","moreTriggerCharacter":[]},
           "codeActionProvider": true,
           "completionProvider": {"resolveProvider": false, "triggerCharacters": [".",">",":"]},
           "definitionProvider": true
-        }}})");
+        }})");
+  });
 }
 
 void ClangdLSPServer::LSPProtocolCallbacks::onShutdown(JSONOutput &Out) {
@@ -106,9 +109,10 @@ void ClangdLSPServer::LSPProtocolCallbacks::onDocumentDidOpen(
 
 void ClangdLSPServer::LSPProtocolCallbacks::onDocumentDidChange(
     DidChangeTextDocumentParams Params, JSONOutput &Out) {
-  // We only support full syncing right now.
-  LangServer.Server.addDocument(Params.textDocument.uri.file,
-                                Params.contentChanges[0].text);
+  if (!LangServer.Server.updateDocument(Params.textDocument.uri.file,
+                                       Params.contentChanges))
+    Out.log("Failed to apply changes to " + Params.textDocument.uri.file +
+            "\n");
 }
 
 void ClangdLSPServer::LSPProtocolCallbacks::onDocumentDidClose(
@@ -116,87 +120,96 @@ void ClangdLSPServer::LSPProtocolCallbacks::onDocumentDidClose(
   LangServer.Server.removeDocument(Params.textDocument.uri.file);
 }
 
+void ClangdLSPServer::LSPProtocolCallbacks::onFileEvent(
+    DidChangeWatchedFilesParams Params, JSONOutput &Out) {
+  std::vector<Path> ChangedFiles;
+  for (const FileEvent &Change : Params.changes)
+    ChangedFiles.push_back(Change.uri.file);
+  LangServer.Server.onFilesChanged(ChangedFiles);
+}
+
 void ClangdLSPServer::LSPProtocolCallbacks::onDocumentOnTypeFormatting(
     DocumentOnTypeFormattingParams Params, StringRef ID, JSONOutput &Out) {
   auto File = Params.textDocument.uri.file;
-  std::string Code = LangServer.Server.getDocument(File);
-  std::string Edits = replacementsToEdits(
-      Code, LangServer.Server.formatOnType(File, Params.position));
+  PieceTable Code = LangServer.Server.getDocument(File);
+  auto Replacements = LangServer.Server.formatOnType(File, Params.position);
 
-  Out.writeMessage(R"({"jsonrpc":"2.0","id":)" + ID.str() +
-                   R"(,"result":[)" + Edits + R"(]})");
+  Out.writeResult(
+      ID, [&](json::Writer &W) { writeEdits(W, Code, Replacements); });
 }
 
 void ClangdLSPServer::LSPProtocolCallbacks::onDocumentRangeFormatting(
     DocumentRangeFormattingParams Params, StringRef ID, JSONOutput &Out) {
   auto File = Params.textDocument.uri.file;
-  std::string Code = LangServer.Server.getDocument(File);
-  std::string Edits = replacementsToEdits(
-      Code, LangServer.Server.formatRange(File, Params.range));
+  PieceTable Code = LangServer.Server.getDocument(File);
+  auto Replacements = LangServer.Server.formatRange(File, Params.range);
 
-  Out.writeMessage(R"({"jsonrpc":"2.0","id":)" + ID.str() +
-                   R"(,"result":[)" + Edits + R"(]})");
+  Out.writeResult(
+      ID, [&](json::Writer &W) { writeEdits(W, Code, Replacements); });
 }
 
 void ClangdLSPServer::LSPProtocolCallbacks::onDocumentFormatting(
     DocumentFormattingParams Params, StringRef ID, JSONOutput &Out) {
   auto File = Params.textDocument.uri.file;
-  std::string Code = LangServer.Server.getDocument(File);
-  std::string Edits =
-      replacementsToEdits(Code, LangServer.Server.formatFile(File));
+  PieceTable Code = LangServer.Server.getDocument(File);
+  auto Replacements = LangServer.Server.formatFile(File);
 
-  Out.writeMessage(R"({"jsonrpc":"2.0","id":)" + ID.str() +
-                   R"(,"result":[)" + Edits + R"(]})");
+  Out.writeResult(
+      ID, [&](json::Writer &W) { writeEdits(W, Code, Replacements); });
 }
 
 void ClangdLSPServer::LSPProtocolCallbacks::onCodeAction(
     CodeActionParams Params, StringRef ID, JSONOutput &Out) {
   // We provide a code action for each diagnostic at the requested location
   // which has FixIts available.
-  std::string Code =
+  PieceTable Code =
       LangServer.Server.getDocument(Params.textDocument.uri.file);
-  std::string Commands;
-  for (Diagnostic &D : Params.context.diagnostics) {
-    std::vector<clang::tooling::Replacement> Fixes =
-        LangServer.getFixIts(Params.textDocument.uri.file, D);
-    std::string Edits = replacementsToEdits(Code, Fixes);
-
-    if (!Edits.empty())
-      Commands +=
-          R"({"title":"Apply FixIt ')" + llvm::yaml::escape(D.message) +
-          R"('", "command": "clangd.applyFix", "arguments": [")" +
-          llvm::yaml::escape(Params.textDocument.uri.uri) +
-          R"(", [)" + Edits +
-          R"(]]},)";
-  }
-  if (!Commands.empty())
-    Commands.pop_back();
-
-  Out.writeMessage(
-      R"({"jsonrpc":"2.0","id":)" + ID.str() +
-      R"(, "result": [)" + Commands +
-      R"(]})");
+  Out.writeResult(ID, [&](json::Writer &W) {
+    W.arrayBegin();
+    for (Diagnostic &D : Params.context.diagnostics) {
+      std::vector<clang::tooling::Replacement> Fixes =
+          LangServer.getFixIts(Params.textDocument.uri.file, D);
+      if (Fixes.empty())
+        continue;
+
+      W.objectBegin();
+      W.key("title");
+      W.string("Apply FixIt '" + D.message + "'");
+      W.key("command");
+      W.string("clangd.applyFix");
+      W.key("arguments");
+      W.arrayBegin();
+      URI::unparse(W, Params.textDocument.uri);
+      writeEdits(W, Code, Fixes);
+      W.arrayEnd();
+      W.objectEnd();
+    }
+    W.arrayEnd();
+  });
 }
 
 void ClangdLSPServer::LSPProtocolCallbacks::onCompletion(
     TextDocumentPositionParams Params, StringRef ID, JSONOutput &Out) {
-
-  auto Items = LangServer.Server
-                   .codeComplete(Params.textDocument.uri.file,
-                                 Position{Params.position.line,
-                                          Params.position.character})
-                   .Value;
-
-  std::string Completions;
-  for (const auto &Item : Items) {
-    Completions += CompletionItem::unparse(Item);
-    Completions += ",";
-  }
-  if (!Completions.empty())
-    Completions.pop_back();
-  Out.writeMessage(
-      R"({"jsonrpc":"2.0","id":)" + ID.str() +
-      R"(,"result":[)" + Completions + R"(]})");
+  std::string RequestID = ID.str();
+  // The reply is written on a worker thread, so that $/cancelRequest can be
+  // processed while the completion is running. The callback might outlive
+  // LSPProtocolCallbacks, so it only refers to the ClangdLSPServer.
+  ClangdLSPServer &LSPServer = LangServer;
+  LangServer.Server.codeComplete(
+      Params.textDocument.uri.file,
+      Position{Params.position.line, Params.position.character},
+      LangServer.startRequest(RequestID),
+      [&LSPServer, RequestID](Tagged<CompletionList> Items) {
+        if (LSPServer.finishRequest(RequestID)) {
+          LSPServer.Out.writeError(RequestID, /*RequestCancelled*/ -32800,
+                                   "Request cancelled");
+          return;
+        }
+
+        LSPServer.Out.writeResult(RequestID, [&](json::Writer &W) {
+          CompletionList::unparse(W, Items.Value);
+        });
+      });
 }
 
 void ClangdLSPServer::LSPProtocolCallbacks::onGoToDefinition(
@@ -208,24 +221,52 @@ void ClangdLSPServer::LSPProtocolCallbacks::onGoToDefinition(
                                              Params.position.character})
                    .Value;
 
-  std::string Locations;
-  for (const auto &Item : Items) {
-    Locations += Location::unparse(Item);
-    Locations += ",";
+  Out.writeResult(ID, [&](json::Writer &W) {
+    W.arrayBegin();
+    for (const auto &Item : Items)
+      Location::unparse(W, Item);
+    W.arrayEnd();
+  });
+}
+
+void ClangdLSPServer::LSPProtocolCallbacks::onMemoryUsage(
+    MemoryUsageParams Params, StringRef ID, JSONOutput &Out) {
+  llvm::Optional<MemoryUsage> Usage =
+      LangServer.Server.getMemoryUsage(Params.textDocument.uri.file);
+  if (!Usage) {
+    Out.writeError(ID, /*InvalidParams*/ -32602,
+                   "The document is not open: " + Params.textDocument.uri.uri);
+    return;
   }
-  if (!Locations.empty())
-    Locations.pop_back();
-  Out.writeMessage(
-      R"({"jsonrpc":"2.0","id":)" + ID.str() +
-      R"(,"result":[)" + Locations + R"(]})");
+  Out.writeResult(ID,
+                  [&](json::Writer &W) { MemoryUsage::unparse(W, *Usage); });
 }
 
-ClangdLSPServer::ClangdLSPServer(JSONOutput &Out, unsigned AsyncThreadsCount,
-                                 bool SnippetCompletions,
-                                 llvm::Optional<StringRef> ResourceDir)
+void ClangdLSPServer::LSPProtocolCallbacks::onLatencyHistograms(
+    StringRef ID, JSONOutput &Out) {
+  std::vector<LatencyHistogram> Histograms = trace::getHistograms();
+  Out.writeResult(ID, [&](json::Writer &W) {
+    W.arrayBegin();
+    for (const auto &Histogram : Histograms)
+      LatencyHistogram::unparse(W, Histogram);
+    W.arrayEnd();
+  });
+}
+
+void ClangdLSPServer::LSPProtocolCallbacks::onCancelRequest(
+    CancelParams Params, JSONOutput &Out) {
+  LangServer.cancelRequest(Params.id);
+}
+
+ClangdLSPServer::ClangdLSPServer(
+    JSONOutput &Out, unsigned AsyncThreadsCount, bool SnippetCompletions,
+    llvm::Optional<StringRef> ResourceDir, std::size_t ASTMemoryBudget,
+    bool BuildIndex, unsigned CompletionLimit,
+    std::chrono::steady_clock::duration UpdateDebounce, bool CacheFileSystem)
     : Out(Out), DiagConsumer(*this),
       Server(CDB, DiagConsumer, FSProvider, AsyncThreadsCount,
-             SnippetCompletions, ResourceDir) {}
+             SnippetCompletions, ResourceDir, ASTMemoryBudget, BuildIndex,
+             CompletionLimit, UpdateDebounce, CacheFileSystem) {}
 
 void ClangdLSPServer::run(std::istream &In) {
   assert(!IsDone && "Run was called before");
@@ -260,17 +301,10 @@ ClangdLSPServer::getFixIts(StringRef File, const clangd::Diagnostic &D) {
 
 void ClangdLSPServer::consumeDiagnostics(
     PathRef File, std::vector<DiagWithFixIts> Diagnostics) {
-  std::string DiagnosticsJSON;
-
+  trace::Span Tracer("PublishDiagnostics");
   DiagnosticToReplacementMap LocalFixIts; // Temporary storage
   for (auto &DiagWithFixes : Diagnostics) {
     auto Diag = DiagWithFixes.Diag;
-    DiagnosticsJSON +=
-        R"({"range":)" + Range::unparse(Diag.range) +
-        R"(,"severity":)" + std::to_string(Diag.severity) +
-        R"(,"message":")" + llvm::yaml::escape(Diag.message) +
-        R"("},)";
-
     // We convert to Replacements to become independent of the SourceManager.
     auto &FixItsForDiagnostic = LocalFixIts[Diag];
     std::copy(DiagWithFixes.FixIts.begin(), DiagWithFixes.FixIts.end(),
@@ -285,10 +319,53 @@ void ClangdLSPServer::consumeDiagnostics(
   }
 
   // Publish diagnostics.
-  if (!DiagnosticsJSON.empty())
-    DiagnosticsJSON.pop_back(); // Drop trailing comma.
-  Out.writeMessage(
-      R"({"jsonrpc":"2.0","method":"textDocument/publishDiagnostics","params":{"uri":")" +
-      URI::fromFile(File).uri + R"(","diagnostics":[)" + DiagnosticsJSON +
-      R"(]}})");
+  Out.writeJSON([&](json::Writer &W) {
+    W.objectBegin();
+    W.key("jsonrpc");
+    W.string("2.0");
+    W.key("method");
+    W.string("textDocument/publishDiagnostics");
+    W.key("params");
+    W.objectBegin();
+    W.key("uri");
+    URI::unparse(W, URI::fromFile(File));
+    W.key("diagnostics");
+    W.arrayBegin();
+    for (auto &DiagWithFixes : Diagnostics) {
+      const clangd::Diagnostic &Diag = DiagWithFixes.Diag;
+      W.objectBegin();
+      W.key("range");
+      Range::unparse(W, Diag.range);
+      W.key("severity");
+      W.integer(Diag.severity);
+      W.key("message");
+      W.string(Diag.message);
+      W.objectEnd();
+    }
+    W.arrayEnd();
+    W.objectEnd();
+    W.objectEnd();
+  });
+}
+
+CancellationToken ClangdLSPServer::startRequest(StringRef ID) {
+  std::lock_guard<std::mutex> Lock(RequestsMutex);
+  return RunningRequests[ID];
+}
+
+bool ClangdLSPServer::finishRequest(StringRef ID) {
+  std::lock_guard<std::mutex> Lock(RequestsMutex);
+  auto It = RunningRequests.find(ID);
+  if (It == RunningRequests.end())
+    return false;
+  bool Cancelled = It->second.isCancelled();
+  RunningRequests.erase(It);
+  return Cancelled;
+}
+
+void ClangdLSPServer::cancelRequest(StringRef ID) {
+  std::lock_guard<std::mutex> Lock(RequestsMutex);
+  auto It = RunningRequests.find(ID);
+  if (It != RunningRequests.end())
+    It->second.cancel();
 }
@@ -28,7 +28,12 @@ class ClangdLSPServer {
 public:
   ClangdLSPServer(JSONOutput &Out, unsigned AsyncThreadsCount,
                   bool SnippetCompletions,
-                  llvm::Optional<StringRef> ResourceDir);
+                  llvm::Optional<StringRef> ResourceDir,
+                  std::size_t ASTMemoryBudget = 0, bool BuildIndex = false,
+                  unsigned CompletionLimit = 0,
+                  std::chrono::steady_clock::duration UpdateDebounce =
+                      std::chrono::steady_clock::duration::zero(),
+                  bool CacheFileSystem = false);
 
   /// Run LSP server loop, receiving input for it from \p In. \p In must be
   /// opened in binary mode. Output will be written using Out variable passed to
@@ -59,6 +64,15 @@ private:
   void consumeDiagnostics(PathRef File,
                           std::vector<DiagWithFixIts> Diagnostics);
 
+  /// Registers a request with \p ID that can be cancelled by $/cancelRequest
+  /// until finishRequest(\p ID) is called. Returns a token for the request.
+  CancellationToken startRequest(StringRef ID);
+  /// Stops tracking the request with \p ID. Returns true if the request was
+  /// cancelled.
+  bool finishRequest(StringRef ID);
+  /// Cancels the request with \p ID, if it is still running.
+  void cancelRequest(StringRef ID);
+
   JSONOutput &Out;
   /// Used to indicate that the 'shutdown' request was received from the
   /// Language Server client.
@@ -71,6 +85,11 @@ private:
   /// Caches FixIts per file and diagnostics
   llvm::StringMap<DiagnosticToReplacementMap> FixItsMap;
 
+  std::mutex RequestsMutex;
+  /// Cancellation tokens of the requests that are still running, keyed by
+  /// request ids.
+  llvm::StringMap<CancellationToken> RunningRequests;
+
   // Various ClangdServer parameters go here. It's important they're created
   // before ClangdServer.
   DirectoryBasedGlobalCompilationDatabase CDB;
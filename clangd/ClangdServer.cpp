@@ -8,6 +8,7 @@
 //===-------------------------------------------------------------------===//
 
 #include "ClangdServer.h"
+#include "Trace.h"
 #include "clang/Format/Format.h"
 #include "clang/Frontend/ASTUnit.h"
 #include "clang/Frontend/CompilerInstance.h"
@@ -16,6 +17,7 @@
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <future>
 
 using namespace clang;
@@ -33,6 +35,29 @@ private:
   std::promise<void> &Promise;
 };
 
+/// Similar to FulfillPromiseGuard, but owns the promise. Used for requests
+/// that ClangdScheduler may drop without running, the promise is fulfilled when
+/// the request is destroyed.
+class OwningFulfillPromiseGuard {
+public:
+  OwningFulfillPromiseGuard(std::promise<void> Promise)
+      : Promise(std::move(Promise)) {}
+
+  OwningFulfillPromiseGuard(OwningFulfillPromiseGuard &&Other)
+      : Promise(std::move(Other.Promise)), IsMovedFrom(Other.IsMovedFrom) {
+    Other.IsMovedFrom = true;
+  }
+
+  ~OwningFulfillPromiseGuard() {
+    if (!IsMovedFrom)
+      Promise.set_value();
+  }
+
+private:
+  std::promise<void> Promise;
+  bool IsMovedFrom = false;
+};
+
 std::vector<tooling::Replacement> formatCode(StringRef Code, StringRef Filename,
                                              ArrayRef<tooling::Range> Ranges) {
   // Call clang-format.
@@ -50,29 +75,6 @@ std::string getStandardResourceDir() {
 
 } // namespace
 
-size_t clangd::positionToOffset(StringRef Code, Position P) {
-  size_t Offset = 0;
-  for (int I = 0; I != P.line; ++I) {
-    // FIXME: \r\n
-    // FIXME: UTF-8
-    size_t F = Code.find('\n', Offset);
-    if (F == StringRef::npos)
-      return 0; // FIXME: Is this reasonable?
-    Offset = F + 1;
-  }
-  return (Offset == 0 ? 0 : (Offset - 1)) + P.character;
-}
-
-/// Turn an offset in Code into a [line, column] pair.
-Position clangd::offsetToPosition(StringRef Code, size_t Offset) {
-  StringRef JustBefore = Code.substr(0, Offset);
-  // FIXME: \r\n
-  // FIXME: UTF-8
-  int Lines = JustBefore.count('\n');
-  int Cols = JustBefore.size() - JustBefore.rfind('\n') - 1;
-  return {Lines, Cols};
-}
-
 Tagged<IntrusiveRefCntPtr<vfs::FileSystem>>
 RealFileSystemProvider::getTaggedFileSystem(PathRef File) {
   return make_tagged(vfs::getRealFileSystem(), VFSTag());
@@ -95,32 +97,80 @@ ClangdScheduler::ClangdScheduler(unsigned AsyncThreadsCount)
     return;
   }
 
+  // Keep one of the workers free for interactive requests, unless we only have
+  // a single worker.
+  MaxNonInteractiveWorkers =
+      AsyncThreadsCount > 1 ? AsyncThreadsCount - 1 : AsyncThreadsCount;
+
   Workers.reserve(AsyncThreadsCount);
   for (unsigned I = 0; I < AsyncThreadsCount; ++I) {
     Workers.push_back(std::thread([this]() {
       while (true) {
-        std::future<void> Request;
+        std::future<void> Action;
+        std::string File;
+        bool IsInteractive;
+        bool IsCompletion;
+        std::chrono::steady_clock::time_point Enqueued;
 
         // Pick request from the queue
         {
           std::unique_lock<std::mutex> Lock(Mutex);
-          // Wait for more requests.
-          RequestCV.wait(Lock,
-                         [this] { return !RequestQueue.empty() || Done; });
-          if (Done)
-            return;
-
-          assert(!RequestQueue.empty() && "RequestQueue was empty");
-
-          // We process requests starting from the front of the queue. Users of
-          // ClangdScheduler have a way to prioritise their requests by putting
-          // them to the either side of the queue (using either addToEnd or
-          // addToFront).
-          Request = std::move(RequestQueue.front());
-          RequestQueue.pop_front();
+          llvm::StringMap<FileQueue>::iterator Queue;
+          std::deque<Request>::iterator NextIt;
+          // Wait for more requests, or for the delayed ones to become due.
+          while (true) {
+            if (Done)
+              return;
+            auto WakeUpTime = std::chrono::steady_clock::time_point::max();
+            Queue = pickNextQueue(NextIt, WakeUpTime);
+            if (Queue != FileQueues.end())
+              break;
+            if (WakeUpTime == std::chrono::steady_clock::time_point::max())
+              RequestCV.wait(Lock);
+            else
+              RequestCV.wait_until(Lock, WakeUpTime);
+          }
+
+          assert(!Queue->second.Requests.empty() && "Picked an empty queue");
+
+          Request &Next = *NextIt;
+          Action = std::move(Next.Action);
+          IsInteractive = Next.Priority == RequestPriority::Interactive;
+          IsCompletion = Next.Kind == RequestKind::Completion;
+          Enqueued = Next.Enqueued;
+          Queue->second.Requests.erase(NextIt);
+          if (IsCompletion)
+            Queue->second.IsRunningCompletion = true;
+          else
+            Queue->second.IsRunning = true;
+          if (!IsInteractive)
+            ++RunningNonInteractive;
+          File = Queue->first().str();
         } // unlock Mutex
 
-        Request.get();
+        trace::record("Queued", Enqueued, std::chrono::steady_clock::now());
+        Action.get();
+
+        {
+          std::lock_guard<std::mutex> Lock(Mutex);
+          auto It = FileQueues.find(File);
+          assert(It != FileQueues.end() &&
+                 (IsCompletion ? It->second.IsRunningCompletion
+                               : It->second.IsRunning) &&
+                 "Queue was removed while its request was running");
+          if (IsCompletion)
+            It->second.IsRunningCompletion = false;
+          else
+            It->second.IsRunning = false;
+          if (It->second.Requests.empty() && !It->second.IsRunning &&
+              !It->second.IsRunningCompletion)
+            FileQueues.erase(It);
+          if (!IsInteractive)
+            --RunningNonInteractive;
+        } // unlock Mutex
+        // Requests for this file, or a slot for non-interactive requests, might
+        // have become available to other workers.
+        RequestCV.notify_all();
       }
     }));
   }
@@ -141,15 +191,139 @@ ClangdScheduler::~ClangdScheduler() {
     Worker.join();
 }
 
+void ClangdScheduler::boostPriority(PathRef File, RequestPriority Priority) {
+  if (RunSynchronously)
+    return;
+
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto It = FileQueues.find(File);
+    if (It == FileQueues.end())
+      return;
+    // Nobody waits for the background requests, e.g. indexing of the file.
+    // The boosted requests don't wait for them either.
+    for (Request &R : It->second.Requests)
+      if (R.Priority != RequestPriority::Background)
+        R.Priority = std::max(R.Priority, Priority);
+  } // unlock Mutex
+  RequestCV.notify_all();
+}
+
+void ClangdScheduler::enqueue(PathRef File, RequestPriority Priority,
+                              RequestKind Kind,
+                              std::chrono::steady_clock::duration Delay,
+                              std::future<void> Action) {
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::deque<Request> &Requests = FileQueues[File].Requests;
+    if (Kind == RequestKind::Supersedable) {
+      // Drop the requests that were superseded by this one. The priority of
+      // the new request must not be lower than that of the dropped ones,
+      // somebody might be waiting for their results.
+      auto IsSupersedable = [](const Request &R) {
+        return R.Kind == RequestKind::Supersedable;
+      };
+      for (const Request &R : Requests)
+        if (IsSupersedable(R))
+          Priority = std::max(Priority, R.Priority);
+      Requests.erase(
+          std::remove_if(Requests.begin(), Requests.end(), IsSupersedable),
+          Requests.end());
+    }
+    auto Now = std::chrono::steady_clock::now();
+    Requests.push_back(Request{std::move(Action), Priority, Kind, Now,
+                               Now + Delay, NextSequence++});
+  } // unlock Mutex
+  RequestCV.notify_one();
+}
+
+llvm::StringMap<ClangdScheduler::FileQueue>::iterator
+ClangdScheduler::pickNextQueue(
+    std::deque<Request>::iterator &Next,
+    std::chrono::steady_clock::time_point &WakeUpTime) {
+  bool CanRunNonInteractive = RunningNonInteractive < MaxNonInteractiveWorkers;
+  auto Now = std::chrono::steady_clock::now();
+
+  auto Best = FileQueues.end();
+  RequestPriority BestPriority = RequestPriority::Background;
+  unsigned long long BestSequence = 0;
+  auto BestRequest = std::deque<Request>::iterator();
+  auto Consider = [&](llvm::StringMap<FileQueue>::iterator It,
+                      std::deque<Request>::iterator First,
+                      RequestPriority Priority) {
+    if (Priority != RequestPriority::Interactive && !CanRunNonInteractive)
+      return;
+    // Nobody waits for the delayed requests, unless they are interactive.
+    auto NotBefore = First->NotBefore;
+    if (Priority != RequestPriority::Interactive && NotBefore > Now) {
+      WakeUpTime = std::min(WakeUpTime, NotBefore);
+      return;
+    }
+
+    unsigned long long Sequence = First->Sequence;
+    if (Best == FileQueues.end() || Priority > BestPriority ||
+        (Priority == BestPriority && Sequence < BestSequence)) {
+      Best = It;
+      BestRequest = First;
+      BestPriority = Priority;
+      BestSequence = Sequence;
+    }
+  };
+
+  for (auto It = FileQueues.begin(), End = FileQueues.end(); It != End; ++It) {
+    FileQueue &Queue = It->second;
+    // Completion requests and the other requests of a file are two separate
+    // sequences, each of them is run in order. Background requests are skipped
+    // by the other requests of the file. Otherwise the first request of a
+    // sequence has to wait for all the others anyway, so use the highest
+    // priority in the sequence.
+    auto REnd = Queue.Requests.end();
+    auto First = REnd;
+    auto FirstCompletion = REnd;
+    RequestPriority Priority = RequestPriority::Background;
+    RequestPriority CompletionPriority = RequestPriority::Background;
+    for (auto R = Queue.Requests.begin(); R != REnd; ++R) {
+      if (R->Kind == RequestKind::Completion) {
+        if (FirstCompletion == REnd)
+          FirstCompletion = R;
+        CompletionPriority = std::max(CompletionPriority, R->Priority);
+        continue;
+      }
+      if (First == REnd || (First->Priority == RequestPriority::Background &&
+                           R->Priority != RequestPriority::Background))
+        First = R;
+      Priority = std::max(Priority, R->Priority);
+    }
+    if (!Queue.IsRunning && First != REnd)
+      Consider(It, First, Priority);
+    if (!Queue.IsRunningCompletion && FirstCompletion != REnd)
+      Consider(It, FirstCompletion, CompletionPriority);
+  }
+
+  // Make sure the picked request is accounted as interactive, if somebody
+  // waits for any of the requests in the queue.
+  if (Best != FileQueues.end()) {
+    BestRequest->Priority = BestPriority;
+    Next = BestRequest;
+  }
+  return Best;
+}
+
 ClangdServer::ClangdServer(GlobalCompilationDatabase &CDB,
                            DiagnosticsConsumer &DiagConsumer,
                            FileSystemProvider &FSProvider,
                            unsigned AsyncThreadsCount, bool SnippetCompletions,
-                           llvm::Optional<StringRef> ResourceDir)
+                           llvm::Optional<StringRef> ResourceDir,
+                           std::size_t ASTMemoryBudget, bool BuildIndex,
+                           unsigned CompletionLimit,
+                           std::chrono::steady_clock::duration UpdateDebounce,
+                           bool CacheFileSystem)
     : CDB(CDB), DiagConsumer(DiagConsumer), FSProvider(FSProvider),
+      Units(ASTMemoryBudget, CacheFileSystem),
       ResourceDir(ResourceDir ? ResourceDir->str() : getStandardResourceDir()),
-      PCHs(std::make_shared<PCHContainerOperations>()),
-      WorkScheduler(AsyncThreadsCount), SnippetCompletions(SnippetCompletions) {
+      PCHs(std::make_shared<PCHContainerOperations>()), BuildIndex(BuildIndex),
+      UpdateDebounce(UpdateDebounce), WorkScheduler(AsyncThreadsCount),
+      SnippetCompletions(SnippetCompletions), CompletionLimit(CompletionLimit) {
 }
 
 std::future<void> ClangdServer::addDocument(PathRef File, StringRef Contents) {
@@ -158,14 +332,32 @@ std::future<void> ClangdServer::addDocument(PathRef File, StringRef Contents) {
   auto TaggedFS = FSProvider.getTaggedFileSystem(File);
   std::shared_ptr<CppFile> Resources =
       Units.getOrCreateFile(File, ResourceDir, CDB, PCHs, TaggedFS.Value);
-  return scheduleReparseAndDiags(File, VersionedDraft{Version, Contents.str()},
+  auto Done = scheduleReparseAndDiags(
+      File, VersionedDraft{Version, PieceTable(Contents)}, std::move(Resources),
+      std::move(TaggedFS));
+  // Opening a file might have loaded a new compilation database.
+  if (BuildIndex)
+    scheduleIndexing();
+  return Done;
+}
+
+llvm::Optional<std::future<void>> ClangdServer::updateDocument(
+    PathRef File, ArrayRef<TextDocumentContentChangeEvent> Changes) {
+  auto NewDraft = DraftMgr.updateDraft(File, Changes);
+  if (!NewDraft)
+    return llvm::None;
+
+  auto TaggedFS = FSProvider.getTaggedFileSystem(File);
+  std::shared_ptr<CppFile> Resources =
+      Units.getOrCreateFile(File, ResourceDir, CDB, PCHs, TaggedFS.Value);
+  return scheduleReparseAndDiags(File, std::move(*NewDraft),
                                  std::move(Resources), std::move(TaggedFS));
 }
 
 std::future<void> ClangdServer::removeDocument(PathRef File) {
   DraftMgr.removeDraft(File);
   std::shared_ptr<CppFile> Resources = Units.removeIfPresent(File);
-  return scheduleCancelRebuild(std::move(Resources));
+  return scheduleCancelRebuild(File, std::move(Resources));
 }
 
 std::future<void> ClangdServer::forceReparse(PathRef File) {
@@ -178,25 +370,56 @@ std::future<void> ClangdServer::forceReparse(PathRef File) {
       File, ResourceDir, CDB, PCHs, TaggedFS.Value);
 
   // Note that std::future from this cleanup action is ignored.
-  scheduleCancelRebuild(std::move(Recreated.RemovedFile));
+  scheduleCancelRebuild(File, std::move(Recreated.RemovedFile));
+  // Headers might have changed, don't reuse the cached files.
+  Recreated.FileInCollection->invalidateFileSystemCache();
   // Schedule a reparse.
   return scheduleReparseAndDiags(File, std::move(FileContents),
                                  std::move(Recreated.FileInCollection),
                                  std::move(TaggedFS));
 }
 
-Tagged<std::vector<CompletionItem>>
+std::vector<std::future<void>>
+ClangdServer::onFilesChanged(ArrayRef<Path> ChangedFiles) {
+  std::vector<std::future<void>> Reparses;
+  // The cache may contain the changed files, or the failed lookups of created
+  // files, even if no file that includes them is reparsed now.
+  Units.invalidateFileSystemCache();
+  for (const Path &File : Units.getFilesByRecentUse()) {
+    std::shared_ptr<CppFile> Resources = Units.getFile(File);
+    if (!Resources)
+      continue; // The file was removed.
+    // Headers, that are only included after the preamble, are not tracked.
+    // Their changes are picked up by the next edit of the file.
+    auto Preamble = Resources->getPossiblyStalePreamble();
+    if (!Preamble || !Preamble->includesAnyOf(ChangedFiles))
+      continue;
+    auto FileContents = DraftMgr.getDraft(File);
+    if (!FileContents.Draft)
+      continue;
+    Reparses.push_back(scheduleReparseAndDiags(
+        File, std::move(FileContents), std::move(Resources),
+        FSProvider.getTaggedFileSystem(File)));
+  }
+  return Reparses;
+}
+
+Tagged<CompletionList>
 ClangdServer::codeComplete(PathRef File, Position Pos,
                            llvm::Optional<StringRef> OverridenContents,
                            IntrusiveRefCntPtr<vfs::FileSystem> *UsedFS) {
   std::string DraftStorage;
+  size_t Offset;
   if (!OverridenContents) {
     auto FileContents = DraftMgr.getDraft(File);
     assert(FileContents.Draft &&
            "codeComplete is called for non-added document");
 
-    DraftStorage = std::move(*FileContents.Draft);
+    DraftStorage = FileContents.Draft->str();
     OverridenContents = DraftStorage;
+    Offset = FileContents.Draft->positionToOffset(Pos);
+  } else {
+    Offset = positionToOffset(*OverridenContents, Pos);
   }
 
   auto TaggedFS = FSProvider.getTaggedFileSystem(File);
@@ -207,25 +430,69 @@ ClangdServer::codeComplete(PathRef File, Position Pos,
   assert(Resources && "Calling completion on non-added file");
 
   auto Preamble = Resources->getPossiblyStalePreamble();
-  std::vector<CompletionItem> Result = clangd::codeComplete(
+  auto CompletionPreamble = Resources->getCompletionPreamble();
+  CompletionList Result = clangd::codeComplete(
       File, Resources->getCompileCommand(),
-      Preamble ? &Preamble->Preamble : nullptr, *OverridenContents, Pos,
-      TaggedFS.Value, PCHs, SnippetCompletions);
+      Preamble ? &Preamble->Preamble : nullptr, CompletionPreamble.get(),
+      *OverridenContents, Pos, Offset, TaggedFS.Value, PCHs,
+      SnippetCompletions, CompletionLimit);
+  scheduleCompletionPreambleBuild(File, *OverridenContents, Offset,
+                                  std::move(Resources));
   return make_tagged(std::move(Result), TaggedFS.Tag);
 }
 
+void ClangdServer::codeComplete(
+    PathRef File, Position Pos, CancellationToken Cancel,
+    std::function<void(Tagged<CompletionList>)> Callback) {
+  auto FileContents = DraftMgr.getDraft(File);
+  assert(FileContents.Draft && "codeComplete is called for non-added document");
+
+  std::shared_ptr<CppFile> Resources = Units.getFile(File);
+  assert(Resources && "Calling completion on non-added file");
+
+  auto DoComplete = [this, Pos, Cancel, Callback](
+      Path File, PieceTable Contents, std::shared_ptr<CppFile> Resources,
+      Tagged<IntrusiveRefCntPtr<vfs::FileSystem>> TaggedFS) {
+    CompletionList Result;
+    // The request might have been cancelled while it was waiting in the queue.
+    if (Cancel.isCancelled()) {
+      Callback(make_tagged(std::move(Result), TaggedFS.Tag));
+      return;
+    }
+    std::string ContentsStr = Contents.str();
+    size_t Offset = Contents.positionToOffset(Pos);
+    auto Preamble = Resources->getPossiblyStalePreamble();
+    auto CompletionPreamble = Resources->getCompletionPreamble();
+    Result = clangd::codeComplete(
+        File, Resources->getCompileCommand(),
+        Preamble ? &Preamble->Preamble : nullptr, CompletionPreamble.get(),
+        ContentsStr, Pos, Offset, TaggedFS.Value, PCHs, SnippetCompletions,
+        CompletionLimit, Cancel);
+    Callback(make_tagged(std::move(Result), TaggedFS.Tag));
+    scheduleCompletionPreambleBuild(File, std::move(ContentsStr), Offset,
+                                    std::move(Resources));
+  };
+
+  // Code completion only needs a preamble, it doesn't wait for the rebuilds of
+  // the file to finish.
+  WorkScheduler.addCompletionRequest(
+      File, RequestPriority::Interactive,
+      std::move(DoComplete), File.str(), std::move(*FileContents.Draft),
+      std::move(Resources), FSProvider.getTaggedFileSystem(File));
+}
+
 std::vector<tooling::Replacement> ClangdServer::formatRange(PathRef File,
                                                             Range Rng) {
-  std::string Code = getDocument(File);
+  PieceTable Draft = getDocument(File);
 
-  size_t Begin = positionToOffset(Code, Rng.start);
-  size_t Len = positionToOffset(Code, Rng.end) - Begin;
-  return formatCode(Code, File, {tooling::Range(Begin, Len)});
+  size_t Begin = Draft.positionToOffset(Rng.start);
+  size_t Len = std::max(Draft.positionToOffset(Rng.end), Begin) - Begin;
+  return formatCode(Draft.str(), File, {tooling::Range(Begin, Len)});
 }
 
 std::vector<tooling::Replacement> ClangdServer::formatFile(PathRef File) {
   // Format everything.
-  std::string Code = getDocument(File);
+  std::string Code = getDocument(File).str();
   return formatCode(Code, File, {tooling::Range(0, Code.size())});
 }
 
@@ -233,8 +500,9 @@ std::vector<tooling::Replacement> ClangdServer::formatOnType(PathRef File,
                                                              Position Pos) {
   // Look for the previous opening brace from the character position and
   // format starting from there.
-  std::string Code = getDocument(File);
-  size_t CursorPos = positionToOffset(Code, Pos);
+  PieceTable Draft = getDocument(File);
+  std::string Code = Draft.str();
+  size_t CursorPos = Draft.positionToOffset(Pos);
   size_t PreviousLBracePos = StringRef(Code).find_last_of('{', CursorPos);
   if (PreviousLBracePos == StringRef::npos)
     PreviousLBracePos = CursorPos;
@@ -243,16 +511,18 @@ std::vector<tooling::Replacement> ClangdServer::formatOnType(PathRef File,
   return formatCode(Code, File, {tooling::Range(PreviousLBracePos, Len)});
 }
 
-std::string ClangdServer::getDocument(PathRef File) {
+PieceTable ClangdServer::getDocument(PathRef File) {
   auto draft = DraftMgr.getDraft(File);
   assert(draft.Draft && "File is not tracked, cannot get contents");
-  return *draft.Draft;
+  return std::move(*draft.Draft);
 }
 
 std::string ClangdServer::dumpAST(PathRef File) {
   std::shared_ptr<CppFile> Resources = Units.getFile(File);
   assert(Resources && "dumpAST is called for non-added document");
 
+  scheduleRebuildIfEvicted(File, Resources);
+  WorkScheduler.boostPriority(File, RequestPriority::Interactive);
   std::string Result;
   Resources->getAST().get()->runUnderLock([&Result](ParsedAST *AST) {
     llvm::raw_string_ostream ResultOS(Result);
@@ -263,6 +533,7 @@ std::string ClangdServer::dumpAST(PathRef File) {
     }
     ResultOS.flush();
   });
+  Units.markASTUsed(File);
   return Result;
 }
 
@@ -277,35 +548,77 @@ Tagged<std::vector<Location>> ClangdServer::findDefinitions(PathRef File,
   std::shared_ptr<CppFile> Resources = Units.getFile(File);
   assert(Resources && "Calling findDefinitions on non-added file");
 
+  scheduleRebuildIfEvicted(File, Resources);
+  // We're about to wait for the AST, make sure its rebuild is not stuck behind
+  // rebuilds of other files.
+  WorkScheduler.boostPriority(File, RequestPriority::Interactive);
   std::vector<Location> Result;
-  Resources->getAST().get()->runUnderLock([Pos, &Result](ParsedAST *AST) {
-    if (!AST)
-      return;
-    Result = clangd::findDefinitions(*AST, Pos);
-  });
+  Resources->getAST().get()->runUnderLock(
+      [this, Pos, &Result](ParsedAST *AST) {
+        if (!AST)
+          return;
+        Result = clangd::findDefinitions(*AST, Pos, &Index);
+      });
+  Units.markASTUsed(File);
   return make_tagged(std::move(Result), TaggedFS.Tag);
 }
 
+llvm::Optional<MemoryUsage> ClangdServer::getMemoryUsage(PathRef File) {
+  // Unlike the other requests, this one is not driven by the editor, so it
+  // might be sent for any file.
+  std::shared_ptr<CppFile> Resources = Units.getFile(File);
+  if (!Resources)
+    return llvm::None;
+
+  MemoryUsage Result;
+  Result.ast = Resources->getASTUsedBytes();
+  Result.astEvicted = Resources->isASTEvicted();
+  Result.completionPreamble = Resources->getCompletionPreambleUsedBytes();
+  return Result;
+}
+
 std::future<void> ClangdServer::scheduleReparseAndDiags(
     PathRef File, VersionedDraft Contents, std::shared_ptr<CppFile> Resources,
     Tagged<IntrusiveRefCntPtr<vfs::FileSystem>> TaggedFS) {
 
   assert(Contents.Draft && "Draft must have contents");
+  DocVersion Version = Contents.Version;
+  Path FileStr = File;
+  VFSTag Tag = TaggedFS.Tag;
+  auto PublishPreambleDiags = [this, FileStr, Version,
+                               Tag](std::vector<DiagWithFixIts> Diags) {
+    // Like the diagnostics of the AST, those of an outdated draft must not
+    // replace the diagnostics of a newer one.
+    if (DraftMgr.getVersion(FileStr) != Version)
+      return;
+    DiagConsumer.onDiagnosticsReady(FileStr,
+                                    make_tagged(std::move(Diags), Tag));
+  };
+  // Nobody waits for the new preamble, the rebuilds of the file use the old one
+  // until it's built. Putting it into the queue of the file makes sure it never
+  // runs concurrently with the rebuilds.
+  auto RunInBackground = [this, FileStr](std::function<void()> Task) {
+    WorkScheduler.addRequest(FileStr, RequestPriority::Background,
+                             std::move(Task));
+  };
+
+  // Contiguous contents are only built if the rebuild actually starts.
+  PieceTable Draft = std::move(*Contents.Draft);
   std::future<llvm::Optional<std::vector<DiagWithFixIts>>> DeferredRebuild =
-      Resources->deferRebuild(*Contents.Draft, TaggedFS.Value);
+      Resources->deferRebuild([Draft]() { return Draft.str(); },
+                              TaggedFS.Value, std::move(PublishPreambleDiags),
+                              std::move(RunInBackground));
   std::promise<void> DonePromise;
   std::future<void> DoneFuture = DonePromise.get_future();
+  // The request might be dropped by WorkScheduler if a newer reparse is
+  // requested before it runs. DoneGuard fulfills DonePromise in that case too.
+  OwningFulfillPromiseGuard DoneGuard(std::move(DonePromise));
 
-  DocVersion Version = Contents.Version;
-  Path FileStr = File;
-  VFSTag Tag = TaggedFS.Tag;
   auto ReparseAndPublishDiags =
       [this, FileStr, Version,
        Tag](std::future<llvm::Optional<std::vector<DiagWithFixIts>>>
                 DeferredRebuild,
-            std::promise<void> DonePromise) -> void {
-    FulfillPromiseGuard Guard(DonePromise);
-
+            OwningFulfillPromiseGuard DoneGuard) -> void {
     auto CurrentVersion = DraftMgr.getVersion(FileStr);
     if (CurrentVersion != Version)
       return; // This request is outdated
@@ -313,17 +626,24 @@ std::future<void> ClangdServer::scheduleReparseAndDiags(
     auto Diags = DeferredRebuild.get();
     if (!Diags)
       return; // A new reparse was requested before this one completed.
+    Units.markASTUsed(FileStr);
     DiagConsumer.onDiagnosticsReady(FileStr,
                                     make_tagged(std::move(*Diags), Tag));
   };
 
-  WorkScheduler.addToFront(std::move(ReparseAndPublishDiags),
-                           std::move(DeferredRebuild), std::move(DonePromise));
+  // Wait a bit before rebuilding, so that a burst of edits results in a single
+  // rebuild. Files that take longer to rebuild wait longer, up to
+  // UpdateDebounce.
+  auto Delay = std::min(UpdateDebounce, Resources->getLastRebuildDuration());
+  WorkScheduler.addDebouncedRequest(
+      File, RequestPriority::Normal, Delay, std::move(ReparseAndPublishDiags),
+      std::move(DeferredRebuild), std::move(DoneGuard));
   return DoneFuture;
 }
 
 std::future<void>
-ClangdServer::scheduleCancelRebuild(std::shared_ptr<CppFile> Resources) {
+ClangdServer::scheduleCancelRebuild(PathRef File,
+                                   std::shared_ptr<CppFile> Resources) {
   std::promise<void> DonePromise;
   std::future<void> DoneFuture = DonePromise.get_future();
   if (!Resources) {
@@ -338,7 +658,80 @@ ClangdServer::scheduleCancelRebuild(std::shared_ptr<CppFile> Resources) {
     FulfillPromiseGuard Guard(DonePromise);
     DeferredCancel.get();
   };
-  WorkScheduler.addToFront(std::move(CancelReparses), std::move(DonePromise),
+  WorkScheduler.addRequest(File, RequestPriority::Background,
+                           std::move(CancelReparses), std::move(DonePromise),
                            std::move(DeferredCancel));
   return DoneFuture;
 }
+
+void ClangdServer::scheduleIndexing() {
+  // Enumerating all files is expensive, only do it if the compilation
+  // databases changed since the last time.
+  unsigned Generation = CDB.getAllFilesGeneration();
+  {
+    std::lock_guard<std::mutex> Lock(IndexingMutex);
+    if (IndexedGeneration && *IndexedGeneration == Generation)
+      return;
+    IndexedGeneration = Generation;
+  } // unlock IndexingMutex
+  // Databases loaded after Generation was read change it again, so their files
+  // are enumerated by a later call if they are missing from this result.
+  std::vector<Path> Files = CDB.getAllFiles();
+
+  std::lock_guard<std::mutex> Lock(IndexingMutex);
+  for (const Path &File : Files) {
+    if (!FilesScheduledForIndexing.insert(File).second)
+      continue;
+
+    auto IndexFile = [this](Path File) {
+      auto TaggedFS = FSProvider.getTaggedFileSystem(File);
+      auto Command = Units.getCompileCommand(CDB, File, ResourceDir);
+      auto AST = clangd::parseFile(File, Command, TaggedFS.Value, PCHs);
+      if (!AST) {
+        Index.remove(File);
+        return;
+      }
+      Index.update(File, collectOccurrences(*AST));
+    };
+    WorkScheduler.addRequest(File, RequestPriority::Background,
+                             std::move(IndexFile), File);
+  }
+}
+
+void ClangdServer::scheduleCompletionPreambleBuild(
+    PathRef File, std::string Contents, size_t Offset,
+    std::shared_ptr<CppFile> Resources) {
+  {
+    std::lock_guard<std::mutex> Lock(CompletionPreamblesMutex);
+    // Completion is requested for almost every typed character. The pending
+    // build will be reused by most of them, so don't queue another one.
+    if (!PendingCompletionPreambles.insert(File).second)
+      return;
+  } // unlock CompletionPreamblesMutex
+
+  auto BuildPreamble = [this, Offset](std::string Contents,
+                                      std::shared_ptr<CppFile> Resources,
+                                      Path File) {
+    Resources->buildCompletionPreamble(
+        Contents, Offset, FSProvider.getTaggedFileSystem(File).Value);
+    std::lock_guard<std::mutex> Lock(CompletionPreamblesMutex);
+    PendingCompletionPreambles.erase(File);
+  };
+  // Put the request into the queue of the file, so that it runs after the
+  // pending rebuilds and doesn't delay the other completion requests.
+  WorkScheduler.addRequest(File, RequestPriority::Background,
+                           std::move(BuildPreamble), std::move(Contents),
+                           std::move(Resources), File.str());
+}
+
+void ClangdServer::scheduleRebuildIfEvicted(
+    PathRef File, std::shared_ptr<CppFile> Resources) {
+  if (!Resources->isASTEvicted())
+    return;
+  auto FileContents = DraftMgr.getDraft(File);
+  assert(FileContents.Draft && "Rebuilding AST for non-added document");
+  // Note that std::future from this rebuild is ignored, callers wait for the
+  // AST instead.
+  scheduleReparseAndDiags(File, std::move(FileContents), std::move(Resources),
+                          FSProvider.getTaggedFileSystem(File));
+}
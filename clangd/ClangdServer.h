@@ -18,12 +18,17 @@
 #include "clang/Tooling/Core/Replacement.h"
 #include "llvm/ADT/IntrusiveRefCntPtr.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 
 #include "ClangdUnit.h"
 #include "Protocol.h"
+#include "SymbolIndex.h"
 
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <string>
@@ -36,12 +41,6 @@ class PCHContainerOperations;
 
 namespace clangd {
 
-/// Turn a [line, column] pair into an offset in Code.
-size_t positionToOffset(StringRef Code, Position P);
-
-/// Turn an offset in Code into a [line, column] pair.
-Position offsetToPosition(StringRef Code, size_t Offset);
-
 /// A tag supplied by the FileSytemProvider.
 typedef std::string VFSTag;
 
@@ -106,64 +105,175 @@ class ClangdServer;
 /// synchronously).
 unsigned getDefaultAsyncThreadsCount();
 
+/// Priorities of requests handled by ClangdScheduler. Requests with higher
+/// priorities are picked up by the worker threads first.
+enum class RequestPriority {
+  /// Cleanup work that nobody is waiting for, e.g. freeing resources of a
+  /// removed file.
+  Background = 0,
+  /// Rebuilds of the edited files and publishing of their diagnostics.
+  Normal = 1,
+  /// Work that the user is waiting for, e.g. a rebuild of the AST needed to
+  /// answer a go-to-definition request.
+  Interactive = 2,
+};
+
 /// Handles running WorkerRequests of ClangdServer on a number of worker
 /// threads.
+/// Requests are kept in a separate queue for each file. Requests for the same
+/// file are run in the order they were added and never run concurrently.
+/// Among the files that have pending requests, the worker threads pick the
+/// file with the highest priority first. Requests with priorities lower than
+/// RequestPriority::Interactive never occupy all of the worker threads, so
+/// that there is always a worker available for interactive requests.
+/// Requests with RequestPriority::Background, e.g. indexing, don't delay the
+/// other requests for the same file, which may run before them. Completion
+/// requests, added by addCompletionRequest, are run in order with each other,
+/// but independently of the other requests for the same file.
 class ClangdScheduler {
 public:
-  /// If \p AsyncThreadsCount is 0, requests added using addToFront and addToEnd
-  /// will be processed synchronously on the calling thread.
+  /// If \p AsyncThreadsCount is 0, requests added using addRequest and
+  /// addSupersedingRequest will be processed synchronously on the calling
+  /// thread.
   // Otherwise, \p AsyncThreadsCount threads will be created to schedule the
   // requests.
   ClangdScheduler(unsigned AsyncThreadsCount);
   ~ClangdScheduler();
 
-  /// Add a new request to run function \p F with args \p As to the start of the
-  /// queue. The request will be run on a separate thread.
+  /// Add a new request to run function \p F with args \p As to the end of the
+  /// queue of \p File. The request will be run on a separate thread.
   template <class Func, class... Args>
-  void addToFront(Func &&F, Args &&... As) {
+  void addRequest(PathRef File, RequestPriority Priority, Func &&F,
+                  Args &&... As) {
     if (RunSynchronously) {
       std::forward<Func>(F)(std::forward<Args>(As)...);
       return;
     }
+    enqueue(File, Priority, RequestKind::Ordered,
+            std::chrono::steady_clock::duration::zero(),
+            std::async(std::launch::deferred, std::forward<Func>(F),
+                       std::forward<Args>(As)...));
+  }
 
-    {
-      std::lock_guard<std::mutex> Lock(Mutex);
-      RequestQueue.push_front(std::async(std::launch::deferred,
-                                         std::forward<Func>(F),
-                                         std::forward<Args>(As)...));
-    }
-    RequestCV.notify_one();
+  /// Similar to addRequest, but also drops all pending requests for \p File
+  /// that were added by addSupersedingRequest and did not start running yet.
+  /// Dropped requests are destroyed without being run, so their arguments
+  /// must not rely on the request being run to release resources.
+  template <class Func, class... Args>
+  void addSupersedingRequest(PathRef File, RequestPriority Priority, Func &&F,
+                             Args &&... As) {
+    addDebouncedRequest(File, Priority,
+                        std::chrono::steady_clock::duration::zero(),
+                        std::forward<Func>(F), std::forward<Args>(As)...);
   }
 
-  /// Add a new request to run function \p F with args \p As to the end of the
-  /// queue. The request will be run on a separate thread.
-  template <class Func, class... Args> void addToEnd(Func &&F, Args &&... As) {
+  /// Similar to addSupersedingRequest, but the request does not start until
+  /// \p Delay passes. Requests added in quick succession are thus coalesced
+  /// into the last one. The delay is ignored once the priority of the request
+  /// is boosted to RequestPriority::Interactive, i.e. somebody waits for it.
+  template <class Func, class... Args>
+  void addDebouncedRequest(PathRef File, RequestPriority Priority,
+                           std::chrono::steady_clock::duration Delay, Func &&F,
+                           Args &&... As) {
     if (RunSynchronously) {
       std::forward<Func>(F)(std::forward<Args>(As)...);
       return;
     }
+    enqueue(File, Priority, RequestKind::Supersedable, Delay,
+            std::async(std::launch::deferred, std::forward<Func>(F),
+                       std::forward<Args>(As)...));
+  }
 
-    {
-      std::lock_guard<std::mutex> Lock(Mutex);
-      RequestQueue.push_back(std::async(std::launch::deferred,
-                                        std::forward<Func>(F),
-                                        std::forward<Args>(As)...));
+  /// Similar to addRequest, but the request doesn't wait for the pending
+  /// requests for \p File, except for the completion requests, and may run
+  /// concurrently with them. Used for code completion, which only needs the
+  /// latest available preamble of the file, not the results of its pending
+  /// rebuilds.
+  template <class Func, class... Args>
+  void addCompletionRequest(PathRef File, RequestPriority Priority, Func &&F,
+                            Args &&... As) {
+    if (RunSynchronously) {
+      std::forward<Func>(F)(std::forward<Args>(As)...);
+      return;
     }
-    RequestCV.notify_one();
+    enqueue(File, Priority, RequestKind::Completion,
+            std::chrono::steady_clock::duration::zero(),
+            std::async(std::launch::deferred, std::forward<Func>(F),
+                       std::forward<Args>(As)...));
   }
 
+  /// Raise priority of all pending requests for \p File, except the
+  /// background ones, to at least \p Priority. Used when the caller is about to
+  /// block on the results of those requests.
+  void boostPriority(PathRef File, RequestPriority Priority);
+
 private:
+  enum class RequestKind {
+    /// Added by addRequest.
+    Ordered,
+    /// Added by addSupersedingRequest and addDebouncedRequest.
+    Supersedable,
+    /// Added by addCompletionRequest.
+    Completion,
+  };
+
+  /// A request, waiting in the queue of a file. Action is an async computation
+  /// (i.e. result of calling std::async(std::launch::deferred, ...)).
+  struct Request {
+    std::future<void> Action;
+    RequestPriority Priority;
+    RequestKind Kind;
+    /// Time when the request was added to the queue.
+    std::chrono::steady_clock::time_point Enqueued;
+    /// The request must not start before this time, unless it is interactive.
+    std::chrono::steady_clock::time_point NotBefore;
+    /// Order in which requests were added, used to break ties between files
+    /// with the same priority.
+    unsigned long long Sequence;
+  };
+
+  /// Pending requests for a single file.
+  struct FileQueue {
+    std::deque<Request> Requests;
+    /// Set to true while a worker thread is running a request for this file,
+    /// other than a completion request.
+    bool IsRunning = false;
+    /// Set to true while a worker thread is running a completion request for
+    /// this file.
+    bool IsRunningCompletion = false;
+  };
+
+  void enqueue(PathRef File, RequestPriority Priority, RequestKind Kind,
+               std::chrono::steady_clock::duration Delay,
+               std::future<void> Action);
+
+  /// Finds a queue with the request that should be run next and sets \p Next
+  /// to that request, or returns FileQueues.end() if no requests can be run
+  /// right now. If some requests can't run only because they are delayed, sets
+  /// \p WakeUpTime to the time when the first of them may run. Must be called
+  /// while holding Mutex.
+  llvm::StringMap<FileQueue>::iterator
+  pickNextQueue(std::deque<Request>::iterator &Next,
+                std::chrono::steady_clock::time_point &WakeUpTime);
+
   bool RunSynchronously;
+  /// Maximal number of workers that may run non-interactive requests at the
+  /// same time.
+  unsigned MaxNonInteractiveWorkers = 0;
   std::mutex Mutex;
   /// We run some tasks on separate threads(parsing, CppFile cleanup).
-  /// These threads looks into RequestQueue to find requests to handle and
+  /// These threads looks into FileQueues to find requests to handle and
   /// terminate when Done is set to true.
   std::vector<std::thread> Workers;
   /// Setting Done to true will make the worker threads terminate.
   bool Done = false;
-  /// A queue of requests. Elements of this vector are async computations (i.e.
-  /// results of calling std::async(std::launch::deferred, ...)).
-  std::deque<std::future<void>> RequestQueue;
+  /// Queues of pending requests, keyed by file name. Queues are removed when
+  /// they become empty and no requests for them are running.
+  llvm::StringMap<FileQueue> FileQueues;
+  /// Number of workers currently running non-interactive requests.
+  unsigned RunningNonInteractive = 0;
+  /// Sequence number of the next added request.
+  unsigned long long NextSequence = 0;
   /// Condition variable to wake up worker threads.
   std::condition_variable RequestCV;
 };
@@ -201,11 +311,39 @@ public:
   /// \p DiagConsumer. Note that a callback to \p DiagConsumer happens on a
   /// worker thread. Therefore, instances of \p DiagConsumer must properly
   /// synchronize access to shared state.
+  ///
+  /// ClangdServer keeps the total size of ASTs and completion preambles of all
+  /// files under \p ASTMemoryBudget bytes by evicting them for the least
+  /// recently used files. Evicted ASTs are rebuilt when they are needed again.
+  /// If \p ASTMemoryBudget is 0, ASTs are never evicted.
+  ///
+  /// If \p BuildIndex is true, ClangdServer indexes all files, known to \p
+  /// CDB, on background worker threads. The index is used to find definitions
+  /// in other translation units.
+  ///
+  /// Code completion returns at most \p CompletionLimit best matching items.
+  /// If \p CompletionLimit is 0, all matching items are returned.
+  ///
+  /// Rebuilds after an edit are delayed by the time the previous rebuild of
+  /// the file took, but no longer than \p UpdateDebounce. Edits that arrive
+  /// during the delay are coalesced into a single rebuild.
+  ///
+  /// If \p CacheFileSystem is true, the results of stat() calls and the
+  /// contents of headers are cached between the rebuilds of all files. The
+  /// cached headers count towards \p ASTMemoryBudget. The cached results are
+  /// only dropped by forceReparse(), onFilesChanged() and when they exceed the
+  /// budget, so this should only be enabled if the client reports changes to
+  /// the files.
   ClangdServer(GlobalCompilationDatabase &CDB,
                DiagnosticsConsumer &DiagConsumer,
                FileSystemProvider &FSProvider, unsigned AsyncThreadsCount,
                bool SnippetCompletions,
-               llvm::Optional<StringRef> ResourceDir = llvm::None);
+               llvm::Optional<StringRef> ResourceDir = llvm::None,
+               std::size_t ASTMemoryBudget = 0, bool BuildIndex = false,
+               unsigned CompletionLimit = 0,
+               std::chrono::steady_clock::duration UpdateDebounce =
+                   std::chrono::steady_clock::duration::zero(),
+               bool CacheFileSystem = false);
 
   /// Add a \p File to the list of tracked C++ files or update the contents if
   /// \p File is already tracked. Also schedules parsing of the AST for it on a
@@ -214,6 +352,15 @@ public:
   /// \return A future that will become ready when the rebuild (including
   /// diagnostics) is finished.
   std::future<void> addDocument(PathRef File, StringRef Contents);
+  /// Apply incremental \p Changes to the contents of \p File, which must be
+  /// already tracked. Reparsing is scheduled in the same way as in
+  /// addDocument. The whole contents of the file are only built right before
+  /// the reparse actually starts.
+  /// \return A future that will become ready when the rebuild (including
+  /// diagnostics) is finished, or None if \p Changes could not be applied.
+  llvm::Optional<std::future<void>>
+  updateDocument(PathRef File,
+                 ArrayRef<TextDocumentContentChangeEvent> Changes);
   /// Remove \p File from list of tracked files, schedule a request to free
   /// resources associated with it.
   /// \return A future that will become ready when the file is removed and all
@@ -224,6 +371,12 @@ public:
   /// for \p File has changed. If it has, will remove currently stored Preamble
   /// and AST and rebuild them from scratch.
   std::future<void> forceReparse(PathRef File);
+  /// Reparse the tracked files, whose preambles include any of \p
+  /// ChangedFiles, e.g. after a header was saved. \p ChangedFiles must be
+  /// absolute paths. The reparses of the most recently used files are
+  /// scheduled first.
+  /// \return Futures that will become ready when the reparses are finished.
+  std::vector<std::future<void>> onFilesChanged(ArrayRef<Path> ChangedFiles);
 
   /// Run code completion for \p File at \p Pos. If \p OverridenContents is not
   /// None, they will used only for code completion, i.e. no diagnostics update
@@ -234,10 +387,21 @@ public:
   /// for completion.
   /// This method should only be called for currently tracked
   /// files.
-  Tagged<std::vector<CompletionItem>>
+  Tagged<CompletionList>
   codeComplete(PathRef File, Position Pos,
                llvm::Optional<StringRef> OverridenContents = llvm::None,
                IntrusiveRefCntPtr<vfs::FileSystem> *UsedFS = nullptr);
+  /// Run code completion for \p File at \p Pos on a worker thread and pass
+  /// the results to \p Callback on that thread. The current draft of \p File
+  /// is used. Completion requests don't wait for the pending rebuilds of \p
+  /// File, they use the latest available preamble instead.
+  /// If \p Cancel is cancelled before completion finishes, completion stops
+  /// early and \p Callback receives incomplete results that should be
+  /// discarded.
+  /// This method should only be called for currently tracked files.
+  void codeComplete(
+      PathRef File, Position Pos, CancellationToken Cancel,
+      std::function<void(Tagged<CompletionList>)> Callback);
   /// Get definition of symbol at a specified \p Line and \p Column in \p File.
   Tagged<std::vector<Location>> findDefinitions(PathRef File, Position Pos);
 
@@ -249,10 +413,15 @@ public:
   std::vector<tooling::Replacement> formatOnType(PathRef File, Position Pos);
 
   /// Gets current document contents for \p File. \p File must point to a
-  /// currently tracked file.
+  /// currently tracked file. The returned PieceTable shares buffers with the
+  /// stored draft and can be used for fast offset-to-Position conversions.
   /// FIXME(ibiryukov): This function is here to allow offset-to-Position
   /// conversions in outside code, maybe there's a way to get rid of it.
-  std::string getDocument(PathRef File);
+  PieceTable getDocument(PathRef File);
+
+  /// Get memory usage of the resources, kept for \p File. Returns None if \p
+  /// File is not tracked.
+  llvm::Optional<MemoryUsage> getMemoryUsage(PathRef File);
 
   /// Only for testing purposes.
   /// Waits until all requests to worker thread are finished and dumps AST for
@@ -265,7 +434,24 @@ private:
                           std::shared_ptr<CppFile> Resources,
                           Tagged<IntrusiveRefCntPtr<vfs::FileSystem>> TaggedFS);
 
-  std::future<void> scheduleCancelRebuild(std::shared_ptr<CppFile> Resources);
+  std::future<void> scheduleCancelRebuild(PathRef File,
+                                          std::shared_ptr<CppFile> Resources);
+
+  /// Schedules indexing of the files, known to CDB, that were not indexed yet.
+  void scheduleIndexing();
+
+  /// Schedules a rebuild of the AST for \p File if it was evicted to save
+  /// memory.
+  void scheduleRebuildIfEvicted(PathRef File,
+                                std::shared_ptr<CppFile> Resources);
+
+  /// Schedules building a preamble that speeds up further completion requests
+  /// around \p Offset in \p Contents of \p File. See
+  /// CppFile::buildCompletionPreamble. Does nothing if a build for \p File is
+  /// already pending.
+  void scheduleCompletionPreambleBuild(PathRef File, std::string Contents,
+                                       size_t Offset,
+                                       std::shared_ptr<CppFile> Resources);
 
   GlobalCompilationDatabase &CDB;
   DiagnosticsConsumer &DiagConsumer;
@@ -274,11 +460,26 @@ private:
   CppFileCollection Units;
   std::string ResourceDir;
   std::shared_ptr<PCHContainerOperations> PCHs;
+  SymbolIndex Index;
+  bool BuildIndex;
+  std::chrono::steady_clock::duration UpdateDebounce;
+  std::mutex IndexingMutex;
+  /// Files that were already scheduled for indexing. Guarded by
+  /// IndexingMutex.
+  llvm::StringSet<> FilesScheduledForIndexing;
+  /// The CDB.getAllFilesGeneration() that the files were last enumerated for.
+  /// Guarded by IndexingMutex.
+  llvm::Optional<unsigned> IndexedGeneration;
+  std::mutex CompletionPreamblesMutex;
+  /// Files with a pending completion preamble build. Guarded by
+  /// CompletionPreamblesMutex.
+  llvm::StringSet<> PendingCompletionPreambles;
   // WorkScheduler has to be the last member, because its destructor has to be
   // called before all other members to stop the worker thread that references
   // ClangdServer
   ClangdScheduler WorkScheduler;
   bool SnippetCompletions;
+  unsigned CompletionLimit;
 };
 
 } // namespace clangd
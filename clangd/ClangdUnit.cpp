@@ -8,13 +8,22 @@
 //===---------------------------------------------------------------------===//
 
 #include "ClangdUnit.h"
-
+#include "DraftStore.h"
+#include "PreambleCache.h"
+#include "SymbolIndex.h"
+#include "Trace.h"
+
+#include "clang/AST/DeclCXX.h"
+#include "clang/Basic/CharInfo.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceManager.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/CompilerInvocation.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/Utils.h"
 #include "clang/Index/IndexDataConsumer.h"
 #include "clang/Index/IndexingAction.h"
+#include "clang/Index/USRGeneration.h"
 #include "clang/Lex/Lexer.h"
 #include "clang/Lex/MacroInfo.h"
 #include "clang/Lex/Preprocessor.h"
@@ -23,18 +32,49 @@
 #include "clang/Serialization/ASTWriter.h"
 #include "clang/Tooling/CompilationDatabase.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/CrashRecoveryContext.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
 
 #include <algorithm>
 #include <chrono>
+#include <tuple>
 
 using namespace clang::clangd;
 using namespace clang;
 
+Position clangd::sourceLocToPosition(const SourceManager &SM,
+                                     SourceLocation Loc) {
+  std::pair<FileID, unsigned> Decomposed = SM.getDecomposedSpellingLoc(Loc);
+  StringRef LinePrefix =
+      SM.getBufferData(Decomposed.first).take_front(Decomposed.second);
+  size_t LineStart = LinePrefix.rfind('\n');
+  if (LineStart != StringRef::npos)
+    LinePrefix = LinePrefix.drop_front(LineStart + 1);
+
+  Position P;
+  P.line = SM.getLineNumber(Decomposed.first, Decomposed.second) - 1;
+  P.character = getUTF16Length(LinePrefix);
+  return P;
+}
+
 namespace {
 
+/// Converts \p Pos, received from the client, to a location in \p FE. The
+/// column of \p Pos is measured in UTF-16 code units, clang measures columns
+/// in bytes.
+SourceLocation positionToSourceLoc(const SourceManager &SM, const FileEntry *FE,
+                                   Position Pos) {
+  SourceLocation LineStart = SM.translateFileLineCol(FE, Pos.line + 1, 1);
+  std::pair<FileID, unsigned> Decomposed = SM.getDecomposedLoc(LineStart);
+  StringRef Line = SM.getBufferData(Decomposed.first)
+                       .drop_front(Decomposed.second)
+                       .take_until([](char C) { return C == '\n'; });
+  return LineStart.getLocWithOffset(getByteOffsetOfColumn(Line, Pos.character));
+}
+
 class DeclTrackingASTConsumer : public ASTConsumer {
 public:
   DeclTrackingASTConsumer(std::vector<const Decl *> &TopLevelDecls)
@@ -77,6 +117,26 @@ public:
     return std::move(TopLevelDeclIDs);
   }
 
+  std::vector<Path> takeIncludes() { return std::move(Includes); }
+
+  void AfterExecute(CompilerInstance &CI) override {
+    // All files, that were read by the preprocessor, are in the SourceManager.
+    SourceManager &SM = CI.getSourceManager();
+    const FileEntry *MainFile = SM.getFileEntryForID(SM.getMainFileID());
+    for (auto It = SM.fileinfo_begin(), End = SM.fileinfo_end(); It != End;
+         ++It) {
+      if (It->first == MainFile)
+        continue;
+      llvm::SmallString<128> Include(It->first->getName());
+      CI.getFileManager().makeAbsolutePath(Include);
+      llvm::sys::path::remove_dots(Include, /*remove_dot_dot=*/true);
+      Includes.push_back(Include.str());
+    }
+    std::sort(Includes.begin(), Includes.end());
+    Includes.erase(std::unique(Includes.begin(), Includes.end()),
+                   Includes.end());
+  }
+
   void AfterPCHEmitted(ASTWriter &Writer) override {
     TopLevelDeclIDs.reserve(TopLevelDecls.size());
     for (Decl *D : TopLevelDecls) {
@@ -98,6 +158,7 @@ public:
 private:
   std::vector<Decl *> TopLevelDecls;
   std::vector<serialization::DeclID> TopLevelDeclIDs;
+  std::vector<Path> Includes;
 };
 
 /// Convert from clang diagnostic level to LSP severity.
@@ -123,9 +184,10 @@ llvm::Optional<DiagWithFixIts> toClangdDiag(StoredDiagnostic D) {
   if (!Location.isValid() || !Location.getManager().isInMainFile(Location))
     return llvm::None;
 
-  Position P;
-  P.line = Location.getSpellingLineNumber() - 1;
-  P.character = Location.getSpellingColumnNumber();
+  Position P = sourceLocToPosition(Location.getManager(), Location);
+  // FIXME: diagnostics have always been reported one column to the right of
+  // their location, clients and tests depend on it.
+  ++P.character;
   Range R = {P, P};
   clangd::Diagnostic Diag = {R, getSeverity(D.getLevel()), D.getMessage()};
 
@@ -230,6 +292,147 @@ prepareCompilerInstance(std::unique_ptr<clang::CompilerInvocation> CI,
   return Clang;
 }
 
+/// Completion preambles are only built if they cover at least this many bytes
+/// of the main file in addition to the regular preamble. Parsing that little
+/// code is faster than loading a separate PCH.
+const size_t MinCompletionPreambleGrowth = 4 * 1024;
+
+/// Where a completion preamble ends, see findCompletionPreambleEnd.
+struct CompletionPreambleCut {
+  /// Offset in the main file, 0 if no preamble can be built.
+  size_t End = 0;
+  /// Number of braces, that are open at End.
+  unsigned OpenBraces = 0;
+  /// The text, that opened them, e.g. "namespace ns {".
+  std::string Reopening;
+};
+
+/// Returns the offset of the start of the line, that contains \p Offset.
+size_t getLineStartOffset(StringRef Text, size_t Offset) {
+  size_t LineStart = Text.rfind('\n', Offset);
+  return LineStart == StringRef::npos ? 0 : LineStart + 1;
+}
+
+template <typename DeclRange>
+size_t findCutInDecls(const DeclRange &Decls, size_t ScopeBegin,
+                      size_t Offset, const SourceManager &SM,
+                      const LangOptions &LangOpts, CompletionPreambleCut &Cut);
+
+/// If \p Offset is inside the braces of the namespace or linkage
+/// specification \p D, which begins at \p DeclBegin, returns the cut inside
+/// it and adds its braces to \p Cut. Returns 0 otherwise.
+size_t findCutInScope(const Decl *D, size_t DeclBegin, size_t ScopeBegin,
+                      size_t Offset, const SourceManager &SM,
+                      const LangOptions &LangOpts,
+                      CompletionPreambleCut &Cut) {
+  SourceLocation RBrace;
+  if (const auto *Namespace = dyn_cast<NamespaceDecl>(D))
+    RBrace = Namespace->getRBraceLoc();
+  else if (const auto *Linkage = dyn_cast<LinkageSpecDecl>(D))
+    RBrace = Linkage->hasBraces() ? Linkage->getRBraceLoc() : SourceLocation();
+  if (RBrace.isInvalid() || !RBrace.isFileID() ||
+      !SM.isWrittenInMainFile(RBrace) || SM.getFileOffset(RBrace) < Offset)
+    return 0;
+
+  StringRef Text = SM.getBufferData(SM.getMainFileID());
+  size_t LBrace = Text.find('{', DeclBegin);
+  if (LBrace == StringRef::npos || LBrace >= Offset)
+    return 0;
+  size_t InnerBegin = LBrace + 1;
+  // Nested namespace definitions, like "namespace a::b {", share the braces
+  // with the namespace that contains them.
+  if (InnerBegin == ScopeBegin)
+    return findCutInDecls(cast<DeclContext>(D)->decls(), ScopeBegin, Offset,
+                          SM, LangOpts, Cut);
+
+  size_t End = findCutInDecls(cast<DeclContext>(D)->decls(), InnerBegin,
+                              Offset, SM, LangOpts, Cut);
+  if (End == 0)
+    return 0;
+  ++Cut.OpenBraces;
+  Cut.Reopening =
+      (Text.slice(DeclBegin, InnerBegin) + " " + Cut.Reopening).str();
+  return End;
+}
+
+/// Returns the start of the line where the declaration of \p Decls, that
+/// contains \p Offset (or the first one after it), begins. Without such a
+/// declaration, returns the start of the line after the last declaration
+/// before \p Offset. Returns 0 if that line also contains a part of the
+/// previous declaration or \p ScopeBegin, the start of the scope of \p Decls.
+template <typename DeclRange>
+size_t findCutInDecls(const DeclRange &Decls, size_t ScopeBegin,
+                      size_t Offset, const SourceManager &SM,
+                      const LangOptions &LangOpts,
+                      CompletionPreambleCut &Cut) {
+  StringRef Text = SM.getBufferData(SM.getMainFileID());
+  size_t PrevDeclEnd = ScopeBegin;
+  for (const Decl *D : Decls) {
+    SourceLocation Begin = SM.getExpansionLoc(D->getLocStart());
+    SourceLocation End = Lexer::getLocForEndOfToken(
+        SM.getExpansionRange(D->getLocEnd()).second, 0, SM, LangOpts);
+    if (!SM.isWrittenInMainFile(Begin) || !SM.isWrittenInMainFile(End))
+      continue;
+    size_t DeclEnd = SM.getFileOffset(End);
+    if (DeclEnd < Offset) {
+      PrevDeclEnd = std::max(PrevDeclEnd, DeclEnd);
+      continue;
+    }
+    size_t DeclBegin = SM.getFileOffset(Begin);
+    if (DeclBegin < Offset)
+      if (size_t InnerEnd = findCutInScope(D, DeclBegin, ScopeBegin, Offset,
+                                           SM, LangOpts, Cut))
+        return InnerEnd;
+    size_t LineStart = getLineStartOffset(Text, std::min(DeclBegin, Offset));
+    return LineStart > PrevDeclEnd ? LineStart : 0;
+  }
+  size_t LineEnd = Text.find('\n', PrevDeclEnd);
+  if (PrevDeclEnd == ScopeBegin || LineEnd >= Offset)
+    return 0;
+  return LineEnd + 1;
+}
+
+/// Finds the end of a completion preamble for completion at \p Offset in \p
+/// AST. The preamble ends at the start of the line where the declaration that
+/// contains \p Offset (or the first one after it) begins, or 0 if that line
+/// also contains a part of the previous declaration.
+/// The preamble is parsed as if the file ended where it ends, so if \p Offset
+/// is inside namespaces or extern "C" blocks, the declarations inside them
+/// are used and their braces are returned in the cut, to be closed at the end
+/// of the preamble and reopened after it. If no declaration inside them can
+/// be used, the preamble ends before the outermost of them.
+CompletionPreambleCut findCompletionPreambleEnd(ParsedAST &AST, size_t Offset) {
+  const SourceManager &SM = AST.getASTContext().getSourceManager();
+  CompletionPreambleCut Cut;
+  Cut.End = findCutInDecls(AST.getParsedTopLevelDecls(), /*ScopeBegin=*/0,
+                           Offset, SM, AST.getASTContext().getLangOpts(), Cut);
+  return Cut;
+}
+
+/// Builds a preamble of \p Contents, covering \p Bounds. Returns null if the
+/// preamble could not be built.
+std::shared_ptr<const PreambleData>
+buildPreamble(CompilerInvocation &CI, const llvm::MemoryBuffer *Contents,
+              const PreambleBounds &Bounds,
+              IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+              std::shared_ptr<PCHContainerOperations> PCHs) {
+  trace::Span Tracer("BuildPreamble");
+  std::vector<DiagWithFixIts> PreambleDiags;
+  StoreDiagsConsumer PreambleDiagnosticsConsumer(/*ref*/ PreambleDiags);
+  IntrusiveRefCntPtr<DiagnosticsEngine> PreambleDiagsEngine =
+      CompilerInstance::createDiagnostics(&CI.getDiagnosticOpts(),
+                                          &PreambleDiagnosticsConsumer, false);
+  CppFilePreambleCallbacks SerializedDeclsCollector;
+  auto BuiltPreamble =
+      PrecompiledPreamble::Build(CI, Contents, Bounds, *PreambleDiagsEngine,
+                                 VFS, PCHs, SerializedDeclsCollector);
+  if (!BuiltPreamble)
+    return nullptr;
+  return std::make_shared<PreambleData>(
+      std::move(*BuiltPreamble), SerializedDeclsCollector.takeTopLevelDeclIDs(),
+      std::move(PreambleDiags), SerializedDeclsCollector.takeIncludes());
+}
+
 template <class T> bool futureIsReady(std::shared_future<T> const &Future) {
   return Future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
 }
@@ -292,27 +495,133 @@ std::string escapeSnippet(const llvm::StringRef Text) {
   return Result;
 }
 
+/// Returns the identifier that was typed right before \p Offset. Completion
+/// results are filtered and ranked by it.
+StringRef getCompletionPrefix(StringRef Contents, size_t Offset) {
+  size_t Begin = Offset;
+  while (Begin > 0 && isIdentifierBody(Contents[Begin - 1]))
+    --Begin;
+  return Contents.slice(Begin, Offset);
+}
+
+/// Returns the text that the user is expected to type for \p Result, i.e. the
+/// CK_TypedText chunk of its completion string, without building the string.
+std::string getTypedText(const CodeCompletionResult &Result) {
+  switch (Result.Kind) {
+  case CodeCompletionResult::RK_Declaration: {
+    DeclarationName Name = Result.Declaration->getDeclName();
+    if (IdentifierInfo *II = Name.getAsIdentifierInfo())
+      return II->getName();
+    return Name.getAsString();
+  }
+  case CodeCompletionResult::RK_Keyword:
+    return Result.Keyword;
+  case CodeCompletionResult::RK_Macro:
+    return Result.Macro->getName();
+  case CodeCompletionResult::RK_Pattern:
+    if (const char *Text = Result.Pattern->getTypedText())
+      return Text;
+    return std::string();
+  }
+  llvm_unreachable("Unknown CodeCompletionResult kind");
+}
+
+// Penalties added to the priority of the results that match the typed prefix
+// only partially. Priorities of clang's results are mostly in the 0-80 range,
+// so these are big enough to move worse matches after the better ones of the
+// same kind, but don't bury good declarations behind, say, exact macro matches.
+const unsigned CaseMismatchPenalty = 5;
+const unsigned WordStartsMatchPenalty = 15;
+const unsigned SubsequenceMatchPenalty = 30;
+
+bool isWordStart(StringRef Text, size_t I) {
+  if (I == 0)
+    return true;
+  char Prev = Text[I - 1], Cur = Text[I];
+  return (Prev == '_' && Cur != '_') || (isLowercase(Prev) && isUppercase(Cur));
+}
+
+/// Matches the \p Prefix typed by the user against the \p TypedText of a
+/// completion result. Returns None if the result should be dropped, otherwise
+/// a penalty for the quality of the match, lower is better.
+llvm::Optional<unsigned> matchPrefix(StringRef Prefix, StringRef TypedText) {
+  if (TypedText.startswith(Prefix))
+    return 0;
+  if (TypedText.startswith_lower(Prefix))
+    return CaseMismatchPenalty;
+  // Allow the characters of the prefix to be spread out in the text, e.g.
+  // 'gCC' for 'getCodeCompletions'. Matches that only skip to the beginnings
+  // of words are ranked higher than arbitrary subsequences.
+  bool OnlyWordStarts = true;
+  size_t Pos = 0;
+  for (char C : Prefix) {
+    size_t Match = Pos;
+    while (Match < TypedText.size() &&
+           toLowercase(TypedText[Match]) != toLowercase(C))
+      ++Match;
+    if (Match == TypedText.size())
+      return llvm::None;
+    if (Match != Pos && !isWordStart(TypedText, Match))
+      OnlyWordStarts = false;
+    Pos = Match + 1;
+  }
+  return OnlyWordStarts ? WordStartsMatchPenalty : SubsequenceMatchPenalty;
+}
+
 class CompletionItemsCollector : public CodeCompleteConsumer {
 
 public:
   CompletionItemsCollector(const CodeCompleteOptions &CodeCompleteOpts,
-                           std::vector<CompletionItem> &Items)
+                           StringRef Prefix, unsigned Limit,
+                           CompletionList &Items, CancellationToken Cancel)
       : CodeCompleteConsumer(CodeCompleteOpts, /*OutputIsBinary=*/false),
-        Items(Items),
+        Prefix(Prefix), Limit(Limit), Items(Items), Cancel(std::move(Cancel)),
         Allocator(std::make_shared<clang::GlobalCodeCompletionAllocator>()),
         CCTUInfo(Allocator) {}
 
   void ProcessCodeCompleteResults(Sema &S, CodeCompletionContext Context,
                                   CodeCompletionResult *Results,
                                   unsigned NumResults) override final {
-    Items.reserve(NumResults);
+    if (Cancel.isCancelled())
+      return;
+
+    // Building completion strings takes a while, so rank the results by their
+    // names first and only build the strings for the ones we return.
+    std::vector<RankedResult> Ranked;
+    Ranked.reserve(NumResults);
     for (unsigned I = 0; I < NumResults; ++I) {
-      auto &Result = Results[I];
+      std::string TypedText = getTypedText(Results[I]);
+      auto Penalty = matchPrefix(Prefix, TypedText);
+      if (!Penalty)
+        continue;
+      Ranked.push_back(
+          {Results[I].Priority + *Penalty, std::move(TypedText), I});
+    }
+
+    auto RankedEnd = Ranked.end();
+    if (Limit != 0 && Ranked.size() > Limit) {
+      Items.isIncomplete = true;
+      RankedEnd = Ranked.begin() + Limit;
+    }
+    std::partial_sort(Ranked.begin(), RankedEnd, Ranked.end(),
+                      [](const RankedResult &L, const RankedResult &R) {
+                        return std::tie(L.Score, L.TypedText) <
+                               std::tie(R.Score, R.TypedText);
+                      });
+
+    Items.items.reserve(RankedEnd - Ranked.begin());
+    for (auto It = Ranked.begin(); It != RankedEnd; ++It) {
+      // Don't bother finishing if nobody waits for the results.
+      if (Cancel.isCancelled()) {
+        Items.items.clear();
+        return;
+      }
+      auto &Result = Results[It->Index];
       const auto *CCS = Result.CreateCodeCompletionString(
           S, Context, *Allocator, CCTUInfo,
           CodeCompleteOpts.IncludeBriefComments);
       assert(CCS && "Expected the CodeCompletionString to be non-null");
-      Items.push_back(ProcessCodeCompleteResult(Result, *CCS));
+      Items.items.push_back(ProcessCodeCompleteResult(Result, *CCS, It->Score));
     }
   }
 
@@ -321,9 +630,19 @@ public:
   CodeCompletionTUInfo &getCodeCompletionTUInfo() override { return CCTUInfo; }
 
 private:
-  CompletionItem
-  ProcessCodeCompleteResult(const CodeCompletionResult &Result,
-                            const CodeCompletionString &CCS) const {
+  /// A result that matched the typed prefix.
+  struct RankedResult {
+    /// Priority of the result, adjusted by the quality of the match. Lower is
+    /// better.
+    unsigned Score;
+    std::string TypedText;
+    /// Index into the results that Sema produced.
+    unsigned Index;
+  };
+
+  CompletionItem ProcessCodeCompleteResult(const CodeCompletionResult &Result,
+                                           const CodeCompletionString &CCS,
+                                           unsigned Score) const {
 
     // Adjust this to InsertTextFormat::Snippet iff we encounter a
     // CK_Placeholder chunk in SnippetCompletionItemsCollector.
@@ -339,7 +658,7 @@ private:
     // Fill in the kind field of the CompletionItem.
     Item.kind = getKind(Result.CursorKind);
 
-    FillSortText(CCS, Item);
+    FillSortText(Score, Item);
 
     return Item;
   }
@@ -376,16 +695,18 @@ private:
     }
   }
 
-  void FillSortText(const CodeCompletionString &CCS,
-                    CompletionItem &Item) const {
+  void FillSortText(unsigned Score, CompletionItem &Item) const {
     // Fill in the sortText of the CompletionItem.
-    assert(CCS.getPriority() < 99999 && "Expecting code completion result "
-                                        "priority to have at most 5-digits");
+    assert(Score < 99999 && "Expecting code completion result "
+                            "score to have at most 5-digits");
     llvm::raw_string_ostream(Item.sortText)
-        << llvm::format("%05d%s", CCS.getPriority(), Item.filterText.c_str());
+        << llvm::format("%05u%s", Score, Item.filterText.c_str());
   }
 
-  std::vector<CompletionItem> &Items;
+  StringRef Prefix;
+  unsigned Limit;
+  CompletionList &Items;
+  CancellationToken Cancel;
   std::shared_ptr<clang::GlobalCodeCompletionAllocator> Allocator;
   CodeCompletionTUInfo CCTUInfo;
 
@@ -396,8 +717,11 @@ class PlainTextCompletionItemsCollector final
 
 public:
   PlainTextCompletionItemsCollector(const CodeCompleteOptions &CodeCompleteOpts,
-                                    std::vector<CompletionItem> &Items)
-      : CompletionItemsCollector(CodeCompleteOpts, Items) {}
+                                    StringRef Prefix, unsigned Limit,
+                                    CompletionList &Items,
+                                    CancellationToken Cancel)
+      : CompletionItemsCollector(CodeCompleteOpts, Prefix, Limit, Items,
+                                 std::move(Cancel)) {}
 
 private:
   void ProcessChunks(const CodeCompletionString &CCS,
@@ -427,8 +751,11 @@ class SnippetCompletionItemsCollector final : public CompletionItemsCollector {
 
 public:
   SnippetCompletionItemsCollector(const CodeCompleteOptions &CodeCompleteOpts,
-                                  std::vector<CompletionItem> &Items)
-      : CompletionItemsCollector(CodeCompleteOpts, Items) {}
+                                  StringRef Prefix, unsigned Limit,
+                                  CompletionList &Items,
+                                  CancellationToken Cancel)
+      : CompletionItemsCollector(CodeCompleteOpts, Prefix, Limit, Items,
+                                 std::move(Cancel)) {}
 
 private:
   void ProcessChunks(const CodeCompletionString &CCS,
@@ -529,12 +856,19 @@ private:
 }; // SnippetCompletionItemsCollector
 } // namespace
 
-std::vector<CompletionItem>
+CompletionList
 clangd::codeComplete(PathRef FileName, tooling::CompileCommand Command,
-                     PrecompiledPreamble const *Preamble, StringRef Contents,
-                     Position Pos, IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+                     PrecompiledPreamble const *Preamble,
+                     CompletionPreambleData const *CompletionPreamble,
+                     StringRef Contents, Position Pos, size_t Offset,
+                     IntrusiveRefCntPtr<vfs::FileSystem> VFS,
                      std::shared_ptr<PCHContainerOperations> PCHs,
-                     bool SnippetCompletions) {
+                     bool SnippetCompletions, unsigned CompletionLimit,
+                     CancellationToken Cancel) {
+  if (Cancel.isCancelled())
+    return {};
+  auto Start = std::chrono::steady_clock::now();
+
   std::vector<const char *> ArgStrs;
   for (const auto &S : Command.CommandLine)
     ArgStrs.push_back(S.c_str());
@@ -551,16 +885,46 @@ clangd::codeComplete(PathRef FileName, tooling::CompileCommand Command,
   }
   assert(CI && "Couldn't create CompilerInvocation");
 
-  std::unique_ptr<llvm::MemoryBuffer> ContentsBuffer =
-      llvm::MemoryBuffer::getMemBufferCopy(Contents, FileName);
-
-  // Attempt to reuse the PCH from precompiled preamble, if it was built.
-  if (Preamble) {
-    auto Bounds =
-        ComputePreambleBounds(*CI->getLangOpts(), ContentsBuffer.get(), 0);
-    if (!Preamble->CanReuse(*CI, ContentsBuffer.get(), Bounds, VFS.get()))
-      Preamble = nullptr;
+  // The completion preamble also covers the declarations that precede the
+  // completion point in the main file, so we don't have to parse them again.
+  // It can only be used if it ends before the completion point and the text it
+  // was built for did not change. The main file is parsed with the braces,
+  // that the preamble closes, opened again after it.
+  std::unique_ptr<llvm::MemoryBuffer> ContentsBuffer;
+  std::string SplicedContents;
+  bool UsesCompletionPreamble = false;
+  if (CompletionPreamble && CompletionPreamble->End <= Offset) {
+    SplicedContents = CompletionPreamble->getSplicedContents(Contents);
+    ContentsBuffer =
+        llvm::MemoryBuffer::getMemBufferCopy(SplicedContents, FileName);
+    UsesCompletionPreamble = CompletionPreamble->Preamble.CanReuse(
+        *CI, ContentsBuffer.get(), CompletionPreamble->Preamble.getBounds(),
+        VFS.get());
   }
+  if (UsesCompletionPreamble) {
+    Preamble = &CompletionPreamble->Preamble;
+    StringRef Inserted = StringRef(SplicedContents)
+                             .substr(CompletionPreamble->End,
+                                     SplicedContents.size() - Contents.size());
+    Offset += Inserted.size();
+    Pos.line += Inserted.count('\n');
+    Contents = SplicedContents;
+  } else {
+    ContentsBuffer = llvm::MemoryBuffer::getMemBufferCopy(Contents, FileName);
+    // Attempt to reuse the PCH from precompiled preamble, if it was built.
+    if (Preamble) {
+      auto Bounds =
+          ComputePreambleBounds(*CI->getLangOpts(), ContentsBuffer.get(), 0);
+      if (!Preamble->CanReuse(*CI, ContentsBuffer.get(), Bounds, VFS.get()))
+        Preamble = nullptr;
+    }
+  }
+  // Completions with and without the completion preamble take very different
+  // time, so their latencies are recorded separately.
+  trace::Span Tracer(UsesCompletionPreamble
+                         ? "CodeCompleteWithCompletionPreamble"
+                         : "CodeComplete",
+                     Start);
 
   auto Clang = prepareCompilerInstance(std::move(CI), Preamble,
                                        std::move(ContentsBuffer), PCHs, VFS,
@@ -575,19 +939,23 @@ clangd::codeComplete(PathRef FileName, tooling::CompileCommand Command,
   FrontendOpts.CodeCompleteOpts.IncludeMacros = true;
   FrontendOpts.CodeCompleteOpts.IncludeBriefComments = true;
 
+  // Clang measures columns in bytes, unlike LSP.
+  size_t LineStart = Contents.rfind('\n', Offset);
+  LineStart = LineStart == StringRef::npos ? 0 : LineStart + 1;
   FrontendOpts.CodeCompletionAt.FileName = FileName;
   FrontendOpts.CodeCompletionAt.Line = Pos.line + 1;
-  FrontendOpts.CodeCompletionAt.Column = Pos.character + 1;
+  FrontendOpts.CodeCompletionAt.Column = Offset - LineStart + 1;
 
-  std::vector<CompletionItem> Items;
+  StringRef Prefix = getCompletionPrefix(Contents, Offset);
+  CompletionList Items;
   if (SnippetCompletions) {
     FrontendOpts.CodeCompleteOpts.IncludeCodePatterns = true;
     Clang->setCodeCompletionConsumer(new SnippetCompletionItemsCollector(
-        FrontendOpts.CodeCompleteOpts, Items));
+        FrontendOpts.CodeCompleteOpts, Prefix, CompletionLimit, Items, Cancel));
   } else {
     FrontendOpts.CodeCompleteOpts.IncludeCodePatterns = false;
     Clang->setCodeCompletionConsumer(new PlainTextCompletionItemsCollector(
-        FrontendOpts.CodeCompleteOpts, Items));
+        FrontendOpts.CodeCompleteOpts, Prefix, CompletionLimit, Items, Cancel));
   }
 
   SyntaxOnlyAction Action;
@@ -595,6 +963,12 @@ clangd::codeComplete(PathRef FileName, tooling::CompileCommand Command,
     // FIXME(ibiryukov): log errors
     return Items;
   }
+  // Setting up the compiler instance might have taken a while, check again
+  // before parsing.
+  if (Cancel.isCancelled()) {
+    Action.EndSourceFile();
+    return Items;
+  }
   if (!Action.Execute()) {
     // FIXME(ibiryukov): log errors
   }
@@ -614,6 +988,7 @@ ParsedAST::Build(std::unique_ptr<clang::CompilerInvocation> CI,
                  std::unique_ptr<llvm::MemoryBuffer> Buffer,
                  std::shared_ptr<PCHContainerOperations> PCHs,
                  IntrusiveRefCntPtr<vfs::FileSystem> VFS) {
+  trace::Span Tracer("BuildAST");
 
   std::vector<DiagWithFixIts> ASTDiags;
   StoreDiagsConsumer UnitDiagsConsumer(/*ref*/ ASTDiags);
@@ -662,14 +1037,13 @@ SourceLocation getMacroArgExpandedLocation(const SourceManager &Mgr,
 
 SourceLocation getMacroArgExpandedLocation(const SourceManager &Mgr,
                                            const FileEntry *FE, Position Pos) {
-  SourceLocation InputLoc =
-      Mgr.translateFileLineCol(FE, Pos.line + 1, Pos.character + 1);
-  return Mgr.getMacroArgExpandedLocation(InputLoc);
+  return Mgr.getMacroArgExpandedLocation(positionToSourceLoc(Mgr, FE, Pos));
 }
 
 /// Finds declarations locations that a given source location refers to.
 class DeclarationLocationsFinder : public index::IndexDataConsumer {
   std::vector<Location> DeclarationLocations;
+  std::vector<std::string> USRs;
   const SourceLocation &SearchedLocation;
   const ASTContext &AST;
   Preprocessor &PP;
@@ -680,6 +1054,8 @@ public:
                              ASTContext &AST, Preprocessor &PP)
       : SearchedLocation(SearchedLocation), AST(AST), PP(PP) {}
 
+  std::vector<std::string> takeUSRs() { return std::move(USRs); }
+
   std::vector<Location> takeLocations() {
     // Don't keep the same location multiple times.
     // This can happen when nodes in the AST are visited twice.
@@ -697,6 +1073,9 @@ public:
                       index::IndexDataConsumer::ASTNodeInfo ASTNode) override {
     if (isSearchedLocation(FID, Offset)) {
       addDeclarationLocation(D->getSourceRange());
+      llvm::SmallString<128> USR;
+      if (!index::generateUSRForDecl(D, USR))
+        USRs.push_back(USR.str());
     }
     return true;
   }
@@ -714,13 +1093,8 @@ private:
     SourceLocation LocStart = ValSourceRange.getBegin();
     SourceLocation LocEnd = Lexer::getLocForEndOfToken(ValSourceRange.getEnd(),
                                                        0, SourceMgr, LangOpts);
-    Position Begin;
-    Begin.line = SourceMgr.getSpellingLineNumber(LocStart) - 1;
-    Begin.character = SourceMgr.getSpellingColumnNumber(LocStart) - 1;
-    Position End;
-    End.line = SourceMgr.getSpellingLineNumber(LocEnd) - 1;
-    End.character = SourceMgr.getSpellingColumnNumber(LocEnd) - 1;
-    Range R = {Begin, End};
+    Range R = {sourceLocToPosition(SourceMgr, LocStart),
+               sourceLocToPosition(SourceMgr, LocEnd)};
     Location L;
     L.uri = URI::fromFile(
         SourceMgr.getFilename(SourceMgr.getSpellingLoc(LocStart)));
@@ -766,8 +1140,7 @@ SourceLocation getBeginningOfIdentifier(ParsedAST &Unit, const Position &Pos,
   const ASTContext &AST = Unit.getASTContext();
   const SourceManager &SourceMgr = AST.getSourceManager();
 
-  SourceLocation InputLocation =
-      SourceMgr.translateFileLineCol(FE, Pos.line + 1, Pos.character + 1);
+  SourceLocation InputLocation = positionToSourceLoc(SourceMgr, FE, Pos);
   if (Pos.character == 0) {
     return InputLocation;
   }
@@ -780,8 +1153,7 @@ SourceLocation getBeginningOfIdentifier(ParsedAST &Unit, const Position &Pos,
   // token. If so, Take the beginning of this token.
   // (It should be the same identifier because you can't have two adjacent
   // identifiers without another token in between.)
-  SourceLocation PeekBeforeLocation = SourceMgr.translateFileLineCol(
-    FE, Pos.line + 1, Pos.character);
+  SourceLocation PeekBeforeLocation = InputLocation.getLocWithOffset(-1);
   Token Result;
   if (Lexer::getRawToken(PeekBeforeLocation, Result, SourceMgr,
                          AST.getLangOpts(), false)) {
@@ -796,9 +1168,22 @@ SourceLocation getBeginningOfIdentifier(ParsedAST &Unit, const Position &Pos,
 
   return InputLocation;
 }
+
+/// \return true if \p Loc is inside the expansion range of \p D.
+bool declContainsLocation(const SourceManager &SourceMgr, const Decl *D,
+                          SourceLocation Loc) {
+  SourceRange R = D->getSourceRange();
+  if (R.isInvalid())
+    return false;
+  SourceLocation Begin = SourceMgr.getExpansionLoc(R.getBegin());
+  SourceLocation End = SourceMgr.getExpansionRange(R.getEnd()).second;
+  return !SourceMgr.isBeforeInTranslationUnit(Loc, Begin) &&
+         !SourceMgr.isBeforeInTranslationUnit(End, Loc);
+}
 } // namespace
 
-std::vector<Location> clangd::findDefinitions(ParsedAST &AST, Position Pos) {
+std::vector<Location> clangd::findDefinitions(ParsedAST &AST, Position Pos,
+                                              const SymbolIndex *Index) {
   const SourceManager &SourceMgr = AST.getASTContext().getSourceManager();
   const FileEntry *FE = SourceMgr.getFileEntryForID(SourceMgr.getMainFileID());
   if (!FE)
@@ -814,10 +1199,61 @@ std::vector<Location> clangd::findDefinitions(ParsedAST &AST, Position Pos) {
       index::IndexingOptions::SystemSymbolFilterKind::All;
   IndexOpts.IndexFunctionLocals = true;
 
-  indexTopLevelDecls(AST.getASTContext(), AST.getTopLevelDecls(),
-                     DeclLocationsFinder, IndexOpts);
+  // Only visit the decls that contain the searched location. The preamble
+  // ends before the first decl of the main file, so its decls can be skipped
+  // too, which saves deserializing all of them. Decls, referenced from the
+  // visited ones, are still deserialized on demand.
+  std::vector<const Decl *> Candidates;
+  for (const Decl *D : AST.getParsedTopLevelDecls()) {
+    if (declContainsLocation(SourceMgr, D, SourceLocationBeg))
+      Candidates.push_back(D);
+  }
 
-  return DeclLocationsFinder->takeLocations();
+  indexTopLevelDecls(AST.getASTContext(), Candidates, DeclLocationsFinder,
+                     IndexOpts);
+
+  std::vector<Location> Result = DeclLocationsFinder->takeLocations();
+  if (!Index)
+    return Result;
+  // The definition might be in another translation unit, which is only
+  // visible through the index.
+  for (const std::string &USR : DeclLocationsFinder->takeUSRs()) {
+    std::vector<Location> Definitions = Index->findDefinitions(USR);
+    Result.insert(Result.end(), Definitions.begin(), Definitions.end());
+  }
+  std::sort(Result.begin(), Result.end());
+  Result.erase(std::unique(Result.begin(), Result.end()), Result.end());
+  return Result;
+}
+
+llvm::Optional<ParsedAST>
+clangd::parseFile(PathRef FileName, const tooling::CompileCommand &Command,
+                  IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+                  std::shared_ptr<PCHContainerOperations> PCHs) {
+  std::vector<const char *> ArgStrs;
+  for (const auto &S : Command.CommandLine)
+    ArgStrs.push_back(S.c_str());
+
+  VFS->setCurrentWorkingDirectory(Command.Directory);
+
+  std::unique_ptr<CompilerInvocation> CI;
+  {
+    EmptyDiagsConsumer CommandLineDiagsConsumer;
+    IntrusiveRefCntPtr<DiagnosticsEngine> CommandLineDiagsEngine =
+        CompilerInstance::createDiagnostics(new DiagnosticOptions,
+                                            &CommandLineDiagsConsumer, false);
+    CI = createCompilerInvocation(ArgStrs, CommandLineDiagsEngine, VFS);
+  }
+  if (!CI)
+    return llvm::None;
+
+  auto Buffer = VFS->getBufferForFile(FileName);
+  if (!Buffer)
+    return llvm::None;
+
+  return ParsedAST::Build(std::move(CI), /*Preamble=*/nullptr,
+                          /*PreambleDeclIDs=*/llvm::None, std::move(*Buffer),
+                          PCHs, VFS);
 }
 
 void ParsedAST::ensurePreambleDeclsDeserialized() {
@@ -868,10 +1304,26 @@ ArrayRef<const Decl *> ParsedAST::getTopLevelDecls() {
   return TopLevelDecls;
 }
 
+ArrayRef<const Decl *> ParsedAST::getParsedTopLevelDecls() const {
+  return llvm::makeArrayRef(TopLevelDecls).take_back(NumParsedTopLevelDecls);
+}
+
 const std::vector<DiagWithFixIts> &ParsedAST::getDiagnostics() const {
   return Diags;
 }
 
+std::size_t ParsedAST::getUsedBytes() const {
+  const ASTContext &AST = getASTContext();
+  const SourceManager &SM = AST.getSourceManager();
+  // FIXME: Diags and the declarations, deserialized from the preamble, are not
+  // accounted for.
+  return AST.getASTAllocatedMemory() + AST.getSideTableAllocatedMemory() +
+         getPreprocessor().getTotalMemory() + SM.getContentCacheSize() +
+         SM.getDataStructureSizes() +
+         TopLevelDecls.capacity() * sizeof(const Decl *) +
+         PendingTopLevelDecls.capacity() * sizeof(serialization::DeclID);
+}
+
 ParsedAST::ParsedAST(std::unique_ptr<CompilerInstance> Clang,
                      std::unique_ptr<FrontendAction> Action,
                      std::vector<const Decl *> TopLevelDecls,
@@ -879,7 +1331,8 @@ ParsedAST::ParsedAST(std::unique_ptr<CompilerInstance> Clang,
                      std::vector<DiagWithFixIts> Diags)
     : Clang(std::move(Clang)), Action(std::move(Action)),
       Diags(std::move(Diags)), TopLevelDecls(std::move(TopLevelDecls)),
-      PendingTopLevelDecls(std::move(PendingTopLevelDecls)) {
+      PendingTopLevelDecls(std::move(PendingTopLevelDecls)),
+      NumParsedTopLevelDecls(this->TopLevelDecls.size()) {
   assert(this->Clang);
   assert(this->Action);
 }
@@ -892,21 +1345,52 @@ ParsedASTWrapper::ParsedASTWrapper(llvm::Optional<ParsedAST> AST)
 
 PreambleData::PreambleData(PrecompiledPreamble Preamble,
                            std::vector<serialization::DeclID> TopLevelDeclIDs,
-                           std::vector<DiagWithFixIts> Diags)
+                           std::vector<DiagWithFixIts> Diags,
+                           std::vector<Path> Includes)
     : Preamble(std::move(Preamble)),
-      TopLevelDeclIDs(std::move(TopLevelDeclIDs)), Diags(std::move(Diags)) {}
+      TopLevelDeclIDs(std::move(TopLevelDeclIDs)), Diags(std::move(Diags)),
+      Includes(std::move(Includes)) {}
+
+bool PreambleData::includesAnyOf(ArrayRef<Path> Files) const {
+  for (const Path &File : Files)
+    if (std::binary_search(Includes.begin(), Includes.end(), File))
+      return true;
+  return false;
+}
+
+CompletionPreambleData::CompletionPreambleData(PrecompiledPreamble Preamble,
+                                               size_t End, std::string Closing,
+                                               std::string Reopening)
+    : Preamble(std::move(Preamble)), End(End), Closing(std::move(Closing)),
+      Reopening(std::move(Reopening)) {}
+
+std::string
+CompletionPreambleData::getSplicedContents(StringRef Contents) const {
+  return (Contents.take_front(End) + Closing + Reopening +
+          Contents.drop_front(End))
+      .str();
+}
 
 std::shared_ptr<CppFile>
 CppFile::Create(PathRef FileName, tooling::CompileCommand Command,
-                std::shared_ptr<PCHContainerOperations> PCHs) {
+                std::shared_ptr<PCHContainerOperations> PCHs,
+                std::shared_ptr<PreambleCache> Preambles,
+                std::shared_ptr<FileSystemCache> FSCache) {
   return std::shared_ptr<CppFile>(
-      new CppFile(FileName, std::move(Command), std::move(PCHs)));
+      new CppFile(FileName, std::move(Command), std::move(PCHs),
+                  std::move(Preambles), std::move(FSCache)));
 }
 
 CppFile::CppFile(PathRef FileName, tooling::CompileCommand Command,
-                 std::shared_ptr<PCHContainerOperations> PCHs)
-    : FileName(FileName), Command(std::move(Command)), RebuildCounter(0),
-      RebuildInProgress(false), PCHs(std::move(PCHs)) {
+                 std::shared_ptr<PCHContainerOperations> PCHs,
+                 std::shared_ptr<PreambleCache> Preambles,
+                 std::shared_ptr<FileSystemCache> FSCache)
+    : FileName(FileName), Command(std::move(Command)),
+      FSCache(std::move(FSCache)), RebuildCounter(0),
+      RebuildInProgress(false), ASTUsedBytes(0), ASTEvicted(false),
+      LastRebuildDuration(std::chrono::steady_clock::duration::zero()),
+      CompletionPreambleUsedBytes(0), PCHs(std::move(PCHs)),
+      Preambles(std::move(Preambles)) {
 
   std::lock_guard<std::mutex> Lock(Mutex);
   LatestAvailablePreamble = nullptr;
@@ -923,6 +1407,7 @@ std::future<void> CppFile::deferCancelRebuild() {
   std::unique_lock<std::mutex> Lock(Mutex);
   // Cancel an ongoing rebuild, if any, and wait for it to finish.
   unsigned RequestRebuildCounter = ++this->RebuildCounter;
+  ASTEvicted = false;
   // Rebuild asserts that futures aren't ready if rebuild is cancelled.
   // We want to keep this invariant.
   if (futureIsReady(PreambleFuture)) {
@@ -932,6 +1417,7 @@ std::future<void> CppFile::deferCancelRebuild() {
   if (futureIsReady(ASTFuture)) {
     ASTPromise = std::promise<std::shared_ptr<ParsedASTWrapper>>();
     ASTFuture = ASTPromise.get_future();
+    ASTUsedBytes = 0;
   }
 
   Lock.unlock();
@@ -954,6 +1440,7 @@ std::future<void> CppFile::deferCancelRebuild() {
     // Set empty results for Promises.
     That->PreamblePromise.set_value(nullptr);
     That->ASTPromise.set_value(std::make_shared<ParsedASTWrapper>(llvm::None));
+    That->ASTUsedBytes = 0;
   });
 }
 
@@ -966,7 +1453,16 @@ CppFile::rebuild(StringRef NewContents,
 std::future<llvm::Optional<std::vector<DiagWithFixIts>>>
 CppFile::deferRebuild(StringRef NewContents,
                       IntrusiveRefCntPtr<vfs::FileSystem> VFS) {
-  std::shared_ptr<const PreambleData> OldPreamble;
+  std::string Contents = NewContents.str();
+  return deferRebuild([Contents]() { return Contents; }, std::move(VFS));
+}
+
+std::future<llvm::Optional<std::vector<DiagWithFixIts>>>
+CppFile::deferRebuild(
+    std::function<std::string()> GetContents,
+    IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+    std::function<void(std::vector<DiagWithFixIts>)> OnPreambleDiags,
+    std::function<void(std::function<void()>)> RunInBackground) {
   std::shared_ptr<PCHContainerOperations> PCHs;
   unsigned RequestRebuildCounter;
   {
@@ -975,10 +1471,9 @@ CppFile::deferRebuild(StringRef NewContents,
     // They will try to exit as early as possible and won't call set_value on
     // our promises.
     RequestRebuildCounter = ++this->RebuildCounter;
+    ASTEvicted = false;
     PCHs = this->PCHs;
 
-    // Remember the preamble to be used during rebuild.
-    OldPreamble = this->LatestAvailablePreamble;
     // Setup std::promises and std::futures for Preamble and AST. Corresponding
     // futures will wait until the rebuild process is finished.
     if (futureIsReady(this->PreambleFuture)) {
@@ -989,6 +1484,7 @@ CppFile::deferRebuild(StringRef NewContents,
     if (futureIsReady(this->ASTFuture)) {
       this->ASTPromise = std::promise<std::shared_ptr<ParsedASTWrapper>>();
       this->ASTFuture = this->ASTPromise.get_future();
+      this->ASTUsedBytes = 0;
     }
   } // unlock Mutex.
   // Notify about changes to RebuildCounter.
@@ -999,8 +1495,12 @@ CppFile::deferRebuild(StringRef NewContents,
 
   // Don't let this CppFile die before rebuild is finished.
   std::shared_ptr<CppFile> That = shared_from_this();
-  auto FinishRebuild = [OldPreamble, VFS, RequestRebuildCounter, PCHs,
-                        That](std::string NewContents)
+  auto FinishRebuild =
+      [RequestRebuildCounter, PCHs, That](
+          std::function<std::string()> GetContents,
+          IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+          std::function<void(std::vector<DiagWithFixIts>)> OnPreambleDiags,
+          std::function<void(std::function<void()>)> RunInBackground)
       -> llvm::Optional<std::vector<DiagWithFixIts>> {
     // Only one execution of this method is possible at a time.
     // RebuildGuard will wait for any ongoing rebuilds to finish and will put us
@@ -1009,59 +1509,68 @@ CppFile::deferRebuild(StringRef NewContents,
     if (Rebuild.wasCancelledBeforeConstruction())
       return llvm::None;
 
-    std::vector<const char *> ArgStrs;
-    for (const auto &S : That->Command.CommandLine)
-      ArgStrs.push_back(S.c_str());
+    std::string NewContents = GetContents();
+    auto RebuildStart = std::chrono::steady_clock::now();
+
+    std::shared_ptr<const PreambleData> OldPreamble =
+        That->getPossiblyStalePreamble();
 
+    // Wrap the VFS only now, so that the rebuild sees the files that changed
+    // while it was waiting.
+    if (That->FSCache)
+      VFS = That->FSCache->getFileSystem(std::move(VFS));
     VFS->setCurrentWorkingDirectory(That->Command.Directory);
 
-    std::unique_ptr<CompilerInvocation> CI;
-    {
-      // FIXME(ibiryukov): store diagnostics from CommandLine when we start
-      // reporting them.
-      EmptyDiagsConsumer CommandLineDiagsConsumer;
-      IntrusiveRefCntPtr<DiagnosticsEngine> CommandLineDiagsEngine =
-          CompilerInstance::createDiagnostics(new DiagnosticOptions,
-                                              &CommandLineDiagsConsumer, false);
-      CI = createCompilerInvocation(ArgStrs, CommandLineDiagsEngine, VFS);
-    }
+    std::unique_ptr<CompilerInvocation> CI = That->createInvocation(VFS);
     assert(CI && "Couldn't create CompilerInvocation");
 
     std::unique_ptr<llvm::MemoryBuffer> ContentsBuffer =
         llvm::MemoryBuffer::getMemBufferCopy(NewContents, That->FileName);
 
-    // A helper function to rebuild the preamble or reuse the existing one. Does
-    // not mutate any fields, only does the actual computation.
-    auto DoRebuildPreamble = [&]() -> std::shared_ptr<const PreambleData> {
-      auto Bounds =
-          ComputePreambleBounds(*CI->getLangOpts(), ContentsBuffer.get(), 0);
+    auto Bounds =
+        ComputePreambleBounds(*CI->getLangOpts(), ContentsBuffer.get(), 0);
+    StringRef PreambleText = StringRef(NewContents).take_front(Bounds.Size);
+
+    // A helper function to find an existing preamble, that can be reused for
+    // the new contents. Does not mutate any fields.
+    auto FindReusablePreamble = [&]() -> std::shared_ptr<const PreambleData> {
       if (OldPreamble && OldPreamble->Preamble.CanReuse(
-                             *CI, ContentsBuffer.get(), Bounds, VFS.get())) {
+                             *CI, ContentsBuffer.get(), Bounds, VFS.get()))
         return OldPreamble;
-      }
-
-      std::vector<DiagWithFixIts> PreambleDiags;
-      StoreDiagsConsumer PreambleDiagnosticsConsumer(/*ref*/ PreambleDiags);
-      IntrusiveRefCntPtr<DiagnosticsEngine> PreambleDiagsEngine =
-          CompilerInstance::createDiagnostics(
-              &CI->getDiagnosticOpts(), &PreambleDiagnosticsConsumer, false);
-      CppFilePreambleCallbacks SerializedDeclsCollector;
-      auto BuiltPreamble = PrecompiledPreamble::Build(
-          *CI, ContentsBuffer.get(), Bounds, *PreambleDiagsEngine, VFS, PCHs,
-          SerializedDeclsCollector);
-
-      if (BuiltPreamble) {
-        return std::make_shared<PreambleData>(
-            std::move(*BuiltPreamble),
-            SerializedDeclsCollector.takeTopLevelDeclIDs(),
-            std::move(PreambleDiags));
-      } else {
+      if (!That->Preambles)
         return nullptr;
-      }
+      // The cache may contain a preamble, built for this file before it was
+      // reopened, or a preamble of another file with the same includes.
+      auto CachedPreamble =
+          That->Preambles->get(That->FileName, That->Command, PreambleText);
+      if (CachedPreamble &&
+          CachedPreamble->Preamble.CanReuse(*CI, ContentsBuffer.get(), Bounds,
+                                            VFS.get()))
+        return CachedPreamble;
+      return nullptr;
     };
 
     // Compute updated Preamble.
-    std::shared_ptr<const PreambleData> NewPreamble = DoRebuildPreamble();
+    std::shared_ptr<const PreambleData> NewPreamble = FindReusablePreamble();
+    bool BuildPreambleInBackground = false;
+    bool BuiltPreamble = false;
+    if (!NewPreamble && RunInBackground && OldPreamble &&
+        OldPreamble->Preamble.CanReuse(*CI, ContentsBuffer.get(),
+                                       OldPreamble->Preamble.getBounds(),
+                                       VFS.get())) {
+      // The new contents still start with the old preamble, e.g. because an
+      // #include was added after the last one. The AST can be built with the
+      // old preamble right away, while the new one is built in the background
+      // for the following rebuilds.
+      NewPreamble = OldPreamble;
+      BuildPreambleInBackground = true;
+    } else if (!NewPreamble) {
+      NewPreamble = buildPreamble(*CI, ContentsBuffer.get(), Bounds, VFS, PCHs);
+      BuiltPreamble = NewPreamble != nullptr;
+      if (NewPreamble && That->Preambles)
+        That->Preambles->put(That->FileName, That->Command, PreambleText,
+                              NewPreamble);
+    }
     // Publish the new Preamble.
     {
       std::lock_guard<std::mutex> Lock(That->Mutex);
@@ -1073,6 +1582,16 @@ CppFile::deferRebuild(StringRef NewContents,
       That->PreamblePromise.set_value(NewPreamble);
     } // unlock Mutex
 
+    // Building the AST takes a while, report the diagnostics of the preamble
+    // before it is done.
+    if (BuiltPreamble && OnPreambleDiags && !NewPreamble->Diags.empty())
+      OnPreambleDiags(NewPreamble->Diags);
+    std::function<void()> BackgroundPreambleBuild;
+    if (BuildPreambleInBackground)
+      BackgroundPreambleBuild = That->deferPreambleBuild(
+          RequestRebuildCounter, std::make_shared<CompilerInvocation>(*CI),
+          NewContents, VFS, PCHs);
+
     // Prepare the Preamble and supplementary data for rebuilding AST.
     const PrecompiledPreamble *PreambleForAST = nullptr;
     ArrayRef<serialization::DeclID> SerializedPreambleDecls = llvm::None;
@@ -1089,9 +1608,11 @@ CppFile::deferRebuild(StringRef NewContents,
         ParsedAST::Build(std::move(CI), PreambleForAST, SerializedPreambleDecls,
                          std::move(ContentsBuffer), PCHs, VFS);
 
+    std::size_t NewASTUsedBytes = 0;
     if (NewAST) {
       Diagnostics.insert(Diagnostics.end(), NewAST->getDiagnostics().begin(),
                          NewAST->getDiagnostics().end());
+      NewASTUsedBytes = NewAST->getUsedBytes();
     } else {
       // Don't report even Preamble diagnostics if we coulnd't build AST.
       Diagnostics.clear();
@@ -1100,18 +1621,100 @@ CppFile::deferRebuild(StringRef NewContents,
     // Publish the new AST.
     {
       std::lock_guard<std::mutex> Lock(That->Mutex);
+      That->LastRebuildDuration =
+          std::chrono::steady_clock::now() - RebuildStart;
       if (RequestRebuildCounter != That->RebuildCounter)
         return Diagnostics; // Our rebuild request was cancelled, don't set
                             // ASTPromise.
 
       That->ASTPromise.set_value(
           std::make_shared<ParsedASTWrapper>(std::move(NewAST)));
+      That->ASTUsedBytes = NewASTUsedBytes;
     } // unlock Mutex
 
+    if (BackgroundPreambleBuild)
+      RunInBackground(std::move(BackgroundPreambleBuild));
     return Diagnostics;
   };
 
-  return std::async(std::launch::deferred, FinishRebuild, NewContents.str());
+  return std::async(std::launch::deferred, FinishRebuild,
+                    std::move(GetContents), std::move(VFS),
+                    std::move(OnPreambleDiags), std::move(RunInBackground));
+}
+
+std::function<void()>
+CppFile::deferPreambleBuild(unsigned RequestRebuildCounter,
+                            std::shared_ptr<CompilerInvocation> CI,
+                            std::string Contents,
+                            IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+                            std::shared_ptr<PCHContainerOperations> PCHs) {
+  std::shared_ptr<CppFile> That = shared_from_this();
+  return [That, RequestRebuildCounter, CI, Contents, VFS, PCHs]() {
+    {
+      std::lock_guard<std::mutex> Lock(That->Mutex);
+      // A newer rebuild was requested, it will build the preamble it needs.
+      if (RequestRebuildCounter != That->RebuildCounter)
+        return;
+    } // unlock Mutex
+
+    trace::Span Tracer("BuildPreambleInBackground");
+    std::unique_ptr<llvm::MemoryBuffer> ContentsBuffer =
+        llvm::MemoryBuffer::getMemBufferCopy(Contents, That->FileName);
+    auto Bounds =
+        ComputePreambleBounds(*CI->getLangOpts(), ContentsBuffer.get(), 0);
+    std::shared_ptr<const PreambleData> NewPreamble =
+        buildPreamble(*CI, ContentsBuffer.get(), Bounds, VFS, PCHs);
+    if (!NewPreamble)
+      return; // Keep using the old preamble.
+    if (That->Preambles)
+      That->Preambles->put(That->FileName, That->Command,
+                           StringRef(Contents).take_front(Bounds.Size),
+                           NewPreamble);
+
+    std::lock_guard<std::mutex> Lock(That->Mutex);
+    That->LatestAvailablePreamble = std::move(NewPreamble);
+  };
+}
+
+std::unique_ptr<CompilerInvocation>
+CppFile::createInvocation(IntrusiveRefCntPtr<vfs::FileSystem> VFS) {
+  std::shared_ptr<const CompilerInvocation> Parsed;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Parsed = Invocation;
+  } // unlock Mutex
+
+  if (!Parsed) {
+    // The driver looks up the toolchain on the file system when parsing the
+    // command line, so it's worth doing only once per CppFile.
+    std::vector<const char *> ArgStrs;
+    for (const auto &S : Command.CommandLine)
+      ArgStrs.push_back(S.c_str());
+
+    // FIXME(ibiryukov): store diagnostics from CommandLine when we start
+    // reporting them.
+    EmptyDiagsConsumer CommandLineDiagsConsumer;
+    IntrusiveRefCntPtr<DiagnosticsEngine> CommandLineDiagsEngine =
+        CompilerInstance::createDiagnostics(new DiagnosticOptions,
+                                            &CommandLineDiagsConsumer, false);
+    std::unique_ptr<CompilerInvocation> CI =
+        createCompilerInvocation(ArgStrs, CommandLineDiagsEngine, VFS);
+    if (!CI)
+      return nullptr;
+    Parsed = std::move(CI);
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Invocation = Parsed;
+  } // unlock Mutex
+
+  // Rebuilds modify the invocation, e.g. to use the preamble, so each of them
+  // needs its own copy.
+  return llvm::make_unique<CompilerInvocation>(*Parsed);
+}
+
+void CppFile::invalidateFileSystemCache() {
+  if (FSCache)
+    FSCache->invalidate();
 }
 
 std::shared_future<std::shared_ptr<const PreambleData>>
@@ -1125,6 +1728,96 @@ std::shared_ptr<const PreambleData> CppFile::getPossiblyStalePreamble() const {
   return LatestAvailablePreamble;
 }
 
+void CppFile::buildCompletionPreamble(StringRef Contents, size_t Offset,
+                                      IntrusiveRefCntPtr<vfs::FileSystem> VFS) {
+  CompletionPreambleCut Cut;
+  // Don't wait for the pending rebuilds, they may be queued after this request
+  // and never start while we wait.
+  auto ASTFuture = getAST();
+  if (!futureIsReady(ASTFuture))
+    return;
+  ASTFuture.get()->runUnderLock([&](ParsedAST *AST) {
+    if (!AST)
+      return;
+    // The AST may be older than Contents. Its declarations can still be used
+    // if the text before them did not change.
+    const SourceManager &SM = AST->getASTContext().getSourceManager();
+    StringRef ASTContents = SM.getBufferData(SM.getMainFileID());
+    CompletionPreambleCut ASTCut = findCompletionPreambleEnd(*AST, Offset);
+    if (ASTCut.End <= Offset &&
+        ASTContents.take_front(ASTCut.End) == Contents.take_front(ASTCut.End))
+      Cut = std::move(ASTCut);
+  });
+
+  std::shared_ptr<const PreambleData> Preamble = getPossiblyStalePreamble();
+  size_t RegularPreambleSize =
+      Preamble ? Preamble->Preamble.getBounds().Size : 0;
+  if (Cut.End < RegularPreambleSize + MinCompletionPreambleGrowth)
+    return;
+
+  if (FSCache)
+    VFS = FSCache->getFileSystem(std::move(VFS));
+  VFS->setCurrentWorkingDirectory(Command.Directory);
+
+  std::unique_ptr<CompilerInvocation> CI = createInvocation(VFS);
+  if (!CI)
+    return;
+
+  // The preamble is built from the contents with the open braces closed at
+  // its end. The rest of the file is not parsed.
+  std::string Closing;
+  if (Cut.OpenBraces > 0)
+    Closing = std::string(Cut.OpenBraces, '}') + "\n";
+  std::string Reopening;
+  if (!Cut.Reopening.empty())
+    Reopening = Cut.Reopening + "\n";
+  std::unique_ptr<llvm::MemoryBuffer> ContentsBuffer =
+      llvm::MemoryBuffer::getMemBufferCopy(
+          (Contents.take_front(Cut.End) + Closing).str(), FileName);
+  PreambleBounds Bounds(ContentsBuffer->getBufferSize(),
+                        /*PreambleEndsAtStartOfLine=*/true);
+  std::shared_ptr<const CompletionPreambleData> OldPreamble =
+      getCompletionPreamble();
+  if (OldPreamble && OldPreamble->End == Cut.End &&
+      OldPreamble->Reopening == Reopening &&
+      OldPreamble->Preamble.CanReuse(*CI, ContentsBuffer.get(), Bounds,
+                                     VFS.get()))
+    return;
+
+  // Completion skips function bodies anyway, so there's no need to precompile
+  // them.
+  CI->getFrontendOpts().SkipFunctionBodies = true;
+
+  EmptyDiagsConsumer PreambleDiagsConsumer;
+  IntrusiveRefCntPtr<DiagnosticsEngine> PreambleDiagsEngine =
+      CompilerInstance::createDiagnostics(&CI->getDiagnosticOpts(),
+                                          &PreambleDiagsConsumer, false);
+  CppFilePreambleCallbacks Callbacks;
+  trace::Span Tracer("BuildCompletionPreamble");
+  auto BuiltPreamble =
+      PrecompiledPreamble::Build(*CI, ContentsBuffer.get(), Bounds,
+                                 *PreambleDiagsEngine, VFS, PCHs, Callbacks);
+  // The build fails if the declarations have errors or if the preamble ends
+  // inside a preprocessor conditional. Completion will use the regular
+  // preamble in that case.
+  if (!BuiltPreamble)
+    return;
+
+  std::size_t NewPreambleUsedBytes = BuiltPreamble->getSize();
+  auto NewPreamble = std::make_shared<CompletionPreambleData>(
+      std::move(*BuiltPreamble), Cut.End, std::move(Closing),
+      std::move(Reopening));
+  std::lock_guard<std::mutex> Lock(Mutex);
+  CompletionPreamble = std::move(NewPreamble);
+  CompletionPreambleUsedBytes = NewPreambleUsedBytes;
+}
+
+std::shared_ptr<const CompletionPreambleData>
+CppFile::getCompletionPreamble() const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return CompletionPreamble;
+}
+
 std::shared_future<std::shared_ptr<ParsedASTWrapper>> CppFile::getAST() const {
   std::lock_guard<std::mutex> Lock(Mutex);
   return ASTFuture;
@@ -1134,6 +1827,46 @@ tooling::CompileCommand const &CppFile::getCompileCommand() const {
   return Command;
 }
 
+bool CppFile::evictAST() {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  bool Evicted = false;
+  // Completion will rebuild the completion preamble when it's needed again.
+  if (CompletionPreamble) {
+    CompletionPreamble = nullptr;
+    CompletionPreambleUsedBytes = 0;
+    Evicted = true;
+  }
+  if (!futureIsReady(ASTFuture) || ASTUsedBytes == 0)
+    return Evicted;
+  // Clients that already got the AST will keep it alive until they're done.
+  ASTPromise = std::promise<std::shared_ptr<ParsedASTWrapper>>();
+  ASTPromise.set_value(std::make_shared<ParsedASTWrapper>(llvm::None));
+  ASTFuture = ASTPromise.get_future();
+  ASTUsedBytes = 0;
+  ASTEvicted = true;
+  return true;
+}
+
+bool CppFile::isASTEvicted() const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return ASTEvicted;
+}
+
+std::size_t CppFile::getASTUsedBytes() const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return ASTUsedBytes;
+}
+
+std::size_t CppFile::getCompletionPreambleUsedBytes() const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return CompletionPreambleUsedBytes;
+}
+
+std::chrono::steady_clock::duration CppFile::getLastRebuildDuration() const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return LastRebuildDuration;
+}
+
 CppFile::RebuildGuard::RebuildGuard(CppFile &File,
                                     unsigned RequestRebuildCounter)
     : File(File), RequestRebuildCounter(RequestRebuildCounter) {
@@ -10,6 +10,8 @@
 #ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_CLANGDUNIT_H
 #define LLVM_CLANG_TOOLS_EXTRA_CLANGD_CLANGDUNIT_H
 
+#include "Cancellation.h"
+#include "FileSystemCache.h"
 #include "Path.h"
 #include "Protocol.h"
 #include "clang/Frontend/ASTUnit.h"
@@ -18,6 +20,8 @@
 #include "clang/Tooling/CompilationDatabase.h"
 #include "clang/Tooling/Core/Replacement.h"
 #include <atomic>
+#include <chrono>
+#include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
@@ -40,6 +44,9 @@ struct CompileCommand;
 
 namespace clangd {
 
+class PreambleCache;
+class SymbolIndex;
+
 /// A diagnostic with its FixIts.
 struct DiagWithFixIts {
   clangd::Diagnostic Diag;
@@ -74,9 +81,17 @@ public:
   /// from Preamble. Decls, coming from Preamble, have to be deserialized, so
   /// this call might be expensive.
   ArrayRef<const Decl *> getTopLevelDecls();
+  /// Returns top-level decls that were parsed from the main file buffer, i.e.
+  /// all top-level decls except those coming from Preamble. Unlike
+  /// getTopLevelDecls, never deserializes anything.
+  ArrayRef<const Decl *> getParsedTopLevelDecls() const;
 
   const std::vector<DiagWithFixIts> &getDiagnostics() const;
 
+  /// Returns the estimated size of memory, used by the AST and the
+  /// Preprocessor, in bytes.
+  std::size_t getUsedBytes() const;
+
 private:
   ParsedAST(std::unique_ptr<CompilerInstance> Clang,
             std::unique_ptr<FrontendAction> Action,
@@ -99,6 +114,9 @@ private:
   std::vector<DiagWithFixIts> Diags;
   std::vector<const Decl *> TopLevelDecls;
   std::vector<serialization::DeclID> PendingTopLevelDecls;
+  /// Number of decls at the end of TopLevelDecls that were parsed from the
+  /// main file buffer. Decls from Preamble are inserted before them.
+  std::size_t NumParsedTopLevelDecls;
 };
 
 // Provides thread-safe access to ParsedAST.
@@ -126,11 +144,37 @@ private:
 struct PreambleData {
   PreambleData(PrecompiledPreamble Preamble,
                std::vector<serialization::DeclID> TopLevelDeclIDs,
-               std::vector<DiagWithFixIts> Diags);
+               std::vector<DiagWithFixIts> Diags,
+               std::vector<Path> Includes = {});
+
+  /// Returns true if any of \p Files, which must be absolute paths, was read
+  /// while building the preamble.
+  bool includesAnyOf(ArrayRef<Path> Files) const;
 
   PrecompiledPreamble Preamble;
   std::vector<serialization::DeclID> TopLevelDeclIDs;
   std::vector<DiagWithFixIts> Diags;
+  /// Absolute paths of all files, directly or transitively included by the
+  /// preamble, sorted.
+  std::vector<Path> Includes;
+};
+
+/// A preamble for code completion, built by CppFile::buildCompletionPreamble.
+/// It covers the main file up to End. If End is inside namespaces or extern
+/// "C" blocks, the preamble was built with Closing appended, which closes
+/// them, and the rest of the file is parsed with Reopening inserted before it.
+struct CompletionPreambleData {
+  CompletionPreambleData(PrecompiledPreamble Preamble, size_t End,
+                         std::string Closing, std::string Reopening);
+
+  /// Returns \p Contents with Closing and Reopening inserted at End. The
+  /// preamble can only be used with these contents.
+  std::string getSplicedContents(StringRef Contents) const;
+
+  PrecompiledPreamble Preamble;
+  size_t End;
+  std::string Closing;
+  std::string Reopening;
 };
 
 /// Manages resources, required by clangd. Allows to rebuild file with new
@@ -139,13 +183,23 @@ class CppFile : public std::enable_shared_from_this<CppFile> {
 public:
   // We only allow to create CppFile as shared_ptr, because a future returned by
   // deferRebuild will hold references to it.
+  /// If \p Preambles is not null, preambles are looked up in it before being
+  /// built and are stored in it after being built.
+  /// If \p FSCache is not null, the files, read during rebuilds, are read
+  /// through it, so the results of stat() calls and the contents of the files
+  /// are cached until invalidateFileSystemCache() is called. It may be shared
+  /// with other CppFiles.
   static std::shared_ptr<CppFile>
   Create(PathRef FileName, tooling::CompileCommand Command,
-         std::shared_ptr<PCHContainerOperations> PCHs);
+         std::shared_ptr<PCHContainerOperations> PCHs,
+         std::shared_ptr<PreambleCache> Preambles = nullptr,
+         std::shared_ptr<FileSystemCache> FSCache = nullptr);
 
 private:
   CppFile(PathRef FileName, tooling::CompileCommand Command,
-          std::shared_ptr<PCHContainerOperations> PCHs);
+          std::shared_ptr<PCHContainerOperations> PCHs,
+          std::shared_ptr<PreambleCache> Preambles,
+          std::shared_ptr<FileSystemCache> FSCache);
 
 public:
   CppFile(CppFile const &) = delete;
@@ -186,6 +240,25 @@ public:
   /// rebuild was finished.
   std::future<llvm::Optional<std::vector<DiagWithFixIts>>>
   deferRebuild(StringRef NewContents, IntrusiveRefCntPtr<vfs::FileSystem> VFS);
+  /// Similar to deferRebuild above, but the new contents are obtained by
+  /// calling \p GetContents when the rebuild actually starts. Rebuilds that are
+  /// cancelled before they start never call \p GetContents.
+  /// If a new preamble is built, \p OnPreambleDiags, if not null, is called
+  /// with its diagnostics before the AST is built, unless there are none.
+  /// If \p RunInBackground is not null and the preamble has to be rebuilt, but
+  /// the new contents still start with the text of the old preamble, the AST is
+  /// built with the old preamble and the diagnostics are returned without
+  /// waiting for the new preamble. A task that builds the new preamble is
+  /// passed to \p RunInBackground after the AST is built. The task may run on
+  /// any thread, its preamble is used by the following rebuilds. It does
+  /// nothing if another rebuild is requested before it starts.
+  std::future<llvm::Optional<std::vector<DiagWithFixIts>>>
+  deferRebuild(
+      std::function<std::string()> GetContents,
+      IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+      std::function<void(std::vector<DiagWithFixIts>)> OnPreambleDiags =
+          nullptr,
+      std::function<void(std::function<void()>)> RunInBackground = nullptr);
 
   /// Returns a future to get the most fresh PreambleData for a file. The
   /// future will wait until the Preamble is rebuilt.
@@ -194,6 +267,22 @@ public:
   /// rebuild to finish.
   std::shared_ptr<const PreambleData> getPossiblyStalePreamble() const;
 
+  /// Builds a preamble for code completion at \p Offset in \p Contents, which
+  /// covers the main file up to the declaration that contains \p Offset. That
+  /// is a top-level declaration or one inside the namespaces and extern "C"
+  /// blocks around \p Offset. Completion requests inside that declaration then
+  /// only need to parse the declaration itself. Declarations are taken from
+  /// the latest AST, this does nothing if there is no AST or its rebuild is
+  /// pending. Also does nothing if the existing completion preamble can be
+  /// reused or if the declarations preceding \p Offset are too small to be
+  /// worth precompiling.
+  void buildCompletionPreamble(StringRef Contents, size_t Offset,
+                               IntrusiveRefCntPtr<vfs::FileSystem> VFS);
+  /// Returns the latest preamble built by buildCompletionPreamble, or nullptr.
+  /// It may not match the current contents of the file, callers must check
+  /// that via PrecompiledPreamble::CanReuse with the spliced contents.
+  std::shared_ptr<const CompletionPreambleData> getCompletionPreamble() const;
+
   /// Returns a future to get the most fresh AST for a file. Returned AST is
   /// wrapped to prevent concurrent accesses.
   /// We use std::shared_ptr here because MVSC fails to compile non-copyable
@@ -204,6 +293,30 @@ public:
   /// Get CompileCommand used to build this CppFile.
   tooling::CompileCommand const &getCompileCommand() const;
 
+  /// Makes the following rebuilds read the files again, instead of using the
+  /// results cached by the previous rebuilds. Must be called when files on
+  /// disk change. Does nothing if the file system cache is disabled. A shared
+  /// cache is invalidated for all its CppFiles.
+  void invalidateFileSystemCache();
+
+  /// Drops the latest AST and the completion preamble to free memory, keeping
+  /// the Preamble. After this call getAST() returns an empty ParsedASTWrapper
+  /// until the next rebuild. The AST is kept if a rebuild is in progress.
+  /// \return true if the AST or the completion preamble was evicted.
+  bool evictAST();
+  /// Returns true if the latest AST was evicted by evictAST() and no rebuilds
+  /// were requested since then.
+  bool isASTEvicted() const;
+  /// Returns the estimated memory usage of the latest AST in bytes, measured
+  /// when the AST was built, or 0 if there is no AST.
+  std::size_t getASTUsedBytes() const;
+  /// Returns the size of the completion preamble in bytes, or 0 if there is
+  /// none.
+  std::size_t getCompletionPreambleUsedBytes() const;
+  /// Returns how long the latest finished rebuild took, or zero if the file
+  /// was never rebuilt.
+  std::chrono::steady_clock::duration getLastRebuildDuration() const;
+
 private:
   /// A helper guard that manages the state of CppFile during rebuild.
   class RebuildGuard {
@@ -219,12 +332,31 @@ private:
     bool WasCancelledBeforeConstruction;
   };
 
+  /// Returns a copy of the CompilerInvocation, parsed from Command. The
+  /// command line is only parsed once, the parsed invocation is reused by all
+  /// the following calls. Returns null if the command line can't be parsed.
+  std::unique_ptr<CompilerInvocation>
+  createInvocation(IntrusiveRefCntPtr<vfs::FileSystem> VFS);
+  /// Returns a task that builds a preamble for \p Contents, which replaces
+  /// LatestAvailablePreamble when it is built. The task does nothing if
+  /// RebuildCounter no longer equals \p RequestRebuildCounter when it starts.
+  std::function<void()>
+  deferPreambleBuild(unsigned RequestRebuildCounter,
+                     std::shared_ptr<CompilerInvocation> CI,
+                     std::string Contents,
+                     IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+                     std::shared_ptr<PCHContainerOperations> PCHs);
+
   Path FileName;
   tooling::CompileCommand Command;
+  /// Caches file accesses between rebuilds. Null if caching is disabled.
+  std::shared_ptr<FileSystemCache> FSCache;
 
-  /// Mutex protects all fields, declared below it, FileName and Command are not
-  /// mutated.
+  /// Mutex protects all fields, declared below it, FileName, Command and
+  /// FSCache are not mutated.
   mutable std::mutex Mutex;
+  /// CompilerInvocation, parsed from Command. Null until the first rebuild.
+  std::shared_ptr<const CompilerInvocation> Invocation;
   /// A counter to cancel old rebuilds.
   unsigned RebuildCounter;
   /// Used to wait when rebuild is finished before starting another one.
@@ -237,6 +369,12 @@ private:
   /// classes as template arguments of promise/future.
   std::promise<std::shared_ptr<ParsedASTWrapper>> ASTPromise;
   std::shared_future<std::shared_ptr<ParsedASTWrapper>> ASTFuture;
+  /// Memory used by the AST, stored in ASTFuture, if it is ready.
+  std::size_t ASTUsedBytes;
+  /// Set by evictAST(), cleared when a rebuild is requested.
+  bool ASTEvicted;
+  /// Time it took to build the Preamble and the AST during the latest rebuild.
+  std::chrono::steady_clock::duration LastRebuildDuration;
 
   /// Promise and future for the latests Preamble. Fulfilled during rebuild.
   std::promise<std::shared_ptr<const PreambleData>> PreamblePromise;
@@ -244,20 +382,54 @@ private:
   /// Latest preamble that was built. May be stale, but always available without
   /// waiting for rebuild to finish.
   std::shared_ptr<const PreambleData> LatestAvailablePreamble;
+  /// Preamble for code completion, see buildCompletionPreamble.
+  std::shared_ptr<const CompletionPreambleData> CompletionPreamble;
+  /// Size of CompletionPreamble.
+  std::size_t CompletionPreambleUsedBytes;
   /// Utility class, required by clang.
   std::shared_ptr<PCHContainerOperations> PCHs;
+  /// Preambles, shared with other CppFiles. May be null.
+  std::shared_ptr<PreambleCache> Preambles;
 };
 
-/// Get code completions at a specified \p Pos in \p FileName.
-std::vector<CompletionItem>
+/// Get code completions at a specified \p Pos in \p FileName. \p Offset must
+/// be the offset of \p Pos in \p Contents.
+/// \p CompletionPreamble, built by CppFile::buildCompletionPreamble, is used
+/// instead of \p Preamble if it can be reused with \p Contents. Either may be
+/// null.
+/// Results are filtered by the identifier typed before \p Pos and ranked by
+/// how well they match it. If \p CompletionLimit is non-zero, at most that
+/// many of the best results are returned and the list is marked incomplete if
+/// some were dropped.
+/// If \p Cancel is cancelled while completion is running, stops early. Results
+/// of a cancelled completion are incomplete and should be discarded.
+CompletionList
 codeComplete(PathRef FileName, tooling::CompileCommand Command,
-             PrecompiledPreamble const *Preamble, StringRef Contents,
-             Position Pos, IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+             PrecompiledPreamble const *Preamble,
+             CompletionPreambleData const *CompletionPreamble,
+             StringRef Contents, Position Pos, size_t Offset,
+             IntrusiveRefCntPtr<vfs::FileSystem> VFS,
              std::shared_ptr<PCHContainerOperations> PCHs,
-             bool SnippetCompletions);
+             bool SnippetCompletions, unsigned CompletionLimit,
+             CancellationToken Cancel = CancellationToken());
+
+/// Parses \p FileName, reading its contents from \p VFS. Does not build a
+/// preamble, so it's only suitable for files that are parsed once, e.g. for
+/// indexing. Returns None if the file could not be read or parsed.
+llvm::Optional<ParsedAST>
+parseFile(PathRef FileName, const tooling::CompileCommand &Command,
+          IntrusiveRefCntPtr<vfs::FileSystem> VFS,
+          std::shared_ptr<PCHContainerOperations> PCHs);
+
+/// Returns the LSP position of the spelling location of \p Loc. LSP measures
+/// columns in UTF-16 code units, unlike clang, which measures them in bytes.
+Position sourceLocToPosition(const SourceManager &SM, SourceLocation Loc);
 
-/// Get definition of symbol at a specified \p Pos.
-std::vector<Location> findDefinitions(ParsedAST &AST, Position Pos);
+/// Get definition of symbol at a specified \p Pos. If \p Index is not null,
+/// definitions from other translation units, found in the index, are returned
+/// too.
+std::vector<Location> findDefinitions(ParsedAST &AST, Position Pos,
+                                      const SymbolIndex *Index = nullptr);
 
 /// For testing/debugging purposes. Note that this method deserializes all
 /// unserialized Decls, so use with care.
@@ -14,6 +14,13 @@
 using namespace clang::clangd;
 using namespace clang;
 
+CppFileCollection::CppFileCollection(std::size_t ASTMemoryBudget,
+                                     bool CacheFileSystem)
+    : Preambles(std::make_shared<PreambleCache>()),
+      ASTMemoryBudget(ASTMemoryBudget),
+      FSCache(CacheFileSystem ? std::make_shared<FileSystemCache>() : nullptr) {
+}
+
 std::shared_ptr<CppFile> CppFileCollection::removeIfPresent(PathRef File) {
   std::lock_guard<std::mutex> Lock(Mutex);
 
@@ -23,6 +30,54 @@ std::shared_ptr<CppFile> CppFileCollection::removeIfPresent(PathRef File) {
 
   std::shared_ptr<CppFile> Result = It->second;
   OpenedFiles.erase(It);
+  ASTUsageOrder.remove(File.str());
+  return Result;
+}
+
+void CppFileCollection::markASTUsed(PathRef File) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  if (OpenedFiles.find(File) == OpenedFiles.end())
+    return; // The file was removed.
+
+  auto It = std::find(ASTUsageOrder.begin(), ASTUsageOrder.end(), File);
+  if (It != ASTUsageOrder.end())
+    ASTUsageOrder.splice(ASTUsageOrder.begin(), ASTUsageOrder, It);
+  else
+    ASTUsageOrder.push_front(File.str());
+
+  if (ASTMemoryBudget == 0)
+    return;
+  std::size_t UsedBytes = FSCache ? FSCache->getUsedBytes() : 0;
+  if (UsedBytes > ASTMemoryBudget) {
+    // The files are read again by the following rebuilds.
+    FSCache->invalidate();
+    UsedBytes = 0;
+  }
+  for (const Path &UsedFile : ASTUsageOrder) {
+    auto FileIt = OpenedFiles.find(UsedFile);
+    assert(FileIt != OpenedFiles.end());
+    std::size_t FileBytes = FileIt->second->getASTUsedBytes() +
+                            FileIt->second->getCompletionPreambleUsedBytes();
+    if (UsedBytes + FileBytes > ASTMemoryBudget && UsedFile != File)
+      FileIt->second->evictAST();
+    else
+      UsedBytes += FileBytes;
+  }
+}
+
+void CppFileCollection::invalidateFileSystemCache() {
+  if (FSCache)
+    FSCache->invalidate();
+}
+
+std::vector<Path> CppFileCollection::getFilesByRecentUse() {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  std::vector<Path> Result(ASTUsageOrder.begin(), ASTUsageOrder.end());
+  // Files, whose ASTs were never used, go last.
+  for (const auto &Entry : OpenedFiles)
+    if (std::find(ASTUsageOrder.begin(), ASTUsageOrder.end(), Entry.first()) ==
+        ASTUsageOrder.end())
+      Result.push_back(Entry.first().str());
   return Result;
 }
 
@@ -40,13 +95,16 @@ CppFileCollection::recreateFileIfCompileCommandChanged(
   auto It = OpenedFiles.find(File);
   if (It == OpenedFiles.end()) {
     It = OpenedFiles
-             .try_emplace(File, CppFile::Create(File, std::move(NewCommand),
-                                                std::move(PCHs)))
+             .try_emplace(File,
+                          CppFile::Create(File, std::move(NewCommand),
+                                          std::move(PCHs), Preambles,
+                                          FSCache))
              .first;
   } else if (!compileCommandsAreEqual(It->second->getCompileCommand(),
                                       NewCommand)) {
     Result.RemovedFile = std::move(It->second);
-    It->second = CppFile::Create(File, std::move(NewCommand), std::move(PCHs));
+    It->second = CppFile::Create(File, std::move(NewCommand), std::move(PCHs),
+                                 Preambles, FSCache);
   }
   Result.FileInCollection = It->second;
   return Result;
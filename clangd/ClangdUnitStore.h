@@ -10,19 +10,37 @@
 #ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_CLANGDUNITSTORE_H
 #define LLVM_CLANG_TOOLS_EXTRA_CLANGD_CLANGDUNITSTORE_H
 
+#include <list>
 #include <mutex>
 
 #include "ClangdUnit.h"
+#include "FileSystemCache.h"
 #include "GlobalCompilationDatabase.h"
 #include "Path.h"
+#include "PreambleCache.h"
 #include "clang/Tooling/CompilationDatabase.h"
 
 namespace clang {
 namespace clangd {
 
-/// Thread-safe mapping from FileNames to CppFile.
+/// Thread-safe mapping from FileNames to CppFile. All CppFiles of the
+/// collection share a PreambleCache, so preambles outlive the CppFiles and
+/// files with identical includes and compile flags use a single preamble.
+/// If the file system cache is enabled, the CppFiles also share a
+/// FileSystemCache, so each header is cached only once.
+/// The collection also limits memory used by ASTs and completion preambles of
+/// its files, and by the cached headers. When their total size exceeds the
+/// budget, ASTs are evicted for the least recently used files (see
+/// CppFile::evictAST). The cached headers are dropped if they exceed the
+/// budget on their own.
 class CppFileCollection {
 public:
+  /// \p ASTMemoryBudget is the maximal total size of ASTs, completion
+  /// preambles and cached headers in bytes, 0 means no limit. If
+  /// \p CacheFileSystem is true, all created CppFiles share a FileSystemCache.
+  explicit CppFileCollection(std::size_t ASTMemoryBudget = 0,
+                             bool CacheFileSystem = false);
+
   std::shared_ptr<CppFile>
   getOrCreateFile(PathRef File, PathRef ResourceDir,
                   GlobalCompilationDatabase &CDB,
@@ -35,8 +53,10 @@ public:
       auto Command = getCompileCommand(CDB, File, ResourceDir);
 
       It = OpenedFiles
-               .try_emplace(File, CppFile::Create(File, std::move(Command),
-                                                  std::move(PCHs)))
+               .try_emplace(File,
+                            CppFile::Create(File, std::move(Command),
+                                            std::move(PCHs), Preambles,
+                                            FSCache))
                .first;
     }
     return It->second;
@@ -74,15 +94,35 @@ public:
   /// returns it.
   std::shared_ptr<CppFile> removeIfPresent(PathRef File);
 
-private:
+  /// Marks the AST of \p File as the most recently used one and evicts ASTs of
+  /// the least recently used files until all ASTs fit into the memory budget.
+  /// The AST of \p File itself is never evicted.
+  void markASTUsed(PathRef File);
+
+  /// Makes the following rebuilds of all files read the files again. Does
+  /// nothing if the file system cache is disabled.
+  void invalidateFileSystemCache();
+
+  /// Returns the paths of all files in the collection. The files, whose ASTs
+  /// were used most recently, go first.
+  std::vector<Path> getFilesByRecentUse();
+
+  /// Returns a CompileCommand, used to build a CppFile for \p File.
   tooling::CompileCommand getCompileCommand(GlobalCompilationDatabase &CDB,
                                             PathRef File, PathRef ResourceDir);
 
+private:
   bool compileCommandsAreEqual(tooling::CompileCommand const &LHS,
                                tooling::CompileCommand const &RHS);
 
   std::mutex Mutex;
   llvm::StringMap<std::shared_ptr<CppFile>> OpenedFiles;
+  std::shared_ptr<PreambleCache> Preambles;
+  std::size_t ASTMemoryBudget;
+  /// Shared by all CppFiles. Null if caching is disabled.
+  std::shared_ptr<FileSystemCache> FSCache;
+  /// Files in OpenedFiles, the most recently used ASTs go first.
+  std::list<Path> ASTUsageOrder;
 };
 } // namespace clangd
 } // namespace clang
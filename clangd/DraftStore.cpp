@@ -8,10 +8,255 @@
 //===----------------------------------------------------------------------===//
 
 #include "DraftStore.h"
+#include <algorithm>
 
 using namespace clang;
 using namespace clang::clangd;
 
+namespace {
+
+/// PieceTable merges all pieces into a single buffer when the number of pieces
+/// exceeds this limit. Keeps the cost of edits bounded, while amortizing the
+/// cost of merging over many edits.
+const size_t MaxPiecesBeforeCompaction = 256;
+
+/// Turn a [line, column] pair into an offset inside \p Draft. Columns past the
+/// end of the line point to the end of the line.
+/// \return None if \p P does not point inside \p Draft.
+llvm::Optional<size_t> getOffsetInDraft(const PieceTable &Draft, Position P) {
+  if (P.line < 0 || P.character < 0)
+    return llvm::None;
+  auto LineStart = Draft.getLineStart(P.line);
+  if (!LineStart)
+    return llvm::None;
+  return Draft.columnToOffset(*LineStart, P.character);
+}
+
+bool isLineBreak(char C) { return C == '\n'; }
+
+/// \return the number of bytes in a UTF-8 sequence starting with \p Lead and
+/// the number of UTF-16 code units, needed to encode the same code point.
+/// Invalid lead bytes are treated as single-byte sequences.
+std::pair<unsigned, unsigned> getUTF8SequenceLength(unsigned char Lead) {
+  if (Lead < 0x80)
+    return {1, 1};
+  if ((Lead & 0xE0) == 0xC0)
+    return {2, 1};
+  if ((Lead & 0xF0) == 0xE0)
+    return {3, 1};
+  if ((Lead & 0xF8) == 0xF0)
+    return {4, 2}; // Encoded by a surrogate pair in UTF-16.
+  return {1, 1};
+}
+
+} // namespace
+
+size_t clangd::getByteOffsetOfColumn(StringRef Line, size_t Column) {
+  size_t Bytes = 0;
+  size_t Units = 0;
+  while (Bytes < Line.size() && Units < Column) {
+    auto Length = getUTF8SequenceLength(Line[Bytes]);
+    Bytes += Length.first;
+    Units += Length.second;
+  }
+  return std::min(Bytes, Line.size());
+}
+
+size_t clangd::positionToOffset(StringRef Code, Position P) {
+  if (P.line < 0)
+    return 0;
+  size_t LineStart = 0;
+  for (int Line = 0; Line < P.line; ++Line) {
+    size_t LineBreak = Code.find('\n', LineStart);
+    if (LineBreak == StringRef::npos)
+      return Code.size();
+    LineStart = LineBreak + 1;
+  }
+  StringRef Line = Code.drop_front(LineStart).take_until(isLineBreak);
+  return LineStart + getByteOffsetOfColumn(Line, std::max(P.character, 0));
+}
+
+size_t clangd::getUTF16Length(StringRef Text) {
+  size_t Units = 0;
+  for (size_t Bytes = 0; Bytes < Text.size();) {
+    auto Length = getUTF8SequenceLength(Text[Bytes]);
+    Bytes += Length.first;
+    Units += Length.second;
+  }
+  return Units;
+}
+
+PieceTable::Buffer::Buffer(std::string Text) : Text(std::move(Text)) {
+  for (size_t I = 0, E = this->Text.size(); I != E; ++I) {
+    if (this->Text[I] == '\n')
+      LineBreaks.push_back(I);
+  }
+}
+
+size_t PieceTable::Piece::countLineBreaks() const {
+  auto First = std::lower_bound(Buf->LineBreaks.begin(), Buf->LineBreaks.end(),
+                                Start);
+  auto Last = std::lower_bound(First, Buf->LineBreaks.end(), Start + Length);
+  return Last - First;
+}
+
+PieceTable::PieceTable() = default;
+
+PieceTable::PieceTable(StringRef Contents) : Size(Contents.size()) {
+  if (!Contents.empty())
+    Pieces.push_back(
+        Piece{std::make_shared<Buffer>(Contents.str()), 0, Contents.size()});
+}
+
+void PieceTable::replace(size_t Offset, size_t Length, StringRef NewText) {
+  assert(Offset + Length <= Size && "Replaced range is out of bounds");
+
+  size_t First = splitAt(Offset);
+  size_t Last = splitAt(Offset + Length);
+  Pieces.erase(Pieces.begin() + First, Pieces.begin() + Last);
+  if (!NewText.empty())
+    Pieces.insert(Pieces.begin() + First,
+                  Piece{std::make_shared<Buffer>(NewText.str()), 0,
+                        NewText.size()});
+  Size = Size - Length + NewText.size();
+
+  if (Pieces.size() > MaxPiecesBeforeCompaction)
+    compact();
+}
+
+llvm::Optional<size_t> PieceTable::findLineBreak(size_t N) const {
+  size_t PieceOffset = 0;
+  for (const Piece &P : Pieces) {
+    size_t LineBreaks = P.countLineBreaks();
+    if (N < LineBreaks) {
+      auto First = std::lower_bound(P.Buf->LineBreaks.begin(),
+                                    P.Buf->LineBreaks.end(), P.Start);
+      return PieceOffset + (*(First + N) - P.Start);
+    }
+    N -= LineBreaks;
+    PieceOffset += P.Length;
+  }
+  return llvm::None;
+}
+
+llvm::Optional<size_t> PieceTable::getLineStart(unsigned Line) const {
+  if (Line == 0)
+    return 0;
+  auto PrevLineBreak = findLineBreak(Line - 1);
+  if (!PrevLineBreak)
+    return llvm::None;
+  return *PrevLineBreak + 1;
+}
+
+size_t PieceTable::getLineEnd(unsigned Line) const {
+  auto LineBreak = findLineBreak(Line);
+  if (!LineBreak)
+    return Size;
+  return *LineBreak;
+}
+
+size_t PieceTable::positionToOffset(Position P) const {
+  if (P.line < 0)
+    return 0;
+  auto LineStart = getLineStart(P.line);
+  if (!LineStart)
+    return Size;
+  return columnToOffset(*LineStart, std::max(P.character, 0));
+}
+
+size_t PieceTable::columnToOffset(size_t LineStart, size_t Column) const {
+  // A UTF-16 code unit takes at most 3 bytes in UTF-8, so only a prefix of the
+  // line has to be examined. It's cut at the line break, which saves looking
+  // up the end of the line.
+  std::string Prefix =
+      substr(LineStart, std::min(Column * 3, Size - LineStart));
+  StringRef Line = StringRef(Prefix).take_until(isLineBreak);
+  return LineStart + getByteOffsetOfColumn(Line, Column);
+}
+
+Position PieceTable::offsetToPosition(size_t Offset) const {
+  Offset = std::min(Offset, Size);
+  size_t Line = countLineBreaksBefore(Offset);
+  size_t LineStart = Line == 0 ? 0 : *findLineBreak(Line - 1) + 1;
+  Position Result;
+  Result.line = Line;
+  Result.character = getUTF16Length(substr(LineStart, Offset - LineStart));
+  return Result;
+}
+
+std::string PieceTable::str() const {
+  std::string Result;
+  Result.reserve(Size);
+  for (const Piece &P : Pieces)
+    Result.append(P.Buf->Text, P.Start, P.Length);
+  return Result;
+}
+
+std::string PieceTable::substr(size_t Offset, size_t Length) const {
+  std::string Result;
+  Result.reserve(Length);
+  size_t PieceOffset = 0;
+  for (const Piece &P : Pieces) {
+    if (Length == 0)
+      break;
+    if (Offset < PieceOffset + P.Length) {
+      size_t Skip = Offset - PieceOffset;
+      size_t Taken = std::min(Length, P.Length - Skip);
+      Result.append(P.Buf->Text, P.Start + Skip, Taken);
+      Offset += Taken;
+      Length -= Taken;
+    }
+    PieceOffset += P.Length;
+  }
+  return Result;
+}
+
+size_t PieceTable::countLineBreaksBefore(size_t Offset) const {
+  size_t Result = 0;
+  size_t PieceOffset = 0;
+  for (const Piece &P : Pieces) {
+    if (Offset >= PieceOffset + P.Length) {
+      Result += P.countLineBreaks();
+      PieceOffset += P.Length;
+      continue;
+    }
+    auto First = std::lower_bound(P.Buf->LineBreaks.begin(),
+                                  P.Buf->LineBreaks.end(), P.Start);
+    auto Last = std::lower_bound(First, P.Buf->LineBreaks.end(),
+                                 P.Start + (Offset - PieceOffset));
+    Result += Last - First;
+    break;
+  }
+  return Result;
+}
+
+size_t PieceTable::splitAt(size_t Offset) {
+  size_t PieceOffset = 0;
+  for (size_t I = 0, E = Pieces.size(); I != E; ++I) {
+    if (PieceOffset == Offset)
+      return I;
+    Piece &P = Pieces[I];
+    if (Offset < PieceOffset + P.Length) {
+      size_t HeadLength = Offset - PieceOffset;
+      Piece Tail{P.Buf, P.Start + HeadLength, P.Length - HeadLength};
+      P.Length = HeadLength;
+      Pieces.insert(Pieces.begin() + I + 1, std::move(Tail));
+      return I + 1;
+    }
+    PieceOffset += P.Length;
+  }
+  assert(Offset == Size && "Offset is out of bounds");
+  return Pieces.size();
+}
+
+void PieceTable::compact() {
+  if (Pieces.size() <= 1)
+    return;
+  auto Merged = std::make_shared<Buffer>(str());
+  Pieces.clear();
+  Pieces.push_back(Piece{std::move(Merged), 0, Size});
+}
+
 VersionedDraft DraftStore::getDraft(PathRef File) const {
   std::lock_guard<std::mutex> Lock(Mutex);
 
@@ -35,10 +280,41 @@ DocVersion DraftStore::updateDraft(PathRef File, StringRef Contents) {
 
   auto &Entry = Drafts[File];
   DocVersion NewVersion = ++Entry.Version;
-  Entry.Draft = Contents;
+  Entry.Draft = PieceTable(Contents);
   return NewVersion;
 }
 
+llvm::Optional<VersionedDraft>
+DraftStore::updateDraft(PathRef File,
+                        ArrayRef<TextDocumentContentChangeEvent> Changes) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  auto It = Drafts.find(File);
+  if (It == Drafts.end() || !It->second.Draft)
+    return llvm::None;
+
+  // Apply the changes to a copy, so that the draft stays untouched if any of
+  // the changes is invalid. Copies only the pieces, not the contents.
+  PieceTable NewDraft = *It->second.Draft;
+  for (const TextDocumentContentChangeEvent &Change : Changes) {
+    if (!Change.range) {
+      NewDraft = PieceTable(Change.text);
+      continue;
+    }
+
+    auto Start = getOffsetInDraft(NewDraft, Change.range->start);
+    auto End = getOffsetInDraft(NewDraft, Change.range->end);
+    if (!Start || !End || *End < *Start)
+      return llvm::None;
+    NewDraft.replace(*Start, *End - *Start, Change.text);
+  }
+
+  auto &Entry = It->second;
+  ++Entry.Version;
+  Entry.Draft = std::move(NewDraft);
+  return Entry;
+}
+
 DocVersion DraftStore::removeDraft(PathRef File) {
   std::lock_guard<std::mutex> Lock(Mutex);
 
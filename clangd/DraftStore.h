@@ -11,8 +11,11 @@
 #define LLVM_CLANG_TOOLS_EXTRA_CLANGD_DRAFTSTORE_H
 
 #include "Path.h"
+#include "Protocol.h"
 #include "clang/Basic/LLVM.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringMap.h"
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -23,11 +26,103 @@ namespace clangd {
 /// Using 'unsigned' here to avoid undefined behaviour on overflow.
 typedef unsigned DocVersion;
 
+/// \return the length of \p Text in UTF-16 code units, in which LSP measures
+/// columns.
+size_t getUTF16Length(StringRef Text);
+/// \return the number of bytes in the prefix of \p Line, that is \p Column
+/// UTF-16 code units long, or the size of \p Line if it is shorter.
+size_t getByteOffsetOfColumn(StringRef Line, size_t Column);
+/// Turn a [line, column] pair into an offset in \p Code, like
+/// PieceTable::positionToOffset. Scans \p Code up to the line without building
+/// a line index, prefer PieceTable::positionToOffset for drafts.
+size_t positionToOffset(StringRef Code, Position P);
+
+/// A piece table, storing contents of a document as a sequence of pieces of
+/// immutable buffers. Allows to apply edits in time proportional to the size of
+/// the edit and the number of pieces, without touching the rest of the
+/// document. Copies of PieceTable share the underlying buffers, so they are
+/// cheap and can be safely passed to other threads.
+/// Each buffer stores offsets of its line breaks, computed once when the
+/// buffer is created. Conversions between offsets and positions use binary
+/// search over those and never scan the whole document.
+class PieceTable {
+public:
+  PieceTable();
+  explicit PieceTable(StringRef Contents);
+
+  /// Replace \p Length bytes, starting at \p Offset, with \p NewText.
+  /// \p Offset and \p Length must point inside the document.
+  void replace(size_t Offset, size_t Length, StringRef NewText);
+
+  /// \return an offset of the first character of a zero-based \p Line, or None
+  /// if the document has less lines.
+  llvm::Optional<size_t> getLineStart(unsigned Line) const;
+  /// \return an offset of the end of a zero-based \p Line, i.e. of the line
+  /// break terminating the line or the end of the document for the last line.
+  /// \p Line must be a valid line of the document.
+  size_t getLineEnd(unsigned Line) const;
+
+  /// Turn a [line, column] pair into an offset in the document. Columns are
+  /// measured in UTF-16 code units, as required by LSP. Columns past the end of
+  /// a line point to the end of that line, lines past the end of the document
+  /// point to the end of the document and negative lines to its start.
+  size_t positionToOffset(Position P) const;
+  /// Turn \p Column, measured in UTF-16 code units, of the line starting at
+  /// \p LineStart into an offset in the document. Columns past the end of the
+  /// line point to the end of that line.
+  size_t columnToOffset(size_t LineStart, size_t Column) const;
+  /// Turn an offset in the document into a [line, column] pair. Columns are
+  /// measured in UTF-16 code units.
+  Position offsetToPosition(size_t Offset) const;
+
+  /// \return a size of the document in bytes.
+  size_t size() const { return Size; }
+
+  /// Builds contiguous contents of the document.
+  std::string str() const;
+  /// Builds contiguous contents of a part of the document, starting at \p
+  /// Offset and \p Length bytes long.
+  std::string substr(size_t Offset, size_t Length) const;
+
+private:
+  /// An immutable buffer with precomputed offsets of line breaks.
+  struct Buffer {
+    Buffer(std::string Text);
+
+    std::string Text;
+    std::vector<size_t> LineBreaks;
+  };
+
+  struct Piece {
+    std::shared_ptr<const Buffer> Buf;
+    size_t Start;
+    size_t Length;
+
+    /// \return number of line breaks inside the piece.
+    size_t countLineBreaks() const;
+  };
+
+  /// \return an offset of the \p N-th (zero-based) line break, or None if the
+  /// document has less line breaks.
+  llvm::Optional<size_t> findLineBreak(size_t N) const;
+  /// \return number of line breaks before \p Offset.
+  size_t countLineBreaksBefore(size_t Offset) const;
+  /// Splits a piece containing \p Offset, so that a piece starts exactly at \p
+  /// Offset. \return an index of that piece (or Pieces.size() if \p Offset is
+  /// the end of the document).
+  size_t splitAt(size_t Offset);
+  /// Replaces all pieces with a single buffer, holding the whole document.
+  void compact();
+
+  std::vector<Piece> Pieces;
+  size_t Size = 0;
+};
+
 /// Document draft with a version of this draft.
 struct VersionedDraft {
   DocVersion Version;
   /// If the value of the field is None, draft is now deleted
-  llvm::Optional<std::string> Draft;
+  llvm::Optional<PieceTable> Draft;
 };
 
 /// A thread-safe container for files opened in a workspace, addressed by
@@ -46,6 +141,13 @@ public:
   /// Replace contents of the draft for \p File with \p Contents.
   /// \return The new version of the draft for \p File.
   DocVersion updateDraft(PathRef File, StringRef Contents);
+  /// Apply \p Changes to the draft for \p File in order. Changes without a
+  /// range replace the whole contents of the draft.
+  /// \return The new version and contents of the draft for \p File, or None if
+  /// \p File is not tracked or one of the changes has an invalid range. In the
+  /// latter case the draft is not modified.
+  llvm::Optional<VersionedDraft>
+  updateDraft(PathRef File, ArrayRef<TextDocumentContentChangeEvent> Changes);
   /// Remove the contents of the draft
   /// \return The new version of the draft for \p File.
   DocVersion removeDraft(PathRef File);
@@ -0,0 +1,234 @@
+//===--- FileSystemCache.cpp - Caches file accesses of CppFiles --*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+
+#include "FileSystemCache.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+using namespace clang::clangd;
+using namespace clang;
+
+struct FileSystemCache::Entries {
+  std::mutex Mutex;
+  /// Results of status() calls, keyed by the requested path.
+  llvm::StringMap<llvm::ErrorOr<vfs::Status>> Statuses;
+  /// Contents of files, keyed by the path they were opened with.
+  llvm::StringMap<std::unique_ptr<llvm::MemoryBuffer>> Contents;
+  /// Total size of Contents.
+  std::size_t ContentsBytes = 0;
+};
+
+namespace {
+
+using Entries = FileSystemCache::Entries;
+
+/// Returns the absolute path of \p Path in the working directory of \p FS,
+/// which is used as the key in the cache, or None if \p Path must not be
+/// cached.
+llvm::Optional<std::string> getCacheKey(const vfs::FileSystem &FS,
+                                        const Twine &Path) {
+  static const std::string TempDir = []() {
+    llvm::SmallString<128> Dir;
+    llvm::sys::path::system_temp_directory(/*ErasedOnReboot=*/true, Dir);
+    return Dir.str().str();
+  }();
+  llvm::SmallString<256> Key;
+  Path.toVector(Key);
+  // The cache is shared by filesystems with different working directories.
+  if (FS.makeAbsolute(Key))
+    return llvm::None;
+  // Preambles are stored in temporary files, which are only read once and are
+  // large. Don't cache anything in the temporary directory.
+  if (Key.startswith(TempDir))
+    return llvm::None;
+  return Key.str().str();
+}
+
+/// Returns \p Status, named as the caller requested it. Statuses are cached by
+/// their absolute path.
+llvm::ErrorOr<vfs::Status> withName(llvm::ErrorOr<vfs::Status> Status,
+                                    StringRef Name) {
+  if (!Status)
+    return Status;
+  return vfs::Status::copyWithNewName(*Status, Name);
+}
+
+/// Returns a buffer, that references \p Contents without copying them.
+std::unique_ptr<llvm::MemoryBuffer>
+referenceContents(const llvm::MemoryBuffer &Contents, const Twine &Name,
+                  bool RequiresNullTerminator) {
+  // The cached copies are always null-terminated.
+  return llvm::MemoryBuffer::getMemBuffer(Contents.getBuffer(), Name,
+                                          RequiresNullTerminator);
+}
+
+/// A file, opened through a CachingFileSystem. Reads from \p File only if the
+/// status or the contents are not in the cache yet, \p File is null if both
+/// were cached when the file was opened. \p Path is the key in the cache,
+/// \p Name is the path the file was opened with.
+class CachedFile : public vfs::File {
+public:
+  CachedFile(std::string Path, std::string Name,
+             std::unique_ptr<vfs::File> File, std::shared_ptr<Entries> Cache)
+      : Path(std::move(Path)), Name(std::move(Name)), File(std::move(File)),
+        Cache(std::move(Cache)) {}
+
+  llvm::ErrorOr<vfs::Status> status() override {
+    {
+      std::lock_guard<std::mutex> Lock(Cache->Mutex);
+      auto It = Cache->Statuses.find(Path);
+      if (It != Cache->Statuses.end())
+        return withName(It->second, Name);
+    } // unlock Cache->Mutex
+    assert(File && "status must be cached when File is null");
+    auto Status = File->status();
+    if (Status) {
+      std::lock_guard<std::mutex> Lock(Cache->Mutex);
+      Cache->Statuses.try_emplace(Path, Status);
+    }
+    return withName(std::move(Status), Name);
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+  getBuffer(const Twine &Name, int64_t FileSize, bool RequiresNullTerminator,
+            bool IsVolatile) override {
+    {
+      std::lock_guard<std::mutex> Lock(Cache->Mutex);
+      auto It = Cache->Contents.find(Path);
+      if (It != Cache->Contents.end())
+        return referenceContents(*It->second, Name, RequiresNullTerminator);
+    } // unlock Cache->Mutex
+    assert(File && "contents must be cached when File is null");
+    auto Buffer =
+        File->getBuffer(Name, FileSize, RequiresNullTerminator, IsVolatile);
+    // Volatile files may change while they're read, don't remember them.
+    if (!Buffer || IsVolatile)
+      return Buffer;
+    // The contents are copied once into the cache, all opens of the file
+    // reference the copy.
+    auto Copy =
+        llvm::MemoryBuffer::getMemBufferCopy((*Buffer)->getBuffer(), Path);
+    std::lock_guard<std::mutex> Lock(Cache->Mutex);
+    auto Inserted = Cache->Contents.try_emplace(Path, std::move(Copy));
+    if (Inserted.second)
+      Cache->ContentsBytes += Inserted.first->second->getBufferSize();
+    // Entries are never removed, so the buffer stays valid while Cache lives.
+    return referenceContents(*Inserted.first->second, Name,
+                             RequiresNullTerminator);
+  }
+
+  std::error_code close() override {
+    if (File)
+      return File->close();
+    return std::error_code();
+  }
+
+private:
+  std::string Path;
+  std::string Name;
+  std::unique_ptr<vfs::File> File;
+  std::shared_ptr<Entries> Cache;
+};
+
+class CachingFileSystem : public vfs::FileSystem {
+public:
+  CachingFileSystem(IntrusiveRefCntPtr<vfs::FileSystem> FS,
+                    std::shared_ptr<Entries> Cache)
+      : FS(std::move(FS)), Cache(std::move(Cache)) {}
+
+  llvm::ErrorOr<vfs::Status> status(const Twine &Path) override {
+    auto CacheKey = getCacheKey(*FS, Path);
+    if (!CacheKey)
+      return FS->status(Path);
+    const std::string &Key = *CacheKey;
+    {
+      std::lock_guard<std::mutex> Lock(Cache->Mutex);
+      auto It = Cache->Statuses.find(Key);
+      if (It != Cache->Statuses.end())
+        return withName(It->second, Path.str());
+    } // unlock Cache->Mutex
+    auto Status = FS->status(Key);
+    {
+      std::lock_guard<std::mutex> Lock(Cache->Mutex);
+      Cache->Statuses.try_emplace(Key, Status);
+    } // unlock Cache->Mutex
+    return withName(std::move(Status), Path.str());
+  }
+
+  llvm::ErrorOr<std::unique_ptr<vfs::File>>
+  openFileForRead(const Twine &Path) override {
+    auto CacheKey = getCacheKey(*FS, Path);
+    if (!CacheKey)
+      return FS->openFileForRead(Path);
+    const std::string &Key = *CacheKey;
+    {
+      std::lock_guard<std::mutex> Lock(Cache->Mutex);
+      auto StatusIt = Cache->Statuses.find(Key);
+      if (StatusIt != Cache->Statuses.end() && !StatusIt->second)
+        return StatusIt->second.getError();
+      if (StatusIt != Cache->Statuses.end() && Cache->Contents.count(Key))
+        return std::unique_ptr<vfs::File>(
+            new CachedFile(Key, Path.str(), nullptr, Cache));
+    } // unlock Cache->Mutex
+    auto File = FS->openFileForRead(Key);
+    if (!File)
+      return File.getError();
+    return std::unique_ptr<vfs::File>(
+        new CachedFile(Key, Path.str(), std::move(*File), Cache));
+  }
+
+  vfs::directory_iterator dir_begin(const Twine &Dir,
+                                    std::error_code &EC) override {
+    return FS->dir_begin(Dir, EC);
+  }
+
+  llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override {
+    return FS->getCurrentWorkingDirectory();
+  }
+
+  std::error_code setCurrentWorkingDirectory(const Twine &Path) override {
+    return FS->setCurrentWorkingDirectory(Path);
+  }
+
+private:
+  IntrusiveRefCntPtr<vfs::FileSystem> FS;
+  std::shared_ptr<Entries> Cache;
+};
+
+} // namespace
+
+FileSystemCache::FileSystemCache()
+    : CurrentEntries(std::make_shared<Entries>()) {}
+
+IntrusiveRefCntPtr<vfs::FileSystem>
+FileSystemCache::getFileSystem(IntrusiveRefCntPtr<vfs::FileSystem> FS) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return new CachingFileSystem(std::move(FS), CurrentEntries);
+}
+
+void FileSystemCache::invalidate() {
+  // Filesystems, returned by getFileSystem() before, keep the old entries
+  // alive.
+  auto NewEntries = std::make_shared<Entries>();
+  std::lock_guard<std::mutex> Lock(Mutex);
+  CurrentEntries = std::move(NewEntries);
+}
+
+std::size_t FileSystemCache::getUsedBytes() {
+  std::shared_ptr<Entries> Current;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Current = CurrentEntries;
+  } // unlock Mutex
+  std::lock_guard<std::mutex> Lock(Current->Mutex);
+  return Current->ContentsBytes;
+}
@@ -0,0 +1,65 @@
+//===--- FileSystemCache.h - Caches file accesses of CppFiles ----*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_FILESYSTEMCACHE_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANGD_FILESYSTEMCACHE_H
+
+#include "clang/Basic/VirtualFileSystem.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+namespace clang {
+namespace clangd {
+
+/// A thread-safe cache of the results of status() calls and of the contents
+/// of files, read through a vfs::FileSystem. A CppFileCollection shares one
+/// between the reparses of all its files, so the header search does not stat()
+/// the same include paths on each reparse, and each header is kept in memory
+/// only once. This matters on network-mounted source trees, where stat()
+/// calls are slow. Failed lookups are cached too. Files in the temporary
+/// directory, e.g. the preambles, are never cached.
+/// The cache does not notice changes to the files on its own, they have to be
+/// reported by calling invalidate().
+/// Paths are cached by their absolute path, in the working directory of the
+/// filesystem they were requested from.
+class FileSystemCache {
+public:
+  FileSystemCache();
+
+  /// Returns a vfs::FileSystem, which reads through \p FS and serves repeated
+  /// status() and openFileForRead() calls from the cache. The returned
+  /// vfs::FileSystem keeps using the results, cached at the time of this
+  /// call, even after invalidate() is called, so a single rebuild always sees
+  /// a consistent view of the files.
+  /// The buffers, returned by the files it opens, reference the cached
+  /// contents, which live as long as the returned vfs::FileSystem.
+  IntrusiveRefCntPtr<vfs::FileSystem>
+  getFileSystem(IntrusiveRefCntPtr<vfs::FileSystem> FS);
+
+  /// Starts a new generation of the cache. The following calls to
+  /// getFileSystem() will not use the results that were cached before.
+  void invalidate();
+
+  /// Returns the size of the contents, cached by the current generation, in
+  /// bytes.
+  std::size_t getUsedBytes();
+
+  /// The results, cached during one generation.
+  struct Entries;
+
+private:
+  std::mutex Mutex;
+  std::shared_ptr<Entries> CurrentEntries;
+};
+
+} // namespace clangd
+} // namespace clang
+
+#endif
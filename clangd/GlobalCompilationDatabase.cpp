@@ -9,8 +9,11 @@
 
 #include "GlobalCompilationDatabase.h"
 #include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
+#include <algorithm>
 
 namespace clang {
 namespace clangd {
@@ -36,35 +39,181 @@ tooling::CompileCommand getDefaultCompileCommand(PathRef File) {
                                  /*Output=*/"");
 }
 
+DirectoryBasedGlobalCompilationDatabase::FileStamp
+DirectoryBasedGlobalCompilationDatabase::FileStamp::get(PathRef File) {
+  FileStamp Stamp;
+  Stamp.File = File;
+  llvm::sys::fs::file_status Status;
+  if (llvm::sys::fs::status(File, Status))
+    return Stamp;
+  Stamp.Exists = true;
+  Stamp.ModificationTime = Status.getLastModificationTime();
+  Stamp.Size = Status.getSize();
+  return Stamp;
+}
+
+bool DirectoryBasedGlobalCompilationDatabase::FileStamp::isUpToDate() const {
+  llvm::sys::fs::file_status Status;
+  if (llvm::sys::fs::status(File, Status))
+    return !Exists;
+  return Exists && Status.getLastModificationTime() == ModificationTime &&
+         Status.getSize() == Size;
+}
+
+DirectoryBasedGlobalCompilationDatabase::
+    DirectoryBasedGlobalCompilationDatabase(
+        std::chrono::steady_clock::duration RevalidationInterval)
+    : RevalidationInterval(RevalidationInterval) {}
+
 std::vector<tooling::CompileCommand>
 DirectoryBasedGlobalCompilationDatabase::getCompileCommands(PathRef File) {
-  std::vector<tooling::CompileCommand> Commands;
+  if (auto Cached = getCachedCommands(File))
+    return Cached->Commands;
 
-  auto CDB = getCompilationDatabase(File);
-  if (CDB)
-    Commands = CDB->getCompileCommands(File);
-  if (Commands.empty())
-    Commands.push_back(getDefaultCompileCommand(File));
+  std::lock_guard<std::mutex> Lock(Mutex);
+  // Another thread might have computed the commands while we were waiting for
+  // the lock.
+  if (auto Cached = getCachedCommands(File))
+    return Cached->Commands;
+  std::shared_ptr<CachedCommands> Computed = computeCommandsLocked(File);
+  {
+    std::lock_guard<std::mutex> CommandsLock(CommandsMutex);
+    storeCommandsLocked(File, Computed);
+  } // unlock CommandsMutex
+  return Computed->Commands;
+}
 
-  auto It = ExtraFlagsForFile.find(File);
-  if (It != ExtraFlagsForFile.end()) {
-    // Append the user-specified flags to the compile commands.
-    for (tooling::CompileCommand &Command : Commands)
-      addExtraFlags(Command, It->second);
-  }
+std::vector<Path> DirectoryBasedGlobalCompilationDatabase::getAllFiles() {
+  std::lock_guard<std::mutex> Lock(Mutex);
 
-  return Commands;
+  std::vector<Path> Result;
+  for (const auto &CDB : CompilationDatabases) {
+    if (!CDB.second.CDB)
+      continue;
+    std::vector<std::string> Files = CDB.second.CDB->getAllFiles();
+    Result.insert(Result.end(), Files.begin(), Files.end());
+  }
+  // Different databases might list the same files.
+  std::sort(Result.begin(), Result.end());
+  Result.erase(std::unique(Result.begin(), Result.end()), Result.end());
+  return Result;
 }
 
 void DirectoryBasedGlobalCompilationDatabase::setExtraFlagsForFile(
     PathRef File, std::vector<std::string> ExtraFlags) {
+  std::lock_guard<std::mutex> Lock(Mutex);
   ExtraFlagsForFile[File] = std::move(ExtraFlags);
+  // Cached commands of the file don't have the new flags.
+  std::lock_guard<std::mutex> CommandsLock(CommandsMutex);
+  storeCommandsLocked(File, nullptr);
 }
 
-tooling::CompilationDatabase *
-DirectoryBasedGlobalCompilationDatabase::getCompilationDatabase(PathRef File) {
-  std::lock_guard<std::mutex> Lock(Mutex);
+std::shared_ptr<DirectoryBasedGlobalCompilationDatabase::CachedCommands>
+DirectoryBasedGlobalCompilationDatabase::getCachedCommands(PathRef File) {
+  std::shared_ptr<CachedCommands> Cached = findInSnapshot(File);
+  if (!Cached) {
+    std::lock_guard<std::mutex> CommandsLock(CommandsMutex);
+    Cached = findCommandsLocked(File);
+    if (!Cached)
+      return nullptr;
+  } // unlock CommandsMutex
+
+  // The dependencies are checked without holding the lock, they are never
+  // modified after the commands were computed.
+  auto Now = std::chrono::steady_clock::now().time_since_epoch().count();
+  if (Now - Cached->ValidatedAt.load() < RevalidationInterval.count())
+    return Cached;
+  for (const FileStamp &Dependency : Cached->Dependencies) {
+    if (!Dependency.isUpToDate())
+      return nullptr;
+  }
+  Cached->ValidatedAt = Now;
+  return Cached;
+}
+
+std::shared_ptr<DirectoryBasedGlobalCompilationDatabase::CachedCommands>
+DirectoryBasedGlobalCompilationDatabase::findInSnapshot(PathRef File) {
+  std::shared_ptr<CachedCommands> Cached;
+  // The snapshot is not freed while SnapshotReaders is not 0.
+  ++SnapshotReaders;
+  if (const CommandsMap *Map = Snapshot.load()) {
+    auto It = Map->find(File);
+    if (It != Map->end() && !It->second->Invalidated)
+      Cached = It->second;
+  }
+  --SnapshotReaders;
+  return Cached;
+}
 
+std::shared_ptr<DirectoryBasedGlobalCompilationDatabase::CachedCommands>
+DirectoryBasedGlobalCompilationDatabase::findCommandsLocked(PathRef File) {
+  auto It = Recent.find(File);
+  if (It != Recent.end())
+    return It->second;
+  // The snapshot is only replaced under CommandsMutex.
+  if (const CommandsMap *Map = Snapshot.load()) {
+    auto SnapshotIt = Map->find(File);
+    if (SnapshotIt != Map->end() && !SnapshotIt->second->Invalidated)
+      return SnapshotIt->second;
+  }
+  return nullptr;
+}
+
+void DirectoryBasedGlobalCompilationDatabase::storeCommandsLocked(
+    PathRef File, std::shared_ptr<CachedCommands> Computed) {
+  if (auto Old = findCommandsLocked(File))
+    Old->Invalidated = true;
+  if (!Computed) {
+    Recent.erase(File);
+    return;
+  }
+  Recent[File] = std::move(Computed);
+
+  const CommandsMap *Current = Snapshot.load();
+  if (Current && Recent.size() < Current->size())
+    return;
+  auto Merged = llvm::make_unique<CommandsMap>();
+  if (Current) {
+    for (const auto &Entry : *Current)
+      if (!Entry.second->Invalidated)
+        Merged->try_emplace(Entry.first(), Entry.second);
+  }
+  for (auto &Entry : Recent)
+    (*Merged)[Entry.first()] = std::move(Entry.second);
+  Recent.clear();
+  Snapshot = Merged.get();
+  Snapshots.push_back(std::move(Merged));
+  // Readers, that start after this point, see the new snapshot.
+  if (SnapshotReaders == 0)
+    Snapshots.erase(Snapshots.begin(), Snapshots.end() - 1);
+}
+
+std::shared_ptr<DirectoryBasedGlobalCompilationDatabase::CachedCommands>
+DirectoryBasedGlobalCompilationDatabase::computeCommandsLocked(PathRef File) {
+  auto Result = std::make_shared<CachedCommands>();
+  // Dependencies are checked before the commands are computed, so changes made
+  // while computing them are noticed by the next revalidation.
+  Result->ValidatedAt =
+      std::chrono::steady_clock::now().time_since_epoch().count();
+
+  auto CDB = getCompilationDatabaseLocked(File, Result->Dependencies);
+  if (CDB)
+    Result->Commands = CDB->getCompileCommands(File);
+  if (Result->Commands.empty())
+    Result->Commands.push_back(getDefaultCompileCommand(File));
+
+  auto It = ExtraFlagsForFile.find(File);
+  if (It != ExtraFlagsForFile.end()) {
+    // Append the user-specified flags to the compile commands.
+    for (tooling::CompileCommand &Command : Result->Commands)
+      addExtraFlags(Command, It->second);
+  }
+  return Result;
+}
+
+tooling::CompilationDatabase *
+DirectoryBasedGlobalCompilationDatabase::getCompilationDatabaseLocked(
+    PathRef File, std::vector<FileStamp> &Dependencies) {
   namespace path = llvm::sys::path;
 
   assert((path::is_absolute(File, path::Style::posix) ||
@@ -75,23 +224,38 @@ DirectoryBasedGlobalCompilationDatabase::getCompilationDatabase(PathRef File) {
        Path = path::parent_path(Path)) {
 
     auto CachedIt = CompilationDatabases.find(Path);
-    if (CachedIt != CompilationDatabases.end())
-      return CachedIt->second.get();
-    std::string Error;
-    auto CDB = tooling::CompilationDatabase::loadFromDirectory(Path, Error);
-    if (!CDB) {
-      if (!Error.empty()) {
+    if (CachedIt == CompilationDatabases.end() ||
+        !CachedIt->second.Stamp.isUpToDate()) {
+      CachedDatabase Loaded;
+      llvm::SmallString<128> DatabaseFile(Path);
+      path::append(DatabaseFile, "compile_commands.json");
+      // Take the stamp before loading, so that changes made while loading
+      // cause a reload.
+      FileStamp DatabaseStamp = FileStamp::get(DatabaseFile);
+      FileStamp DirectoryStamp = FileStamp::get(Path);
+
+      std::string Error;
+      Loaded.CDB = tooling::CompilationDatabase::loadFromDirectory(Path, Error);
+      if (!Loaded.CDB && !Error.empty()) {
         // FIXME(ibiryukov): logging
         // Output.log("Error when trying to load compilation database from " +
         //            Twine(Path) + ": " + Twine(Error) + "\n");
       }
-      continue;
+      // A directory without a database changes when a database is added. A
+      // database that failed to load is tried again when it's fixed, which
+      // may not change the directory.
+      Loaded.Stamp = Loaded.CDB || DatabaseStamp.Exists
+                         ? std::move(DatabaseStamp)
+                         : std::move(DirectoryStamp);
+      CachedIt = CompilationDatabases.try_emplace(Path).first;
+      if (Loaded.CDB || CachedIt->second.CDB)
+        ++Generation;
+      CachedIt->second = std::move(Loaded);
     }
 
-    // FIXME(ibiryukov): Invalidate cached compilation databases on changes
-    auto result = CDB.get();
-    CompilationDatabases.insert(std::make_pair(Path, std::move(CDB)));
-    return result;
+    Dependencies.push_back(CachedIt->second.Stamp);
+    if (CachedIt->second.CDB)
+      return CachedIt->second.CDB.get();
   }
 
   // FIXME(ibiryukov): logging
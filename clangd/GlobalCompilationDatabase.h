@@ -12,6 +12,9 @@
 
 #include "Path.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Chrono.h"
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -36,28 +39,131 @@ public:
   virtual std::vector<tooling::CompileCommand>
   getCompileCommands(PathRef File) = 0;
 
+  /// Returns all files the database knows about. Used to build the index of
+  /// the whole project.
+  virtual std::vector<Path> getAllFiles() { return {}; }
+
+  /// Returns a number that changes whenever getAllFiles() might return
+  /// different files, e.g. when a new compilation database was loaded. Allows
+  /// callers to avoid enumerating all files when nothing changed.
+  virtual unsigned getAllFilesGeneration() { return 0; }
+
   /// FIXME(ibiryukov): add facilities to track changes to compilation flags of
   /// existing targets.
 };
 
 /// Gets compile args from tooling::CompilationDatabases built for parent
 /// directories.
+///
+/// Compile commands are cached per file. Cached commands are looked up without
+/// locking, and are revalidated by checking modification times of the files
+/// they were computed from: the compile_commands.json they came from, or that
+/// failed to load, and the directories that were searched for a database
+/// without finding one.
+/// Compilation databases are reloaded when compile_commands.json changes.
 class DirectoryBasedGlobalCompilationDatabase
     : public GlobalCompilationDatabase {
 public:
+  /// Cached commands are revalidated at most once per \p RevalidationInterval,
+  /// so changes to compilation databases are noticed with that delay.
+  explicit DirectoryBasedGlobalCompilationDatabase(
+      std::chrono::steady_clock::duration RevalidationInterval =
+          std::chrono::seconds(1));
+
   std::vector<tooling::CompileCommand>
   getCompileCommands(PathRef File) override;
 
+  /// Returns all files from the compilation databases that were loaded so far,
+  /// i.e. the databases for files that getCompileCommands was called for.
+  std::vector<Path> getAllFiles() override;
+
+  /// Changes when a compilation database is loaded, reloaded or removed.
+  unsigned getAllFilesGeneration() override { return Generation; }
+
   void setExtraFlagsForFile(PathRef File, std::vector<std::string> ExtraFlags);
 
 private:
-  tooling::CompilationDatabase *getCompilationDatabase(PathRef File);
+  /// The state of a file or directory at the time it was read.
+  struct FileStamp {
+    Path File;
+    bool Exists = false;
+    llvm::sys::TimePoint<> ModificationTime;
+    uint64_t Size = 0;
+
+    static FileStamp get(PathRef File);
+    bool isUpToDate() const;
+  };
+
+  struct CachedCommands {
+    std::vector<tooling::CompileCommand> Commands;
+    /// Files and directories that the commands were computed from.
+    std::vector<FileStamp> Dependencies;
+    /// When the dependencies were last checked, in steady_clock ticks.
+    std::atomic<std::chrono::steady_clock::rep> ValidatedAt;
+    /// Set when the commands were replaced or removed from the cache. They
+    /// may still be found in an older snapshot.
+    std::atomic<bool> Invalidated{false};
+  };
+
+  /// A compilation database loaded from a directory or, if CDB is null, a
+  /// directory that has no compilation database.
+  struct CachedDatabase {
+    std::unique_ptr<tooling::CompilationDatabase> CDB;
+    /// The compile_commands.json for loaded databases, or the directory
+    /// itself, which changes when a database is added to it.
+    FileStamp Stamp;
+  };
+
+  using CommandsMap = llvm::StringMap<std::shared_ptr<CachedCommands>>;
+
+  /// Returns cached commands for \p File if they are up to date. Only locks
+  /// CommandsMutex if \p File is not in the snapshot.
+  std::shared_ptr<CachedCommands> getCachedCommands(PathRef File);
+  /// Looks up \p File in the current snapshot without locking.
+  std::shared_ptr<CachedCommands> findInSnapshot(PathRef File);
+  /// Looks up \p File in Recent and the snapshot. CommandsMutex must be locked.
+  std::shared_ptr<CachedCommands> findCommandsLocked(PathRef File);
+  /// Caches \p Computed for \p File, or removes the cached commands if it's
+  /// null. CommandsMutex must be locked.
+  void storeCommandsLocked(PathRef File,
+                           std::shared_ptr<CachedCommands> Computed);
+  std::shared_ptr<CachedCommands> computeCommandsLocked(PathRef File);
+  /// Finds a compilation database for \p File, recording all directories and
+  /// files it was looked up in into \p Dependencies.
+  tooling::CompilationDatabase *
+  getCompilationDatabaseLocked(PathRef File,
+                               std::vector<FileStamp> &Dependencies);
+
+  const std::chrono::steady_clock::duration RevalidationInterval;
+
+  /// The cached commands for each file are split between an immutable snapshot,
+  /// which is read without locking, and Recent, which holds the commands
+  /// computed since the snapshot was made. Recent is merged into a new
+  /// snapshot once it's as large as the current one, so each entry is copied a
+  /// constant number of times on average.
+  std::atomic<const CommandsMap *> Snapshot{nullptr};
+  /// Number of threads reading a snapshot. Replaced snapshots are freed when
+  /// it is 0, later readers only see the newest one.
+  std::atomic<unsigned> SnapshotReaders{0};
+
+  /// Guards the fields below, up to Mutex, and the replacement of Snapshot.
+  /// It is not held while a database is loaded under Mutex. When both are
+  /// needed, Mutex is locked first.
+  std::mutex CommandsMutex;
+  /// Commands computed after Snapshot was made.
+  CommandsMap Recent;
+  /// Owns Snapshot, which is the last element, and the replaced snapshots,
+  /// which may still be read.
+  std::vector<std::unique_ptr<const CommandsMap>> Snapshots;
+
+  /// Incremented when CompilationDatabases changes the loaded databases.
+  std::atomic<unsigned> Generation{0};
 
+  /// Guards all fields below.
   std::mutex Mutex;
   /// Caches compilation databases loaded from directories(keys are
-  /// directories).
-  llvm::StringMap<std::unique_ptr<clang::tooling::CompilationDatabase>>
-      CompilationDatabases;
+  /// directories), including the directories without databases.
+  llvm::StringMap<CachedDatabase> CompilationDatabases;
 
   /// Stores extra flags per file.
   llvm::StringMap<std::vector<std::string>> ExtraFlagsForFile;
@@ -0,0 +1,514 @@
+//===--- JSON.cpp - In-place JSON parser and streaming writer ----*-C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "JSON.h"
+#include "llvm/Support/Format.h"
+#include <cstring>
+
+using namespace clang::clangd;
+using namespace clang;
+
+namespace {
+
+/// Maximum nesting of arrays and objects. LSP messages are shallow, the limit
+/// only protects the recursive parser from running out of stack.
+const unsigned MaxDepth = 256;
+
+bool isWhitespace(char C) {
+  return C == ' ' || C == '\t' || C == '\n' || C == '\r';
+}
+
+bool isDigit(char C) { return C >= '0' && C <= '9'; }
+
+/// Parses 4 hex digits at \p P. \return false if they are not hex digits.
+bool parseHex4(const char *P, unsigned &Result) {
+  Result = 0;
+  for (int I = 0; I < 4; ++I) {
+    char C = P[I];
+    unsigned Digit;
+    if (C >= '0' && C <= '9')
+      Digit = C - '0';
+    else if (C >= 'a' && C <= 'f')
+      Digit = C - 'a' + 10;
+    else if (C >= 'A' && C <= 'F')
+      Digit = C - 'A' + 10;
+    else
+      return false;
+    Result = Result * 16 + Digit;
+  }
+  return true;
+}
+
+/// Writes \p CodePoint to \p Out as UTF-8. \return the end of the written
+/// sequence.
+char *encodeUTF8(unsigned CodePoint, char *Out) {
+  if (CodePoint < 0x80) {
+    *Out++ = CodePoint;
+  } else if (CodePoint < 0x800) {
+    *Out++ = 0xC0 | (CodePoint >> 6);
+    *Out++ = 0x80 | (CodePoint & 0x3F);
+  } else if (CodePoint < 0x10000) {
+    *Out++ = 0xE0 | (CodePoint >> 12);
+    *Out++ = 0x80 | ((CodePoint >> 6) & 0x3F);
+    *Out++ = 0x80 | (CodePoint & 0x3F);
+  } else {
+    *Out++ = 0xF0 | (CodePoint >> 18);
+    *Out++ = 0x80 | ((CodePoint >> 12) & 0x3F);
+    *Out++ = 0x80 | ((CodePoint >> 6) & 0x3F);
+    *Out++ = 0x80 | (CodePoint & 0x3F);
+  }
+  return Out;
+}
+
+} // namespace
+
+namespace clang {
+namespace clangd {
+namespace json {
+
+/// A recursive descent parser. Strings are unescaped in place: an escape
+/// sequence is never shorter than the characters it stands for, so the
+/// unescaped string always fits into the space of the original one.
+class Parser {
+public:
+  Parser(MutableArrayRef<char> Text, llvm::BumpPtrAllocator &Alloc)
+      : P(Text.begin()), End(Text.end()), Alloc(Alloc) {}
+
+  const Value *parse() {
+    Value *Result = new (Alloc.Allocate<Value>()) Value();
+    if (!parseValue(*Result, 0))
+      return nullptr;
+    skipWhitespace();
+    if (P != End)
+      return nullptr;
+    return Result;
+  }
+
+private:
+  void skipWhitespace() {
+    while (P != End && isWhitespace(*P))
+      ++P;
+  }
+
+  /// Consumes \p Literal if the input starts with it.
+  bool consume(StringRef Literal) {
+    if (static_cast<size_t>(End - P) < Literal.size() ||
+        std::memcmp(P, Literal.data(), Literal.size()) != 0)
+      return false;
+    P += Literal.size();
+    return true;
+  }
+
+  bool parseValue(Value &Out, unsigned Depth) {
+    skipWhitespace();
+    if (P == End)
+      return false;
+    switch (*P) {
+    case 'n':
+      Out.Kind = Value::Null;
+      return consume("null");
+    case 't':
+      Out.Kind = Value::Boolean;
+      Out.BooleanValue = true;
+      return consume("true");
+    case 'f':
+      Out.Kind = Value::Boolean;
+      Out.BooleanValue = false;
+      return consume("false");
+    case '"':
+      Out.Kind = Value::String;
+      return parseString(Out.Text);
+    case '[':
+      if (Depth >= MaxDepth)
+        return false;
+      return parseArray(Out, Depth + 1);
+    case '{':
+      if (Depth >= MaxDepth)
+        return false;
+      return parseObject(Out, Depth + 1);
+    default:
+      Out.Kind = Value::Number;
+      return parseNumber(Out.Text);
+    }
+  }
+
+  /// Checks the number against the JSON grammar, the number is converted
+  /// lazily by Value::asInteger.
+  bool parseNumber(StringRef &Out) {
+    const char *Begin = P;
+    if (P != End && *P == '-')
+      ++P;
+    if (P == End || !isDigit(*P))
+      return false;
+    if (*P == '0') {
+      ++P;
+    } else {
+      while (P != End && isDigit(*P))
+        ++P;
+    }
+    if (P != End && *P == '.') {
+      ++P;
+      if (P == End || !isDigit(*P))
+        return false;
+      while (P != End && isDigit(*P))
+        ++P;
+    }
+    if (P != End && (*P == 'e' || *P == 'E')) {
+      ++P;
+      if (P != End && (*P == '+' || *P == '-'))
+        ++P;
+      if (P == End || !isDigit(*P))
+        return false;
+      while (P != End && isDigit(*P))
+        ++P;
+    }
+    Out = StringRef(Begin, P - Begin);
+    return true;
+  }
+
+  bool parseString(StringRef &Out) {
+    assert(*P == '"');
+    ++P;
+    char *Begin = P;
+    char *W = P;
+    while (true) {
+      if (P == End)
+        return false;
+      char C = *P;
+      if (C == '"') {
+        ++P;
+        break;
+      }
+      if (static_cast<unsigned char>(C) < 0x20)
+        return false; // Control characters must be escaped.
+      if (C != '\\') {
+        *W++ = *P++;
+        continue;
+      }
+
+      ++P;
+      if (P == End)
+        return false;
+      switch (*P++) {
+      case '"':
+        *W++ = '"';
+        break;
+      case '\\':
+        *W++ = '\\';
+        break;
+      case '/':
+        *W++ = '/';
+        break;
+      case 'b':
+        *W++ = '\b';
+        break;
+      case 'f':
+        *W++ = '\f';
+        break;
+      case 'n':
+        *W++ = '\n';
+        break;
+      case 'r':
+        *W++ = '\r';
+        break;
+      case 't':
+        *W++ = '\t';
+        break;
+      case 'u': {
+        unsigned CodePoint;
+        if (End - P < 4 || !parseHex4(P, CodePoint))
+          return false;
+        P += 4;
+        if (CodePoint >= 0xD800 && CodePoint < 0xDC00) {
+          // A high surrogate, must be followed by a low one.
+          unsigned Low;
+          if (End - P >= 6 && P[0] == '\\' && P[1] == 'u' &&
+              parseHex4(P + 2, Low) && Low >= 0xDC00 && Low < 0xE000) {
+            P += 6;
+            CodePoint = 0x10000 + ((CodePoint - 0xD800) << 10) + (Low - 0xDC00);
+          } else {
+            CodePoint = 0xFFFD;
+          }
+        } else if (CodePoint >= 0xDC00 && CodePoint < 0xE000) {
+          CodePoint = 0xFFFD; // An unpaired low surrogate.
+        }
+        W = encodeUTF8(CodePoint, W);
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+    Out = StringRef(Begin, W - Begin);
+    return true;
+  }
+
+  bool parseArray(Value &Out, unsigned Depth) {
+    assert(*P == '[');
+    ++P;
+    Out.Kind = Value::Array;
+
+    llvm::SmallVector<Value, 8> Elements;
+    skipWhitespace();
+    if (P != End && *P == ']') {
+      ++P;
+      return true;
+    }
+    while (true) {
+      Elements.emplace_back();
+      if (!parseValue(Elements.back(), Depth))
+        return false;
+      skipWhitespace();
+      if (P == End)
+        return false;
+      if (*P == ']') {
+        ++P;
+        break;
+      }
+      if (*P++ != ',')
+        return false;
+    }
+
+    Value *Stored = Alloc.Allocate<Value>(Elements.size());
+    std::uninitialized_copy(Elements.begin(), Elements.end(), Stored);
+    Out.Children = Stored;
+    Out.NumChildren = Elements.size();
+    return true;
+  }
+
+  bool parseObject(Value &Out, unsigned Depth) {
+    assert(*P == '{');
+    ++P;
+    Out.Kind = Value::Object;
+
+    llvm::SmallVector<Member, 8> Members;
+    skipWhitespace();
+    if (P != End && *P == '}') {
+      ++P;
+      return true;
+    }
+    while (true) {
+      skipWhitespace();
+      if (P == End || *P != '"')
+        return false;
+      Members.emplace_back();
+      Member &M = Members.back();
+      if (!parseString(M.Key))
+        return false;
+      skipWhitespace();
+      if (P == End || *P++ != ':')
+        return false;
+      if (!parseValue(M.V, Depth))
+        return false;
+      skipWhitespace();
+      if (P == End)
+        return false;
+      if (*P == '}') {
+        ++P;
+        break;
+      }
+      if (*P++ != ',')
+        return false;
+    }
+
+    Member *Stored = Alloc.Allocate<Member>(Members.size());
+    std::uninitialized_copy(Members.begin(), Members.end(), Stored);
+    Out.Children = Stored;
+    Out.NumChildren = Members.size();
+    return true;
+  }
+
+  char *P;
+  char *End;
+  llvm::BumpPtrAllocator &Alloc;
+};
+
+} // namespace json
+} // namespace clangd
+} // namespace clang
+
+llvm::Optional<bool> json::Value::asBoolean() const {
+  if (Kind != Boolean)
+    return llvm::None;
+  return BooleanValue;
+}
+
+llvm::Optional<int64_t> json::Value::asInteger() const {
+  if (Kind != Number)
+    return llvm::None;
+  long long Result;
+  if (Text.getAsInteger(10, Result))
+    return llvm::None;
+  return Result;
+}
+
+llvm::Optional<StringRef> json::Value::asString() const {
+  if (Kind != String)
+    return llvm::None;
+  return Text;
+}
+
+llvm::Optional<ArrayRef<json::Value>> json::Value::asArray() const {
+  if (Kind != Array)
+    return llvm::None;
+  return llvm::makeArrayRef(static_cast<const Value *>(Children), NumChildren);
+}
+
+llvm::Optional<ArrayRef<json::Member>> json::Value::asObject() const {
+  if (Kind != Object)
+    return llvm::None;
+  return llvm::makeArrayRef(static_cast<const Member *>(Children),
+                            NumChildren);
+}
+
+const json::Value *json::parse(MutableArrayRef<char> Text,
+                               llvm::BumpPtrAllocator &Alloc) {
+  return Parser(Text, Alloc).parse();
+}
+
+void json::Writer::objectBegin() {
+  valueBegin();
+  OS << '{';
+  HasElements.push_back(false);
+}
+
+void json::Writer::objectEnd() {
+  assert(!HasElements.empty() && !AfterKey);
+  HasElements.pop_back();
+  OS << '}';
+}
+
+void json::Writer::arrayBegin() {
+  valueBegin();
+  OS << '[';
+  HasElements.push_back(false);
+}
+
+void json::Writer::arrayEnd() {
+  assert(!HasElements.empty() && !AfterKey);
+  HasElements.pop_back();
+  OS << ']';
+}
+
+void json::Writer::key(StringRef Key) {
+  assert(!HasElements.empty() && !AfterKey);
+  valueBegin();
+  writeEscaped(Key);
+  OS << ':';
+  AfterKey = true;
+}
+
+void json::Writer::string(StringRef S) {
+  valueBegin();
+  writeEscaped(S);
+}
+
+void json::Writer::integer(int64_t N) {
+  valueBegin();
+  OS << N;
+}
+
+void json::Writer::boolean(bool B) {
+  valueBegin();
+  OS << (B ? "true" : "false");
+}
+
+void json::Writer::null() {
+  valueBegin();
+  OS << "null";
+}
+
+void json::Writer::value(const Value &V) {
+  switch (V.kind()) {
+  case Value::Null:
+    null();
+    return;
+  case Value::Boolean:
+    boolean(*V.asBoolean());
+    return;
+  case Value::Number:
+    raw(V.getNumberText());
+    return;
+  case Value::String:
+    string(*V.asString());
+    return;
+  case Value::Array:
+    arrayBegin();
+    for (const Value &Element : *V.asArray())
+      value(Element);
+    arrayEnd();
+    return;
+  case Value::Object:
+    objectBegin();
+    for (const Member &M : *V.asObject()) {
+      key(M.Key);
+      value(M.V);
+    }
+    objectEnd();
+    return;
+  }
+}
+
+void json::Writer::raw(StringRef JSON) {
+  valueBegin();
+  OS << JSON;
+}
+
+void json::Writer::valueBegin() {
+  if (AfterKey) {
+    AfterKey = false;
+    return;
+  }
+  if (HasElements.empty())
+    return;
+  if (HasElements.back())
+    OS << ',';
+  HasElements.back() = true;
+}
+
+void json::Writer::writeEscaped(StringRef S) {
+  OS << '"';
+  const char *Unescaped = S.begin();
+  for (const char *I = S.begin(), *E = S.end(); I != E; ++I) {
+    unsigned char C = *I;
+    if (C >= 0x20 && C != '"' && C != '\\')
+      continue;
+    // Write runs of characters that don't need escaping at once.
+    OS.write(Unescaped, I - Unescaped);
+    Unescaped = I + 1;
+    switch (C) {
+    case '"':
+      OS << "\\\"";
+      break;
+    case '\\':
+      OS << "\\\\";
+      break;
+    case '\b':
+      OS << "\\b";
+      break;
+    case '\f':
+      OS << "\\f";
+      break;
+    case '\n':
+      OS << "\\n";
+      break;
+    case '\r':
+      OS << "\\r";
+      break;
+    case '\t':
+      OS << "\\t";
+      break;
+    default:
+      OS << llvm::format("\\u%04x", C);
+      break;
+    }
+  }
+  OS.write(Unescaped, S.end() - Unescaped);
+  OS << '"';
+}
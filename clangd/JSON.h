@@ -0,0 +1,133 @@
+//===--- JSON.h - In-place JSON parser and streaming writer -----*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+//
+// A minimal JSON implementation for the Language Server Protocol messages.
+// The parser works in place over a mutable buffer: strings are unescaped
+// inside the buffer and the parsed values refer to it, so parsing a message
+// does not copy any strings. The writer outputs JSON directly into a
+// raw_ostream without building any intermediate representation.
+//
+//===---------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_JSON_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANGD_JSON_H
+
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+
+namespace clang {
+namespace clangd {
+namespace json {
+
+class Parser;
+struct Member;
+
+/// A parsed JSON value. Values don't own any memory: strings point into the
+/// parsed buffer and elements of arrays and objects are allocated by the
+/// parser. A default-constructed Value is null.
+class Value {
+public:
+  enum ValueKind { Null, Boolean, Number, String, Array, Object };
+
+  ValueKind kind() const { return Kind; }
+
+  /// Returns None if the value is not a boolean.
+  llvm::Optional<bool> asBoolean() const;
+  /// Returns None if the value is not a number or is not an integer that fits
+  /// into int64_t.
+  llvm::Optional<int64_t> asInteger() const;
+  /// Returns None if the value is not a string. Escape sequences in the
+  /// returned string are already replaced.
+  llvm::Optional<StringRef> asString() const;
+  /// Returns None if the value is not an array.
+  llvm::Optional<ArrayRef<Value>> asArray() const;
+  /// Returns None if the value is not an object. Members are returned in the
+  /// order they were written.
+  llvm::Optional<ArrayRef<Member>> asObject() const;
+
+  /// Returns the text of a number, as it was written.
+  StringRef getNumberText() const {
+    assert(Kind == Number);
+    return Text;
+  }
+
+private:
+  friend class Parser;
+
+  ValueKind Kind = Null;
+  bool BooleanValue = false;
+  /// Unescaped contents of a string or the text of a number.
+  StringRef Text;
+  /// Elements of an array or members of an object.
+  const void *Children = nullptr;
+  unsigned NumChildren = 0;
+};
+
+/// A member of a JSON object.
+struct Member {
+  /// Unescaped key of the member.
+  StringRef Key;
+  Value V;
+};
+
+/// Parses \p Text as a single JSON value, surrounded by optional whitespace.
+/// Parsing happens in place: strings are unescaped inside \p Text, so the
+/// contents of \p Text are modified and the returned value refers to them.
+/// Arrays and objects are allocated in \p Alloc.
+/// Returns nullptr if \p Text is not valid JSON.
+const Value *parse(MutableArrayRef<char> Text, llvm::BumpPtrAllocator &Alloc);
+
+/// Writes JSON into a raw_ostream as it goes. Commas between the elements of
+/// arrays and objects are inserted automatically. Every value inside an object
+/// must be preceded by a call to key(). The writer does not check that the
+/// output is well-formed, i.e. that arrays and objects are properly closed.
+class Writer {
+public:
+  explicit Writer(llvm::raw_ostream &OS) : OS(OS) {}
+
+  void objectBegin();
+  void objectEnd();
+  void arrayBegin();
+  void arrayEnd();
+
+  /// Starts a member of the current object. Must be followed by a value.
+  void key(StringRef Key);
+
+  void string(StringRef S);
+  void integer(int64_t N);
+  void boolean(bool B);
+  void null();
+  /// Writes a parsed value.
+  void value(const Value &V);
+  /// Writes \p JSON, which must be a single serialized JSON value, as is.
+  void raw(StringRef JSON);
+
+private:
+  /// Writes a comma if the value is not the first one in an array or object.
+  void valueBegin();
+  void writeEscaped(StringRef S);
+
+  llvm::raw_ostream &OS;
+  /// For each open array or object, whether it already has elements.
+  llvm::SmallVector<bool, 8> HasElements;
+  /// Set by key(), values of object members are not preceded by commas.
+  bool AfterKey = false;
+};
+
+} // namespace json
+} // namespace clangd
+} // namespace clang
+
+#endif
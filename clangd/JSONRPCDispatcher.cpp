@@ -9,9 +9,8 @@
 
 #include "JSONRPCDispatcher.h"
 #include "ProtocolHandlers.h"
+#include "Trace.h"
 #include "llvm/ADT/SmallString.h"
-#include "llvm/Support/SourceMgr.h"
-#include "llvm/Support/YAMLParser.h"
 #include <istream>
 
 using namespace clang;
@@ -31,21 +30,89 @@ void JSONOutput::writeMessage(const Twine &Message) {
   Outs.flush();
 }
 
+void JSONOutput::writeJSON(
+    llvm::function_ref<void(json::Writer &)> WriteMessage) {
+  llvm::SmallString<256> Storage;
+  llvm::raw_svector_ostream OS(Storage);
+  json::Writer W(OS);
+  WriteMessage(W);
+  writeMessage(OS.str());
+}
+
+void JSONOutput::writeResult(
+    StringRef ID, llvm::function_ref<void(json::Writer &)> WriteResult) {
+  writeJSON([&](json::Writer &W) {
+    W.objectBegin();
+    W.key("jsonrpc");
+    W.string("2.0");
+    W.key("id");
+    W.raw(ID);
+    W.key("result");
+    WriteResult(W);
+    W.objectEnd();
+  });
+  requestAnswered(ID);
+}
+
+void JSONOutput::writeError(StringRef ID, int Code, StringRef Message) {
+  writeJSON([&](json::Writer &W) {
+    W.objectBegin();
+    W.key("jsonrpc");
+    W.string("2.0");
+    W.key("id");
+    W.raw(ID);
+    W.key("error");
+    W.objectBegin();
+    W.key("code");
+    W.integer(Code);
+    if (!Message.empty()) {
+      W.key("message");
+      W.string(Message);
+    }
+    W.objectEnd();
+    W.objectEnd();
+  });
+  requestAnswered(ID);
+}
+
+void JSONOutput::requestReceived(StringRef ID, StringRef Method) {
+  std::lock_guard<std::mutex> Guard(RequestsMutex);
+  PendingRequests[ID] =
+      std::make_pair(Method.str(), std::chrono::steady_clock::now());
+}
+
+void JSONOutput::requestDropped(StringRef ID) {
+  std::lock_guard<std::mutex> Guard(RequestsMutex);
+  PendingRequests.erase(ID);
+}
+
+void JSONOutput::requestAnswered(StringRef ID) {
+  std::pair<std::string, std::chrono::steady_clock::time_point> Request;
+  {
+    std::lock_guard<std::mutex> Guard(RequestsMutex);
+    auto It = PendingRequests.find(ID);
+    if (It == PendingRequests.end())
+      return;
+    Request = std::move(It->second);
+    PendingRequests.erase(It);
+  } // unlock RequestsMutex
+  trace::record(Request.first, Request.second,
+                std::chrono::steady_clock::now());
+}
+
 void JSONOutput::log(const Twine &Message) {
   std::lock_guard<std::mutex> Guard(StreamMutex);
   Logs << Message;
   Logs.flush();
 }
 
-void Handler::handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) {
+void Handler::handleMethod(const json::Value &Params, StringRef ID) {
   Output.log("Method ignored.\n");
   // Return that this method is unsupported.
-  writeMessage(
-      R"({"jsonrpc":"2.0","id":)" + ID +
-      R"(,"error":{"code":-32601}})");
+  Output.writeError(ID, /*MethodNotFound*/ -32601, "");
 }
 
-void Handler::handleNotification(llvm::yaml::MappingNode *Params) {
+void Handler::handleNotification(const json::Value &Params) {
   Output.log("Notification ignored.\n");
 }
 
@@ -55,86 +122,60 @@ void JSONRPCDispatcher::registerHandler(StringRef Method,
   Handlers[Method] = std::move(H);
 }
 
-static void
-callHandler(const llvm::StringMap<std::unique_ptr<Handler>> &Handlers,
-            llvm::yaml::ScalarNode *Method, llvm::yaml::ScalarNode *Id,
-            llvm::yaml::MappingNode *Params, Handler *UnknownHandler) {
-  llvm::SmallString<10> MethodStorage;
-  auto I = Handlers.find(Method->getValue(MethodStorage));
-  auto *Handler = I != Handlers.end() ? I->second.get() : UnknownHandler;
-  if (Id)
-    Handler->handleMethod(Params, Id->getRawValue());
-  else
-    Handler->handleNotification(Params);
-}
-
-bool JSONRPCDispatcher::call(StringRef Content) const {
-  llvm::SourceMgr SM;
-  llvm::yaml::Stream YAMLStream(Content, SM);
-
-  auto Doc = YAMLStream.begin();
-  if (Doc == YAMLStream.end())
-    return false;
-
-  auto *Root = Doc->getRoot();
+bool JSONRPCDispatcher::call(MutableArrayRef<char> Content,
+                             JSONOutput &Out) {
+  Alloc.Reset();
+  const json::Value *Root = json::parse(Content, Alloc);
   if (!Root)
     return false;
-
-  auto *Object = dyn_cast<llvm::yaml::MappingNode>(Root);
+  auto Object = Root->asObject();
   if (!Object)
     return false;
 
-  llvm::yaml::ScalarNode *Version = nullptr;
-  llvm::yaml::ScalarNode *Method = nullptr;
-  llvm::yaml::MappingNode *Params = nullptr;
-  llvm::yaml::ScalarNode *Id = nullptr;
-  for (auto &NextKeyValue : *Object) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return false;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    llvm::yaml::Node *Value = NextKeyValue.getValue();
-    if (!Value)
-      return false;
-
-    if (KeyValue == "jsonrpc") {
+  Optional<StringRef> Method;
+  const json::Value *Id = nullptr;
+  // Absent params are passed to the handler as null.
+  static const json::Value NoParams;
+  const json::Value *Params = &NoParams;
+  for (const json::Member &M : *Object) {
+    if (M.Key == "jsonrpc") {
       // This should be "2.0". Always.
-      Version = dyn_cast<llvm::yaml::ScalarNode>(Value);
-      if (!Version || Version->getRawValue() != "\"2.0\"")
+      auto Version = M.V.asString();
+      if (!Version || *Version != "2.0")
         return false;
-    } else if (KeyValue == "method") {
-      Method = dyn_cast<llvm::yaml::ScalarNode>(Value);
-    } else if (KeyValue == "id") {
-      Id = dyn_cast<llvm::yaml::ScalarNode>(Value);
-    } else if (KeyValue == "params") {
+    } else if (M.Key == "method") {
+      Method = M.V.asString();
       if (!Method)
         return false;
-      // We have to interleave the call of the function here, otherwise the
-      // YAMLParser will die because it can't go backwards. This is unfortunate
-      // because it will break clients that put the id after params. A possible
-      // fix would be to split the parsing and execution phases.
-      Params = dyn_cast<llvm::yaml::MappingNode>(Value);
-      callHandler(Handlers, Method, Id, Params, UnknownHandler.get());
-      return true;
+    } else if (M.Key == "id") {
+      Id = &M.V;
+    } else if (M.Key == "params") {
+      Params = &M.V;
     } else {
       return false;
     }
   }
-
-  // In case there was a request with no params, call the handler on the
-  // leftovers.
   if (!Method)
     return false;
-  callHandler(Handlers, Method, Id, nullptr, UnknownHandler.get());
 
+  auto I = Handlers.find(*Method);
+  auto *Handler = I != Handlers.end() ? I->second.get() : UnknownHandler.get();
+  if (!Id) {
+    trace::Span Tracer(*Method);
+    Handler->handleNotification(*Params);
+    return true;
+  }
+  // Handlers echo the id back in their responses, so pass it serialized.
+  llvm::SmallString<16> IdStorage;
+  llvm::raw_svector_ostream IdOS(IdStorage);
+  json::Writer(IdOS).value(*Id);
+  Out.requestReceived(IdOS.str(), *Method);
+  Handler->handleMethod(*Params, IdOS.str());
   return true;
 }
 
-void clangd::runLanguageServerLoop(std::istream &In, JSONOutput &Out,
-                                   JSONRPCDispatcher &Dispatcher,
-                                   bool &IsDone) {
+bool clangd::readMessage(std::istream &In, JSONOutput &Out,
+                         std::vector<char> &JSON) {
   while (In.good()) {
     // A Language Server Protocol message starts with a set of HTTP headers,
     // delimited  by \r\n, and terminated by an empty line (\r\n).
@@ -181,9 +222,8 @@ void clangd::runLanguageServerLoop(std::istream &In, JSONOutput &Out,
     }
 
     if (ContentLength > 0) {
-      // Now read the JSON. Insert a trailing null byte as required by the YAML
-      // parser.
-      std::vector<char> JSON(ContentLength + 1, '\0');
+      // Now read the JSON.
+      JSON.resize(ContentLength);
       In.read(JSON.data(), ContentLength);
 
       // If the stream is aborted before we read ContentLength bytes, In
@@ -194,23 +234,32 @@ void clangd::runLanguageServerLoop(std::istream &In, JSONOutput &Out,
                 + " bytes of expected "
                 + std::to_string(ContentLength)
                 + ".\n");
-        break;
+        return false;
       }
-
-      llvm::StringRef JSONRef(JSON.data(), ContentLength);
-      // Log the message.
-      Out.log("<-- " + JSONRef + "\n");
-
-      // Finally, execute the action for this JSON message.
-      if (!Dispatcher.call(JSONRef))
-        Out.log("JSON dispatch failed!\n");
-
-      // If we're done, exit the loop.
-      if (IsDone)
-        break;
+      return true;
     } else {
       Out.log( "Warning: Missing Content-Length header, or message has zero "
                "length.\n" );
     }
   }
+  return false;
+}
+
+void clangd::runLanguageServerLoop(std::istream &In, JSONOutput &Out,
+                                   JSONRPCDispatcher &Dispatcher,
+                                   bool &IsDone) {
+  // Messages are parsed in place, the buffer is reused between them.
+  std::vector<char> JSON;
+  while (readMessage(In, Out, JSON)) {
+    // Log the message before it's modified by the parser.
+    Out.log("<-- " + llvm::StringRef(JSON.data(), JSON.size()) + "\n");
+
+    // Finally, execute the action for this JSON message.
+    if (!Dispatcher.call(JSON, Out))
+      Out.log("JSON dispatch failed!\n");
+
+    // If we're done, exit the loop.
+    if (IsDone)
+      break;
+  }
 }
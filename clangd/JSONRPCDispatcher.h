@@ -10,11 +10,15 @@
 #ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_JSONRPCDISPATCHER_H
 #define LLVM_CLANG_TOOLS_EXTRA_CLANGD_JSONRPCDISPATCHER_H
 
+#include "JSON.h"
 #include "clang/Basic/LLVM.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/StringMap.h"
-#include "llvm/Support/YAMLParser.h"
+#include "llvm/Support/Allocator.h"
+#include <chrono>
 #include <iosfwd>
 #include <mutex>
+#include <vector>
 
 namespace clang {
 namespace clangd {
@@ -29,14 +33,43 @@ public:
   /// Emit a JSONRPC message.
   void writeMessage(const Twine &Message);
 
+  /// Emit a JSONRPC message, written by \p WriteMessage. The message is
+  /// buffered before it is sent, because the header contains its length.
+  void writeJSON(llvm::function_ref<void(json::Writer &)> WriteMessage);
+
+  /// Emit a successful JSONRPC response to the request with \p ID.
+  /// \p WriteResult must write a single JSON value, that is the result.
+  void writeResult(StringRef ID,
+                   llvm::function_ref<void(json::Writer &)> WriteResult);
+
+  /// Emit a JSONRPC error response to the request with \p ID.
+  void writeError(StringRef ID, int Code, StringRef Message);
+
+  /// Remember that the request with \p ID was received for \p Method. The
+  /// time until it is answered is recorded as a trace::Span called \p Method.
+  void requestReceived(StringRef ID, StringRef Method);
+
+  /// Forget the request with \p ID without recording its latency. Must be
+  /// called for requests that are never answered, e.g. the ones whose
+  /// params could not be parsed.
+  void requestDropped(StringRef ID);
+
   /// Write to the logging stream.
   void log(const Twine &Message);
 
 private:
+  /// Records the latency of the request with \p ID, if it was received.
+  void requestAnswered(StringRef ID);
+
   llvm::raw_ostream &Outs;
   llvm::raw_ostream &Logs;
 
   std::mutex StreamMutex;
+
+  /// Method and time of arrival of the requests, that were not answered yet.
+  std::mutex RequestsMutex;
+  llvm::StringMap<std::pair<std::string, std::chrono::steady_clock::time_point>>
+      PendingRequests;
 };
 
 /// Callback for messages sent to the server, called by the JSONRPCDispatcher.
@@ -48,10 +81,11 @@ public:
   /// Called when the server receives a method call. This is supposed to return
   /// a result on Outs. The default implementation returns an "unknown method"
   /// error to the client and logs a warning.
-  virtual void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID);
+  /// \p ID is the serialized JSON value of the request id.
+  virtual void handleMethod(const json::Value &Params, StringRef ID);
   /// Called when the server receives a notification. No result should be
   /// written to Outs. The default implemetation logs a warning.
-  virtual void handleNotification(llvm::yaml::MappingNode *Params);
+  virtual void handleNotification(const json::Value &Params);
 
 protected:
   JSONOutput &Output;
@@ -72,14 +106,23 @@ public:
   /// Registers a Handler for the specified Method.
   void registerHandler(StringRef Method, std::unique_ptr<Handler> H);
 
-  /// Parses a JSONRPC message and calls the Handler for it.
-  bool call(StringRef Content) const;
+  /// Parses a JSONRPC message and calls the Handler for it. The message is
+  /// parsed in place, so \p Content is modified. Requests are registered with
+  /// \p Out, so that their latency is recorded when they are answered.
+  bool call(MutableArrayRef<char> Content, JSONOutput &Out);
 
 private:
+  /// Holds the parsed values of the current message, reset by each call.
+  llvm::BumpPtrAllocator Alloc;
   llvm::StringMap<std::unique_ptr<Handler>> Handlers;
   std::unique_ptr<Handler> UnknownHandler;
 };
 
+/// Reads the next message from \p In into \p JSON, skipping the headers.
+/// Returns false if \p In ends before a complete message was read.
+/// Input stream(\p In) must be opened in binary mode.
+bool readMessage(std::istream &In, JSONOutput &Out, std::vector<char> &JSON);
+
 /// Parses input queries from LSP client (coming from \p In) and runs call
 /// method of \p Dispatcher for each query.
 /// After handling each query checks if \p IsDone is set true and exits the loop
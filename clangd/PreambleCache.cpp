@@ -0,0 +1,104 @@
+//===--- PreambleCache.cpp - Preambles shared between CppFiles ---*-C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PreambleCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Path.h"
+#include <string>
+
+using namespace clang::clangd;
+using namespace clang;
+
+namespace {
+
+/// \return true if \p Arg, relative to \p Directory, points to \p File.
+bool isSameFile(StringRef Directory, StringRef Arg, PathRef File) {
+  if (!Arg.endswith(llvm::sys::path::filename(File)))
+    return false;
+  llvm::SmallString<128> Path;
+  if (llvm::sys::path::is_relative(Arg))
+    Path = Directory;
+  llvm::sys::path::append(Path, Arg);
+  llvm::sys::path::remove_dots(Path, /*remove_dot_dot=*/true);
+  return Path == File;
+}
+
+} // namespace
+
+PreambleCache::PreambleCache(unsigned MaxPreambles)
+    : MaxPreambles(MaxPreambles) {}
+
+std::shared_ptr<const PreambleData>
+PreambleCache::get(PathRef File, const tooling::CompileCommand &Command,
+                   StringRef PreambleText) {
+  std::string Key = computeKey(File, Command, PreambleText);
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto It = EntriesByKey.find(Key);
+  if (It == EntriesByKey.end())
+    return nullptr;
+  // Move the entry to the front of the list.
+  Entries.splice(Entries.begin(), Entries, It->second);
+  return It->second->Preamble;
+}
+
+void PreambleCache::put(PathRef File, const tooling::CompileCommand &Command,
+                        StringRef PreambleText,
+                        std::shared_ptr<const PreambleData> Preamble) {
+  std::string Key = computeKey(File, Command, PreambleText);
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto It = EntriesByKey.find(Key);
+  if (It != EntriesByKey.end()) {
+    auto Existing = It->second;
+    EntriesByKey.erase(It);
+    Entries.erase(Existing);
+  }
+  if (MaxPreambles == 0)
+    return;
+  if (Entries.size() >= MaxPreambles) {
+    EntriesByKey.erase(Entries.back().Key);
+    Entries.pop_back();
+  }
+  Entries.push_front(Entry{std::move(Key), std::move(Preamble)});
+  EntriesByKey[Entries.front().Key] = Entries.begin();
+}
+
+std::string
+PreambleCache::computeKey(PathRef File, const tooling::CompileCommand &Command,
+                          StringRef PreambleText) {
+  std::string Key;
+  // Each part is prefixed with its length, so that different commands and
+  // preambles never produce the same key.
+  auto AddPart = [&Key](StringRef Part) {
+    Key += std::to_string(Part.size());
+    Key += ':';
+    Key += Part;
+  };
+  // Quoted includes are looked up relative to the directory of the main file,
+  // so only files in the same directory can share preambles.
+  AddPart(Command.Directory);
+  AddPart(llvm::sys::path::parent_path(File));
+  AddPart(PreambleText);
+  for (auto It = Command.CommandLine.begin(), End = Command.CommandLine.end();
+       It != End; ++It) {
+    // Skip the output file.
+    // tooling::CompileCommand.Output is ignored, it's not relevant for clangd.
+    if (*It == "-o") {
+      if (It + 1 != End)
+        ++It;
+      continue;
+    }
+    // Skip the input file.
+    if (isSameFile(Command.Directory, *It, File))
+      continue;
+    AddPart(*It);
+  }
+  return Key;
+}
@@ -0,0 +1,80 @@
+//===--- PreambleCache.h - Preambles shared between CppFiles ----*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_PREAMBLECACHE_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANGD_PREAMBLECACHE_H
+
+#include "ClangdUnit.h"
+#include "Path.h"
+#include "llvm/ADT/DenseMap.h"
+#include <list>
+#include <memory>
+#include <mutex>
+
+namespace clang {
+namespace clangd {
+
+/// A thread-safe cache of built preambles, addressed by the CompileCommand and
+/// the text of the preamble. Preambles stay in the cache
+/// after the CppFile that built them is closed or recreated, so reopening a
+/// file does not require building its preamble from scratch.
+/// The name of the main file is not a part of the key, so files in the same
+/// directory with the same compile flags and the same preamble text share a
+/// single PreambleData.
+/// The cache does not check whether headers, included by the preamble, have
+/// changed. Callers must check that via PrecompiledPreamble::CanReuse before
+/// using a preamble, returned by the cache.
+class PreambleCache {
+public:
+  /// Number of preambles that are kept by default. Preambles are stored in
+  /// temporary files, so each one only takes a small amount of memory.
+  static const unsigned DefaultMaxPreambles = 32;
+
+  explicit PreambleCache(unsigned MaxPreambles = DefaultMaxPreambles);
+
+  /// \return a preamble that was stored for \p File (or another file,
+  /// compatible with it) with \p Command and \p PreambleText, or nullptr if
+  /// there is none.
+  std::shared_ptr<const PreambleData>
+  get(PathRef File, const tooling::CompileCommand &Command,
+      StringRef PreambleText);
+
+  /// Stores \p Preamble, built for \p File with \p Command and \p
+  /// PreambleText, replacing any other preamble stored for them. Evicts the
+  /// least recently used preamble if the cache is full.
+  void put(PathRef File, const tooling::CompileCommand &Command,
+           StringRef PreambleText,
+           std::shared_ptr<const PreambleData> Preamble);
+
+private:
+  struct Entry {
+    std::string Key;
+    std::shared_ptr<const PreambleData> Preamble;
+  };
+
+  /// Computes a key, which is the same for all files in the directory of \p
+  /// File, that are compiled with \p Command modulo the names of the input and
+  /// output files. The key contains the whole \p PreambleText and command
+  /// line, so different preambles never share a key.
+  static std::string computeKey(PathRef File,
+                                const tooling::CompileCommand &Command,
+                                StringRef PreambleText);
+
+  std::mutex Mutex;
+  unsigned MaxPreambles;
+  /// Most recently used entries go first.
+  std::list<Entry> Entries;
+  /// Entries by their keys. The keys point into the Key strings of Entries.
+  llvm::DenseMap<StringRef, std::list<Entry>::iterator> EntriesByKey;
+};
+
+} // namespace clangd
+} // namespace clang
+
+#endif
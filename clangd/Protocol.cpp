@@ -14,11 +14,9 @@
 
 #include "Protocol.h"
 #include "clang/Basic/LLVM.h"
-#include "llvm/ADT/SmallString.h"
-#include "llvm/Support/Format.h"
 #include "llvm/Support/Path.h"
-#include "llvm/Support/raw_ostream.h"
 using namespace clang::clangd;
+using namespace clang;
 
 URI URI::fromUri(llvm::StringRef uri) {
   URI Result;
@@ -47,31 +45,28 @@ URI URI::fromFile(llvm::StringRef file) {
   return Result;
 }
 
-URI URI::parse(llvm::yaml::ScalarNode *Param) {
-  llvm::SmallString<10> Storage;
-  return URI::fromUri(Param->getValue(Storage));
+llvm::Optional<URI> URI::parse(const json::Value &Param) {
+  auto Str = Param.asString();
+  if (!Str)
+    return llvm::None;
+  return URI::fromUri(*Str);
 }
 
-std::string URI::unparse(const URI &U) { return "\"" + U.uri + "\""; }
+void URI::unparse(json::Writer &W, const URI &U) { W.string(U.uri); }
 
 llvm::Optional<TextDocumentIdentifier>
-TextDocumentIdentifier::parse(llvm::yaml::MappingNode *Params) {
+TextDocumentIdentifier::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   TextDocumentIdentifier Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::ScalarNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    if (KeyValue == "uri") {
-      Result.uri = URI::parse(Value);
-    } else if (KeyValue == "version") {
+  for (const json::Member &M : *Members) {
+    if (M.Key == "uri") {
+      auto Parsed = URI::parse(M.V);
+      if (!Parsed)
+        return llvm::None;
+      Result.uri = std::move(*Parsed);
+    } else if (M.Key == "version") {
       // FIXME: parse version, but only for VersionedTextDocumentIdentifiers.
     } else {
       return llvm::None;
@@ -80,31 +75,22 @@ TextDocumentIdentifier::parse(llvm::yaml::MappingNode *Params) {
   return Result;
 }
 
-llvm::Optional<Position> Position::parse(llvm::yaml::MappingNode *Params) {
+llvm::Optional<Position> Position::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   Position Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::ScalarNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "line") {
-      long long Val;
-      if (llvm::getAsSignedInteger(Value->getValue(Storage), 0, Val))
+  for (const json::Member &M : *Members) {
+    if (M.Key == "line") {
+      auto Val = M.V.asInteger();
+      if (!Val)
         return llvm::None;
-      Result.line = Val;
-    } else if (KeyValue == "character") {
-      long long Val;
-      if (llvm::getAsSignedInteger(Value->getValue(Storage), 0, Val))
+      Result.line = *Val;
+    } else if (M.Key == "character") {
+      auto Val = M.V.asInteger();
+      if (!Val)
         return llvm::None;
-      Result.character = Val;
+      Result.character = *Val;
     } else {
       return llvm::None;
     }
@@ -112,35 +98,28 @@ llvm::Optional<Position> Position::parse(llvm::yaml::MappingNode *Params) {
   return Result;
 }
 
-std::string Position::unparse(const Position &P) {
-  std::string Result;
-  llvm::raw_string_ostream(Result)
-      << llvm::format(R"({"line": %d, "character": %d})", P.line, P.character);
-  return Result;
+void Position::unparse(json::Writer &W, const Position &P) {
+  W.objectBegin();
+  W.key("line");
+  W.integer(P.line);
+  W.key("character");
+  W.integer(P.character);
+  W.objectEnd();
 }
 
-llvm::Optional<Range> Range::parse(llvm::yaml::MappingNode *Params) {
+llvm::Optional<Range> Range::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   Range Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::MappingNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "start") {
-      auto Parsed = Position::parse(Value);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "start") {
+      auto Parsed = Position::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.start = std::move(*Parsed);
-    } else if (KeyValue == "end") {
-      auto Parsed = Position::parse(Value);
+    } else if (M.Key == "end") {
+      auto Parsed = Position::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.end = std::move(*Parsed);
@@ -151,49 +130,51 @@ llvm::Optional<Range> Range::parse(llvm::yaml::MappingNode *Params) {
   return Result;
 }
 
-std::string Range::unparse(const Range &P) {
-  std::string Result;
-  llvm::raw_string_ostream(Result) << llvm::format(
-      R"({"start": %s, "end": %s})", Position::unparse(P.start).c_str(),
-      Position::unparse(P.end).c_str());
-  return Result;
+void Range::unparse(json::Writer &W, const Range &P) {
+  W.objectBegin();
+  W.key("start");
+  Position::unparse(W, P.start);
+  W.key("end");
+  Position::unparse(W, P.end);
+  W.objectEnd();
 }
 
-std::string Location::unparse(const Location &P) {
-  std::string Result;
-  llvm::raw_string_ostream(Result) << llvm::format(
-      R"({"uri": %s, "range": %s})", URI::unparse(P.uri).c_str(),
-      Range::unparse(P.range).c_str());
-  return Result;
+void Location::unparse(json::Writer &W, const Location &P) {
+  W.objectBegin();
+  W.key("uri");
+  URI::unparse(W, P.uri);
+  W.key("range");
+  Range::unparse(W, P.range);
+  W.objectEnd();
 }
 
 llvm::Optional<TextDocumentItem>
-TextDocumentItem::parse(llvm::yaml::MappingNode *Params) {
+TextDocumentItem::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   TextDocumentItem Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::ScalarNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "uri") {
-      Result.uri = URI::parse(Value);
-    } else if (KeyValue == "languageId") {
-      Result.languageId = Value->getValue(Storage);
-    } else if (KeyValue == "version") {
-      long long Val;
-      if (llvm::getAsSignedInteger(Value->getValue(Storage), 0, Val))
-        return llvm::None;
-      Result.version = Val;
-    } else if (KeyValue == "text") {
-      Result.text = Value->getValue(Storage);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "uri") {
+      auto Parsed = URI::parse(M.V);
+      if (!Parsed)
+        return llvm::None;
+      Result.uri = std::move(*Parsed);
+    } else if (M.Key == "languageId") {
+      auto Str = M.V.asString();
+      if (!Str)
+        return llvm::None;
+      Result.languageId = *Str;
+    } else if (M.Key == "version") {
+      auto Val = M.V.asInteger();
+      if (!Val)
+        return llvm::None;
+      Result.version = *Val;
+    } else if (M.Key == "text") {
+      auto Str = M.V.asString();
+      if (!Str)
+        return llvm::None;
+      Result.text = *Str;
     } else {
       return llvm::None;
     }
@@ -201,58 +182,43 @@ TextDocumentItem::parse(llvm::yaml::MappingNode *Params) {
   return Result;
 }
 
-llvm::Optional<Metadata> Metadata::parse(llvm::yaml::MappingNode *Params) {
+llvm::Optional<Metadata> Metadata::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   Metadata Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value = NextKeyValue.getValue();
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "extraFlags") {
-      auto *Seq = dyn_cast<llvm::yaml::SequenceNode>(Value);
-      if (!Seq)
-        return llvm::None;
-      for (auto &Item : *Seq) {
-        auto *Node = dyn_cast<llvm::yaml::ScalarNode>(&Item);
-        if (!Node)
+  for (const json::Member &M : *Members) {
+    if (M.Key == "extraFlags") {
+      auto Flags = M.V.asArray();
+      if (!Flags)
+        return llvm::None;
+      for (const json::Value &Flag : *Flags) {
+        auto Str = Flag.asString();
+        if (!Str)
           return llvm::None;
-        Result.extraFlags.push_back(Node->getValue(Storage));
+        Result.extraFlags.push_back(*Str);
       }
     }
   }
   return Result;
 }
 
-llvm::Optional<TextEdit> TextEdit::parse(llvm::yaml::MappingNode *Params) {
+llvm::Optional<TextEdit> TextEdit::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   TextEdit Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value = NextKeyValue.getValue();
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "range") {
-      auto *Map = dyn_cast<llvm::yaml::MappingNode>(Value);
-      if (!Map)
-        return llvm::None;
-      auto Parsed = Range::parse(Map);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "range") {
+      auto Parsed = Range::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.range = std::move(*Parsed);
-    } else if (KeyValue == "newText") {
-      auto *Node = dyn_cast<llvm::yaml::ScalarNode>(Value);
-      if (!Node)
+    } else if (M.Key == "newText") {
+      auto Str = M.V.asString();
+      if (!Str)
         return llvm::None;
-      Result.newText = Node->getValue(Storage);
+      Result.newText = *Str;
     } else {
       return llvm::None;
     }
@@ -260,37 +226,29 @@ llvm::Optional<TextEdit> TextEdit::parse(llvm::yaml::MappingNode *Params) {
   return Result;
 }
 
-std::string TextEdit::unparse(const TextEdit &P) {
-  std::string Result;
-  llvm::raw_string_ostream(Result) << llvm::format(
-      R"({"range": %s, "newText": "%s"})", Range::unparse(P.range).c_str(),
-      llvm::yaml::escape(P.newText).c_str());
-  return Result;
+void TextEdit::unparse(json::Writer &W, const TextEdit &P) {
+  W.objectBegin();
+  W.key("range");
+  Range::unparse(W, P.range);
+  W.key("newText");
+  W.string(P.newText);
+  W.objectEnd();
 }
 
 llvm::Optional<DidOpenTextDocumentParams>
-DidOpenTextDocumentParams::parse(llvm::yaml::MappingNode *Params) {
+DidOpenTextDocumentParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   DidOpenTextDocumentParams Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::MappingNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "textDocument") {
-      auto Parsed = TextDocumentItem::parse(Value);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentItem::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.textDocument = std::move(*Parsed);
-    } else if (KeyValue == "metadata") {
-      auto Parsed = Metadata::parse(Value);
+    } else if (M.Key == "metadata") {
+      auto Parsed = Metadata::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.metadata = std::move(*Parsed);
@@ -302,22 +260,14 @@ DidOpenTextDocumentParams::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<DidCloseTextDocumentParams>
-DidCloseTextDocumentParams::parse(llvm::yaml::MappingNode *Params) {
+DidCloseTextDocumentParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   DidCloseTextDocumentParams Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value = NextKeyValue.getValue();
-
-    if (KeyValue == "textDocument") {
-      auto *Map = dyn_cast<llvm::yaml::MappingNode>(Value);
-      if (!Map)
-        return llvm::None;
-      auto Parsed = TextDocumentIdentifier::parse(Map);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentIdentifier::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.textDocument = std::move(*Parsed);
@@ -329,35 +279,23 @@ DidCloseTextDocumentParams::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<DidChangeTextDocumentParams>
-DidChangeTextDocumentParams::parse(llvm::yaml::MappingNode *Params) {
+DidChangeTextDocumentParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   DidChangeTextDocumentParams Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value = NextKeyValue.getValue();
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "textDocument") {
-      auto *Map = dyn_cast<llvm::yaml::MappingNode>(Value);
-      if (!Map)
-        return llvm::None;
-      auto Parsed = TextDocumentIdentifier::parse(Map);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentIdentifier::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.textDocument = std::move(*Parsed);
-    } else if (KeyValue == "contentChanges") {
-      auto *Seq = dyn_cast<llvm::yaml::SequenceNode>(Value);
-      if (!Seq)
+    } else if (M.Key == "contentChanges") {
+      auto Changes = M.V.asArray();
+      if (!Changes)
         return llvm::None;
-      for (auto &Item : *Seq) {
-        auto *I = dyn_cast<llvm::yaml::MappingNode>(&Item);
-        if (!I)
-          return llvm::None;
-        auto Parsed = TextDocumentContentChangeEvent::parse(I);
+      for (const json::Value &Change : *Changes) {
+        auto Parsed = TextDocumentContentChangeEvent::parse(Change);
         if (!Parsed)
           return llvm::None;
         Result.contentChanges.push_back(std::move(*Parsed));
@@ -370,23 +308,27 @@ DidChangeTextDocumentParams::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<TextDocumentContentChangeEvent>
-TextDocumentContentChangeEvent::parse(llvm::yaml::MappingNode *Params) {
+TextDocumentContentChangeEvent::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   TextDocumentContentChangeEvent Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::ScalarNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "text") {
-      Result.text = Value->getValue(Storage);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "range") {
+      auto Parsed = Range::parse(M.V);
+      if (!Parsed)
+        return llvm::None;
+      Result.range = std::move(*Parsed);
+    } else if (M.Key == "rangeLength") {
+      auto Val = M.V.asInteger();
+      if (!Val)
+        return llvm::None;
+      Result.rangeLength = *Val;
+    } else if (M.Key == "text") {
+      auto Str = M.V.asString();
+      if (!Str)
+        return llvm::None;
+      Result.text = *Str;
     } else {
       return llvm::None;
     }
@@ -395,38 +337,25 @@ TextDocumentContentChangeEvent::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<FormattingOptions>
-FormattingOptions::parse(llvm::yaml::MappingNode *Params) {
+FormattingOptions::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   FormattingOptions Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::ScalarNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "tabSize") {
-      long long Val;
-      if (llvm::getAsSignedInteger(Value->getValue(Storage), 0, Val))
-        return llvm::None;
-      Result.tabSize = Val;
-    } else if (KeyValue == "insertSpaces") {
-      long long Val;
-      StringRef Str = Value->getValue(Storage);
-      if (llvm::getAsSignedInteger(Str, 0, Val)) {
-        if (Str == "true")
-          Val = 1;
-        else if (Str == "false")
-          Val = 0;
-        else
-          return llvm::None;
-      }
-      Result.insertSpaces = Val;
+  for (const json::Member &M : *Members) {
+    if (M.Key == "tabSize") {
+      auto Val = M.V.asInteger();
+      if (!Val)
+        return llvm::None;
+      Result.tabSize = *Val;
+    } else if (M.Key == "insertSpaces") {
+      // Some clients send a number instead of a boolean.
+      if (auto B = M.V.asBoolean())
+        Result.insertSpaces = *B;
+      else if (auto Val = M.V.asInteger())
+        Result.insertSpaces = *Val;
+      else
+        return llvm::None;
     } else {
       return llvm::None;
     }
@@ -434,41 +363,34 @@ FormattingOptions::parse(llvm::yaml::MappingNode *Params) {
   return Result;
 }
 
-std::string FormattingOptions::unparse(const FormattingOptions &P) {
-  std::string Result;
-  llvm::raw_string_ostream(Result) << llvm::format(
-      R"({"tabSize": %d, "insertSpaces": %d})", P.tabSize, P.insertSpaces);
-  return Result;
+void FormattingOptions::unparse(json::Writer &W, const FormattingOptions &P) {
+  W.objectBegin();
+  W.key("tabSize");
+  W.integer(P.tabSize);
+  W.key("insertSpaces");
+  W.boolean(P.insertSpaces);
+  W.objectEnd();
 }
 
 llvm::Optional<DocumentRangeFormattingParams>
-DocumentRangeFormattingParams::parse(llvm::yaml::MappingNode *Params) {
+DocumentRangeFormattingParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   DocumentRangeFormattingParams Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::MappingNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "textDocument") {
-      auto Parsed = TextDocumentIdentifier::parse(Value);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentIdentifier::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.textDocument = std::move(*Parsed);
-    } else if (KeyValue == "range") {
-      auto Parsed = Range::parse(Value);
+    } else if (M.Key == "range") {
+      auto Parsed = Range::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.range = std::move(*Parsed);
-    } else if (KeyValue == "options") {
-      auto Parsed = FormattingOptions::parse(Value);
+    } else if (M.Key == "options") {
+      auto Parsed = FormattingOptions::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.options = std::move(*Parsed);
@@ -480,42 +402,29 @@ DocumentRangeFormattingParams::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<DocumentOnTypeFormattingParams>
-DocumentOnTypeFormattingParams::parse(llvm::yaml::MappingNode *Params) {
+DocumentOnTypeFormattingParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   DocumentOnTypeFormattingParams Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-
-    if (KeyValue == "ch") {
-      auto *ScalarValue =
-          dyn_cast_or_null<llvm::yaml::ScalarNode>(NextKeyValue.getValue());
-      if (!ScalarValue)
-        return llvm::None;
-      llvm::SmallString<10> Storage;
-      Result.ch = ScalarValue->getValue(Storage);
-      continue;
-    }
-
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::MappingNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-    if (KeyValue == "textDocument") {
-      auto Parsed = TextDocumentIdentifier::parse(Value);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "ch") {
+      auto Str = M.V.asString();
+      if (!Str)
+        return llvm::None;
+      Result.ch = *Str;
+    } else if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentIdentifier::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.textDocument = std::move(*Parsed);
-    } else if (KeyValue == "position") {
-      auto Parsed = Position::parse(Value);
+    } else if (M.Key == "position") {
+      auto Parsed = Position::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.position = std::move(*Parsed);
-    } else if (KeyValue == "options") {
-      auto Parsed = FormattingOptions::parse(Value);
+    } else if (M.Key == "options") {
+      auto Parsed = FormattingOptions::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.options = std::move(*Parsed);
@@ -527,28 +436,19 @@ DocumentOnTypeFormattingParams::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<DocumentFormattingParams>
-DocumentFormattingParams::parse(llvm::yaml::MappingNode *Params) {
+DocumentFormattingParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   DocumentFormattingParams Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::MappingNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "textDocument") {
-      auto Parsed = TextDocumentIdentifier::parse(Value);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentIdentifier::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.textDocument = std::move(*Parsed);
-    } else if (KeyValue == "options") {
-      auto Parsed = FormattingOptions::parse(Value);
+    } else if (M.Key == "options") {
+      auto Parsed = FormattingOptions::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.options = std::move(*Parsed);
@@ -559,41 +459,27 @@ DocumentFormattingParams::parse(llvm::yaml::MappingNode *Params) {
   return Result;
 }
 
-llvm::Optional<Diagnostic> Diagnostic::parse(llvm::yaml::MappingNode *Params) {
+llvm::Optional<Diagnostic> Diagnostic::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   Diagnostic Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "range") {
-      auto *Value =
-          dyn_cast_or_null<llvm::yaml::MappingNode>(NextKeyValue.getValue());
-      if (!Value)
-        return llvm::None;
-      auto Parsed = Range::parse(Value);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "range") {
+      auto Parsed = Range::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.range = std::move(*Parsed);
-    } else if (KeyValue == "severity") {
-      auto *Value =
-          dyn_cast_or_null<llvm::yaml::ScalarNode>(NextKeyValue.getValue());
-      if (!Value)
-        return llvm::None;
-      long long Val;
-      if (llvm::getAsSignedInteger(Value->getValue(Storage), 0, Val))
+    } else if (M.Key == "severity") {
+      auto Val = M.V.asInteger();
+      if (!Val)
         return llvm::None;
-      Result.severity = Val;
-    } else if (KeyValue == "message") {
-      auto *Value =
-          dyn_cast_or_null<llvm::yaml::ScalarNode>(NextKeyValue.getValue());
-      if (!Value)
+      Result.severity = *Val;
+    } else if (M.Key == "message") {
+      auto Str = M.V.asString();
+      if (!Str)
         return llvm::None;
-      Result.message = Value->getValue(Storage);
+      Result.message = *Str;
     } else {
       return llvm::None;
     }
@@ -602,27 +488,18 @@ llvm::Optional<Diagnostic> Diagnostic::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<CodeActionContext>
-CodeActionContext::parse(llvm::yaml::MappingNode *Params) {
+CodeActionContext::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   CodeActionContext Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value = NextKeyValue.getValue();
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "diagnostics") {
-      auto *Seq = dyn_cast<llvm::yaml::SequenceNode>(Value);
-      if (!Seq)
+  for (const json::Member &M : *Members) {
+    if (M.Key == "diagnostics") {
+      auto Diagnostics = M.V.asArray();
+      if (!Diagnostics)
         return llvm::None;
-      for (auto &Item : *Seq) {
-        auto *I = dyn_cast<llvm::yaml::MappingNode>(&Item);
-        if (!I)
-          return llvm::None;
-        auto Parsed = Diagnostic::parse(I);
+      for (const json::Value &D : *Diagnostics) {
+        auto Parsed = Diagnostic::parse(D);
         if (!Parsed)
           return llvm::None;
         Result.diagnostics.push_back(std::move(*Parsed));
@@ -635,33 +512,24 @@ CodeActionContext::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<CodeActionParams>
-CodeActionParams::parse(llvm::yaml::MappingNode *Params) {
+CodeActionParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   CodeActionParams Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::MappingNode>(NextKeyValue.getValue());
-    if (!Value)
-      return llvm::None;
-
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "textDocument") {
-      auto Parsed = TextDocumentIdentifier::parse(Value);
+  for (const json::Member &M : *Members) {
+    if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentIdentifier::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.textDocument = std::move(*Parsed);
-    } else if (KeyValue == "range") {
-      auto Parsed = Range::parse(Value);
+    } else if (M.Key == "range") {
+      auto Parsed = Range::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.range = std::move(*Parsed);
-    } else if (KeyValue == "context") {
-      auto Parsed = CodeActionContext::parse(Value);
+    } else if (M.Key == "context") {
+      auto Parsed = CodeActionContext::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.context = std::move(*Parsed);
@@ -673,28 +541,22 @@ CodeActionParams::parse(llvm::yaml::MappingNode *Params) {
 }
 
 llvm::Optional<TextDocumentPositionParams>
-TextDocumentPositionParams::parse(llvm::yaml::MappingNode *Params) {
+TextDocumentPositionParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
   TextDocumentPositionParams Result;
-  for (auto &NextKeyValue : *Params) {
-    auto *KeyString = dyn_cast<llvm::yaml::ScalarNode>(NextKeyValue.getKey());
-    if (!KeyString)
-      return llvm::None;
-
-    llvm::SmallString<10> KeyStorage;
-    StringRef KeyValue = KeyString->getValue(KeyStorage);
-    auto *Value =
-        dyn_cast_or_null<llvm::yaml::MappingNode>(NextKeyValue.getValue());
-    if (!Value)
+  for (const json::Member &M : *Members) {
+    if (M.V.kind() != json::Value::Object)
       continue;
 
-    llvm::SmallString<10> Storage;
-    if (KeyValue == "textDocument") {
-      auto Parsed = TextDocumentIdentifier::parse(Value);
+    if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentIdentifier::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.textDocument = std::move(*Parsed);
-    } else if (KeyValue == "position") {
-      auto Parsed = Position::parse(Value);
+    } else if (M.Key == "position") {
+      auto Parsed = Position::parse(M.V);
       if (!Parsed)
         return llvm::None;
       Result.position = std::move(*Parsed);
@@ -705,41 +567,218 @@ TextDocumentPositionParams::parse(llvm::yaml::MappingNode *Params) {
   return Result;
 }
 
-std::string CompletionItem::unparse(const CompletionItem &CI) {
-  std::string Result = "{";
-  llvm::raw_string_ostream Os(Result);
+void CompletionItem::unparse(json::Writer &W, const CompletionItem &CI) {
   assert(!CI.label.empty() && "completion item label is required");
-  Os << R"("label":")" << llvm::yaml::escape(CI.label) << R"(",)";
-  if (CI.kind != CompletionItemKind::Missing)
-    Os << R"("kind":)" << static_cast<int>(CI.kind) << R"(,)";
-  if (!CI.detail.empty())
-    Os << R"("detail":")" << llvm::yaml::escape(CI.detail) << R"(",)";
-  if (!CI.documentation.empty())
-    Os << R"("documentation":")" << llvm::yaml::escape(CI.documentation)
-       << R"(",)";
-  if (!CI.sortText.empty())
-    Os << R"("sortText":")" << llvm::yaml::escape(CI.sortText) << R"(",)";
-  if (!CI.filterText.empty())
-    Os << R"("filterText":")" << llvm::yaml::escape(CI.filterText) << R"(",)";
-  if (!CI.insertText.empty())
-    Os << R"("insertText":")" << llvm::yaml::escape(CI.insertText) << R"(",)";
+  W.objectBegin();
+  W.key("label");
+  W.string(CI.label);
+  if (CI.kind != CompletionItemKind::Missing) {
+    W.key("kind");
+    W.integer(static_cast<int>(CI.kind));
+  }
+  if (!CI.detail.empty()) {
+    W.key("detail");
+    W.string(CI.detail);
+  }
+  if (!CI.documentation.empty()) {
+    W.key("documentation");
+    W.string(CI.documentation);
+  }
+  if (!CI.sortText.empty()) {
+    W.key("sortText");
+    W.string(CI.sortText);
+  }
+  if (!CI.filterText.empty()) {
+    W.key("filterText");
+    W.string(CI.filterText);
+  }
+  if (!CI.insertText.empty()) {
+    W.key("insertText");
+    W.string(CI.insertText);
+  }
   if (CI.insertTextFormat != InsertTextFormat::Missing) {
-    Os << R"("insertTextFormat":)" << static_cast<int>(CI.insertTextFormat)
-       << R"(,)";
+    W.key("insertTextFormat");
+    W.integer(static_cast<int>(CI.insertTextFormat));
+  }
+  if (CI.textEdit) {
+    W.key("textEdit");
+    TextEdit::unparse(W, *CI.textEdit);
   }
-  if (CI.textEdit)
-    Os << R"("textEdit":)" << TextEdit::unparse(*CI.textEdit) << ',';
   if (!CI.additionalTextEdits.empty()) {
-    Os << R"("additionalTextEdits":[)";
+    W.key("additionalTextEdits");
+    W.arrayBegin();
     for (const auto &Edit : CI.additionalTextEdits)
-      Os << TextEdit::unparse(Edit) << ",";
-    Os.flush();
-    // The list additionalTextEdits is guaranteed nonempty at this point.
-    // Replace the trailing comma with right brace.
-    Result.back() = ']';
-  }
-  Os.flush();
-  // Label is required, so Result is guaranteed to have a trailing comma.
-  Result.back() = '}';
+      TextEdit::unparse(W, Edit);
+    W.arrayEnd();
+  }
+  W.objectEnd();
+}
+
+void CompletionList::unparse(json::Writer &W, const CompletionList &P) {
+  W.objectBegin();
+  W.key("isIncomplete");
+  W.boolean(P.isIncomplete);
+  W.key("items");
+  W.arrayBegin();
+  for (const auto &Item : P.items)
+    CompletionItem::unparse(W, Item);
+  W.arrayEnd();
+  W.objectEnd();
+}
+
+llvm::Optional<FileEvent> FileEvent::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
+  FileEvent Result;
+  for (const json::Member &M : *Members) {
+    if (M.Key == "uri") {
+      auto Parsed = URI::parse(M.V);
+      if (!Parsed)
+        return llvm::None;
+      Result.uri = std::move(*Parsed);
+    } else if (M.Key == "type") {
+      auto Val = M.V.asInteger();
+      if (!Val || *Val < static_cast<int>(FileChangeType::Created) ||
+          *Val > static_cast<int>(FileChangeType::Deleted))
+        return llvm::None;
+      Result.type = static_cast<FileChangeType>(*Val);
+    } else {
+      return llvm::None;
+    }
+  }
   return Result;
 }
+
+llvm::Optional<DidChangeWatchedFilesParams>
+DidChangeWatchedFilesParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
+  DidChangeWatchedFilesParams Result;
+  for (const json::Member &M : *Members) {
+    if (M.Key == "changes") {
+      auto Changes = M.V.asArray();
+      if (!Changes)
+        return llvm::None;
+      for (const json::Value &Change : *Changes) {
+        auto Parsed = FileEvent::parse(Change);
+        if (!Parsed)
+          return llvm::None;
+        Result.changes.push_back(std::move(*Parsed));
+      }
+    } else {
+      return llvm::None;
+    }
+  }
+  return Result;
+}
+
+llvm::Optional<CancelParams> CancelParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
+  CancelParams Result;
+  for (const json::Member &M : *Members) {
+    if (M.Key == "id") {
+      // Request ids are compared in their serialized form.
+      llvm::raw_string_ostream OS(Result.id);
+      json::Writer(OS).value(M.V);
+    } else {
+      return llvm::None;
+    }
+  }
+  return Result;
+}
+
+llvm::Optional<MemoryUsageParams>
+MemoryUsageParams::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
+  MemoryUsageParams Result;
+  for (const json::Member &M : *Members) {
+    if (M.Key == "textDocument") {
+      auto Parsed = TextDocumentIdentifier::parse(M.V);
+      if (!Parsed)
+        return llvm::None;
+      Result.textDocument = std::move(*Parsed);
+    } else {
+      return llvm::None;
+    }
+  }
+  return Result;
+}
+
+void MemoryUsage::unparse(json::Writer &W, const MemoryUsage &P) {
+  W.objectBegin();
+  W.key("ast");
+  W.integer(P.ast);
+  W.key("astEvicted");
+  W.boolean(P.astEvicted);
+  W.key("completionPreamble");
+  W.integer(P.completionPreamble);
+  W.objectEnd();
+}
+
+llvm::Optional<LatencyHistogram>
+LatencyHistogram::parse(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return llvm::None;
+  LatencyHistogram Result;
+  for (const json::Member &M : *Members) {
+    if (M.Key == "name") {
+      auto Val = M.V.asString();
+      if (!Val)
+        return llvm::None;
+      Result.name = *Val;
+    } else if (M.Key == "count") {
+      auto Val = M.V.asInteger();
+      if (!Val)
+        return llvm::None;
+      Result.count = *Val;
+    } else if (M.Key == "totalUs") {
+      auto Val = M.V.asInteger();
+      if (!Val)
+        return llvm::None;
+      Result.totalUs = *Val;
+    } else if (M.Key == "maxUs") {
+      auto Val = M.V.asInteger();
+      if (!Val)
+        return llvm::None;
+      Result.maxUs = *Val;
+    } else if (M.Key == "buckets") {
+      auto Buckets = M.V.asArray();
+      if (!Buckets)
+        return llvm::None;
+      for (const json::Value &Bucket : *Buckets) {
+        auto Val = Bucket.asInteger();
+        if (!Val)
+          return llvm::None;
+        Result.buckets.push_back(*Val);
+      }
+    } else {
+      return llvm::None;
+    }
+  }
+  return Result;
+}
+
+void LatencyHistogram::unparse(json::Writer &W, const LatencyHistogram &P) {
+  W.objectBegin();
+  W.key("name");
+  W.string(P.name);
+  W.key("count");
+  W.integer(P.count);
+  W.key("totalUs");
+  W.integer(P.totalUs);
+  W.key("maxUs");
+  W.integer(P.maxUs);
+  W.key("buckets");
+  W.arrayBegin();
+  for (uint64_t Count : P.buckets)
+    W.integer(Count);
+  W.arrayEnd();
+  W.objectEnd();
+}
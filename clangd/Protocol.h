@@ -14,15 +14,16 @@
 // when they're needed.
 //
 // Each struct has a parse and unparse function, that converts back and forth
-// between the struct and a JSON representation.
+// between the struct and a JSON representation. Structs are parsed from
+// json::Value and written directly into a json::Writer.
 //
 //===----------------------------------------------------------------------===//
 
 #ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_PROTOCOL_H
 #define LLVM_CLANG_TOOLS_EXTRA_CLANGD_PROTOCOL_H
 
+#include "JSON.h"
 #include "llvm/ADT/Optional.h"
-#include "llvm/Support/YAMLParser.h"
 #include <string>
 #include <vector>
 
@@ -36,8 +37,8 @@ struct URI {
   static URI fromUri(llvm::StringRef uri);
   static URI fromFile(llvm::StringRef file);
 
-  static URI parse(llvm::yaml::ScalarNode *Param);
-  static std::string unparse(const URI &U);
+  static llvm::Optional<URI> parse(const json::Value &Param);
+  static void unparse(json::Writer &W, const URI &U);
 
   friend bool operator==(const URI &LHS, const URI &RHS) {
     return LHS.uri == RHS.uri;
@@ -57,14 +58,16 @@ struct TextDocumentIdentifier {
   URI uri;
 
   static llvm::Optional<TextDocumentIdentifier>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct Position {
   /// Line position in a document (zero-based).
   int line;
 
-  /// Character offset on a line in a document (zero-based).
+  /// Character offset on a line in a document (zero-based), in UTF-16 code
+  /// units. Clang measures columns in bytes, they are converted when positions
+  /// are received from or sent to the client.
   int character;
 
   friend bool operator==(const Position &LHS, const Position &RHS) {
@@ -76,8 +79,8 @@ struct Position {
            std::tie(RHS.line, RHS.character);
   }
 
-  static llvm::Optional<Position> parse(llvm::yaml::MappingNode *Params);
-  static std::string unparse(const Position &P);
+  static llvm::Optional<Position> parse(const json::Value &Params);
+  static void unparse(json::Writer &W, const Position &P);
 };
 
 struct Range {
@@ -94,8 +97,8 @@ struct Range {
     return std::tie(LHS.start, LHS.end) < std::tie(RHS.start, RHS.end);
   }
 
-  static llvm::Optional<Range> parse(llvm::yaml::MappingNode *Params);
-  static std::string unparse(const Range &P);
+  static llvm::Optional<Range> parse(const json::Value &Params);
+  static void unparse(json::Writer &W, const Range &P);
 };
 
 struct Location {
@@ -115,13 +118,13 @@ struct Location {
     return std::tie(LHS.uri, LHS.range) < std::tie(RHS.uri, RHS.range);
   }
 
-  static std::string unparse(const Location &P);
+  static void unparse(json::Writer &W, const Location &P);
 };
 
 struct Metadata {
   std::vector<std::string> extraFlags;
 
-  static llvm::Optional<Metadata> parse(llvm::yaml::MappingNode *Params);
+  static llvm::Optional<Metadata> parse(const json::Value &Params);
 };
 
 struct TextEdit {
@@ -133,8 +136,8 @@ struct TextEdit {
   /// empty string.
   std::string newText;
 
-  static llvm::Optional<TextEdit> parse(llvm::yaml::MappingNode *Params);
-  static std::string unparse(const TextEdit &P);
+  static llvm::Optional<TextEdit> parse(const json::Value &Params);
+  static void unparse(json::Writer &W, const TextEdit &P);
 };
 
 struct TextDocumentItem {
@@ -151,7 +154,7 @@ struct TextDocumentItem {
   std::string text;
 
   static llvm::Optional<TextDocumentItem>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct DidOpenTextDocumentParams {
@@ -162,7 +165,7 @@ struct DidOpenTextDocumentParams {
   llvm::Optional<Metadata> metadata;
 
   static llvm::Optional<DidOpenTextDocumentParams>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct DidCloseTextDocumentParams {
@@ -170,15 +173,22 @@ struct DidCloseTextDocumentParams {
   TextDocumentIdentifier textDocument;
 
   static llvm::Optional<DidCloseTextDocumentParams>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct TextDocumentContentChangeEvent {
-  /// The new text of the document.
+  /// The range of the document that changed. If None, \p text is the new text
+  /// of the whole document.
+  llvm::Optional<Range> range;
+
+  /// The length of the range that got replaced.
+  llvm::Optional<int> rangeLength;
+
+  /// The new text of the range/document.
   std::string text;
 
   static llvm::Optional<TextDocumentContentChangeEvent>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct DidChangeTextDocumentParams {
@@ -191,7 +201,7 @@ struct DidChangeTextDocumentParams {
   std::vector<TextDocumentContentChangeEvent> contentChanges;
 
   static llvm::Optional<DidChangeTextDocumentParams>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct FormattingOptions {
@@ -202,8 +212,8 @@ struct FormattingOptions {
   bool insertSpaces;
 
   static llvm::Optional<FormattingOptions>
-  parse(llvm::yaml::MappingNode *Params);
-  static std::string unparse(const FormattingOptions &P);
+  parse(const json::Value &Params);
+  static void unparse(json::Writer &W, const FormattingOptions &P);
 };
 
 struct DocumentRangeFormattingParams {
@@ -217,7 +227,7 @@ struct DocumentRangeFormattingParams {
   FormattingOptions options;
 
   static llvm::Optional<DocumentRangeFormattingParams>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct DocumentOnTypeFormattingParams {
@@ -234,7 +244,7 @@ struct DocumentOnTypeFormattingParams {
   FormattingOptions options;
 
   static llvm::Optional<DocumentOnTypeFormattingParams>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct DocumentFormattingParams {
@@ -245,7 +255,7 @@ struct DocumentFormattingParams {
   FormattingOptions options;
 
   static llvm::Optional<DocumentFormattingParams>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct Diagnostic {
@@ -268,7 +278,7 @@ struct Diagnostic {
            std::tie(RHS.range, RHS.severity, RHS.message);
   }
 
-  static llvm::Optional<Diagnostic> parse(llvm::yaml::MappingNode *Params);
+  static llvm::Optional<Diagnostic> parse(const json::Value &Params);
 };
 
 struct CodeActionContext {
@@ -276,7 +286,7 @@ struct CodeActionContext {
   std::vector<Diagnostic> diagnostics;
 
   static llvm::Optional<CodeActionContext>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct CodeActionParams {
@@ -290,7 +300,7 @@ struct CodeActionParams {
   CodeActionContext context;
 
   static llvm::Optional<CodeActionParams>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 struct TextDocumentPositionParams {
@@ -301,7 +311,7 @@ struct TextDocumentPositionParams {
   Position position;
 
   static llvm::Optional<TextDocumentPositionParams>
-  parse(llvm::yaml::MappingNode *Params);
+  parse(const json::Value &Params);
 };
 
 /// The kind of a completion entry.
@@ -397,7 +407,105 @@ struct CompletionItem {
   //
   // data?: any - A data entry field that is preserved on a completion item
   //              between a completion and a completion resolve request.
-  static std::string unparse(const CompletionItem &P);
+  static void unparse(json::Writer &W, const CompletionItem &P);
+};
+
+/// Represents a collection of completion items to be presented in the editor.
+struct CompletionList {
+  /// The list is not complete. Further typing should result in recomputing the
+  /// list.
+  bool isIncomplete = false;
+
+  /// The completion items.
+  std::vector<CompletionItem> items;
+
+  static void unparse(json::Writer &W, const CompletionList &P);
+};
+
+enum class FileChangeType {
+  /// The file got created.
+  Created = 1,
+  /// The file got changed.
+  Changed = 2,
+  /// The file got deleted.
+  Deleted = 3
+};
+
+/// An event describing a file change.
+struct FileEvent {
+  /// The file's URI.
+  URI uri;
+
+  /// The change type.
+  FileChangeType type;
+
+  static llvm::Optional<FileEvent> parse(const json::Value &Params);
+};
+
+struct DidChangeWatchedFilesParams {
+  /// The actual file events.
+  std::vector<FileEvent> changes;
+
+  static llvm::Optional<DidChangeWatchedFilesParams>
+  parse(const json::Value &Params);
+};
+
+/// Parameters of the $/cancelRequest notification.
+struct CancelParams {
+  /// The id of the request to cancel, serialized as JSON, i.e. string ids keep
+  /// their quotes.
+  std::string id;
+
+  static llvm::Optional<CancelParams> parse(const json::Value &Params);
+};
+
+/// Parameters of the clangd/memoryUsage request, a clangd extension to LSP.
+struct MemoryUsageParams {
+  /// The text document.
+  TextDocumentIdentifier textDocument;
+
+  static llvm::Optional<MemoryUsageParams>
+  parse(const json::Value &Params);
+};
+
+/// Result of the clangd/memoryUsage request.
+struct MemoryUsage {
+  /// Estimated memory used by the AST of the document, in bytes.
+  uint64_t ast = 0;
+
+  /// Whether the AST was evicted to keep ASTs of all documents within the
+  /// memory budget. It will be rebuilt when it is needed again.
+  bool astEvicted = false;
+
+  /// Size of the preamble, built to speed up code completion in the document,
+  /// in bytes.
+  uint64_t completionPreamble = 0;
+
+  static void unparse(json::Writer &W, const MemoryUsage &P);
+};
+
+/// Latencies of a kind of request, or of a phase of processing a file, an
+/// element of the result of the clangd/latencyHistograms request.
+struct LatencyHistogram {
+  /// The LSP method of the request, or the name of the phase.
+  std::string name;
+
+  /// Number of recorded latencies.
+  uint64_t count = 0;
+
+  /// Sum of the recorded latencies, in microseconds.
+  uint64_t totalUs = 0;
+
+  /// Maximal recorded latency, in microseconds.
+  uint64_t maxUs = 0;
+
+  /// buckets[0] counts latencies below 1 millisecond, buckets[I] counts
+  /// latencies in [2^(I-1), 2^I) milliseconds. The last bucket also counts all
+  /// longer latencies.
+  std::vector<uint64_t> buckets;
+
+  static llvm::Optional<LatencyHistogram> parse(const json::Value &Params);
+  static void unparse(json::Writer &W, const LatencyHistogram &P);
 };
 
 } // namespace clangd
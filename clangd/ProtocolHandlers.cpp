@@ -20,7 +20,7 @@ struct InitializeHandler : Handler {
   InitializeHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) override {
+  void handleMethod(const json::Value &Params, StringRef ID) override {
     Callbacks.onInitialize(ID, Output);
   }
 
@@ -32,7 +32,9 @@ struct ShutdownHandler : Handler {
   ShutdownHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) override {
+  void handleMethod(const json::Value &Params, StringRef ID) override {
+    // The server exits without answering the shutdown request.
+    Output.requestDropped(ID);
     Callbacks.onShutdown(Output);
   }
 
@@ -44,7 +46,7 @@ struct TextDocumentDidOpenHandler : Handler {
   TextDocumentDidOpenHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleNotification(llvm::yaml::MappingNode *Params) override {
+  void handleNotification(const json::Value &Params) override {
     auto DOTDP = DidOpenTextDocumentParams::parse(Params);
     if (!DOTDP) {
       Output.log("Failed to decode DidOpenTextDocumentParams!\n");
@@ -61,9 +63,9 @@ struct TextDocumentDidChangeHandler : Handler {
   TextDocumentDidChangeHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleNotification(llvm::yaml::MappingNode *Params) override {
+  void handleNotification(const json::Value &Params) override {
     auto DCTDP = DidChangeTextDocumentParams::parse(Params);
-    if (!DCTDP || DCTDP->contentChanges.size() != 1) {
+    if (!DCTDP) {
       Output.log("Failed to decode DidChangeTextDocumentParams!\n");
       return;
     }
@@ -79,7 +81,7 @@ struct TextDocumentDidCloseHandler : Handler {
   TextDocumentDidCloseHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleNotification(llvm::yaml::MappingNode *Params) override {
+  void handleNotification(const json::Value &Params) override {
     auto DCTDP = DidCloseTextDocumentParams::parse(Params);
     if (!DCTDP) {
       Output.log("Failed to decode DidCloseTextDocumentParams!\n");
@@ -93,15 +95,35 @@ private:
   ProtocolCallbacks &Callbacks;
 };
 
+struct WorkspaceDidChangeWatchedFilesHandler : Handler {
+  WorkspaceDidChangeWatchedFilesHandler(JSONOutput &Output,
+                                        ProtocolCallbacks &Callbacks)
+      : Handler(Output), Callbacks(Callbacks) {}
+
+  void handleNotification(const json::Value &Params) override {
+    auto DCWFP = DidChangeWatchedFilesParams::parse(Params);
+    if (!DCWFP) {
+      Output.log("Failed to decode DidChangeWatchedFilesParams!\n");
+      return;
+    }
+
+    Callbacks.onFileEvent(*DCWFP, Output);
+  }
+
+private:
+  ProtocolCallbacks &Callbacks;
+};
+
 struct TextDocumentOnTypeFormattingHandler : Handler {
   TextDocumentOnTypeFormattingHandler(JSONOutput &Output,
                                       ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) override {
+  void handleMethod(const json::Value &Params, StringRef ID) override {
     auto DOTFP = DocumentOnTypeFormattingParams::parse(Params);
     if (!DOTFP) {
       Output.log("Failed to decode DocumentOnTypeFormattingParams!\n");
+      Output.requestDropped(ID);
       return;
     }
 
@@ -117,10 +139,11 @@ struct TextDocumentRangeFormattingHandler : Handler {
                                      ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) override {
+  void handleMethod(const json::Value &Params, StringRef ID) override {
     auto DRFP = DocumentRangeFormattingParams::parse(Params);
     if (!DRFP) {
       Output.log("Failed to decode DocumentRangeFormattingParams!\n");
+      Output.requestDropped(ID);
       return;
     }
 
@@ -136,10 +159,11 @@ struct TextDocumentFormattingHandler : Handler {
                                 ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) override {
+  void handleMethod(const json::Value &Params, StringRef ID) override {
     auto DFP = DocumentFormattingParams::parse(Params);
     if (!DFP) {
       Output.log("Failed to decode DocumentFormattingParams!\n");
+      Output.requestDropped(ID);
       return;
     }
 
@@ -154,10 +178,11 @@ struct CodeActionHandler : Handler {
   CodeActionHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) override {
+  void handleMethod(const json::Value &Params, StringRef ID) override {
     auto CAP = CodeActionParams::parse(Params);
     if (!CAP) {
       Output.log("Failed to decode CodeActionParams!\n");
+      Output.requestDropped(ID);
       return;
     }
 
@@ -172,10 +197,11 @@ struct CompletionHandler : Handler {
   CompletionHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) override {
+  void handleMethod(const json::Value &Params, StringRef ID) override {
     auto TDPP = TextDocumentPositionParams::parse(Params);
     if (!TDPP) {
       Output.log("Failed to decode TextDocumentPositionParams!\n");
+      Output.requestDropped(ID);
       return;
     }
 
@@ -190,10 +216,11 @@ struct GotoDefinitionHandler : Handler {
   GotoDefinitionHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
       : Handler(Output), Callbacks(Callbacks) {}
 
-  void handleMethod(llvm::yaml::MappingNode *Params, StringRef ID) override {
+  void handleMethod(const json::Value &Params, StringRef ID) override {
     auto TDPP = TextDocumentPositionParams::parse(Params);
     if (!TDPP) {
       Output.log("Failed to decode TextDocumentPositionParams!\n");
+      Output.requestDropped(ID);
       return;
     }
 
@@ -204,6 +231,55 @@ private:
   ProtocolCallbacks &Callbacks;
 };
 
+struct MemoryUsageHandler : Handler {
+  MemoryUsageHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
+      : Handler(Output), Callbacks(Callbacks) {}
+
+  void handleMethod(const json::Value &Params, StringRef ID) override {
+    auto MUP = MemoryUsageParams::parse(Params);
+    if (!MUP) {
+      Output.log("Failed to decode MemoryUsageParams!\n");
+      Output.requestDropped(ID);
+      return;
+    }
+
+    Callbacks.onMemoryUsage(*MUP, ID, Output);
+  }
+
+private:
+  ProtocolCallbacks &Callbacks;
+};
+
+struct LatencyHistogramsHandler : Handler {
+  LatencyHistogramsHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
+      : Handler(Output), Callbacks(Callbacks) {}
+
+  void handleMethod(const json::Value &Params, StringRef ID) override {
+    Callbacks.onLatencyHistograms(ID, Output);
+  }
+
+private:
+  ProtocolCallbacks &Callbacks;
+};
+
+struct CancelRequestHandler : Handler {
+  CancelRequestHandler(JSONOutput &Output, ProtocolCallbacks &Callbacks)
+      : Handler(Output), Callbacks(Callbacks) {}
+
+  void handleNotification(const json::Value &Params) override {
+    auto CP = CancelParams::parse(Params);
+    if (!CP) {
+      Output.log("Failed to decode CancelParams!\n");
+      return;
+    }
+
+    Callbacks.onCancelRequest(*CP, Output);
+  }
+
+private:
+  ProtocolCallbacks &Callbacks;
+};
+
 } // namespace
 
 void clangd::regiterCallbackHandlers(JSONRPCDispatcher &Dispatcher,
@@ -222,6 +298,9 @@ void clangd::regiterCallbackHandlers(JSONRPCDispatcher &Dispatcher,
   Dispatcher.registerHandler(
       "textDocument/didChange",
       llvm::make_unique<TextDocumentDidChangeHandler>(Out, Callbacks));
+  Dispatcher.registerHandler(
+      "workspace/didChangeWatchedFiles",
+      llvm::make_unique<WorkspaceDidChangeWatchedFilesHandler>(Out, Callbacks));
   Dispatcher.registerHandler(
       "textDocument/rangeFormatting",
       llvm::make_unique<TextDocumentRangeFormattingHandler>(Out, Callbacks));
@@ -240,4 +319,13 @@ void clangd::regiterCallbackHandlers(JSONRPCDispatcher &Dispatcher,
   Dispatcher.registerHandler(
       "textDocument/definition",
       llvm::make_unique<GotoDefinitionHandler>(Out, Callbacks));
+  Dispatcher.registerHandler(
+      "clangd/memoryUsage",
+      llvm::make_unique<MemoryUsageHandler>(Out, Callbacks));
+  Dispatcher.registerHandler(
+      "clangd/latencyHistograms",
+      llvm::make_unique<LatencyHistogramsHandler>(Out, Callbacks));
+  Dispatcher.registerHandler(
+      "$/cancelRequest",
+      llvm::make_unique<CancelRequestHandler>(Out, Callbacks));
 }
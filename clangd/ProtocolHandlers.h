@@ -36,6 +36,8 @@ public:
 
   virtual void onDocumentDidClose(DidCloseTextDocumentParams Params,
                                   JSONOutput &Out) = 0;
+  virtual void onFileEvent(DidChangeWatchedFilesParams Params,
+                           JSONOutput &Out) = 0;
   virtual void onDocumentFormatting(DocumentFormattingParams Params,
                                     StringRef ID, JSONOutput &Out) = 0;
   virtual void onDocumentOnTypeFormatting(DocumentOnTypeFormattingParams Params,
@@ -48,6 +50,10 @@ public:
                             JSONOutput &Out) = 0;
   virtual void onGoToDefinition(TextDocumentPositionParams Params, StringRef ID,
                                 JSONOutput &Out) = 0;
+  virtual void onMemoryUsage(MemoryUsageParams Params, StringRef ID,
+                             JSONOutput &Out) = 0;
+  virtual void onLatencyHistograms(StringRef ID, JSONOutput &Out) = 0;
+  virtual void onCancelRequest(CancelParams Params, JSONOutput &Out) = 0;
 };
 
 void regiterCallbackHandlers(JSONRPCDispatcher &Dispatcher, JSONOutput &Out,
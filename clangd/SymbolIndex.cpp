@@ -0,0 +1,205 @@
+//===--- SymbolIndex.cpp - Project-wide index of symbols ---------*-C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SymbolIndex.h"
+#include "ClangdUnit.h"
+#include "DraftStore.h"
+#include "clang/Index/IndexDataConsumer.h"
+#include "clang/Index/IndexingAction.h"
+#include "clang/Index/USRGeneration.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/SmallString.h"
+#include <algorithm>
+
+using namespace clang::clangd;
+using namespace clang;
+
+namespace {
+
+class OccurrenceCollector : public index::IndexDataConsumer {
+public:
+  OccurrenceCollector(const ASTContext &AST) : AST(AST) {}
+
+  std::vector<SymbolOccurrence> takeOccurrences() {
+    return std::move(Occurrences);
+  }
+
+  bool
+  handleDeclOccurence(const Decl *D, index::SymbolRoleSet Roles,
+                      ArrayRef<index::SymbolRelation> Relations, FileID FID,
+                      unsigned Offset,
+                      index::IndexDataConsumer::ASTNodeInfo ASTNode) override {
+    OccurrenceKind Kind;
+    if (Roles & static_cast<unsigned>(index::SymbolRole::Definition))
+      Kind = OccurrenceKind::Definition;
+    else if (Roles & static_cast<unsigned>(index::SymbolRole::Declaration))
+      Kind = OccurrenceKind::Declaration;
+    else if (Roles & static_cast<unsigned>(index::SymbolRole::Reference))
+      Kind = OccurrenceKind::Reference;
+    else
+      return true;
+
+    const SourceManager &SourceMgr = AST.getSourceManager();
+    const FileEntry *FE = SourceMgr.getFileEntryForID(FID);
+    if (!FE)
+      return true;
+
+    llvm::SmallString<128> USR;
+    if (index::generateUSRForDecl(D, USR))
+      return true; // Failed to generate a USR.
+
+    SourceLocation Loc = SourceMgr.getComposedLoc(FID, Offset);
+    unsigned Length =
+        Lexer::MeasureTokenLength(Loc, SourceMgr, AST.getLangOpts());
+    Position Begin = sourceLocToPosition(SourceMgr, Loc);
+    Position End = Begin;
+    End.character +=
+        getUTF16Length(StringRef(SourceMgr.getCharacterData(Loc), Length));
+
+    SymbolOccurrence Occurrence;
+    Occurrence.USR = USR.str();
+    Occurrence.Kind = Kind;
+    Occurrence.File = FE->getName();
+    Occurrence.NameRange = Range{Begin, End};
+    Occurrences.push_back(std::move(Occurrence));
+    return true;
+  }
+
+private:
+  const ASTContext &AST;
+  std::vector<SymbolOccurrence> Occurrences;
+};
+
+} // namespace
+
+std::vector<SymbolOccurrence> clangd::collectOccurrences(ParsedAST &AST) {
+  auto Collector = std::make_shared<OccurrenceCollector>(AST.getASTContext());
+  index::IndexingOptions IndexOpts;
+  IndexOpts.SystemSymbolFilter =
+      index::IndexingOptions::SystemSymbolFilterKind::DeclarationsOnly;
+  IndexOpts.IndexFunctionLocals = false;
+
+  indexTopLevelDecls(AST.getASTContext(), AST.getTopLevelDecls(), Collector,
+                     IndexOpts);
+  return Collector->takeOccurrences();
+}
+
+void SymbolIndex::update(PathRef TU,
+                         std::vector<SymbolOccurrence> NewOccurrences) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  unsigned TUID = getFileID(TU);
+  removeLocked(TUID);
+
+  // Occurrences of each file are replaced together, group them by files. The
+  // order of the files is kept, so that the results don't depend on it.
+  std::vector<unsigned> TUFiles;
+  llvm::DenseMap<unsigned, std::vector<SymbolOccurrence *>> OccurrencesByFile;
+  for (SymbolOccurrence &O : NewOccurrences) {
+    unsigned FileID = getFileID(O.File);
+    auto &FileOccurrences = OccurrencesByFile[FileID];
+    if (FileOccurrences.empty())
+      TUFiles.push_back(FileID);
+    FileOccurrences.push_back(&O);
+  }
+
+  for (unsigned FileID : TUFiles) {
+    // The file might have been stored by another TU, e.g. if it's a header.
+    // The occurrences from the latest TU replace the old ones.
+    removeFileOccurrencesLocked(FileID);
+    ++TUCountByFile[FileID];
+
+    std::vector<StringRef> &USRs = USRsByFile[FileID];
+    for (SymbolOccurrence *O : OccurrencesByFile[FileID]) {
+      auto It = Occurrences.try_emplace(O->USR).first;
+      std::vector<StoredOccurrence> &Stored = It->second;
+      // Occurrences of a single file are added together, so checking the last
+      // one is enough to find out if the USR was already recorded for the
+      // file.
+      if (Stored.empty() || Stored.back().File != FileID)
+        USRs.push_back(It->first());
+      Stored.push_back(StoredOccurrence{FileID, O->Kind, O->NameRange});
+    }
+  }
+  FilesByTU[TUID] = std::move(TUFiles);
+}
+
+void SymbolIndex::remove(PathRef TU) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto It = FileIDs.find(TU);
+  if (It == FileIDs.end())
+    return;
+  removeLocked(It->second);
+}
+
+std::vector<Location> SymbolIndex::findDefinitions(StringRef USR) const {
+  return find(USR, OccurrenceKind::Definition);
+}
+
+std::vector<Location> SymbolIndex::findReferences(StringRef USR) const {
+  return find(USR, OccurrenceKind::Reference);
+}
+
+unsigned SymbolIndex::getFileID(PathRef File) {
+  auto Inserted = FileIDs.try_emplace(File, Files.size());
+  if (Inserted.second)
+    Files.push_back(File);
+  return Inserted.first->second;
+}
+
+void SymbolIndex::removeLocked(unsigned TU) {
+  auto It = FilesByTU.find(TU);
+  if (It == FilesByTU.end())
+    return;
+  for (unsigned File : It->second) {
+    auto CountIt = TUCountByFile.find(File);
+    assert(CountIt != TUCountByFile.end() && CountIt->second > 0);
+    if (--CountIt->second != 0)
+      continue;
+    TUCountByFile.erase(CountIt);
+    removeFileOccurrencesLocked(File);
+  }
+  FilesByTU.erase(It);
+}
+
+void SymbolIndex::removeFileOccurrencesLocked(unsigned File) {
+  auto It = USRsByFile.find(File);
+  if (It == USRsByFile.end())
+    return;
+  for (StringRef USR : It->second) {
+    auto OccurrencesIt = Occurrences.find(USR);
+    assert(OccurrencesIt != Occurrences.end());
+    auto &Stored = OccurrencesIt->second;
+    Stored.erase(std::remove_if(Stored.begin(), Stored.end(),
+                                [File](const StoredOccurrence &O) {
+                                  return O.File == File;
+                                }),
+                 Stored.end());
+    if (Stored.empty())
+      Occurrences.erase(OccurrencesIt);
+  }
+  USRsByFile.erase(It);
+}
+
+std::vector<Location> SymbolIndex::find(StringRef USR,
+                                        OccurrenceKind Kind) const {
+  std::vector<Location> Result;
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto It = Occurrences.find(USR);
+  if (It == Occurrences.end())
+    return Result;
+  for (const StoredOccurrence &O : It->second) {
+    if (O.Kind != Kind)
+      continue;
+    Location L;
+    L.uri = URI::fromFile(Files[O.File]);
+    L.range = O.NameRange;
+    Result.push_back(std::move(L));
+  }
+  return Result;
+}
@@ -0,0 +1,100 @@
+//===--- SymbolIndex.h - Project-wide index of symbols ----------*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_SYMBOLINDEX_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANGD_SYMBOLINDEX_H
+
+#include "Path.h"
+#include "Protocol.h"
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clang {
+namespace clangd {
+
+class ParsedAST;
+
+enum class OccurrenceKind { Declaration, Definition, Reference };
+
+/// An occurrence of a symbol in the source code.
+struct SymbolOccurrence {
+  /// Unified Symbol Resolution identifier of the symbol.
+  std::string USR;
+  OccurrenceKind Kind;
+  /// Absolute path to the file, containing the occurrence.
+  Path File;
+  /// Range of the name of the symbol.
+  Range NameRange;
+};
+
+/// Collects occurrences of symbols in \p AST, including the ones coming from
+/// headers. Only declarations are collected from system headers.
+/// Note that this deserializes all declarations from the preamble, if \p AST
+/// was built with one.
+std::vector<SymbolOccurrence> collectOccurrences(ParsedAST &AST);
+
+/// A thread-safe in-memory index of symbol occurrences, collected from
+/// multiple translation units. Lookups by USR don't require parsing.
+/// Occurrences are stored per file, so a header that is included by many TUs
+/// is only stored once. Its occurrences are replaced each time one of these
+/// TUs is updated and are removed when all of them are removed.
+class SymbolIndex {
+public:
+  /// Replaces the occurrences that were previously collected from \p TU with
+  /// \p Occurrences.
+  void update(PathRef TU, std::vector<SymbolOccurrence> Occurrences);
+  /// Removes all occurrences that were collected from \p TU.
+  void remove(PathRef TU);
+
+  /// \return locations of definitions of a symbol with \p USR.
+  std::vector<Location> findDefinitions(StringRef USR) const;
+  /// \return locations of references to a symbol with \p USR.
+  std::vector<Location> findReferences(StringRef USR) const;
+
+private:
+  /// Occurrences are stored in a compact form: file paths are interned and
+  /// USRs are only stored once as keys of Occurrences.
+  struct StoredOccurrence {
+    unsigned File;
+    OccurrenceKind Kind;
+    Range NameRange;
+  };
+
+  unsigned getFileID(PathRef File);
+  /// Forgets that \p TU contains its files and removes the occurrences of the
+  /// files that are no longer contained in any TU.
+  void removeLocked(unsigned TU);
+  /// Removes all occurrences in \p File.
+  void removeFileOccurrencesLocked(unsigned File);
+  std::vector<Location> find(StringRef USR, OccurrenceKind Kind) const;
+
+  mutable std::mutex Mutex;
+  /// Paths of all TUs and files with occurrences, addressed by IDs stored in
+  /// StoredOccurrence.
+  std::vector<Path> Files;
+  llvm::StringMap<unsigned> FileIDs;
+  /// Occurrences of each symbol, keys are USRs.
+  llvm::StringMap<std::vector<StoredOccurrence>> Occurrences;
+  /// USRs of the symbols that occur in each file. Point to the keys of
+  /// Occurrences.
+  llvm::DenseMap<unsigned, std::vector<StringRef>> USRsByFile;
+  /// Files with occurrences, collected from each TU.
+  llvm::DenseMap<unsigned, std::vector<unsigned>> FilesByTU;
+  /// Number of TUs that contain each file.
+  llvm::DenseMap<unsigned, unsigned> TUCountByFile;
+};
+
+} // namespace clangd
+} // namespace clang
+
+#endif
@@ -0,0 +1,143 @@
+//===--- Trace.cpp - Performance tracing of clangd requests -----*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+
+#include "Trace.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+using namespace clang::clangd;
+using namespace clang;
+
+namespace {
+
+/// Number of buckets of the latency histograms. The last one counts all spans
+/// longer than 2^(NumBuckets - 2) milliseconds.
+const unsigned NumBuckets = 16;
+
+/// State shared by all threads, that record spans.
+struct TraceState {
+  std::mutex Mutex;
+  llvm::StringMap<LatencyHistogram> Histograms;
+  /// Set while a Session is active.
+  llvm::raw_ostream *OS = nullptr;
+  std::unique_ptr<json::Writer> Writer;
+  /// Timestamps of the trace events are relative to the start of the Session.
+  std::chrono::steady_clock::time_point SessionStart;
+};
+
+TraceState &getState() {
+  static TraceState State;
+  return State;
+}
+
+/// Returns a small number, identifying the current thread in trace events.
+unsigned getThreadID() {
+  static std::atomic<unsigned> NextThreadID(0);
+  static LLVM_THREAD_LOCAL unsigned ThreadID = 0;
+  if (ThreadID == 0)
+    ThreadID = ++NextThreadID;
+  return ThreadID;
+}
+
+unsigned getBucket(std::chrono::steady_clock::duration Duration) {
+  auto Ms = std::chrono::duration_cast<std::chrono::milliseconds>(Duration)
+                .count();
+  if (Ms <= 0)
+    return 0;
+  return std::min(llvm::Log2_64(Ms) + 1, NumBuckets - 1);
+}
+
+int64_t toMicroseconds(std::chrono::steady_clock::duration Duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Duration)
+      .count();
+}
+
+} // namespace
+
+std::unique_ptr<trace::Session> trace::Session::create(llvm::raw_ostream &OS) {
+  TraceState &State = getState();
+  std::lock_guard<std::mutex> Lock(State.Mutex);
+  if (State.OS)
+    return nullptr;
+  State.OS = &OS;
+  State.Writer = llvm::make_unique<json::Writer>(OS);
+  State.SessionStart = std::chrono::steady_clock::now();
+  State.Writer->objectBegin();
+  State.Writer->key("traceEvents");
+  State.Writer->arrayBegin();
+  return std::unique_ptr<Session>(new Session());
+}
+
+trace::Session::~Session() {
+  TraceState &State = getState();
+  std::lock_guard<std::mutex> Lock(State.Mutex);
+  State.Writer->arrayEnd();
+  State.Writer->objectEnd();
+  State.OS->flush();
+  State.Writer.reset();
+  State.OS = nullptr;
+}
+
+void trace::record(StringRef Name, std::chrono::steady_clock::time_point Start,
+                   std::chrono::steady_clock::time_point End) {
+  auto Duration = End - Start;
+  TraceState &State = getState();
+  std::lock_guard<std::mutex> Lock(State.Mutex);
+
+  LatencyHistogram &Histogram = State.Histograms[Name];
+  if (Histogram.buckets.empty()) {
+    Histogram.name = Name.str();
+    Histogram.buckets.resize(NumBuckets);
+  }
+  ++Histogram.count;
+  Histogram.totalUs += toMicroseconds(Duration);
+  Histogram.maxUs = std::max<uint64_t>(Histogram.maxUs,
+                                       toMicroseconds(Duration));
+  ++Histogram.buckets[getBucket(Duration)];
+
+  // Skip the spans that started before the Session.
+  if (!State.Writer || Start < State.SessionStart)
+    return;
+  // A complete event, described in the "Trace Event Format" document.
+  json::Writer &W = *State.Writer;
+  W.objectBegin();
+  W.key("name");
+  W.string(Name);
+  W.key("ph");
+  W.string("X");
+  W.key("ts");
+  W.integer(toMicroseconds(Start - State.SessionStart));
+  W.key("dur");
+  W.integer(toMicroseconds(Duration));
+  W.key("pid");
+  W.integer(0);
+  W.key("tid");
+  W.integer(getThreadID());
+  W.objectEnd();
+}
+
+std::vector<LatencyHistogram> trace::getHistograms() {
+  TraceState &State = getState();
+  std::vector<LatencyHistogram> Result;
+  {
+    std::lock_guard<std::mutex> Lock(State.Mutex);
+    for (const auto &Entry : State.Histograms)
+      Result.push_back(Entry.second);
+  } // unlock Mutex
+  std::sort(Result.begin(), Result.end(),
+            [](const LatencyHistogram &L, const LatencyHistogram &R) {
+              return L.name < R.name;
+            });
+  return Result;
+}
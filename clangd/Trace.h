@@ -0,0 +1,81 @@
+//===--- Trace.h - Performance tracing of clangd requests -------*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+//
+// Spans measure how long clangd spends handling requests and in the phases of
+// processing a file. The durations are always collected in per-name latency
+// histograms, that clients can query with the clangd/latencyHistograms request.
+// While a Session is active, each span is also written out as an event of the
+// Chrome trace-event format, that can be loaded into chrome://tracing.
+//
+//===---------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_TRACE_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANGD_TRACE_H
+
+#include "Protocol.h"
+#include "clang/Basic/LLVM.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clang {
+namespace clangd {
+namespace trace {
+
+/// Writes the trace events of all spans, finished while it is alive, to a
+/// stream. At most one Session can be active at a time.
+class Session {
+public:
+  /// Starts writing trace events to \p OS. \p OS must outlive the Session.
+  /// Returns null if another Session is already active.
+  static std::unique_ptr<Session> create(llvm::raw_ostream &OS);
+
+  /// Completes the JSON document and stops writing to the stream.
+  ~Session();
+
+private:
+  Session() = default;
+};
+
+/// Records a span called \p Name, which started at \p Start and finished at
+/// \p End. Thread-safe.
+void record(StringRef Name, std::chrono::steady_clock::time_point Start,
+            std::chrono::steady_clock::time_point End);
+
+/// Records the time between its construction and destruction as a span.
+class Span {
+public:
+  explicit Span(StringRef Name)
+      : Span(Name, std::chrono::steady_clock::now()) {}
+  /// Creates a span, that started at \p Start. Used when the work started
+  /// before the Span could be created, e.g. on another thread.
+  Span(StringRef Name, std::chrono::steady_clock::time_point Start)
+      : Name(Name.str()), Start(Start) {}
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+  ~Span() { record(Name, Start, std::chrono::steady_clock::now()); }
+
+private:
+  std::string Name;
+  std::chrono::steady_clock::time_point Start;
+};
+
+/// Returns the latency histograms of all span names recorded so far, sorted by
+/// name. Thread-safe.
+std::vector<LatencyHistogram> getHistograms();
+
+} // namespace trace
+} // namespace clangd
+} // namespace clang
+
+#endif
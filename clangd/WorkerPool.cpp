@@ -0,0 +1,700 @@
+//===--- WorkerPool.cpp - Runs clangd in worker processes --------*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+
+#include "WorkerPool.h"
+#include "JSON.h"
+#include "Protocol.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <algorithm>
+#include <cerrno>
+
+#ifdef LLVM_ON_UNIX
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace clang::clangd;
+using namespace clang;
+
+namespace {
+
+/// The id of the initialize requests, that are sent to restarted workers.
+/// Their answers are not forwarded to the client.
+const char RestartRequestID[] = "\"clangd-worker-restart\"";
+
+/// JSONRPC error code, sent for requests of crashed workers.
+const int InternalErrorCode = -32603;
+
+/// A worker is not restarted anymore if it exits this many times in a row
+/// within MinWorkerLifetime after being started, e.g. because one of its files
+/// crashes clangd.
+const unsigned MaxQuickRestarts = 3;
+const std::chrono::seconds MinWorkerLifetime(10);
+
+#ifdef LLVM_ON_UNIX
+
+void closeFD(int &FD) {
+  if (FD < 0)
+    return;
+  ::close(FD);
+  FD = -1;
+}
+
+/// Starts a process running \p Args, with its standard input and output
+/// connected to \p InputFD and \p OutputFD.
+bool spawnProcess(const std::vector<std::string> &Args, std::size_t MemoryLimit,
+                  int &Pid, int &InputFD, int &OutputFD) {
+  int ToChild[2];
+  int FromChild[2];
+  if (::pipe(ToChild) != 0)
+    return false;
+  if (::pipe(FromChild) != 0) {
+    ::close(ToChild[0]);
+    ::close(ToChild[1]);
+    return false;
+  }
+  // Don't leak our ends of the pipes into the other workers, they would keep
+  // the pipes open after the worker exits.
+  ::fcntl(ToChild[1], F_SETFD, FD_CLOEXEC);
+  ::fcntl(FromChild[0], F_SETFD, FD_CLOEXEC);
+
+  // Only async-signal-safe functions can be called after fork(), prepare the
+  // arguments before it.
+  std::vector<char *> Argv;
+  for (const std::string &Arg : Args)
+    Argv.push_back(const_cast<char *>(Arg.c_str()));
+  Argv.push_back(nullptr);
+
+  pid_t Child = ::fork();
+  if (Child < 0) {
+    ::close(ToChild[0]);
+    ::close(ToChild[1]);
+    ::close(FromChild[0]);
+    ::close(FromChild[1]);
+    return false;
+  }
+  if (Child == 0) {
+    ::dup2(ToChild[0], STDIN_FILENO);
+    ::dup2(FromChild[1], STDOUT_FILENO);
+    ::close(ToChild[0]);
+    ::close(ToChild[1]);
+    ::close(FromChild[0]);
+    ::close(FromChild[1]);
+    if (MemoryLimit != 0) {
+      struct rlimit Limit;
+      Limit.rlim_cur = Limit.rlim_max = MemoryLimit;
+      ::setrlimit(RLIMIT_AS, &Limit);
+    }
+    ::execv(Argv[0], Argv.data());
+    ::_exit(127);
+  }
+
+  ::close(ToChild[0]);
+  ::close(FromChild[1]);
+  Pid = Child;
+  InputFD = ToChild[1];
+  OutputFD = FromChild[0];
+  return true;
+}
+
+/// Waits for the process \p Pid to exit and describes how it exited.
+std::string waitForProcess(int Pid) {
+  int Status = 0;
+  while (::waitpid(Pid, &Status, 0) < 0) {
+    if (errno != EINTR)
+      return "unknown status";
+  }
+  if (WIFSIGNALED(Status))
+    return "killed by signal " + std::to_string(WTERMSIG(Status));
+  return "exit code " + std::to_string(WEXITSTATUS(Status));
+}
+
+bool writeAll(int FD, StringRef Data) {
+  while (!Data.empty()) {
+    ssize_t Written = ::write(FD, Data.data(), Data.size());
+    if (Written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    Data = Data.drop_front(Written);
+  }
+  return true;
+}
+
+ssize_t readSome(int FD, char *Buffer, std::size_t Size) {
+  ssize_t Read;
+  do {
+    Read = ::read(FD, Buffer, Size);
+  } while (Read < 0 && errno == EINTR);
+  return Read;
+}
+
+void ignoreBrokenPipes() {
+  // Writing to a crashed worker must not kill the pool. The reader thread of
+  // the worker notices that it exited and restarts it.
+  ::signal(SIGPIPE, SIG_IGN);
+}
+
+#else
+
+void closeFD(int &FD) { FD = -1; }
+
+bool spawnProcess(const std::vector<std::string> &Args, std::size_t MemoryLimit,
+                  int &Pid, int &InputFD, int &OutputFD) {
+  return false;
+}
+
+std::string waitForProcess(int Pid) { return "unknown status"; }
+
+bool writeAll(int FD, StringRef Data) { return false; }
+
+long readSome(int FD, char *Buffer, std::size_t Size) { return -1; }
+
+void ignoreBrokenPipes() {}
+
+#endif
+
+/// Reads the JSONRPC messages, written by a worker to \p FD.
+class MessageReader {
+public:
+  explicit MessageReader(int FD) : FD(FD) {}
+
+  /// Reads the next message into \p Message. Returns false when the output of
+  /// the worker ends.
+  bool read(std::string &Message) {
+    unsigned long long ContentLength = 0;
+    while (true) {
+      std::string Line;
+      if (!readLine(Line))
+        return false;
+      StringRef LineRef = StringRef(Line).trim();
+      if (LineRef.consume_front("Content-Length: "))
+        llvm::getAsUnsignedInteger(LineRef, 10, ContentLength);
+      else if (LineRef.empty() && ContentLength > 0)
+        break;
+    }
+    while (Buffer.size() < ContentLength)
+      if (!fill())
+        return false;
+    Message = Buffer.substr(0, ContentLength);
+    Buffer.erase(0, ContentLength);
+    return true;
+  }
+
+private:
+  bool readLine(std::string &Line) {
+    std::size_t End;
+    while ((End = Buffer.find('\n')) == std::string::npos)
+      if (!fill())
+        return false;
+    Line = Buffer.substr(0, End);
+    Buffer.erase(0, End + 1);
+    return true;
+  }
+
+  bool fill() {
+    char Data[4096];
+    auto Read = readSome(FD, Data, sizeof(Data));
+    if (Read <= 0)
+      return false;
+    Buffer.append(Data, Read);
+    return true;
+  }
+
+  int FD;
+  /// Data that was read, but not consumed yet.
+  std::string Buffer;
+};
+
+std::string serialize(const json::Value &V) {
+  std::string Result;
+  llvm::raw_string_ostream OS(Result);
+  json::Writer(OS).value(V);
+  return OS.str();
+}
+
+/// The members of a JSONRPC message, needed to route it.
+struct MessageHeader {
+  /// Empty for responses.
+  StringRef Method;
+  /// Serialized id, empty for notifications.
+  std::string ID;
+  /// Null if the message has no params.
+  const json::Value *Params = nullptr;
+  /// Null if the message is not a successful response.
+  const json::Value *Result = nullptr;
+};
+
+/// Parses \p Buffer in place and returns the header of the message, or None
+/// if it's not a JSONRPC message.
+llvm::Optional<MessageHeader> parseMessage(MutableArrayRef<char> Buffer,
+                                           llvm::BumpPtrAllocator &Alloc) {
+  const json::Value *Root = json::parse(Buffer, Alloc);
+  if (!Root)
+    return llvm::None;
+  auto Members = Root->asObject();
+  if (!Members)
+    return llvm::None;
+  MessageHeader Header;
+  for (const json::Member &M : *Members) {
+    if (M.Key == "method") {
+      auto Method = M.V.asString();
+      if (!Method)
+        return llvm::None;
+      Header.Method = *Method;
+    } else if (M.Key == "id") {
+      Header.ID = serialize(M.V);
+    } else if (M.Key == "params") {
+      Header.Params = &M.V;
+    } else if (M.Key == "result") {
+      Header.Result = &M.V;
+    }
+  }
+  return Header;
+}
+
+/// Returns the path of params.textDocument.uri, or an empty string if the
+/// message is not about a single document.
+Path getDocumentFile(const json::Value &Params) {
+  auto Members = Params.asObject();
+  if (!Members)
+    return Path();
+  for (const json::Member &M : *Members) {
+    if (M.Key != "textDocument")
+      continue;
+    auto Document = M.V.asObject();
+    if (!Document)
+      return Path();
+    for (const json::Member &DocumentMember : *Document)
+      if (DocumentMember.Key == "uri")
+        if (auto URI = URI::parse(DocumentMember.V))
+          return URI->file;
+  }
+  return Path();
+}
+
+/// Adds the histograms in \p Result, a worker's answer to the
+/// clangd/latencyHistograms request, to \p Merged.
+void mergeHistograms(const json::Value &Result,
+                     llvm::StringMap<LatencyHistogram> &Merged) {
+  auto Histograms = Result.asArray();
+  if (!Histograms)
+    return;
+  for (const json::Value &Value : *Histograms) {
+    auto Histogram = LatencyHistogram::parse(Value);
+    if (!Histogram)
+      continue;
+    auto Inserted = Merged.try_emplace(Histogram->name, *Histogram);
+    if (Inserted.second)
+      continue;
+    LatencyHistogram &Sum = Inserted.first->second;
+    Sum.count += Histogram->count;
+    Sum.totalUs += Histogram->totalUs;
+    Sum.maxUs = std::max(Sum.maxUs, Histogram->maxUs);
+    if (Sum.buckets.size() < Histogram->buckets.size())
+      Sum.buckets.resize(Histogram->buckets.size());
+    for (size_t I = 0; I < Histogram->buckets.size(); ++I)
+      Sum.buckets[I] += Histogram->buckets[I];
+  }
+}
+
+std::string makeMessage(StringRef Message) {
+  return ("Content-Length: " + Twine(Message.size()) + "\r\n\r\n" + Message)
+      .str();
+}
+
+} // namespace
+
+bool WorkerPool::isSupported() {
+#ifdef LLVM_ON_UNIX
+  return true;
+#else
+  return false;
+#endif
+}
+
+WorkerPool::WorkerPool(JSONOutput &Out, std::vector<std::string> WorkerArgs,
+                       unsigned WorkersCount, std::size_t MemoryLimit)
+    : Out(Out), WorkerArgs(std::move(WorkerArgs)), MemoryLimit(MemoryLimit),
+      Workers(WorkersCount) {
+  assert(WorkersCount > 0 && "WorkerPool needs at least one worker");
+  ignoreBrokenPipes();
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  for (unsigned I = 0; I < WorkersCount; ++I) {
+    if (!startWorker(I))
+      Out.log("Failed to start worker " + Twine(I) + "\n");
+    Workers[I].Reader = std::thread([this, I]() { runReader(I); });
+    Workers[I].Writer = std::thread([this, I]() { runWriter(I); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    ShuttingDown = true;
+    StopWriters = true;
+  } // unlock Mutex
+  // Let the workers receive the messages, that were queued for them, e.g. the
+  // exit notification.
+  OutgoingChanged.notify_all();
+  for (Worker &W : Workers)
+    W.Writer.join();
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    // The workers exit when their input ends.
+    for (Worker &W : Workers)
+      closeFD(W.InputFD);
+  } // unlock Mutex
+  for (Worker &W : Workers)
+    W.Reader.join();
+}
+
+void WorkerPool::run(std::istream &In) {
+  std::vector<char> JSON;
+  while (readMessage(In, Out, JSON)) {
+    StringRef Message(JSON.data(), JSON.size());
+    Out.log("<-- " + Message + "\n");
+    handleClientMessage(Message);
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (ShuttingDown)
+      break;
+  }
+}
+
+unsigned WorkerPool::getWorkerIndex(PathRef File) const {
+  // Files are assigned to workers by hash, so all requests for a file go to
+  // the worker that has its preamble and AST. Unlike llvm::hash_value(),
+  // xxHash64 doesn't depend on a per-execution seed, so a restarted pool
+  // assigns the files in the same way.
+  return llvm::xxHash64(File) % Workers.size();
+}
+
+void WorkerPool::handleClientMessage(StringRef Message) {
+  // The message is forwarded as is, parse a copy of it.
+  std::vector<char> Buffer(Message.begin(), Message.end());
+  llvm::BumpPtrAllocator Alloc;
+  auto Header = parseMessage(Buffer, Alloc);
+  if (!Header || Header->Method.empty()) {
+    // The workers never send requests, so the client never answers them.
+    Out.log("Dropped a message, that is not a request or notification.\n");
+    return;
+  }
+
+  static const json::Value NoParams;
+  const json::Value &Params = Header->Params ? *Header->Params : NoParams;
+  Path File = getDocumentFile(Params);
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  // Remember the state of the client, a restarted worker needs it.
+  if (Header->Method == "initialize") {
+    InitializeParams = serialize(Params);
+  } else if (Header->Method == "shutdown" || Header->Method == "exit") {
+    // The workers exit after either of them.
+    ShuttingDown = true;
+  } else if (Header->Method == "textDocument/didOpen") {
+    if (auto Open = DidOpenTextDocumentParams::parse(Params)) {
+      OpenFile &Opened = OpenFiles[File];
+      Opened.URI = Open->textDocument.uri.uri;
+      Opened.LanguageID = Open->textDocument.languageId;
+      Opened.ExtraFlags.clear();
+      if (Open->metadata)
+        Opened.ExtraFlags = Open->metadata->extraFlags;
+      Drafts.updateDraft(File, Open->textDocument.text);
+    }
+  } else if (Header->Method == "textDocument/didChange") {
+    if (auto Change = DidChangeTextDocumentParams::parse(Params))
+      Drafts.updateDraft(File, Change->contentChanges);
+  } else if (Header->Method == "textDocument/didClose") {
+    OpenFiles.erase(File);
+    Drafts.removeDraft(File);
+  }
+
+  if (File.empty()) {
+    // Messages, that are not about a single document, go to all workers.
+    BroadcastRequest Request;
+    Request.MergeHistograms = Header->Method == "clangd/latencyHistograms";
+    for (unsigned I = 0; I < Workers.size(); ++I)
+      if (Workers[I].InputFD >= 0)
+        Request.Waiting.insert(I);
+    if (!Header->ID.empty()) {
+      if (Request.Waiting.empty()) {
+        Out.writeError(Header->ID, InternalErrorCode,
+                       "No workers are running");
+        return;
+      }
+      std::lock_guard<std::mutex> RequestsLock(RequestsMutex);
+      BroadcastRequests[Header->ID] = Request;
+    }
+    for (unsigned I : Request.Waiting)
+      sendToWorker(I, Message);
+    return;
+  }
+
+  unsigned Index = getWorkerIndex(File);
+  if (Workers[Index].InputFD < 0) {
+    if (!Header->ID.empty())
+      Out.writeError(Header->ID, InternalErrorCode,
+                     "The worker for this file is not running");
+    return;
+  }
+  if (!Header->ID.empty()) {
+    std::lock_guard<std::mutex> RequestsLock(RequestsMutex);
+    PendingRequests[Header->ID] = Index;
+  }
+  sendToWorker(Index, Message);
+}
+
+void WorkerPool::handleWorkerMessage(unsigned Index, StringRef Message) {
+  std::vector<char> Buffer(Message.begin(), Message.end());
+  llvm::BumpPtrAllocator Alloc;
+  auto Header = parseMessage(Buffer, Alloc);
+  if (!Header) {
+    Out.log("Worker " + Twine(Index) + " sent an invalid message.\n");
+    return;
+  }
+
+  // Forward the message while holding the lock, so that the first answer to a
+  // broadcast request is written before the messages that other workers send
+  // after their answer. Mutex is not locked here, the Reader of a crashed
+  // worker holds it while it waits for the process.
+  std::lock_guard<std::mutex> Lock(RequestsMutex);
+  if (Header->Method.empty() && !Header->ID.empty()) {
+    // An answer to a request.
+    if (Header->ID == RestartRequestID)
+      return;
+    auto Broadcast = BroadcastRequests.find(Header->ID);
+    if (Broadcast != BroadcastRequests.end()) {
+      BroadcastRequest &Request = Broadcast->second;
+      Request.Waiting.erase(Index);
+      if (Request.MergeHistograms) {
+        if (Header->Result) {
+          mergeHistograms(*Header->Result, Request.Histograms);
+          Request.Answered = true;
+        }
+        if (!Request.Waiting.empty())
+          return;
+        if (Request.Answered)
+          writeMergedHistograms(Header->ID, Request);
+        else
+          Out.writeMessage(Message); // All workers failed, forward an error.
+        BroadcastRequests.erase(Broadcast);
+        return;
+      }
+      bool IsFirstAnswer = !Request.Answered;
+      Request.Answered = true;
+      if (Request.Waiting.empty())
+        BroadcastRequests.erase(Broadcast);
+      if (!IsFirstAnswer)
+        return;
+    } else {
+      PendingRequests.erase(Header->ID);
+    }
+  }
+  Out.writeMessage(Message);
+}
+
+void WorkerPool::runReader(unsigned Index) {
+  std::string Message;
+  while (true) {
+    int OutputFD;
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      OutputFD = Workers[Index].OutputFD;
+    } // unlock Mutex
+    if (OutputFD < 0)
+      return; // The worker could not be started.
+
+    MessageReader Reader(OutputFD);
+    while (Reader.read(Message))
+      handleWorkerMessage(Index, Message);
+
+    // The worker exited. The restarted worker gets the current state, so the
+    // queued messages are dropped. A pending write fails, now that the worker
+    // is gone, but InputFD must not be closed and reused before.
+    std::unique_lock<std::mutex> Lock(Mutex);
+    Worker &W = Workers[Index];
+    W.Outgoing.clear();
+    OutgoingChanged.wait(Lock, [&W]() { return !W.Writing; });
+    closeFD(W.InputFD);
+    closeFD(W.OutputFD);
+    std::string Status = waitForProcess(W.Pid);
+    W.Pid = -1;
+    if (ShuttingDown)
+      return;
+
+    Out.log("Worker " + Twine(Index) + " exited unexpectedly (" + Status +
+            ").\n");
+    failPendingRequests(Index);
+    if (std::chrono::steady_clock::now() - W.Started < MinWorkerLifetime)
+      ++W.QuickRestarts;
+    else
+      W.QuickRestarts = 0;
+    if (W.QuickRestarts > MaxQuickRestarts) {
+      Out.log("Worker " + Twine(Index) +
+              " keeps exiting, it will not be restarted.\n");
+      return;
+    }
+    if (!startWorker(Index)) {
+      Out.log("Failed to restart worker " + Twine(Index) + ".\n");
+      return;
+    }
+    // The state is queued before any other message, and the worker's answers
+    // are read by this thread while the Writer sends it.
+    restoreWorker(Index);
+  }
+}
+
+void WorkerPool::runWriter(unsigned Index) {
+  Worker &W = Workers[Index];
+  std::unique_lock<std::mutex> Lock(Mutex);
+  while (true) {
+    OutgoingChanged.wait(
+        Lock, [&W, this]() { return !W.Outgoing.empty() || StopWriters; });
+    if (W.Outgoing.empty())
+      return; // The pool is destroyed.
+    std::string Message = std::move(W.Outgoing.front());
+    W.Outgoing.pop_front();
+    int InputFD = W.InputFD;
+    W.Writing = true;
+
+    // The write blocks while the pipe of the worker is full. Mutex is not
+    // held, so the messages for the other workers are still routed.
+    Lock.unlock();
+    bool Written = writeAll(InputFD, Message);
+    Lock.lock();
+
+    W.Writing = false;
+    OutgoingChanged.notify_all();
+    // If the worker crashed, its reader thread restarts it and the new worker
+    // gets the current state, so the message doesn't need to be resent.
+    if (!Written)
+      Out.log("Failed to send a message to worker " + Twine(Index) + ".\n");
+  }
+}
+
+bool WorkerPool::startWorker(unsigned Index) {
+  Worker &W = Workers[Index];
+  if (!spawnProcess(WorkerArgs, MemoryLimit, W.Pid, W.InputFD, W.OutputFD))
+    return false;
+  W.Started = std::chrono::steady_clock::now();
+  return true;
+}
+
+void WorkerPool::restoreWorker(unsigned Index) {
+  if (InitializeParams.empty())
+    return; // The client did not send anything yet.
+  // Bring the new worker to the state of the one it replaces.
+  sendToWorker(Index, (Twine("{\"jsonrpc\":\"2.0\",\"id\":") +
+                       RestartRequestID +
+                       ",\"method\":\"initialize\",\"params\":" +
+                       InitializeParams + "}")
+                          .str());
+  for (const auto &Entry : OpenFiles) {
+    if (getWorkerIndex(Entry.first()) != Index)
+      continue;
+    VersionedDraft Draft = Drafts.getDraft(Entry.first());
+    if (!Draft.Draft)
+      continue;
+    const OpenFile &Opened = Entry.second;
+
+    std::string DidOpen;
+    llvm::raw_string_ostream OS(DidOpen);
+    json::Writer Writer(OS);
+    Writer.objectBegin();
+    Writer.key("jsonrpc");
+    Writer.string("2.0");
+    Writer.key("method");
+    Writer.string("textDocument/didOpen");
+    Writer.key("params");
+    Writer.objectBegin();
+    Writer.key("textDocument");
+    Writer.objectBegin();
+    Writer.key("uri");
+    Writer.string(Opened.URI);
+    Writer.key("languageId");
+    Writer.string(Opened.LanguageID);
+    Writer.key("version");
+    Writer.integer(Draft.Version);
+    Writer.key("text");
+    Writer.string(Draft.Draft->str());
+    Writer.objectEnd();
+    if (!Opened.ExtraFlags.empty()) {
+      Writer.key("metadata");
+      Writer.objectBegin();
+      Writer.key("extraFlags");
+      Writer.arrayBegin();
+      for (const std::string &Flag : Opened.ExtraFlags)
+        Writer.string(Flag);
+      Writer.arrayEnd();
+      Writer.objectEnd();
+    }
+    Writer.objectEnd();
+    Writer.objectEnd();
+    sendToWorker(Index, OS.str());
+  }
+}
+
+void WorkerPool::sendToWorker(unsigned Index, StringRef Message) {
+  Worker &W = Workers[Index];
+  if (W.InputFD < 0)
+    return;
+  W.Outgoing.push_back(makeMessage(Message));
+  OutgoingChanged.notify_all();
+}
+
+void WorkerPool::writeMergedHistograms(StringRef ID,
+                                       const BroadcastRequest &Request) {
+  std::vector<const LatencyHistogram *> Histograms;
+  for (const auto &Entry : Request.Histograms)
+    Histograms.push_back(&Entry.second);
+  std::sort(Histograms.begin(), Histograms.end(),
+            [](const LatencyHistogram *L, const LatencyHistogram *R) {
+              return L->name < R->name;
+            });
+  Out.writeResult(ID, [&](json::Writer &W) {
+    W.arrayBegin();
+    for (const LatencyHistogram *Histogram : Histograms)
+      LatencyHistogram::unparse(W, *Histogram);
+    W.arrayEnd();
+  });
+}
+
+void WorkerPool::failPendingRequests(unsigned Index) {
+  std::lock_guard<std::mutex> Lock(RequestsMutex);
+  for (auto It = PendingRequests.begin(); It != PendingRequests.end();) {
+    auto Current = It++;
+    if (Current->second != Index)
+      continue;
+    Out.writeError(Current->first(), InternalErrorCode,
+                   "The worker process crashed");
+    PendingRequests.erase(Current);
+  }
+  for (auto It = BroadcastRequests.begin(); It != BroadcastRequests.end();) {
+    auto Current = It++;
+    BroadcastRequest &Request = Current->second;
+    Request.Waiting.erase(Index);
+    if (!Request.Waiting.empty())
+      continue;
+    if (Request.MergeHistograms && Request.Answered)
+      writeMergedHistograms(Current->first(), Request);
+    else if (!Request.Answered)
+      Out.writeError(Current->first(), InternalErrorCode,
+                     "The worker process crashed");
+    BroadcastRequests.erase(Current);
+  }
+}
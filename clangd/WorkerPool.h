@@ -0,0 +1,168 @@
+//===--- WorkerPool.h - Runs clangd in worker processes ----------*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+//
+// WorkerPool forwards the messages of an LSP client to a number of clangd
+// worker processes. Each file is handled by one worker, so the preambles and
+// ASTs of a file stay in that worker. A worker that crashes, e.g. because it
+// exceeded its memory limit, only loses the files assigned to it: it is
+// restarted and the open files are sent to the new process.
+//
+//===---------------------------------------------------------------------===//
+
+#ifndef LLVM_CLANG_TOOLS_EXTRA_CLANGD_WORKERPOOL_H
+#define LLVM_CLANG_TOOLS_EXTRA_CLANGD_WORKERPOOL_H
+
+#include "DraftStore.h"
+#include "JSONRPCDispatcher.h"
+#include "Path.h"
+#include "Protocol.h"
+#include "clang/Basic/LLVM.h"
+#include "llvm/ADT/StringMap.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace clang {
+namespace clangd {
+
+class WorkerPool {
+public:
+  /// Returns false if worker processes can't be started on this platform.
+  static bool isSupported();
+
+  /// \p WorkerArgs is the command line of a worker, starting with the path to
+  /// the clangd executable. The address space of each worker is limited to
+  /// \p MemoryLimit bytes, 0 means no limit.
+  WorkerPool(JSONOutput &Out, std::vector<std::string> WorkerArgs,
+             unsigned WorkersCount, std::size_t MemoryLimit);
+  /// Waits for the workers to exit.
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  /// Forwards the messages from \p In to the workers and their answers to the
+  /// client, until the client sends the shutdown request, the exit
+  /// notification or \p In ends.
+  /// \p In must be opened in binary mode.
+  void run(std::istream &In);
+
+private:
+  struct Worker {
+    /// Id of the worker process, -1 if it's not running.
+    int Pid = -1;
+    /// Pipe to the standard input of the worker.
+    int InputFD = -1;
+    /// Pipe from the standard output of the worker.
+    int OutputFD = -1;
+    /// When the process was started.
+    std::chrono::steady_clock::time_point Started;
+    /// Number of times in a row the process exited soon after it was started.
+    unsigned QuickRestarts = 0;
+    /// Messages, that were not written to the worker yet.
+    std::deque<std::string> Outgoing;
+    /// Set while the Writer writes a message to InputFD.
+    bool Writing = false;
+    /// Reads the messages of the worker and restarts it when it exits.
+    std::thread Reader;
+    /// Writes the Outgoing messages to the worker. Writes block until the
+    /// worker reads them, so they must not delay the other workers.
+    std::thread Writer;
+  };
+
+  /// A request, that was sent to all workers. The answers to
+  /// clangd/latencyHistograms are merged. The workers answer the other
+  /// requests in the same way, only the first answer is forwarded to the
+  /// client.
+  struct BroadcastRequest {
+    /// Workers, that did not answer yet.
+    std::set<unsigned> Waiting;
+    bool Answered = false;
+    /// Set for clangd/latencyHistograms, which is answered when all workers
+    /// have answered.
+    bool MergeHistograms = false;
+    /// The histograms of the answers, received so far, by name.
+    llvm::StringMap<LatencyHistogram> Histograms;
+  };
+
+  /// Extension data of an open file, which is needed to reopen it in a
+  /// restarted worker. The contents are stored in Drafts.
+  struct OpenFile {
+    std::string URI;
+    std::string LanguageID;
+    std::vector<std::string> ExtraFlags;
+  };
+
+  /// Returns the index of the worker, that handles \p File.
+  unsigned getWorkerIndex(PathRef File) const;
+  /// Routes a single message of the client.
+  void handleClientMessage(StringRef Message);
+  /// Handles a message, that was written by the worker with \p Index.
+  void handleWorkerMessage(unsigned Index, StringRef Message);
+  /// Runs on the Reader thread of the worker with \p Index.
+  void runReader(unsigned Index);
+  /// Runs on the Writer thread of the worker with \p Index.
+  void runWriter(unsigned Index);
+
+  /// Starts the process of the worker with \p Index. Mutex must be locked.
+  bool startWorker(unsigned Index);
+  /// Sends the initialize request of the client and all of its open files to
+  /// the restarted worker with \p Index. Mutex must be locked.
+  void restoreWorker(unsigned Index);
+  /// Queues \p Message for the worker with \p Index, it is written by the
+  /// Writer thread of the worker. Mutex must be locked.
+  void sendToWorker(unsigned Index, StringRef Message);
+  /// Sends the merged histograms of \p Request to the client.
+  void writeMergedHistograms(StringRef ID, const BroadcastRequest &Request);
+  /// Answers the requests, sent to the worker with \p Index, with errors,
+  /// after it exited. Mutex must be locked.
+  void failPendingRequests(unsigned Index);
+
+  JSONOutput &Out;
+  std::vector<std::string> WorkerArgs;
+  std::size_t MemoryLimit;
+  DraftStore Drafts;
+
+  /// Mutex protects the fields, declared below it up to RequestsMutex.
+  /// WorkerArgs and MemoryLimit are not mutated.
+  std::mutex Mutex;
+  /// Notified when a message is queued for a worker or a Writer finished a
+  /// write.
+  std::condition_variable OutgoingChanged;
+  std::vector<Worker> Workers;
+  /// Set when the pool is destroyed. The Writers exit after writing the queued
+  /// messages.
+  bool StopWriters = false;
+  /// Set when the client sent the shutdown request or the exit notification.
+  /// Workers, that exit after it, are not restarted.
+  bool ShuttingDown = false;
+  /// Params of the initialize request of the client, serialized. Restarted
+  /// workers receive them in their own initialize request.
+  std::string InitializeParams;
+  llvm::StringMap<OpenFile> OpenFiles;
+
+  /// RequestsMutex protects the fields, declared below it. It is locked after
+  /// Mutex, if both are needed.
+  std::mutex RequestsMutex;
+  /// Ids of the requests, sent to a single worker, mapped to its index.
+  llvm::StringMap<unsigned> PendingRequests;
+  llvm::StringMap<BroadcastRequest> BroadcastRequests;
+};
+
+} // namespace clangd
+} // namespace clang
+
+#endif
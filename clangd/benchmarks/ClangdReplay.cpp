@@ -0,0 +1,419 @@
+//===--- ClangdReplay.cpp - Replay recorded LSP sessions ---------*- C++-*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===---------------------------------------------------------------------===//
+//
+// A benchmark that replays a recorded LSP session against ClangdServer and
+// reports the latencies of the requests, the peak memory usage and the
+// throughput.
+//
+// The recording has the same format as the input of clangd: messages with
+// Content-Length headers, lines starting with '#' are ignored. The client's
+// document synchronization, textDocument/completion and
+// textDocument/definition messages are replayed, everything else is ignored.
+// Requests are replayed as soon as the previous one has finished, edits don't
+// wait for the rebuilds they trigger.
+//
+// Files are served from memory, on top of the real file system, which is used
+// for system headers. The replay/addFile notification, which takes the same
+// parameters as textDocument/didOpen, adds a file (e.g. a header) to the
+// in-memory file system without opening it.
+//
+// Reported latencies:
+//   - textDocument/completion and textDocument/definition: the time until the
+//     result is available.
+//   - diagnostics: the time from an edit until the diagnostics of the file,
+//     that include the edit, are available. Edits that were superseded by the
+//     following edits before their rebuild started produce no diagnostics.
+//
+//===---------------------------------------------------------------------===//
+
+#include "ClangdServer.h"
+#include "JSONRPCDispatcher.h"
+#include "ProtocolHandlers.h"
+#include "clang/Basic/VirtualFileSystem.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef LLVM_ON_UNIX
+#include <sys/resource.h>
+#endif
+
+using namespace clang;
+using namespace clang::clangd;
+
+static llvm::cl::opt<std::string>
+    Recording(llvm::cl::Positional, llvm::cl::desc("<recorded LSP session>"),
+              llvm::cl::Required);
+
+static llvm::cl::opt<unsigned>
+    WorkerThreadsCount("j",
+                       llvm::cl::desc("Number of async workers used by clangd"),
+                       llvm::cl::init(getDefaultAsyncThreadsCount()));
+
+static llvm::cl::opt<unsigned>
+    Iterations("iterations",
+               llvm::cl::desc("Number of times the session is replayed, each "
+                              "time with a new ClangdServer"),
+               llvm::cl::init(1));
+
+static llvm::cl::opt<unsigned> CompletionLimit(
+    "completion-limit",
+    llvm::cl::desc("Maximal number of code completion items returned for a "
+                   "request. 0 means no limit"),
+    llvm::cl::init(100));
+
+static llvm::cl::opt<unsigned> UpdateDebounce(
+    "update-debounce",
+    llvm::cl::desc("Maximal delay in milliseconds before a file is rebuilt "
+                   "after an edit"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<bool> CacheFileSystem(
+    "cache-file-system",
+    llvm::cl::desc("Cache file lookups and the contents of headers between "
+                   "rebuilds of a file"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<std::string>
+    ResourceDir("resource-dir",
+                llvm::cl::desc("Directory for system clang headers"),
+                llvm::cl::init(""));
+
+namespace {
+
+/// Latencies of the replayed requests, grouped by kind. Thread-safe.
+class LatencyStats {
+public:
+  void add(StringRef Kind, std::chrono::steady_clock::duration Latency) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Latencies[Kind.str()].push_back(
+        std::chrono::duration<double, std::milli>(Latency).count());
+  }
+
+  void print(llvm::raw_ostream &OS) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    OS << llvm::format("%-26s %8s %10s %10s %10s\n", "", "count", "p50 (ms)",
+                       "p99 (ms)", "max (ms)");
+    for (auto &Kind : Latencies) {
+      std::vector<double> &Values = Kind.second;
+      std::sort(Values.begin(), Values.end());
+      OS << llvm::format("%-26s %8zu %10.1f %10.1f %10.1f\n",
+                         Kind.first.c_str(), Values.size(),
+                         percentile(Values, 50), percentile(Values, 99),
+                         Values.back());
+    }
+  }
+
+private:
+  /// \p Values must be sorted and non-empty.
+  static double percentile(const std::vector<double> &Values, unsigned P) {
+    size_t Rank = (Values.size() * P + 99) / 100;
+    return Values[std::max<size_t>(Rank, 1) - 1];
+  }
+
+  std::mutex Mutex;
+  std::map<std::string, std::vector<double>> Latencies;
+};
+
+/// Serves the files of the recording from memory. The file system is tagged
+/// with the number of the edit, for which it is requested, so that the
+/// diagnostics can be matched with the edit they belong to.
+class ReplayFSProvider : public FileSystemProvider {
+public:
+  ReplayFSProvider() : Files(new vfs::InMemoryFileSystem) {}
+
+  /// Adds \p File to the in-memory file system. Requests, that are already
+  /// running, keep using the previous version of the file system.
+  void addFile(PathRef File, StringRef Contents) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    FileContents[File.str()] = Contents.str();
+    IntrusiveRefCntPtr<vfs::InMemoryFileSystem> NewFiles(
+        new vfs::InMemoryFileSystem);
+    for (const auto &Entry : FileContents)
+      NewFiles->addFile(Entry.first, 0,
+                        llvm::MemoryBuffer::getMemBufferCopy(Entry.second,
+                                                             Entry.first));
+    Files = std::move(NewFiles);
+  }
+
+  /// The file systems returned after this call are tagged with \p Edit.
+  void setEdit(unsigned Edit) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Tag = std::to_string(Edit);
+  }
+
+  Tagged<IntrusiveRefCntPtr<vfs::FileSystem>>
+  getTaggedFileSystem(PathRef File) override {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    IntrusiveRefCntPtr<vfs::OverlayFileSystem> FS(
+        new vfs::OverlayFileSystem(vfs::getRealFileSystem()));
+    FS->pushOverlay(Files);
+    return make_tagged(IntrusiveRefCntPtr<vfs::FileSystem>(FS), Tag);
+  }
+
+private:
+  std::mutex Mutex;
+  std::map<std::string, std::string> FileContents;
+  IntrusiveRefCntPtr<vfs::InMemoryFileSystem> Files;
+  VFSTag Tag;
+};
+
+/// Measures the time from an edit until its diagnostics are ready.
+class ReplayDiagConsumer : public DiagnosticsConsumer {
+public:
+  ReplayDiagConsumer(LatencyStats &Stats) : Stats(Stats) {}
+
+  void editStarted(unsigned Edit) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    PendingEdits[std::to_string(Edit)] = std::chrono::steady_clock::now();
+  }
+
+  void onDiagnosticsReady(
+      PathRef File, Tagged<std::vector<DiagWithFixIts>> Diagnostics) override {
+    auto Now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto It = PendingEdits.find(Diagnostics.Tag);
+    if (It == PendingEdits.end())
+      return;
+    Stats.add("diagnostics", Now - It->second);
+    PendingEdits.erase(It);
+  }
+
+  /// Returns the number of edits, for which no diagnostics were produced.
+  size_t getSupersededEdits() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return PendingEdits.size();
+  }
+
+private:
+  LatencyStats &Stats;
+  std::mutex Mutex;
+  std::map<VFSTag, std::chrono::steady_clock::time_point> PendingEdits;
+};
+
+/// Replays the messages of the recording against a ClangdServer.
+class ReplayCallbacks : public ProtocolCallbacks {
+public:
+  ReplayCallbacks(ReplayFSProvider &FSProvider, LatencyStats &Stats,
+                  bool &IsDone, llvm::Optional<StringRef> ResourceDir)
+      : FSProvider(FSProvider), Stats(Stats), IsDone(IsDone),
+        DiagConsumer(Stats),
+        Server(CDB, DiagConsumer, FSProvider, WorkerThreadsCount,
+               /*SnippetCompletions=*/false, ResourceDir,
+               /*ASTMemoryBudget=*/0, /*BuildIndex=*/false, CompletionLimit,
+               std::chrono::milliseconds(UpdateDebounce), CacheFileSystem) {}
+
+  /// Waits until the rebuilds of all the edits have finished.
+  void waitForRebuilds() {
+    for (auto &Rebuild : Rebuilds)
+      Rebuild.wait();
+    Rebuilds.clear();
+  }
+
+  size_t getSupersededEdits() { return DiagConsumer.getSupersededEdits(); }
+
+  /// Returns the number of replayed edits and requests.
+  size_t getReplayedMessages() const { return ReplayedMessages; }
+
+  void onInitialize(StringRef ID, JSONOutput &Out) override {}
+  void onShutdown(JSONOutput &Out) override { IsDone = true; }
+
+  void onDocumentDidOpen(DidOpenTextDocumentParams Params,
+                         JSONOutput &Out) override {
+    if (Params.metadata && !Params.metadata->extraFlags.empty())
+      CDB.setExtraFlagsForFile(Params.textDocument.uri.file,
+                               std::move(Params.metadata->extraFlags));
+    ++ReplayedMessages;
+    startEdit();
+    Rebuilds.push_back(Server.addDocument(Params.textDocument.uri.file,
+                                          Params.textDocument.text));
+  }
+
+  void onDocumentDidChange(DidChangeTextDocumentParams Params,
+                           JSONOutput &Out) override {
+    ++ReplayedMessages;
+    startEdit();
+    auto Rebuild = Server.updateDocument(Params.textDocument.uri.file,
+                                         Params.contentChanges);
+    if (!Rebuild) {
+      llvm::errs() << "Failed to apply changes to "
+                   << Params.textDocument.uri.file << "\n";
+      return;
+    }
+    Rebuilds.push_back(std::move(*Rebuild));
+  }
+
+  void onDocumentDidClose(DidCloseTextDocumentParams Params,
+                          JSONOutput &Out) override {
+    ++ReplayedMessages;
+    Rebuilds.push_back(Server.removeDocument(Params.textDocument.uri.file));
+  }
+
+  void onFileEvent(DidChangeWatchedFilesParams Params,
+                   JSONOutput &Out) override {}
+
+  void onCompletion(TextDocumentPositionParams Params, StringRef ID,
+                    JSONOutput &Out) override {
+    ++ReplayedMessages;
+    auto Start = std::chrono::steady_clock::now();
+    std::promise<void> Done;
+    Server.codeComplete(
+        Params.textDocument.uri.file,
+        Position{Params.position.line, Params.position.character},
+        CancellationToken(),
+        [&Done](Tagged<CompletionList> Items) { Done.set_value(); });
+    Done.get_future().wait();
+    Stats.add("textDocument/completion",
+              std::chrono::steady_clock::now() - Start);
+  }
+
+  void onGoToDefinition(TextDocumentPositionParams Params, StringRef ID,
+                        JSONOutput &Out) override {
+    ++ReplayedMessages;
+    auto Start = std::chrono::steady_clock::now();
+    Server.findDefinitions(
+        Params.textDocument.uri.file,
+        Position{Params.position.line, Params.position.character});
+    Stats.add("textDocument/definition",
+              std::chrono::steady_clock::now() - Start);
+  }
+
+  void onDocumentFormatting(DocumentFormattingParams Params, StringRef ID,
+                            JSONOutput &Out) override {}
+  void onDocumentOnTypeFormatting(DocumentOnTypeFormattingParams Params,
+                                  StringRef ID, JSONOutput &Out) override {}
+  void onDocumentRangeFormatting(DocumentRangeFormattingParams Params,
+                                 StringRef ID, JSONOutput &Out) override {}
+  void onCodeAction(CodeActionParams Params, StringRef ID,
+                    JSONOutput &Out) override {}
+  void onMemoryUsage(MemoryUsageParams Params, StringRef ID,
+                     JSONOutput &Out) override {}
+  void onLatencyHistograms(StringRef ID, JSONOutput &Out) override {}
+  void onCancelRequest(CancelParams Params, JSONOutput &Out) override {}
+
+private:
+  void startEdit() {
+    ++Edits;
+    FSProvider.setEdit(Edits);
+    DiagConsumer.editStarted(Edits);
+  }
+
+  ReplayFSProvider &FSProvider;
+  LatencyStats &Stats;
+  bool &IsDone;
+  unsigned Edits = 0;
+  size_t ReplayedMessages = 0;
+  std::vector<std::future<void>> Rebuilds;
+
+  DirectoryBasedGlobalCompilationDatabase CDB;
+  ReplayDiagConsumer DiagConsumer;
+  // Server must be the last member, its destructor waits for the worker
+  // threads, which might call into DiagConsumer.
+  ClangdServer Server;
+};
+
+/// Handles the replay/addFile notification.
+struct AddFileHandler : Handler {
+  AddFileHandler(JSONOutput &Output, ReplayFSProvider &FSProvider)
+      : Handler(Output), FSProvider(FSProvider) {}
+
+  void handleNotification(const json::Value &Params) override {
+    auto DOTDP = DidOpenTextDocumentParams::parse(Params);
+    if (!DOTDP) {
+      llvm::errs() << "Failed to decode replay/addFile params!\n";
+      return;
+    }
+    FSProvider.addFile(DOTDP->textDocument.uri.file, DOTDP->textDocument.text);
+  }
+
+private:
+  ReplayFSProvider &FSProvider;
+};
+
+/// Returns the peak resident set size of the process in bytes, or 0 if it is
+/// not known.
+uint64_t getPeakRSS() {
+#ifdef LLVM_ON_UNIX
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return Usage.ru_maxrss;
+#else
+  return uint64_t(Usage.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  llvm::cl::ParseCommandLineOptions(argc, argv, "clangd replay benchmark");
+
+  if (WorkerThreadsCount == 0) {
+    llvm::errs() << "A number of worker threads cannot be 0.\n";
+    return 1;
+  }
+
+  llvm::Optional<StringRef> ResourceDirRef = None;
+  if (!ResourceDir.empty())
+    ResourceDirRef = ResourceDir;
+
+  LatencyStats Stats;
+  size_t ReplayedMessages = 0;
+  size_t SupersededEdits = 0;
+  auto Start = std::chrono::steady_clock::now();
+  for (unsigned I = 0; I < Iterations; ++I) {
+    std::ifstream In(Recording, std::ios::binary);
+    if (!In) {
+      llvm::errs() << "Cannot open " << Recording << "\n";
+      return 1;
+    }
+
+    // Replies are not needed, the latencies are measured by the callbacks.
+    JSONOutput Out(llvm::nulls(), llvm::nulls());
+    ReplayFSProvider FSProvider;
+    bool IsDone = false;
+    ReplayCallbacks Callbacks(FSProvider, Stats, IsDone, ResourceDirRef);
+    JSONRPCDispatcher Dispatcher(llvm::make_unique<Handler>(Out));
+    regiterCallbackHandlers(Dispatcher, Out, Callbacks);
+    Dispatcher.registerHandler(
+        "replay/addFile", llvm::make_unique<AddFileHandler>(Out, FSProvider));
+
+    runLanguageServerLoop(In, Out, Dispatcher, IsDone);
+    Callbacks.waitForRebuilds();
+    ReplayedMessages += Callbacks.getReplayedMessages();
+    SupersededEdits += Callbacks.getSupersededEdits();
+  }
+  std::chrono::duration<double> Elapsed =
+      std::chrono::steady_clock::now() - Start;
+
+  llvm::raw_ostream &OS = llvm::outs();
+  Stats.print(OS);
+  OS << "\nreplayed messages: " << ReplayedMessages << "\n";
+  OS << "superseded edits: " << SupersededEdits << "\n";
+  OS << llvm::format("wall time: %.2f s\n", Elapsed.count());
+  OS << llvm::format("throughput: %.1f messages/s\n",
+                     ReplayedMessages / Elapsed.count());
+  OS << "peak RSS: " << getPeakRSS() / (1024 * 1024) << " MB\n";
+  return 0;
+}
@@ -9,10 +9,13 @@
 
 #include "ClangdLSPServer.h"
 #include "JSONRPCDispatcher.h"
+#include "Trace.h"
+#include "WorkerPool.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Program.h"
 
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -42,6 +45,72 @@ static llvm::cl::opt<std::string>
                 llvm::cl::desc("Directory for system clang headers"),
                 llvm::cl::init(""), llvm::cl::Hidden);
 
+static llvm::cl::opt<unsigned> ASTMemoryBudget(
+    "ast-memory-budget",
+    llvm::cl::desc("Maximal total size of ASTs and completion preambles of "
+                   "open files in megabytes. Those of the least recently used "
+                   "files are dropped when it is exceeded. 0 means no limit"),
+    llvm::cl::init(4096));
+
+static llvm::cl::opt<bool> BackgroundIndex(
+    "background-index",
+    llvm::cl::desc("Index all files from the compilation database in the "
+                   "background to find definitions across translation units"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> CompletionLimit(
+    "completion-limit",
+    llvm::cl::desc("Maximal number of code completion items returned for a "
+                   "request. The best matching items are returned. 0 means "
+                   "no limit"),
+    llvm::cl::init(100));
+
+static llvm::cl::opt<unsigned> UpdateDebounce(
+    "update-debounce",
+    llvm::cl::desc("Maximal delay in milliseconds before a file is rebuilt "
+                   "after an edit. Edits made during the delay are handled by "
+                   "a single rebuild. The actual delay adapts to the time it "
+                   "takes to rebuild the file. 0 means no delay"),
+    llvm::cl::init(500));
+
+static llvm::cl::opt<bool> CacheFileSystem(
+    "cache-file-system",
+    llvm::cl::desc("Cache file lookups and the contents of headers between "
+                   "rebuilds of all files. Changes to headers are only noticed "
+                   "if the client reports them with "
+                   "workspace/didChangeWatchedFiles"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> WorkerProcesses(
+    "worker-processes",
+    llvm::cl::desc("Number of clangd processes, that the files are "
+                   "distributed to. A crash of a process only affects its "
+                   "files, the process is restarted. 0 means that the files "
+                   "are handled in this process"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<unsigned> WorkerMemoryLimit(
+    "worker-memory-limit",
+    llvm::cl::desc("Maximal size of the address space of each worker process "
+                   "in megabytes. 0 means no limit. Only used with "
+                   "-worker-processes"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<std::string> TraceFile(
+    "trace",
+    llvm::cl::desc("Write a trace of the requests to the given file, in the "
+                   "Chrome trace-event format (see chrome://tracing)"),
+    llvm::cl::init(""), llvm::cl::Hidden);
+
+/// Returns true if \p Arg is an option of the worker pool, that must not be
+/// passed to the workers.
+static bool isWorkerPoolArg(StringRef Arg) {
+  StringRef Name = Arg.ltrim('-').split('=').first;
+  return Arg.startswith("-") &&
+         (Name == "worker-processes" || Name == "worker-memory-limit" ||
+          Name == "trace");
+}
+
 int main(int argc, char *argv[]) {
   llvm::cl::ParseCommandLineOptions(argc, argv, "clangd");
 
@@ -60,14 +129,59 @@ int main(int argc, char *argv[]) {
   llvm::raw_ostream &Logs = llvm::errs();
   JSONOutput Out(Outs, Logs);
 
+  llvm::Optional<llvm::raw_fd_ostream> TraceStream;
+  std::unique_ptr<trace::Session> TraceSession;
+  if (!TraceFile.empty()) {
+    std::error_code EC;
+    TraceStream.emplace(TraceFile, /*ref*/ EC, llvm::sys::fs::F_None);
+    if (EC) {
+      TraceStream.reset();
+      Logs << "Error while opening trace file " << TraceFile << ": "
+           << EC.message() << "\n";
+    } else {
+      TraceSession = trace::Session::create(*TraceStream);
+    }
+  }
+
   // Change stdin to binary to not lose \r\n on windows.
   llvm::sys::ChangeStdinToBinary();
 
+  if (WorkerProcesses > 0) {
+    if (!WorkerPool::isSupported()) {
+      llvm::errs() << "-worker-processes is not supported on this platform.\n";
+      return 1;
+    }
+    // The workers run this executable with the same options, except for the
+    // ones of the pool. Only the pool writes the trace.
+    std::vector<std::string> WorkerArgs;
+    WorkerArgs.push_back(
+        llvm::sys::fs::getMainExecutable(argv[0], (void *)&main));
+    for (int I = 1; I < argc; ++I) {
+      StringRef Arg = argv[I];
+      if (!isWorkerPoolArg(Arg)) {
+        WorkerArgs.push_back(Arg.str());
+        continue;
+      }
+      // Skip the value, if it's passed as a separate argument.
+      if (!Arg.contains('='))
+        ++I;
+    }
+
+    WorkerPool Pool(Out, std::move(WorkerArgs), WorkerProcesses,
+                    std::size_t(WorkerMemoryLimit) * 1024 * 1024);
+    Pool.run(std::cin);
+    return 0;
+  }
+
   llvm::Optional<StringRef> ResourceDirRef = None;
   if (!ResourceDir.empty())
     ResourceDirRef = ResourceDir;
 
   ClangdLSPServer LSPServer(Out, WorkerThreadsCount, EnableSnippets,
-                            ResourceDirRef);
+                            ResourceDirRef,
+                            std::size_t(ASTMemoryBudget) * 1024 * 1024,
+                            BackgroundIndex, CompletionLimit,
+                            std::chrono::milliseconds(UpdateDebounce),
+                            CacheFileSystem);
   LSPServer.run(std::cin);
 }
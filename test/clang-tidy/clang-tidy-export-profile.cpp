@@ -0,0 +1,23 @@
+// RUN: clang-tidy %s -checks='-*,modernize-use-nullptr' -export-profile=%t.json -- > /dev/null
+// RUN: FileCheck -input-file=%t.json %s
+
+int *P = 0;
+
+// CHECK: "phases": {
+// CHECK-NEXT: "fixes": {"wall": {{.*}}, "user": {{.*}}, "system": {{.*}}}
+// CHECK-NEXT: "matching": {"wall":
+// CHECK-NEXT: "parse": {"wall":
+// CHECK-NEXT: "report": {"wall":
+// CHECK-NEXT: "setup": {"wall":
+// CHECK-NEXT: },
+// CHECK-NEXT: "checks": {
+// CHECK-NEXT: "modernize-use-nullptr": {"wall": {{.*}}, "matches": {{[1-9][0-9]*}}}
+// CHECK-NEXT: },
+// CHECK-NEXT: "translation-units": [
+// CHECK-NEXT: {"file": "{{.*}}clang-tidy-export-profile.cpp", "total": {"wall":
+// CHECK-NEXT: "phases": {
+// CHECK-NEXT: "matching": {"wall":
+// CHECK-NEXT: "parse": {"wall":
+// CHECK-NEXT: "setup": {"wall":
+// CHECK-NEXT: }}
+// CHECK-NEXT: ]
@@ -0,0 +1,38 @@
+// RUN: rm -rf %T/result-cache
+// RUN: mkdir -p %T/result-cache/cache
+// RUN: echo 'int *H = 0;' > %T/result-cache/header.h
+// RUN: echo '#include "header.h"' > %T/result-cache/main.cpp
+// RUN: echo 'int *M = 0;' >> %T/result-cache/main.cpp
+// RUN: clang-tidy -checks=-*,modernize-use-nullptr -header-filter=.* -cache-dir=%T/result-cache/cache %T/result-cache/main.cpp -- 2>&1 | FileCheck %s -check-prefix=CHECK-RUN
+// Change the cached results, to see that they are used.
+// RUN: sed -i 's/use nullptr/use cached nullptr/' %T/result-cache/cache/*.yaml
+// RUN: clang-tidy -checks=-*,modernize-use-nullptr -header-filter=.* -cache-dir=%T/result-cache/cache %T/result-cache/main.cpp -- 2>&1 | FileCheck %s -check-prefix=CHECK-CACHED
+// Changing the options or a header invalidates the cached results.
+// RUN: clang-tidy -checks=-*,modernize-use-nullptr -cache-dir=%T/result-cache/cache %T/result-cache/main.cpp -- 2>&1 | FileCheck %s -check-prefix=CHECK-OPTIONS
+// RUN: echo 'int *H2 = 0;' >> %T/result-cache/header.h
+// RUN: clang-tidy -checks=-*,modernize-use-nullptr -header-filter=.* -cache-dir=%T/result-cache/cache %T/result-cache/main.cpp -- 2>&1 | FileCheck %s -check-prefix=CHECK-HEADER
+// A new header, that shadows an included one, invalidates the cached results.
+// RUN: mkdir -p %T/result-cache/include
+// RUN: echo '#include <shadowed.h>' > %T/result-cache/shadow.cpp
+// RUN: echo 'int *S = 0;' > %T/result-cache/shadowed.h
+// RUN: clang-tidy -checks=-*,modernize-use-nullptr -header-filter=.* -cache-dir=%T/result-cache/cache %T/result-cache/shadow.cpp -- -I%T/result-cache/include -I%T/result-cache 2>&1 | FileCheck %s -check-prefix=CHECK-SHADOWED
+// RUN: echo 'int *I = 0;' > %T/result-cache/include/shadowed.h
+// RUN: clang-tidy -checks=-*,modernize-use-nullptr -header-filter=.* -cache-dir=%T/result-cache/cache %T/result-cache/shadow.cpp -- -I%T/result-cache/include -I%T/result-cache 2>&1 | FileCheck %s -check-prefix=CHECK-SHADOWING
+
+// CHECK-RUN: header.h:1:10: warning: use nullptr
+// CHECK-RUN: main.cpp:2:10: warning: use nullptr
+
+// CHECK-CACHED: header.h:1:10: warning: use cached nullptr
+// CHECK-CACHED: main.cpp:2:10: warning: use cached nullptr
+
+// CHECK-OPTIONS-NOT: header.h
+// CHECK-OPTIONS: main.cpp:2:10: warning: use nullptr
+
+// CHECK-HEADER: header.h:1:10: warning: use nullptr
+// CHECK-HEADER: header.h:2:11: warning: use nullptr
+// CHECK-HEADER: main.cpp:2:10: warning: use nullptr
+
+// CHECK-SHADOWED-NOT: include{{[/\\]}}shadowed.h
+// CHECK-SHADOWED: result-cache{{[/\\]}}shadowed.h:1:10: warning: use nullptr
+
+// CHECK-SHADOWING: include{{[/\\]}}shadowed.h:1:10: warning: use nullptr
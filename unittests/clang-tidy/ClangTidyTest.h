@@ -12,6 +12,7 @@
 
 #include "ClangTidy.h"
 #include "ClangTidyDiagnosticConsumer.h"
+#include "NamedCallMatcher.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
@@ -41,13 +42,16 @@ private:
 
     for (auto &Check : Checks) {
       Check->registerMatchers(&Finder);
+      Check->registerNamedCallMatchers(Calls);
       Check->registerPPCallbacks(Compiler);
     }
+    Calls.registerMatchers(Finder);
     return Finder.newASTConsumer();
   }
 
   SmallVectorImpl<std::unique_ptr<ClangTidyCheck>> &Checks;
   ast_matchers::MatchFinder &Finder;
+  NamedCallMatcher Calls;
   ClangTidyContext &Context;
 };
 
@@ -0,0 +1,75 @@
+#include "ClangTidyTest.h"
+#include "NamedCallMatcher.h"
+#include "gtest/gtest.h"
+
+namespace clang {
+namespace tidy {
+namespace test {
+
+using namespace ast_matchers;
+
+class NamedCallCheck : public ClangTidyCheck {
+public:
+  NamedCallCheck(StringRef Name, ClangTidyContext *Context)
+      : ClangTidyCheck(Name, Context) {}
+  void registerNamedCallMatchers(NamedCallMatcher &Calls) override {
+    Calls.addMatcher({"::f", "ns::g", "h", "::h"}, callExpr().bind("call"),
+                     this);
+    Calls.addMatcher({"::f"}, callExpr(argumentCountIs(1)).bind("unary"),
+                     this);
+  }
+  void check(const MatchFinder::MatchResult &Result) override {
+    if (const auto *Call = Result.Nodes.getNodeAs<CallExpr>("unary"))
+      diag(Call->getLocStart(), "unary call to %0") << Call->getDirectCallee();
+    else if (const auto *Call = Result.Nodes.getNodeAs<CallExpr>("call"))
+      diag(Call->getLocStart(), "call to %0 (match %1)")
+          << Call->getDirectCallee() << ++Matches;
+  }
+
+  static unsigned Matches;
+};
+
+unsigned NamedCallCheck::Matches = 0;
+
+std::vector<std::string> runNamedCallCheck(StringRef Code) {
+  std::vector<ClangTidyError> Errors;
+  NamedCallCheck::Matches = 0;
+  runCheckOnCode<NamedCallCheck>(Code, &Errors);
+  std::vector<std::string> Messages;
+  for (const ClangTidyError &Error : Errors)
+    Messages.push_back(Error.Message.Message);
+  return Messages;
+}
+
+TEST(NamedCallMatcherTest, MatchesNamesLikeHasName) {
+  EXPECT_EQ(runNamedCallCheck("void f(); void g() { f(); }"),
+            std::vector<std::string>{"call to 'f' (match 1)"});
+  // "::f" is fully qualified.
+  EXPECT_TRUE(runNamedCallCheck("namespace a { void f(); void g() { f(); } }")
+                  .empty());
+  // "ns::g" matches the end of the qualified name.
+  EXPECT_EQ(runNamedCallCheck("namespace a { namespace ns { void g(); } }\n"
+                              "void f(int); void h() { a::ns::g(); }"),
+            std::vector<std::string>{"call to 'g' (match 1)"});
+  EXPECT_TRUE(runNamedCallCheck("namespace xns { void g(); }\n"
+                                "void k() { xns::g(); }")
+                  .empty());
+  // Inline namespaces are not written in the names.
+  EXPECT_EQ(runNamedCallCheck("namespace ns { inline namespace v1 { void g(); }"
+                              " }\nvoid k() { ns::g(); }"),
+            std::vector<std::string>{"call to 'g' (match 1)"});
+}
+
+TEST(NamedCallMatcherTest, RunsEachMatcherOnce) {
+  // "h" and "::h" both match, the first matcher still runs only once. Both
+  // matchers run for f(1).
+  EXPECT_EQ(runNamedCallCheck("void h(); void f(int);\n"
+                              "void k() { h(); f(1); }"),
+            (std::vector<std::string>{"call to 'h' (match 1)",
+                                      "call to 'f' (match 2)",
+                                      "unary call to 'f'"}));
+}
+
+} // namespace test
+} // namespace tidy
+} // namespace clang
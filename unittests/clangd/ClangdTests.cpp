@@ -8,11 +8,14 @@
 //===----------------------------------------------------------------------===//
 
 #include "ClangdServer.h"
+#include "Trace.h"
 #include "clang/Basic/VirtualFileSystem.h"
 #include "clang/Config/config.h"
+#include "clang/Frontend/PCHContainerOperations.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/Support/Errc.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Regex.h"
 #include "gtest/gtest.h"
@@ -199,7 +202,17 @@ public:
                                     CommandLine, "")};
   }
 
+  std::vector<Path> getAllFiles() override {
+    ++GetAllFilesCalls;
+    return AllFiles;
+  }
+
+  unsigned getAllFilesGeneration() override { return AllFilesGeneration; }
+
   std::vector<std::string> ExtraClangFlags;
+  std::vector<Path> AllFiles;
+  unsigned AllFilesGeneration = 0;
+  unsigned GetAllFilesCalls = 0;
 };
 
 IntrusiveRefCntPtr<vfs::FileSystem>
@@ -451,6 +464,430 @@ int b = a;
   EXPECT_NE(DumpParse1, DumpParseDifferent);
 }
 
+TEST_F(ClangdVFSTest, ReparseIncludersOnFilesChanged) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+
+  ClangdServer Server(CDB, DiagConsumer, FS, getDefaultAsyncThreadsCount(),
+                      /*SnippetCompletions=*/false);
+
+  const auto FooContents = R"cpp(
+#include "foo.h"
+int b = a;
+)cpp";
+  const auto BarContents = "int c;";
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto FooH = getVirtualTestFilePath("foo.h");
+  auto BarCpp = getVirtualTestFilePath("bar.cpp");
+
+  FS.Files[FooH] = "int a;";
+  FS.Files[FooCpp] = FooContents;
+  FS.Files[BarCpp] = BarContents;
+
+  auto BarFuture = Server.addDocument(BarCpp, BarContents);
+  auto FooFuture = Server.addDocument(FooCpp, FooContents);
+  ASSERT_EQ(BarFuture.wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  ASSERT_EQ(FooFuture.wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  EXPECT_FALSE(DiagConsumer.hadErrorInLastDiags());
+
+  // Only foo.cpp includes foo.h, so bar.cpp must not be rebuilt.
+  FS.Files[FooH] = "";
+  auto Reparses = Server.onFilesChanged(Path(FooH.str()));
+  ASSERT_EQ(Reparses.size(), 1u);
+  ASSERT_EQ(Reparses.front().wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  EXPECT_TRUE(DiagConsumer.hadErrorInLastDiags());
+
+  // Files, that are not included by any opened file, do not cause reparses.
+  auto BazH = getVirtualTestFilePath("baz.h");
+  EXPECT_TRUE(Server.onFilesChanged(Path(BazH.str())).empty());
+}
+
+TEST_F(ClangdVFSTest, CachedFileSystem) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+
+  ClangdServer Server(CDB, DiagConsumer, FS, getDefaultAsyncThreadsCount(),
+                      /*SnippetCompletions=*/false, /*ResourceDir=*/llvm::None,
+                      /*ASTMemoryBudget=*/0, /*BuildIndex=*/false,
+                      /*CompletionLimit=*/0,
+                      std::chrono::steady_clock::duration::zero(),
+                      /*CacheFileSystem=*/true);
+
+  const auto SourceContents = R"cpp(
+#include "foo.h"
+int b = a;
+)cpp";
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto FooH = getVirtualTestFilePath("foo.h");
+
+  FS.Files[FooH] = "int a;";
+  FS.Files[FooCpp] = SourceContents;
+
+  auto ParseFuture = Server.addDocument(FooCpp, SourceContents);
+  ASSERT_EQ(ParseFuture.wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  EXPECT_FALSE(DiagConsumer.hadErrorInLastDiags());
+
+  // The change is not noticed until it's reported, the cached foo.h is used.
+  FS.Files[FooH] = "";
+  ParseFuture = Server.addDocument(FooCpp, SourceContents);
+  ASSERT_EQ(ParseFuture.wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  EXPECT_FALSE(DiagConsumer.hadErrorInLastDiags());
+
+  // The cache is shared by all files, so other files see the cached foo.h too.
+  auto BarCpp = getVirtualTestFilePath("bar.cpp");
+  FS.Files[BarCpp] = SourceContents;
+  ParseFuture = Server.addDocument(BarCpp, SourceContents);
+  ASSERT_EQ(ParseFuture.wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  EXPECT_FALSE(DiagConsumer.hadErrorInLastDiags());
+  Server.removeDocument(BarCpp);
+
+  auto Reparses = Server.onFilesChanged(Path(FooH.str()));
+  ASSERT_EQ(Reparses.size(), 1u);
+  ASSERT_EQ(Reparses.front().wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  EXPECT_TRUE(DiagConsumer.hadErrorInLastDiags());
+}
+
+TEST_F(ClangdVFSTest, ReparseWithOldPreambleWhenIncludeIsAdded) {
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  auto PCHs = std::make_shared<PCHContainerOperations>();
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto FooH = getVirtualTestFilePath("foo.h");
+  auto BarH = getVirtualTestFilePath("bar.h");
+  llvm::StringMap<std::string> Files;
+  Files[FooH] = "int a;";
+  Files[BarH] = "int c;";
+  auto Command = CDB.getCompileCommands(FooCpp).front();
+
+  const auto SourceContents1 = R"cpp(
+#include "foo.h"
+int b = a;
+)cpp";
+  // Starts with the preamble of SourceContents1, so the AST is built with the
+  // old preamble while the new one is built in the background.
+  const auto SourceContents2 = R"cpp(
+#include "foo.h"
+#include "bar.h"
+int b = a + c;
+)cpp";
+
+  auto File = CppFile::Create(FooCpp, Command, PCHs);
+  std::vector<std::function<void()>> BackgroundTasks;
+  auto RunInBackground = [&BackgroundTasks](std::function<void()> Task) {
+    BackgroundTasks.push_back(std::move(Task));
+  };
+  auto Rebuild = [&](StringRef Contents) {
+    std::string ContentsStr = Contents.str();
+    return File->deferRebuild([ContentsStr]() { return ContentsStr; },
+                              buildTestFS(Files), /*OnPreambleDiags=*/nullptr,
+                              RunInBackground)
+        .get();
+  };
+
+  auto Diags = Rebuild(SourceContents1);
+  ASSERT_TRUE(Diags);
+  EXPECT_FALSE(diagsContainErrors(*Diags));
+  EXPECT_TRUE(BackgroundTasks.empty());
+  auto OldPreamble = File->getPreamble().get();
+  ASSERT_TRUE(OldPreamble);
+
+  Diags = Rebuild(SourceContents2);
+  ASSERT_TRUE(Diags);
+  EXPECT_FALSE(diagsContainErrors(*Diags));
+  EXPECT_EQ(File->getPreamble().get(), OldPreamble);
+  ASSERT_EQ(BackgroundTasks.size(), 1u);
+  BackgroundTasks.front()();
+  BackgroundTasks.clear();
+  auto NewPreamble = File->getPossiblyStalePreamble();
+  ASSERT_TRUE(NewPreamble);
+  EXPECT_NE(NewPreamble, OldPreamble);
+
+  // The next rebuild uses the preamble that was built in the background.
+  Diags = Rebuild(SourceContents2);
+  ASSERT_TRUE(Diags);
+  EXPECT_FALSE(diagsContainErrors(*Diags));
+  EXPECT_EQ(File->getPreamble().get(), NewPreamble);
+  EXPECT_TRUE(BackgroundTasks.empty());
+
+  // The background build does nothing if another rebuild was requested before
+  // it started.
+  Diags = Rebuild(SourceContents1);
+  ASSERT_TRUE(Diags);
+  Diags = Rebuild(SourceContents2);
+  ASSERT_TRUE(Diags);
+  ASSERT_EQ(BackgroundTasks.size(), 1u);
+  auto Preamble = File->getPossiblyStalePreamble();
+  Rebuild(SourceContents2);
+  BackgroundTasks.front()();
+  EXPECT_EQ(File->getPossiblyStalePreamble(), Preamble);
+}
+
+TEST_F(ClangdVFSTest, PreambleDiagnosticsAreReportedBeforeAST) {
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  auto PCHs = std::make_shared<PCHContainerOperations>();
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto FooH = getVirtualTestFilePath("foo.h");
+  llvm::StringMap<std::string> Files;
+  Files[FooH] = "int a;";
+  auto Command = CDB.getCompileCommands(FooCpp).front();
+
+  const auto SourceContents = R"cpp(
+#include "foo.h"
+#error "in the preamble"
+int b = a;
+)cpp";
+
+  std::vector<DiagWithFixIts> PreambleDiags;
+  auto File = CppFile::Create(FooCpp, Command, PCHs);
+  auto Diags =
+      File->deferRebuild([&]() { return std::string(SourceContents); },
+                         buildTestFS(Files),
+                         [&](std::vector<DiagWithFixIts> NewDiags) {
+                           // The AST isn't built yet.
+                           EXPECT_NE(File->getAST().wait_for(
+                                         std::chrono::seconds(0)),
+                                     std::future_status::ready);
+                           PreambleDiags = std::move(NewDiags);
+                         })
+          .get();
+  ASSERT_TRUE(Diags);
+  EXPECT_TRUE(diagsContainErrors(PreambleDiags));
+  EXPECT_TRUE(diagsContainErrors(*Diags));
+}
+
+TEST_F(ClangdVFSTest, PreambleCacheOutlivesFiles) {
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  auto PCHs = std::make_shared<PCHContainerOperations>();
+  auto Preambles = std::make_shared<PreambleCache>();
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto FooH = getVirtualTestFilePath("foo.h");
+  llvm::StringMap<std::string> Files;
+  Files[FooH] = "int a;";
+  auto Command = CDB.getCompileCommands(FooCpp).front();
+
+  const auto SourceContents = R"cpp(
+#include "foo.h"
+int b = a;
+)cpp";
+
+  auto File = CppFile::Create(FooCpp, Command, PCHs, Preambles);
+  ASSERT_TRUE(File->rebuild(SourceContents, buildTestFS(Files)));
+  auto Preamble = File->getPreamble().get();
+  ASSERT_TRUE(Preamble);
+  File->cancelRebuild();
+
+  // A new CppFile for the same file reuses the preamble.
+  auto Reopened = CppFile::Create(FooCpp, Command, PCHs, Preambles);
+  ASSERT_TRUE(Reopened->rebuild(SourceContents, buildTestFS(Files)));
+  EXPECT_EQ(Reopened->getPreamble().get(), Preamble);
+
+  // But not if the headers have changed.
+  Files[FooH] = "int a = 0;";
+  auto Changed = CppFile::Create(FooCpp, Command, PCHs, Preambles);
+  ASSERT_TRUE(Changed->rebuild(SourceContents, buildTestFS(Files)));
+  EXPECT_NE(Changed->getPreamble().get(), Preamble);
+}
+
+TEST_F(ClangdVFSTest, FindDefinitionsInPreamble) {
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  auto PCHs = std::make_shared<PCHContainerOperations>();
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto FooH = getVirtualTestFilePath("foo.h");
+  llvm::StringMap<std::string> Files;
+  Files[FooH] = "int a;\nint b;";
+  const auto SourceContents = R"cpp(#include "foo.h"
+int c = a;
+int d = b + c;
+)cpp";
+
+  auto File =
+      CppFile::Create(FooCpp, CDB.getCompileCommands(FooCpp).front(), PCHs);
+  ASSERT_TRUE(File->rebuild(SourceContents, buildTestFS(Files)));
+  ASSERT_TRUE(File->getPreamble().get());
+
+  std::vector<Location> AInHeader, BInHeader, CInMain;
+  File->getAST().get()->runUnderLock([&](ParsedAST *AST) {
+    ASSERT_TRUE(AST);
+    AInHeader = findDefinitions(*AST, Position{1, 8});
+    BInHeader = findDefinitions(*AST, Position{2, 8});
+    CInMain = findDefinitions(*AST, Position{2, 12});
+  });
+
+  ASSERT_EQ(AInHeader.size(), 1u);
+  EXPECT_EQ(AInHeader[0].uri.file, FooH);
+  EXPECT_EQ(AInHeader[0].range.start, (Position{0, 0}));
+  ASSERT_EQ(BInHeader.size(), 1u);
+  EXPECT_EQ(BInHeader[0].uri.file, FooH);
+  EXPECT_EQ(BInHeader[0].range.start, (Position{1, 0}));
+  ASSERT_EQ(CInMain.size(), 1u);
+  EXPECT_EQ(CInMain[0].uri.file, FooCpp);
+  EXPECT_EQ(CInMain[0].range.start, (Position{1, 0}));
+}
+
+TEST_F(ClangdVFSTest, FindDefinitionsMeasuresColumnsInUTF16) {
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  auto PCHs = std::make_shared<PCHContainerOperations>();
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  // "€" takes 3 bytes in UTF-8 and a single code unit in UTF-16.
+  const auto SourceContents = "/*\xE2\x82\xAC*/ int a;\n"
+                              "/*\xE2\x82\xAC*/ int b = a;\n";
+
+  auto File =
+      CppFile::Create(FooCpp, CDB.getCompileCommands(FooCpp).front(), PCHs);
+  ASSERT_TRUE(File->rebuild(SourceContents, buildTestFS({})));
+
+  std::vector<Location> Locations;
+  File->getAST().get()->runUnderLock([&](ParsedAST *AST) {
+    ASSERT_TRUE(AST);
+    Locations = findDefinitions(*AST, Position{1, 14});
+  });
+
+  ASSERT_EQ(Locations.size(), 1u);
+  EXPECT_EQ(Locations[0].range.start, (Position{0, 10}));
+  EXPECT_EQ(Locations[0].range.end, (Position{0, 11}));
+}
+
+TEST_F(ClangdVFSTest, PreambleSharedBetweenFiles) {
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  auto PCHs = std::make_shared<PCHContainerOperations>();
+  auto Preambles = std::make_shared<PreambleCache>();
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto BarCpp = getVirtualTestFilePath("bar.cpp");
+  auto SubDirCpp = getVirtualTestFilePath("sub/baz.cpp");
+  llvm::StringMap<std::string> Files;
+  Files[getVirtualTestFilePath("foo.h")] = "int a;";
+  Files[getVirtualTestFilePath("sub/foo.h")] = "int a;";
+  auto FS = buildTestFS(Files);
+
+  auto Foo = CppFile::Create(FooCpp, CDB.getCompileCommands(FooCpp).front(),
+                             PCHs, Preambles);
+  ASSERT_TRUE(Foo->rebuild("#include \"foo.h\"\nint b = a;", FS));
+  auto Preamble = Foo->getPreamble().get();
+  ASSERT_TRUE(Preamble);
+
+  auto Bar = CppFile::Create(BarCpp, CDB.getCompileCommands(BarCpp).front(),
+                             PCHs, Preambles);
+  ASSERT_TRUE(Bar->rebuild("#include \"foo.h\"\nint c = a;", FS));
+  EXPECT_EQ(Bar->getPreamble().get(), Preamble);
+
+  // Quoted includes of a file in another directory resolve differently.
+  auto SubDir = CppFile::Create(
+      SubDirCpp, CDB.getCompileCommands(SubDirCpp).front(), PCHs, Preambles);
+  ASSERT_TRUE(SubDir->rebuild("#include \"foo.h\"\nint b = a;", FS));
+  EXPECT_NE(SubDir->getPreamble().get(), Preamble);
+}
+
+TEST_F(ClangdVFSTest, EvictASTsOverMemoryBudget) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  // Any AST is larger than the budget, so only the most recently used one is
+  // kept.
+  ClangdServer Server(CDB, DiagConsumer, FS, getDefaultAsyncThreadsCount(),
+                      /*SnippetCompletions=*/false, /*ResourceDir=*/llvm::None,
+                      /*ASTMemoryBudget=*/1);
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto BarCpp = getVirtualTestFilePath("bar.cpp");
+  const auto SourceContents = "int a;\nint b = a;";
+  FS.Files[FooCpp] = SourceContents;
+  FS.Files[BarCpp] = SourceContents;
+
+  ASSERT_EQ(Server.addDocument(FooCpp, SourceContents)
+                .wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  EXPECT_FALSE(Server.getMemoryUsage(FooCpp)->astEvicted);
+  EXPECT_GT(Server.getMemoryUsage(FooCpp)->ast, 0u);
+
+  ASSERT_EQ(Server.addDocument(BarCpp, SourceContents)
+                .wait_for(DefaultFutureTimeout),
+            std::future_status::ready);
+  EXPECT_TRUE(Server.getMemoryUsage(FooCpp)->astEvicted);
+  EXPECT_EQ(Server.getMemoryUsage(FooCpp)->ast, 0u);
+  EXPECT_FALSE(Server.getMemoryUsage(BarCpp)->astEvicted);
+
+  // Evicted ASTs are rebuilt on demand.
+  auto Locations = Server.findDefinitions(FooCpp, Position{1, 8}).Value;
+  EXPECT_EQ(Locations.size(), 1u);
+  EXPECT_FALSE(Server.getMemoryUsage(FooCpp)->astEvicted);
+  EXPECT_GT(Server.getMemoryUsage(FooCpp)->ast, 0u);
+  EXPECT_TRUE(Server.getMemoryUsage(BarCpp)->astEvicted);
+
+  // Files that are not open have no memory usage.
+  EXPECT_FALSE(Server.getMemoryUsage(getVirtualTestFilePath("baz.cpp")));
+}
+
+TEST_F(ClangdVFSTest, FindDefinitionsInOtherFiles) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  ClangdServer Server(CDB, DiagConsumer, FS, /*AsyncThreadsCount=*/0,
+                      /*SnippetCompletions=*/false, /*ResourceDir=*/llvm::None,
+                      /*ASTMemoryBudget=*/0, /*BuildIndex=*/true);
+
+  auto FooH = getVirtualTestFilePath("foo.h");
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto MainCpp = getVirtualTestFilePath("main.cpp");
+  const auto MainContents = "#include \"foo.h\"\nint a = foo();";
+  FS.Files[FooH] = "int foo();";
+  FS.Files[FooCpp] = "#include \"foo.h\"\nint foo() { return 1; }";
+  FS.Files[MainCpp] = MainContents;
+  CDB.AllFiles = {FooCpp.str(), MainCpp.str()};
+
+  // Requests are processed synchronously, so the index is complete when
+  // addDocument returns.
+  Server.addDocument(MainCpp, MainContents);
+
+  auto Locations = Server.findDefinitions(MainCpp, Position{1, 8}).Value;
+  EXPECT_TRUE(std::any_of(Locations.begin(), Locations.end(),
+                          [&](const Location &L) {
+                            return StringRef(L.uri.file) == FooCpp &&
+                                   L.range.start == Position{1, 4};
+                          }));
+}
+
+TEST_F(ClangdVFSTest, EnumerateAllFilesOnlyWhenDatabaseChanges) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  ClangdServer Server(CDB, DiagConsumer, FS, /*AsyncThreadsCount=*/0,
+                      /*SnippetCompletions=*/false, /*ResourceDir=*/llvm::None,
+                      /*ASTMemoryBudget=*/0, /*BuildIndex=*/true);
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  auto BarCpp = getVirtualTestFilePath("bar.cpp");
+  FS.Files[FooCpp] = "int foo;";
+  FS.Files[BarCpp] = "int bar;";
+  CDB.AllFiles = {FooCpp.str()};
+
+  Server.addDocument(FooCpp, FS.Files[FooCpp]);
+  EXPECT_EQ(CDB.GetAllFilesCalls, 1u);
+  Server.addDocument(FooCpp, FS.Files[FooCpp]);
+  Server.addDocument(BarCpp, FS.Files[BarCpp]);
+  EXPECT_EQ(CDB.GetAllFilesCalls, 1u);
+
+  CDB.AllFiles.push_back(BarCpp.str());
+  ++CDB.AllFilesGeneration;
+  Server.addDocument(BarCpp, FS.Files[BarCpp]);
+  EXPECT_EQ(CDB.GetAllFilesCalls, 2u);
+}
+
 TEST_F(ClangdVFSTest, CheckVersions) {
   MockFSProvider FS;
   ErrorCheckingDiagConsumer DiagConsumer;
@@ -582,8 +1019,8 @@ struct bar { T x; };
 
 class ClangdCompletionTest : public ClangdVFSTest {
 protected:
-  bool ContainsItem(std::vector<CompletionItem> const &Items, StringRef Name) {
-    for (const auto &Item : Items) {
+  bool ContainsItem(CompletionList const &Items, StringRef Name) {
+    for (const auto &Item : Items.items) {
       if (Item.insertText == Name)
         return true;
     }
@@ -647,6 +1084,711 @@ int b =   ;
   }
 }
 
+TEST_F(ClangdCompletionTest, AsyncAndCancelled) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+
+  ClangdServer Server(CDB, DiagConsumer, FS, getDefaultAsyncThreadsCount(),
+                      /*SnippetCompletions=*/false);
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  const auto SourceContents = R"cpp(
+int aba;
+int b =   ;
+)cpp";
+  Position CompletePos = {2, 8};
+  FS.Files[FooCpp] = SourceContents;
+
+  Server.addDocument(FooCpp, SourceContents);
+
+  auto Complete = [&](CancellationToken Cancel) {
+    std::promise<CompletionList> Result;
+    auto ResultFuture = Result.get_future();
+    Server.codeComplete(
+        FooCpp, CompletePos, std::move(Cancel),
+        [&Result](Tagged<CompletionList> Items) {
+          Result.set_value(std::move(Items.Value));
+        });
+    EXPECT_EQ(ResultFuture.wait_for(DefaultFutureTimeout),
+              std::future_status::ready);
+    return ResultFuture.get();
+  };
+
+  EXPECT_TRUE(ContainsItem(Complete(CancellationToken()), "aba"));
+
+  CancellationToken Cancelled;
+  Cancelled.cancel();
+  EXPECT_TRUE(Complete(Cancelled).items.empty());
+}
+
+TEST_F(ClangdCompletionTest, FilterAndLimit) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  const auto SourceContents = R"cpp(
+int abcdef;
+int AbXyz;
+int xaybz;
+int xyz;
+int b = ab;
+)cpp";
+  // Complete after 'ab'.
+  Position CompletePos = {5, 10};
+  FS.Files[FooCpp] = SourceContents;
+
+  {
+    ClangdServer Server(CDB, DiagConsumer, FS, getDefaultAsyncThreadsCount(),
+                        /*SnippetCompletions=*/false);
+    Server.addDocument(FooCpp, SourceContents);
+
+    auto Results = Server.codeComplete(FooCpp, CompletePos, None).Value;
+    EXPECT_FALSE(Results.isIncomplete);
+    EXPECT_TRUE(ContainsItem(Results, "abcdef"));
+    EXPECT_TRUE(ContainsItem(Results, "AbXyz"));
+    EXPECT_TRUE(ContainsItem(Results, "xaybz"));
+    EXPECT_FALSE(ContainsItem(Results, "xyz"));
+
+    // Exact prefix matches are ranked before the case-insensitive ones, which
+    // are ranked before the subsequence matches.
+    auto SortTextOf = [&](StringRef Name) {
+      for (const auto &Item : Results.items)
+        if (Item.insertText == Name)
+          return Item.sortText;
+      return std::string();
+    };
+    EXPECT_LT(SortTextOf("abcdef"), SortTextOf("AbXyz"));
+    EXPECT_LT(SortTextOf("AbXyz"), SortTextOf("xaybz"));
+  }
+
+  {
+    ClangdServer Server(CDB, DiagConsumer, FS, getDefaultAsyncThreadsCount(),
+                        /*SnippetCompletions=*/false, /*ResourceDir=*/None,
+                        /*ASTMemoryBudget=*/0, /*BuildIndex=*/false,
+                        /*CompletionLimit=*/1);
+    Server.addDocument(FooCpp, SourceContents);
+
+    auto Results = Server.codeComplete(FooCpp, CompletePos, None).Value;
+    EXPECT_TRUE(Results.isIncomplete);
+    ASSERT_EQ(Results.items.size(), 1u);
+    EXPECT_EQ(Results.items[0].insertText, "abcdef");
+  }
+}
+
+TEST_F(ClangdCompletionTest, CompletionPreamble) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  // Run synchronously, so that the completion preamble is built right after
+  // the first completion request.
+  ClangdServer Server(CDB, DiagConsumer, FS, /*AsyncThreadsCount=*/0,
+                      /*SnippetCompletions=*/false);
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  // Enough declarations before main() to build a completion preamble for
+  // them.
+  auto GetSource = [](StringRef FirstFunction, StringRef MainBody) {
+    std::string Source =
+        ("int " + FirstFunction + "(int x) { return x; }\n").str();
+    for (int I = 1; I < 1000; ++I)
+      Source += "int func_" + std::to_string(I) + "(int x) { return x; }\n";
+    Source += "int main() {\n  int local = 0;\n" + MainBody.str() + "\n}\n";
+    return Source;
+  };
+  // Complete on the last line of the body of main().
+  Position CompletePos = {1002, 2};
+  // Returns how many completions used the completion preamble so far.
+  auto CountCompletionPreambleUses = []() -> uint64_t {
+    for (const LatencyHistogram &H : trace::getHistograms())
+      if (H.name == "CodeCompleteWithCompletionPreamble")
+        return H.count;
+    return 0;
+  };
+  uint64_t Uses = CountCompletionPreambleUses();
+
+  std::string SourceContents = GetSource("func_0", "  ");
+  FS.Files[FooCpp] = SourceContents;
+  Server.addDocument(FooCpp, SourceContents);
+  EXPECT_EQ(Server.getMemoryUsage(FooCpp)->completionPreamble, 0u);
+  for (int I = 0; I < 2; ++I) {
+    auto Results = Server.codeComplete(FooCpp, CompletePos, None).Value;
+    EXPECT_TRUE(ContainsItem(Results, "func_0"));
+    EXPECT_TRUE(ContainsItem(Results, "func_999"));
+    EXPECT_TRUE(ContainsItem(Results, "local"));
+    // The preamble is built after the first request and used by the second.
+    EXPECT_EQ(CountCompletionPreambleUses(), Uses + I);
+    EXPECT_GT(Server.getMemoryUsage(FooCpp)->completionPreamble, 0u);
+  }
+  Uses = CountCompletionPreambleUses();
+
+  // Edits inside main() are seen by completion, the preamble is still used.
+  SourceContents = GetSource("func_0", "  int other = 1;\n  ");
+  Server.addDocument(FooCpp, SourceContents);
+  {
+    auto Results = Server.codeComplete(FooCpp, Position{1003, 2}, None).Value;
+    EXPECT_TRUE(ContainsItem(Results, "func_0"));
+    EXPECT_TRUE(ContainsItem(Results, "other"));
+    EXPECT_TRUE(ContainsItem(Results, "local"));
+    EXPECT_EQ(CountCompletionPreambleUses(), Uses + 1);
+  }
+  Uses = CountCompletionPreambleUses();
+
+  // So are the edits of the declarations before main(), but the preamble
+  // can't be used for them.
+  SourceContents = GetSource("renamed_0", "  ");
+  Server.addDocument(FooCpp, SourceContents);
+  {
+    auto Results = Server.codeComplete(FooCpp, CompletePos, None).Value;
+    EXPECT_TRUE(ContainsItem(Results, "renamed_0"));
+    EXPECT_FALSE(ContainsItem(Results, "func_0"));
+    EXPECT_TRUE(ContainsItem(Results, "local"));
+    EXPECT_EQ(CountCompletionPreambleUses(), Uses);
+  }
+}
+
+TEST_F(ClangdCompletionTest, CompletionPreambleInNamespace) {
+  MockFSProvider FS;
+  ErrorCheckingDiagConsumer DiagConsumer;
+  MockCompilationDatabase CDB(/*AddFreestandingFlag=*/true);
+  ClangdServer Server(CDB, DiagConsumer, FS, /*AsyncThreadsCount=*/0,
+                      /*SnippetCompletions=*/false);
+
+  auto FooCpp = getVirtualTestFilePath("foo.cpp");
+  // All of the code is inside a namespace, the completion preamble ends in it.
+  std::string SourceContents = "namespace ns {\nextern \"C\" {\n";
+  for (int I = 0; I < 1000; ++I)
+    SourceContents +=
+        "int func_" + std::to_string(I) + "(int x) { return x; }\n";
+  SourceContents += "}\nint test() {\n  int local = 0;\n  \n}\n}\n";
+  // Complete on the last line of the body of test().
+  Position CompletePos = {1005, 2};
+  auto CountCompletionPreambleUses = []() -> uint64_t {
+    for (const LatencyHistogram &H : trace::getHistograms())
+      if (H.name == "CodeCompleteWithCompletionPreamble")
+        return H.count;
+    return 0;
+  };
+  uint64_t Uses = CountCompletionPreambleUses();
+
+  FS.Files[FooCpp] = SourceContents;
+  Server.addDocument(FooCpp, SourceContents);
+  for (int I = 0; I < 2; ++I) {
+    auto Results = Server.codeComplete(FooCpp, CompletePos, None).Value;
+    // The declarations of the preamble are only visible without
+    // qualification if completion runs inside the namespace.
+    EXPECT_TRUE(ContainsItem(Results, "func_0"));
+    EXPECT_TRUE(ContainsItem(Results, "func_999"));
+    EXPECT_TRUE(ContainsItem(Results, "local"));
+    EXPECT_EQ(CountCompletionPreambleUses(), Uses + I);
+    EXPECT_GT(Server.getMemoryUsage(FooCpp)->completionPreamble, 0u);
+  }
+}
+
+TEST(PieceTableTest, ReplaceAndLines) {
+  PieceTable Table("int a;\nint b;\n");
+  EXPECT_EQ(*Table.getLineStart(1), 7u);
+  EXPECT_EQ(Table.getLineEnd(1), 13u);
+  EXPECT_EQ(*Table.getLineStart(2), 14u);
+  EXPECT_FALSE(Table.getLineStart(3));
+
+  Table.replace(4, 1, "foo");
+  Table.replace(0, 0, "// x\n");
+  Table.replace(Table.size(), 0, "int c;");
+  EXPECT_EQ(Table.str(), "// x\nint foo;\nint b;\nint c;");
+  EXPECT_EQ(*Table.getLineStart(1), 5u);
+  EXPECT_EQ(*Table.getLineStart(3), 21u);
+  EXPECT_EQ(Table.getLineEnd(3), Table.size());
+
+  // Remove a range that spans multiple pieces.
+  Table.replace(2, 9, "");
+  EXPECT_EQ(Table.str(), "//o;\nint b;\nint c;");
+
+  PieceTable Copy = Table;
+  Table.replace(0, Table.size(), "");
+  EXPECT_EQ(Table.str(), "");
+  EXPECT_EQ(Copy.str(), "//o;\nint b;\nint c;");
+}
+
+TEST(PieceTableTest, PositionConversions) {
+  // "ä" takes 2 bytes in UTF-8, "€" takes 3, "𝄞" takes 4 bytes in UTF-8 and 2
+  // code units in UTF-16.
+  PieceTable Table("int a;\n// \xC3\xA4\xE2\x82\xAC\xF0\x9D\x84\x9E x\n");
+  Table.replace(0, 0, "\n");
+
+  std::string Contents = Table.str();
+  auto ExpectOffset = [&](int Line, int Character, size_t Offset) {
+    EXPECT_EQ(Table.positionToOffset(Position{Line, Character}), Offset)
+        << Line << ":" << Character;
+    EXPECT_EQ(positionToOffset(Contents, Position{Line, Character}), Offset)
+        << Line << ":" << Character;
+  };
+  ExpectOffset(0, 0, 0u);
+  ExpectOffset(1, 3, 4u);
+  ExpectOffset(1, 100, 7u);
+  ExpectOffset(2, 3, 11u); // Before "ä".
+  ExpectOffset(2, 4, 13u); // After "ä".
+  ExpectOffset(2, 5, 16u); // After "€".
+  ExpectOffset(2, 7, 20u); // After "𝄞".
+  ExpectOffset(2, 9, 22u); // After "x".
+  ExpectOffset(2, 100, 22u);
+  ExpectOffset(3, 0, 23u);
+  ExpectOffset(4, 0, 23u);
+  ExpectOffset(-1, 5, 0u);
+
+  auto ExpectPosition = [&](size_t Offset, int Line, int Character) {
+    Position P = Table.offsetToPosition(Offset);
+    EXPECT_EQ(P.line, Line) << Offset;
+    EXPECT_EQ(P.character, Character) << Offset;
+  };
+  ExpectPosition(0, 0, 0);
+  ExpectPosition(1, 1, 0);
+  ExpectPosition(7, 1, 6);
+  ExpectPosition(16, 2, 5);
+  ExpectPosition(20, 2, 7);
+  ExpectPosition(23, 3, 0);
+  ExpectPosition(100, 3, 0);
+}
+
+TEST(DraftStoreTest, IncrementalUpdates) {
+  DraftStore Drafts;
+  EXPECT_FALSE(Drafts.updateDraft("foo.cpp", TextDocumentContentChangeEvent()));
+
+  Drafts.updateDraft("foo.cpp", "int a;\nint b;\n");
+
+  TextDocumentContentChangeEvent Rename;
+  Rename.range = Range{Position{1, 4}, Position{1, 5}};
+  Rename.text = "bar";
+  TextDocumentContentChangeEvent Append;
+  Append.range = Range{Position{2, 0}, Position{2, 0}};
+  Append.text = "int c;";
+  auto Updated = Drafts.updateDraft("foo.cpp", {Rename, Append});
+  ASSERT_TRUE(Updated);
+  EXPECT_EQ(Updated->Version, 2u);
+  EXPECT_EQ(Updated->Draft->str(), "int a;\nint bar;\nint c;");
+
+  // Invalid ranges leave the draft untouched.
+  TextDocumentContentChangeEvent Invalid;
+  Invalid.range = Range{Position{10, 0}, Position{10, 1}};
+  EXPECT_FALSE(Drafts.updateDraft("foo.cpp", {Append, Invalid}));
+  Invalid.range = Range{Position{-1, 0}, Position{0, 1}};
+  EXPECT_FALSE(Drafts.updateDraft("foo.cpp", {Invalid}));
+  EXPECT_EQ(Drafts.getDraft("foo.cpp").Draft->str(),
+            "int a;\nint bar;\nint c;");
+  EXPECT_EQ(Drafts.getVersion("foo.cpp"), 2u);
+
+  TextDocumentContentChangeEvent Full;
+  Full.text = "int d;";
+  Updated = Drafts.updateDraft("foo.cpp", {Full});
+  ASSERT_TRUE(Updated);
+  EXPECT_EQ(Updated->Draft->str(), "int d;");
+}
+
+TEST(DirectoryBasedGlobalCompilationDatabaseTest, ReloadsChangedDatabase) {
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("clangd-cdb-test", Dir));
+  llvm::SmallString<128> File(Dir);
+  llvm::sys::path::append(File, "foo.cpp");
+  llvm::SmallString<128> DatabaseFile(Dir);
+  llvm::sys::path::append(DatabaseFile, "compile_commands.json");
+
+  auto WriteDatabase = [&](StringRef Flag) {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(DatabaseFile, EC, llvm::sys::fs::F_Text);
+    ASSERT_FALSE(EC);
+    OS << R"([{"directory":")" << Dir << R"(","command":"clang )" << Flag
+       << " " << File << R"(","file":")" << File << R"("}])";
+  };
+  // Check the changes immediately.
+  DirectoryBasedGlobalCompilationDatabase CDB(
+      std::chrono::steady_clock::duration::zero());
+  auto HasFlag = [&](StringRef Flag) {
+    auto Commands = CDB.getCompileCommands(File);
+    return !Commands.empty() &&
+           std::find(Commands[0].CommandLine.begin(),
+                     Commands[0].CommandLine.end(),
+                     Flag) != Commands[0].CommandLine.end();
+  };
+
+  // There is no database yet, so the default command is used.
+  EXPECT_FALSE(HasFlag("-DFOO"));
+  // The directory was remembered as the one without a database, adding the
+  // database must still be noticed.
+  WriteDatabase("-DFOO");
+  EXPECT_TRUE(HasFlag("-DFOO"));
+  EXPECT_TRUE(HasFlag("-DFOO"));
+  // The database is reloaded when it changes.
+  WriteDatabase("-DBARBAZ");
+  EXPECT_TRUE(HasFlag("-DBARBAZ"));
+  EXPECT_FALSE(HasFlag("-DFOO"));
+  // Extra flags replace the cached commands of the file.
+  CDB.setExtraFlagsForFile(File, {"-DEXTRA"});
+  EXPECT_TRUE(HasFlag("-DEXTRA"));
+  EXPECT_TRUE(HasFlag("-DBARBAZ"));
+
+  llvm::sys::fs::remove(DatabaseFile);
+  llvm::sys::fs::remove(Dir);
+}
+
+TEST(SymbolIndexTest, UpdateAndRemove) {
+  const char *FooCpp = "/clangd-test/foo.cpp";
+  const char *BarCpp = "/clangd-test/bar.cpp";
+  const char *FooH = "/clangd-test/foo.h";
+  auto Occurrence = [](StringRef USR, OccurrenceKind Kind, PathRef File,
+                       int Line) {
+    return SymbolOccurrence{USR.str(), Kind, File.str(),
+                            Range{Position{Line, 0}, Position{Line, 3}}};
+  };
+
+  SymbolIndex Index;
+  // Both TUs include foo.h, the definition from it must be reported once.
+  Index.update(FooCpp,
+               {Occurrence("c:@F@foo#", OccurrenceKind::Definition, FooH, 0),
+                Occurrence("c:@F@bar#", OccurrenceKind::Reference, FooCpp, 1)});
+  Index.update(BarCpp,
+               {Occurrence("c:@F@foo#", OccurrenceKind::Definition, FooH, 0),
+                Occurrence("c:@F@bar#", OccurrenceKind::Definition, BarCpp, 2)});
+  EXPECT_EQ(Index.findDefinitions("c:@F@foo#").size(), 1u);
+  EXPECT_EQ(Index.findDefinitions("c:@F@bar#").size(), 1u);
+  EXPECT_EQ(Index.findReferences("c:@F@bar#").size(), 1u);
+
+  // Occurrences in a header are replaced by the latest TU that includes it.
+  Index.update(FooCpp,
+               {Occurrence("c:@F@foo#", OccurrenceKind::Definition, FooH, 4),
+                Occurrence("c:@F@bar#", OccurrenceKind::Reference, FooCpp, 1)});
+  auto FooDefinitions = Index.findDefinitions("c:@F@foo#");
+  ASSERT_EQ(FooDefinitions.size(), 1u);
+  EXPECT_EQ(FooDefinitions[0].range.start.line, 4);
+
+  // Updating a TU replaces all of its occurrences. Occurrences in headers are
+  // kept while other TUs include them.
+  Index.update(BarCpp,
+               {Occurrence("c:@F@baz#", OccurrenceKind::Definition, BarCpp, 2)});
+  EXPECT_TRUE(Index.findDefinitions("c:@F@bar#").empty());
+  EXPECT_EQ(Index.findDefinitions("c:@F@foo#").size(), 1u);
+  EXPECT_EQ(Index.findDefinitions("c:@F@baz#").size(), 1u);
+
+  Index.remove(FooCpp);
+  EXPECT_TRUE(Index.findDefinitions("c:@F@foo#").empty());
+  EXPECT_TRUE(Index.findReferences("c:@F@bar#").empty());
+  EXPECT_EQ(Index.findDefinitions("c:@F@baz#").size(), 1u);
+}
+
+TEST(JSONTest, ParseInPlace) {
+  std::string Text =
+      R"( {"a": [1, -2.5e3, true, null], "s": "x\"\u00e9\ud83d\ude00\n"} )";
+  std::vector<char> Buffer(Text.begin(), Text.end());
+  llvm::BumpPtrAllocator Alloc;
+  const json::Value *V = json::parse(Buffer, Alloc);
+  ASSERT_TRUE(V);
+  auto Members = V->asObject();
+  ASSERT_TRUE(Members);
+  ASSERT_EQ(Members->size(), 2u);
+
+  EXPECT_EQ((*Members)[0].Key, "a");
+  auto Elements = (*Members)[0].V.asArray();
+  ASSERT_TRUE(Elements);
+  ASSERT_EQ(Elements->size(), 4u);
+  EXPECT_EQ((*Elements)[0].asInteger(), llvm::Optional<int64_t>(1));
+  EXPECT_FALSE((*Elements)[1].asInteger());
+  EXPECT_EQ((*Elements)[1].getNumberText(), "-2.5e3");
+  EXPECT_EQ((*Elements)[2].asBoolean(), llvm::Optional<bool>(true));
+  EXPECT_EQ((*Elements)[3].kind(), json::Value::Null);
+
+  EXPECT_EQ((*Members)[1].Key, "s");
+  auto Str = (*Members)[1].V.asString();
+  ASSERT_TRUE(Str);
+  EXPECT_EQ(*Str, "x\"\xC3\xA9\xF0\x9F\x98\x80\n");
+  // The string was unescaped inside the buffer.
+  EXPECT_GE(Str->data(), Buffer.data());
+  EXPECT_LT(Str->data(), Buffer.data() + Buffer.size());
+
+  for (StringRef Invalid : {"", "{", "[1,]", "01", "1 2", R"("\x")",
+                            R"({"a" 1})", "\"\n\"", "tru"}) {
+    std::vector<char> InvalidBuffer(Invalid.begin(), Invalid.end());
+    EXPECT_FALSE(json::parse(InvalidBuffer, Alloc)) << Invalid.str();
+  }
+}
+
+TEST(JSONTest, Write) {
+  std::string Output;
+  llvm::raw_string_ostream OS(Output);
+  json::Writer W(OS);
+  W.objectBegin();
+  W.key("a");
+  W.arrayBegin();
+  W.integer(-1);
+  W.boolean(false);
+  W.null();
+  W.raw("{}");
+  W.arrayEnd();
+  W.key("s\n");
+  W.string("\"\\\t\x01");
+  W.objectEnd();
+  EXPECT_EQ(OS.str(), R"({"a":[-1,false,null,{}],"s\n":"\"\\\t\u0001"})");
+
+  // Parsed values are written back in the compact form.
+  std::string Text = R"([ {"x" : "A\/"}, [ ], 1e2 ])";
+  std::vector<char> Buffer(Text.begin(), Text.end());
+  llvm::BumpPtrAllocator Alloc;
+  const json::Value *V = json::parse(Buffer, Alloc);
+  ASSERT_TRUE(V);
+  Output.clear();
+  json::Writer(OS).value(*V);
+  EXPECT_EQ(OS.str(), R"([{"x":"A/"},[],1e2])");
+}
+
+TEST(TraceTest, HistogramsAndTraceEvents) {
+  std::string Output;
+  llvm::raw_string_ostream OS(Output);
+  auto Start = std::chrono::steady_clock::now();
+  {
+    auto Session = trace::Session::create(OS);
+    ASSERT_TRUE(Session);
+    // Only one session can be active at a time.
+    EXPECT_FALSE(trace::Session::create(OS));
+    trace::record("TraceTest", Start + std::chrono::milliseconds(1),
+                  Start + std::chrono::milliseconds(4));
+  }
+  // Spans are still collected in histograms after the session is closed.
+  trace::record("TraceTest", Start, Start + std::chrono::milliseconds(100));
+
+  std::vector<char> Buffer(OS.str().begin(), OS.str().end());
+  llvm::BumpPtrAllocator Alloc;
+  const json::Value *Root = json::parse(Buffer, Alloc);
+  ASSERT_TRUE(Root) << Output;
+  auto Members = Root->asObject();
+  ASSERT_TRUE(Members);
+  ASSERT_EQ(Members->size(), 1u);
+  EXPECT_EQ((*Members)[0].Key, "traceEvents");
+  auto Events = (*Members)[0].V.asArray();
+  ASSERT_TRUE(Events);
+  ASSERT_EQ(Events->size(), 1u);
+  auto Event = (*Events)[0].asObject();
+  ASSERT_TRUE(Event);
+  llvm::StringMap<const json::Value *> Fields;
+  for (const json::Member &M : *Event)
+    Fields[M.Key] = &M.V;
+  EXPECT_EQ(Fields["name"]->asString(), llvm::Optional<StringRef>("TraceTest"));
+  EXPECT_EQ(Fields["ph"]->asString(), llvm::Optional<StringRef>("X"));
+  EXPECT_EQ(Fields["dur"]->asInteger(), llvm::Optional<int64_t>(3000));
+  EXPECT_TRUE(Fields.count("ts"));
+  EXPECT_TRUE(Fields.count("tid"));
+
+  auto Histograms = trace::getHistograms();
+  auto It = std::find_if(
+      Histograms.begin(), Histograms.end(),
+      [](const LatencyHistogram &H) { return H.name == "TraceTest"; });
+  ASSERT_NE(It, Histograms.end());
+  EXPECT_EQ(It->count, 2u);
+  EXPECT_EQ(It->totalUs, 103000u);
+  EXPECT_EQ(It->maxUs, 100000u);
+  ASSERT_EQ(It->buckets.size(), 16u);
+  // 3ms is in [2, 4), 100ms is in [64, 128).
+  for (unsigned I = 0; I < It->buckets.size(); ++I)
+    EXPECT_EQ(It->buckets[I], (I == 2 || I == 7) ? 1u : 0u) << I;
+}
+
+class ClangdSchedulerTest : public ::testing::Test {
+protected:
+  /// Adds a request that blocks the only worker of \p Scheduler until the
+  /// returned promise is fulfilled.
+  std::promise<void> blockWorker(ClangdScheduler &Scheduler) {
+    std::promise<void> Unblock;
+    std::shared_future<void> Unblocked = Unblock.get_future().share();
+    std::promise<void> Started;
+    std::future<void> StartedFuture = Started.get_future();
+    Scheduler.addRequest("blocker.cpp", RequestPriority::Normal,
+                         [Unblocked](std::promise<void> Started) {
+                           Started.set_value();
+                           Unblocked.wait();
+                         },
+                         std::move(Started));
+    EXPECT_EQ(StartedFuture.wait_for(DefaultFutureTimeout),
+              std::future_status::ready);
+    return Unblock;
+  }
+
+  void log(std::string Entry) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Log.push_back(std::move(Entry));
+  }
+
+  std::vector<std::string> takeLog() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return std::move(Log);
+  }
+
+private:
+  std::mutex Mutex;
+  std::vector<std::string> Log;
+};
+
+TEST_F(ClangdSchedulerTest, InteractiveRequestsGoFirst) {
+  std::promise<void> Done;
+  std::future<void> DoneFuture = Done.get_future();
+  {
+    ClangdScheduler Scheduler(/*AsyncThreadsCount=*/1);
+    std::promise<void> Unblock = blockWorker(Scheduler);
+
+    Scheduler.addRequest("a.cpp", RequestPriority::Background,
+                         [this]() { log("a"); });
+    Scheduler.addRequest("b.cpp", RequestPriority::Normal,
+                         [this]() { log("b"); });
+    Scheduler.addRequest("c.cpp", RequestPriority::Normal,
+                         [this]() { log("c"); });
+    Scheduler.boostPriority("c.cpp", RequestPriority::Interactive);
+    Scheduler.addRequest("d.cpp", RequestPriority::Background,
+                         [](std::promise<void> Done) { Done.set_value(); },
+                         std::move(Done));
+
+    Unblock.set_value();
+    ASSERT_EQ(DoneFuture.wait_for(DefaultFutureTimeout),
+              std::future_status::ready);
+  }
+  EXPECT_EQ(takeLog(), (std::vector<std::string>{"c", "b", "a"}));
+}
+
+TEST_F(ClangdSchedulerTest, BackgroundRequestsDontDelayBoostedRequests) {
+  std::promise<void> Done;
+  std::future<void> DoneFuture = Done.get_future();
+  {
+    ClangdScheduler Scheduler(/*AsyncThreadsCount=*/1);
+    std::promise<void> Unblock = blockWorker(Scheduler);
+
+    Scheduler.addRequest("a.cpp", RequestPriority::Background,
+                         [this]() { log("a-index"); });
+    Scheduler.addRequest("a.cpp", RequestPriority::Normal,
+                         [this]() { log("a-rebuild"); });
+    Scheduler.addRequest("b.cpp", RequestPriority::Normal,
+                         [this]() { log("b"); });
+    // Only the rebuild is boosted, the index request keeps its priority.
+    Scheduler.boostPriority("a.cpp", RequestPriority::Interactive);
+    Scheduler.addRequest("c.cpp", RequestPriority::Background,
+                         [](std::promise<void> Done) { Done.set_value(); },
+                         std::move(Done));
+
+    Unblock.set_value();
+    ASSERT_EQ(DoneFuture.wait_for(DefaultFutureTimeout),
+              std::future_status::ready);
+  }
+  EXPECT_EQ(takeLog(),
+            (std::vector<std::string>{"a-rebuild", "b", "a-index"}));
+}
+
+TEST_F(ClangdSchedulerTest, CompletionDoesntWaitForOtherRequests) {
+  std::promise<void> CompletionDone;
+  std::future<void> CompletionDoneFuture = CompletionDone.get_future();
+  std::promise<void> Done;
+  std::future<void> DoneFuture = Done.get_future();
+  {
+    ClangdScheduler Scheduler(/*AsyncThreadsCount=*/2);
+    std::promise<void> Unblock;
+    std::shared_future<void> Unblocked = Unblock.get_future().share();
+
+    Scheduler.addRequest("a.cpp", RequestPriority::Normal,
+                         [this, Unblocked]() {
+                           Unblocked.wait();
+                           log("a-rebuild");
+                         });
+    // Doesn't drop the completion request.
+    Scheduler.addSupersedingRequest("a.cpp", RequestPriority::Normal,
+                                    [this]() { log("a-update"); });
+    Scheduler.addCompletionRequest("a.cpp", RequestPriority::Interactive,
+                                   [this](std::promise<void> Done) {
+                                     log("a-completion");
+                                     Done.set_value();
+                                   },
+                                   std::move(CompletionDone));
+    Scheduler.addRequest("a.cpp", RequestPriority::Normal,
+                         [](std::promise<void> Done) { Done.set_value(); },
+                         std::move(Done));
+
+    // Runs while the rebuild of a.cpp is still blocked.
+    auto Status = CompletionDoneFuture.wait_for(DefaultFutureTimeout);
+    Unblock.set_value();
+    ASSERT_EQ(Status, std::future_status::ready);
+    ASSERT_EQ(DoneFuture.wait_for(DefaultFutureTimeout),
+              std::future_status::ready);
+  }
+  EXPECT_EQ(takeLog(), (std::vector<std::string>{"a-completion", "a-rebuild",
+                                                 "a-update"}));
+}
+
+TEST_F(ClangdSchedulerTest, SupersededRequestsAreDropped) {
+  std::promise<void> Done;
+  std::future<void> DoneFuture = Done.get_future();
+  {
+    ClangdScheduler Scheduler(/*AsyncThreadsCount=*/1);
+    std::promise<void> Unblock = blockWorker(Scheduler);
+
+    Scheduler.addSupersedingRequest("a.cpp", RequestPriority::Normal,
+                                    [this]() { log("a1"); });
+    Scheduler.addRequest("a.cpp", RequestPriority::Normal,
+                         [this]() { log("a-cleanup"); });
+    Scheduler.addSupersedingRequest("a.cpp", RequestPriority::Normal,
+                                    [this]() { log("a2"); });
+    Scheduler.addSupersedingRequest("b.cpp", RequestPriority::Normal,
+                                    [this]() { log("b1"); });
+    Scheduler.addSupersedingRequest("a.cpp", RequestPriority::Normal,
+                                    [this]() { log("a3"); });
+    Scheduler.addRequest("a.cpp", RequestPriority::Normal,
+                         [](std::promise<void> Done) { Done.set_value(); },
+                         std::move(Done));
+
+    Unblock.set_value();
+    ASSERT_EQ(DoneFuture.wait_for(DefaultFutureTimeout),
+              std::future_status::ready);
+  }
+  EXPECT_EQ(takeLog(), (std::vector<std::string>{"a-cleanup", "b1", "a3"}));
+}
+
+TEST_F(ClangdSchedulerTest, DebouncedRequestsAreDelayedAndCoalesced) {
+  std::promise<void> Done;
+  std::future<void> DoneFuture = Done.get_future();
+  {
+    ClangdScheduler Scheduler(/*AsyncThreadsCount=*/1);
+
+    Scheduler.addDebouncedRequest("a.cpp", RequestPriority::Normal,
+                                  std::chrono::milliseconds(50),
+                                  [this]() { log("a1"); });
+    Scheduler.addDebouncedRequest("a.cpp", RequestPriority::Normal,
+                                  std::chrono::milliseconds(50),
+                                  [this]() { log("a2"); });
+    // Doesn't wait for the delayed requests of a.cpp.
+    Scheduler.addRequest("b.cpp", RequestPriority::Normal,
+                         [this]() { log("b"); });
+    Scheduler.addRequest("a.cpp", RequestPriority::Normal,
+                         [](std::promise<void> Done) { Done.set_value(); },
+                         std::move(Done));
+
+    ASSERT_EQ(DoneFuture.wait_for(DefaultFutureTimeout),
+              std::future_status::ready);
+  }
+  EXPECT_EQ(takeLog(), (std::vector<std::string>{"b", "a2"}));
+}
+
+TEST_F(ClangdSchedulerTest, BoostingPriorityDropsDelay) {
+  std::promise<void> Done;
+  std::future<void> DoneFuture = Done.get_future();
+  {
+    ClangdScheduler Scheduler(/*AsyncThreadsCount=*/1);
+
+    Scheduler.addDebouncedRequest("a.cpp", RequestPriority::Normal,
+                                  std::chrono::hours(1),
+                                  [this]() { log("a"); });
+    Scheduler.addRequest("a.cpp", RequestPriority::Normal,
+                         [](std::promise<void> Done) { Done.set_value(); },
+                         std::move(Done));
+    Scheduler.boostPriority("a.cpp", RequestPriority::Interactive);
+
+    ASSERT_EQ(DoneFuture.wait_for(DefaultFutureTimeout),
+              std::future_status::ready);
+  }
+  EXPECT_EQ(takeLog(), (std::vector<std::string>{"a"}));
+}
+
 class ClangdThreadingTest : public ClangdVFSTest {};
 
 TEST_F(ClangdThreadingTest, StressTest) {